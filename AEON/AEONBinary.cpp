@@ -0,0 +1,483 @@
+//	AEONBinary.cpp
+//
+//	Methods for converting to/from compact binary
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	The binary format is designed to be loaded without tokenizing. It starts
+//	with a single signature BYTE (AEON_BINARY_SIGNATURE), which also encodes
+//	the format version. After that comes a single tagged value:
+//
+//	BYTE		tag
+//	...			payload (depends on tag)
+//
+//	tagNil			(no payload)
+//	tagTrue			(no payload)
+//	tagInt32		varint (zig-zag encoded)
+//	tagInt64		DWORDLONG (unsigned)
+//	tagDouble		double
+//	tagString		varint length; BYTEs
+//	tagDateTime		varint days since 1 AD; varint milliseconds since midnight
+//	tagIPInteger	CIPInteger serialization
+//	tagArray		varint count; values
+//	tagStruct		varint count; for each: varint length; BYTEs key; value
+//	tagBinary		varint length; BYTEs
+//	tagAEONScript	varint length; BYTEs AEONScript (used for external types)
+//
+//	Varints are little-endian base-128 (7 bits per BYTE, high bit set if more
+//	BYTEs follow).
+//
+//	Segments and recovery logs can be truncated or corrupt, so the reader
+//	never trusts a length or count beyond the BYTEs left in the stream and it
+//	returns FALSE (instead of throwing) on any invalid input.
+
+#include "stdafx.h"
+
+enum EBinaryTags
+	{
+	tagNil =							0x00,
+	tagTrue =							0x01,
+	tagInt32 =							0x02,
+	tagInt64 =							0x03,
+	tagDouble =							0x04,
+	tagString =							0x05,
+	tagDateTime =						0x06,
+	tagIPInteger =						0x07,
+	tagArray =							0x08,
+	tagStruct =							0x09,
+	tagBinary =							0x0A,
+	tagAEONScript =						0x0B,
+	};
+
+static int GetBytesLeft (IByteStream &Stream);
+static bool ReadBinaryValue (IByteStream &Stream, CDatum *retDatum);
+static bool ReadBytes (IByteStream &Stream, void *pData, int iLength);
+static bool ReadString (IByteStream &Stream, CString *retsValue);
+static bool ReadVarint (IByteStream &Stream, DWORD *retdwValue);
+static void WriteBinaryValue (IByteStream &Stream, CDatum dValue);
+static void WriteString (IByteStream &Stream, const CString &sValue);
+static void WriteVarint (IByteStream &Stream, DWORD dwValue);
+
+bool CDatum::DeserializeAEONBinary (IByteStream &Stream, CDatum *retDatum)
+
+//	DeserializeAEONBinary
+//
+//	Deserialize from binary
+
+	{
+	BYTE bySignature;
+	if (!ReadBytes(Stream, &bySignature, 1) || bySignature != AEON_BINARY_SIGNATURE)
+		return false;
+
+	return ReadBinaryValue(Stream, retDatum);
+	}
+
+void CDatum::SerializeAEONBinary (IByteStream &Stream) const
+
+//	SerializeAEONBinary
+//
+//	Serializes to binary
+
+	{
+	BYTE bySignature = AEON_BINARY_SIGNATURE;
+	Stream.Write(&bySignature, 1);
+
+	WriteBinaryValue(Stream, *this);
+	}
+
+//	Helpers --------------------------------------------------------------------
+
+int GetBytesLeft (IByteStream &Stream)
+
+//	GetBytesLeft
+//
+//	Returns the number of BYTEs left to read.
+
+	{
+	return Max(0, Stream.GetStreamLength() - Stream.GetPos());
+	}
+
+bool ReadBinaryValue (IByteStream &Stream, CDatum *retDatum)
+
+//	ReadBinaryValue
+//
+//	Reads a single tagged value. Returns FALSE if the stream is invalid.
+
+	{
+	int i;
+
+	BYTE byTag;
+	if (!ReadBytes(Stream, &byTag, 1))
+		return false;
+
+	switch (byTag)
+		{
+		case tagNil:
+			*retDatum = CDatum();
+			return true;
+
+		case tagTrue:
+			*retDatum = CDatum(CDatum::constTrue);
+			return true;
+
+		case tagInt32:
+			{
+			DWORD dwZigZag;
+			if (!ReadVarint(Stream, &dwZigZag))
+				return false;
+
+			*retDatum = CDatum((int)((dwZigZag >> 1) ^ (~(dwZigZag & 1) + 1)));
+			return true;
+			}
+
+		case tagInt64:
+			{
+			DWORDLONG ilValue;
+			if (!ReadBytes(Stream, &ilValue, sizeof(ilValue)))
+				return false;
+
+			*retDatum = CDatum(ilValue);
+			return true;
+			}
+
+		case tagDouble:
+			{
+			double rValue;
+			if (!ReadBytes(Stream, &rValue, sizeof(rValue)))
+				return false;
+
+			*retDatum = CDatum(rValue);
+			return true;
+			}
+
+		case tagString:
+			{
+			CString sValue;
+			if (!ReadString(Stream, &sValue))
+				return false;
+
+			return CDatum::CreateStringFromHandoff(sValue, retDatum);
+			}
+
+		case tagDateTime:
+			{
+			DWORD dwDays;
+			DWORD dwMilliseconds;
+			if (!ReadVarint(Stream, &dwDays) || !ReadVarint(Stream, &dwMilliseconds))
+				return false;
+
+			*retDatum = CDatum(CDateTime((int)dwDays, (int)dwMilliseconds));
+			return true;
+			}
+
+		case tagIPInteger:
+			{
+			CIPInteger Value;
+			if (!CIPInteger::Deserialize(Stream, &Value))
+				return false;
+
+			return CDatum::CreateIPIntegerFromHandoff(Value, retDatum);
+			}
+
+		case tagArray:
+			{
+			//	Every element takes at least one BYTE (its tag), so a count
+			//	larger than what is left is corrupt (and we must not allocate
+			//	it).
+
+			DWORD dwCount;
+			if (!ReadVarint(Stream, &dwCount) || dwCount > (DWORD)GetBytesLeft(Stream))
+				return false;
+
+			int iCount = (int)dwCount;
+
+			CComplexArray *pArray = new CComplexArray;
+			pArray->InsertEmpty(iCount);
+			CDatum dArray(pArray);
+
+			for (i = 0; i < iCount; i++)
+				{
+				CDatum dElement;
+				if (!ReadBinaryValue(Stream, &dElement))
+					return false;
+
+				pArray->SetElement(i, dElement);
+				}
+
+			*retDatum = dArray;
+			return true;
+			}
+
+		case tagStruct:
+			{
+			//	Every field takes at least two BYTEs (key length and value tag).
+
+			DWORD dwCount;
+			if (!ReadVarint(Stream, &dwCount) || dwCount > (DWORD)GetBytesLeft(Stream) / 2)
+				return false;
+
+			int iCount = (int)dwCount;
+
+			CComplexStruct *pStruct = new CComplexStruct;
+			pStruct->GrowToFit(iCount);
+			CDatum dStruct(pStruct);
+
+			for (i = 0; i < iCount; i++)
+				{
+				CString sKey;
+				if (!ReadString(Stream, &sKey))
+					return false;
+
+				CDatum dElement;
+				if (!ReadBinaryValue(Stream, &dElement))
+					return false;
+
+				pStruct->SetElement(sKey, dElement);
+				}
+
+			*retDatum = dStruct;
+			return true;
+			}
+
+		case tagBinary:
+			{
+			DWORD dwLength;
+			if (!ReadVarint(Stream, &dwLength) || dwLength > (DWORD)GetBytesLeft(Stream))
+				return false;
+
+			return CDatum::CreateBinary(Stream, (int)dwLength, retDatum);
+			}
+
+		case tagAEONScript:
+			{
+			CString sScript;
+			if (!ReadString(Stream, &sScript))
+				return false;
+
+			CMemoryBuffer Buffer(sScript.GetParsePointer(), sScript.GetLength());
+			return CDatum::Deserialize(CDatum::formatAEONScript, Buffer, retDatum);
+			}
+
+		default:
+			return false;
+		}
+	}
+
+bool ReadBytes (IByteStream &Stream, void *pData, int iLength)
+
+//	ReadBytes
+//
+//	Reads exactly iLength BYTEs. Returns FALSE if the stream is too short.
+
+	{
+	return (Stream.Read(pData, iLength) == iLength);
+	}
+
+bool ReadString (IByteStream &Stream, CString *retsValue)
+
+//	ReadString
+//
+//	Reads a length-prefixed string
+
+	{
+	DWORD dwLength;
+	if (!ReadVarint(Stream, &dwLength) || dwLength > (DWORD)GetBytesLeft(Stream))
+		return false;
+
+	int iLength = (int)dwLength;
+
+	if (iLength == 0)
+		{
+		*retsValue = NULL_STR;
+		return true;
+		}
+
+	CString sValue(iLength);
+	if (!ReadBytes(Stream, sValue.GetParsePointer(), iLength))
+		return false;
+
+	retsValue->TakeHandoff(sValue);
+	return true;
+	}
+
+bool ReadVarint (IByteStream &Stream, DWORD *retdwValue)
+
+//	ReadVarint
+//
+//	Reads a base-128 varint. Returns FALSE if the stream ends first or if the
+//	value does not fit in a DWORD.
+
+	{
+	DWORD dwValue = 0;
+	int iShift = 0;
+
+	while (true)
+		{
+		BYTE byPart;
+		if (!ReadBytes(Stream, &byPart, 1))
+			return false;
+
+		//	The fifth BYTE only has room for the top 4 bits.
+
+		if (iShift == 28 && (byPart & 0xF0))
+			return false;
+
+		dwValue |= ((DWORD)(byPart & 0x7F)) << iShift;
+		if (!(byPart & 0x80))
+			{
+			*retdwValue = dwValue;
+			return true;
+			}
+
+		iShift += 7;
+		}
+	}
+
+void WriteBinaryValue (IByteStream &Stream, CDatum dValue)
+
+//	WriteBinaryValue
+//
+//	Writes a single tagged value
+
+	{
+	int i;
+	BYTE byTag;
+
+	switch (dValue.GetBasicType())
+		{
+		case CDatum::typeNil:
+			byTag = tagNil;
+			Stream.Write(&byTag, 1);
+			break;
+
+		case CDatum::typeTrue:
+			byTag = tagTrue;
+			Stream.Write(&byTag, 1);
+			break;
+
+		case CDatum::typeInteger32:
+			{
+			int iValue = (int)dValue;
+			byTag = tagInt32;
+			Stream.Write(&byTag, 1);
+			WriteVarint(Stream, ((DWORD)iValue << 1) ^ (DWORD)(iValue >> 31));
+			break;
+			}
+
+		case CDatum::typeDouble:
+			{
+			double rValue = (double)dValue;
+			byTag = tagDouble;
+			Stream.Write(&byTag, 1);
+			Stream.Write(&rValue, sizeof(rValue));
+			break;
+			}
+
+		case CDatum::typeString:
+			byTag = tagString;
+			Stream.Write(&byTag, 1);
+			WriteString(Stream, (const CString &)dValue);
+			break;
+
+		case CDatum::typeDateTime:
+			{
+			const CDateTime &DateTime = (const CDateTime &)dValue;
+			byTag = tagDateTime;
+			Stream.Write(&byTag, 1);
+			WriteVarint(Stream, (DWORD)DateTime.DaysSince1AD());
+			WriteVarint(Stream, (DWORD)DateTime.MillisecondsSinceMidnight());
+			break;
+			}
+
+		case CDatum::typeIntegerIP:
+			{
+			const CIPInteger &Value = (const CIPInteger &)dValue;
+
+			//	Most of these fit in 64-bits, so we store them natively.
+
+			if (!Value.IsNegative() && Value.FitsAsInteger64Unsigned())
+				{
+				DWORDLONG ilValue = Value.AsInteger64Unsigned();
+				byTag = tagInt64;
+				Stream.Write(&byTag, 1);
+				Stream.Write(&ilValue, sizeof(ilValue));
+				}
+			else
+				{
+				byTag = tagIPInteger;
+				Stream.Write(&byTag, 1);
+				Value.Serialize(Stream);
+				}
+			break;
+			}
+
+		case CDatum::typeArray:
+			byTag = tagArray;
+			Stream.Write(&byTag, 1);
+			WriteVarint(Stream, (DWORD)dValue.GetCount());
+			for (i = 0; i < dValue.GetCount(); i++)
+				WriteBinaryValue(Stream, dValue.GetElement(i));
+			break;
+
+		case CDatum::typeStruct:
+			byTag = tagStruct;
+			Stream.Write(&byTag, 1);
+			WriteVarint(Stream, (DWORD)dValue.GetCount());
+			for (i = 0; i < dValue.GetCount(); i++)
+				{
+				WriteString(Stream, dValue.GetKey(i));
+				WriteBinaryValue(Stream, dValue.GetElement(i));
+				}
+			break;
+
+		case CDatum::typeBinary:
+			byTag = tagBinary;
+			Stream.Write(&byTag, 1);
+			WriteVarint(Stream, (DWORD)dValue.GetBinarySize());
+			dValue.WriteBinaryToStream(Stream);
+			break;
+
+		//	External types (and anything else we don't know about) are stored
+		//	as embedded AEONScript.
+
+		default:
+			{
+			CString sScript = dValue.SerializeToString(CDatum::formatAEONScript);
+			byTag = tagAEONScript;
+			Stream.Write(&byTag, 1);
+			WriteString(Stream, sScript);
+			break;
+			}
+		}
+	}
+
+void WriteString (IByteStream &Stream, const CString &sValue)
+
+//	WriteString
+//
+//	Writes a length-prefixed string
+
+	{
+	WriteVarint(Stream, (DWORD)sValue.GetLength());
+	if (sValue.GetLength() > 0)
+		Stream.Write(sValue.GetParsePointer(), sValue.GetLength());
+	}
+
+void WriteVarint (IByteStream &Stream, DWORD dwValue)
+
+//	WriteVarint
+//
+//	Writes a base-128 varint
+
+	{
+	BYTE Buffer[5];
+	int iLen = 0;
+
+	while (dwValue >= 0x80)
+		{
+		Buffer[iLen++] = (BYTE)(dwValue | 0x80);
+		dwValue >>= 7;
+		}
+
+	Buffer[iLen++] = (BYTE)dwValue;
+	Stream.Write(Buffer, iLen);
+	}
@@ -1145,6 +1145,9 @@ bool CDatum::Deserialize (ESerializationFormats iFormat, IByteStream &Stream, IA
 			case formatAEONLocal:
 				return DeserializeAEONScript(Stream, pExtension, retDatum);
 
+			case formatAEONBinary:
+				return DeserializeAEONBinary(Stream, retDatum);
+
 			case formatJSON:
 				return DeserializeJSON(Stream, retDatum);
 
@@ -2171,6 +2174,10 @@ void CDatum::Serialize (ESerializationFormats iFormat, IByteStream &Stream) cons
 			SerializeAEONScript(iFormat, Stream);
 			break;
 
+		case formatAEONBinary:
+			SerializeAEONBinary(Stream);
+			break;
+
 		case formatJSON:
 			SerializeJSON(Stream);
 			break;
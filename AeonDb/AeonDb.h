@@ -10,7 +10,10 @@
 //#define DEBUG_FILE_UPLOAD
 #endif
 
+class CAeonRateLimiter;
 class CAeonRowValue;
+class CAeonSegment;
+class CAeonViewSnapshot;
 
 enum EKeyTypes
 	{
@@ -91,12 +94,20 @@ enum EAeonErrorCodes
 typedef DWORD AEONERR;
 
 //	IOrderedRowSet
+//
+//	Row sets are reference counted. Readers hold references outside of the
+//	table lock (see CAeonViewSnapshot) so we can't use IRefCounted; we update
+//	the count atomically instead.
 
-class IOrderedRowSet : public IRefCounted
+class IOrderedRowSet
 	{
 	public:
+		IOrderedRowSet (void) : m_iRefCount(1) { }
 		virtual ~IOrderedRowSet (void) { }
 
+		inline void AddRef (void) { ::InterlockedIncrement(&m_iRefCount); }
+		inline void Release (void) { if (::InterlockedDecrement(&m_iRefCount) == 0) delete this; }
+
 		virtual bool FindData (const CRowKey &Key, CDatum *retData, SEQUENCENUMBER *retRowID = NULL) { return false; }
 		virtual bool FindKey (const CRowKey &Key, int *retiIndex) { return false; }
 		virtual int GetCount (void) { return 0; }
@@ -105,12 +116,87 @@ class IOrderedRowSet : public IRefCounted
 		virtual bool GetRow (int iIndex, CRowKey *retKey, CDatum *retData, SEQUENCENUMBER *retRowID = NULL) { return false; }
 		virtual SEQUENCENUMBER GetRowID (int iIndex) { return 0; }
 		virtual DWORD GetRowSize (int iIndex) { return 0; }
-		virtual void WriteData (IByteStream &Stream, int iIndex, DWORD *retdwSize = NULL, SEQUENCENUMBER *retRowID = NULL) = 0;
+		virtual SEQUENCENUMBER GetSequence (void) { return 0; }	//	0 = not a segment
+		virtual void WriteData (IByteStream &Stream, int iIndex, DWORD *retdwSize = NULL, SEQUENCENUMBER *retRowID = NULL) { }
+
+		//	Returns a row set to iterate over. Immutable row sets return
+		//	themselves; mutable ones return a stable snapshot (and a snapshot
+		//	that keeps a cursor returns a copy with its own cursor). Either way,
+		//	the caller must Release the result.
+		virtual IOrderedRowSet *OpenSnapshot (void) { AddRef(); return this; }
 
 		//	Helper methods
 //		static int CompareKeys (const CTableDimensions &Dims, const CString &sKey1, const CString &sKey2);
 //		static CString PathToKey (const SDimensionPath &Path);
 		static void ShiftDimensions (const CTableDimensions &Source, CTableDimensions *retDest);
+
+	private:
+		volatile LONG m_iRefCount;
+	};
+
+//	CAeonRowExpiration
+//
+//	Describes when the rows of a table expire (the ttl field of the table
+//	descriptor). Expiration is keyed off a datetime field in the row: either
+//	the field is the expiration time itself or the row expires a fixed number
+//	of seconds after it. Rows without the field never expire.
+
+class CAeonRowExpiration
+	{
+	public:
+		CAeonRowExpiration (void) : m_dwLifetime(0), m_bHideField(false) { }
+
+		CDateTime GetCutoff (const CDateTime &Now) const;
+		CDatum GetDesc (void) const;
+		inline const CString &GetField (void) const { return m_sField; }
+		bool InitFromDesc (CDatum dDesc, CString *retsError);
+		inline bool IsEnabled (void) const { return !m_sField.IsEmpty(); }
+		inline bool IsEqual (const CAeonRowExpiration &Other) const { return (strEquals(m_sField, Other.m_sField) && m_dwLifetime == Other.m_dwLifetime); }
+		bool IsExpired (CDatum dData, const CDateTime &Cutoff) const;
+		inline void SetHideField (bool bHide = true) { m_bHideField = bHide; }
+		CDatum StripField (CDatum dData) const;
+
+	private:
+		CString m_sField;					//	Datetime field in the row
+		DWORD m_dwLifetime;					//	Seconds after m_sField (0 = m_sField is the expiration time)
+		bool m_bHideField;					//	If TRUE, StripField removes m_sField (see CAeonView::SetExpiration)
+	};
+
+//	CAeonRangeDeletes
+//
+//	Range tombstones (see CAeonTable::DeleteRange). Each one hides the rows
+//	under a key prefix (or in a key range) that were saved to segments at or
+//	before its sequence number. In-memory rows are covered by the row array
+//	itself (see CAeonRowArray::DeleteRange), so they are never hidden here.
+
+class CAeonRangeDeletes
+	{
+	public:
+		void Add (const CTableDimensions &Dims, const CRowKey &From, const CRowKey &To, SEQUENCENUMBER Seq);
+		void DeleteAll (void);
+		bool Deserialize (const CTableDimensions &Dims, IByteStream &Stream);
+		SEQUENCENUMBER GetMaxSequence (void) const;
+		bool IsDeleted (const CTableDimensions &Dims, const CString &sKey, SEQUENCENUMBER Seq) const;
+		inline bool IsEmpty (void) const { return (m_Prefixes.GetCount() == 0 && m_Ranges.GetCount() == 0); }
+		void Serialize (IByteStream &Stream) const;
+
+		static bool IsInRange (const CTableDimensions &Dims, const CRowKey &From, const CRowKey &To, const CRowKey &Key);
+		static bool ParseRange (const CTableDimensions &Dims, CDatum dFrom, CDatum dTo, CRowKey *retFrom, CRowKey *retTo, CString *retsError);
+
+	private:
+		struct SRange
+			{
+			CString sFrom;					//	Encoded key prefix (or first key in range)
+			CString sTo;					//	Encoded key after range (empty = sFrom is a prefix)
+			CString sMaxTo;					//	Highest sTo of this and all earlier ranges
+			SEQUENCENUMBER Seq;				//	Hides rows in segments at or before this
+			};
+
+		static int FindInsertPos (const CTableDimensions &Dims, const TArray<SRange> &List, const CRowKey &Key);
+		void UpdateMaxTo (const CTableDimensions &Dims, int iStart = 0);
+
+		TArray<SRange> m_Prefixes;			//	Sorted by key (no duplicates)
+		TArray<SRange> m_Ranges;			//	Sorted by sFrom
 	};
 
 class CRowIterator
@@ -133,10 +219,14 @@ class CRowIterator
 		void GetNextRow (CRowKey *retKey, CDatum *retdData, SEQUENCENUMBER *retRowID = NULL);
 		DWORD GetNextRowSize (void);
 		void GetRow (CRowKey *retKey, CDatum *retdData, SEQUENCENUMBER *retRowID = NULL);
+		DWORD GetRowSize (void);
 		void WriteNextRow (IByteStream &Stream, DWORD *retdwKeySize, DWORD *retdwDataSize, SEQUENCENUMBER *retRowID = NULL);
+		void WriteNextValue (IByteStream &Stream, DWORD *retdwDataSize, SEQUENCENUMBER *retRowID = NULL);
 		void Reset (void);
 		bool SelectKey (const CRowKey &Key);
+		void SetExpiration (const CAeonRowExpiration &Expiration);
 		inline void SetIncludeNil (bool bInclude = true) { m_bIncludeNil = bInclude; }
+		inline void SetRangeDeletes (const CAeonRangeDeletes &RangeDeletes) { m_RangeDeletes = RangeDeletes; }
 		void SetLimits (const TArray<int> &Limits);
 
 	private:
@@ -146,6 +236,7 @@ class CRowIterator
 			CString sKey;
 			int iPosCursor;
 			int iCount;
+			SEQUENCENUMBER Seq;				//	Segment sequence (0 = in-memory rows)
 			};
 
 		struct SLimit
@@ -157,6 +248,7 @@ class CRowIterator
 			};
 
 		void Advance (void);
+		void AdvanceEntry (int iEntry);
 		void AdvanceUntilDifferent (const CRowKey &PartialKey);
 		void AdvanceUntilNonNil (void);
 		void AdvanceWithLimits (void);
@@ -165,13 +257,28 @@ class CRowIterator
 		void Copy (const CRowIterator &Src);
 		bool DecrementLimit (int iDimIndex, int *retiDimLeft);
 		inline bool HasLimits (void) { return (m_Limits.GetCount() > 0); }
+		void HeapBuild (void);
+		int HeapPop (void);
+		bool HeapPrecedes (int iEntry1, int iEntry2);
+		void HeapPush (int iEntry);
+		void HeapSiftDown (int iPos);
+		inline int HeapTop (void) { return (m_Heap.GetCount() > 0 ? m_Heap[0] : -1); }
+		bool IsHidden (void);
+		bool IsHidden (CDatum dData);
+		bool IsNilRow (void);
+		bool WriteIfHidden (IByteStream &Stream, DWORD *retdwDataSize, SEQUENCENUMBER *retRowID);
 
 		CTableDimensions m_Dims;
 		TArray<SEntry> m_Data;
+		TArray<int> m_Heap;					//	Min-heap of entries with rows left
 		int m_iEntryCursor;
 
 		bool m_bIncludeNil;
 		TArray<SLimit> m_Limits;
+
+		CAeonRowExpiration m_Expiration;	//	Expired rows look like nil rows
+		CDateTime m_ExpirationCutoff;		//	Rows whose time is at or before this are expired
+		CAeonRangeDeletes m_RangeDeletes;	//	Covered rows look like nil rows
 	};
 
 //	CAeonRowValue
@@ -191,14 +298,19 @@ class CAeonRowValue
 		int GetSerializedSize (void);
 		CDatum GetValue (void);
 		void Init (void *pValue = NULL);
+		bool IsLegacyFormat (void);
 		bool IsNil (void);
 		void Load (void);
 		void Save (void);
 		void Serialize (IByteStream &Stream);
 		void SetValue (CDatum dValue);
+		void UpgradeFormat (void);
 
 		static DWORD GetSerializedKeySize (const CString &sKey);
 		static void SerializeKey (IByteStream &Stream, const CString &sKey, DWORD *retdwSize);
+#ifdef DEBUG
+		static void SetLegacyFormat (bool bLegacy) { m_bLegacyFormat = bLegacy; }
+#endif
 
 	private:
 		struct SItemHeader
@@ -210,53 +322,265 @@ class CAeonRowValue
 		void Copy (const CAeonRowValue &Src);
 		inline SItemHeader *Get0DItem (void) { return (SItemHeader *)(&((SItemHeader *)m_pFixedBlock)[1]); }
 		DWORD GetFixedBlockSize (void);
+		static CDatum::ESerializationFormats GetItemFormat (SItemHeader *pItem);
 		CDatum ItemToValue (SItemHeader *pItem);
 
 		DWORD m_dwFixedBlockAlloc;			//	Allocation size of fixed block
 		void *m_pFixedBlock;				//	Fixed block pointer
+
+#ifdef DEBUG
+		static bool m_bLegacyFormat;		//	Write new rows as AEONScript (to test old segments)
+#endif
+	};
+
+//	CAeonRowArena
+//
+//	Simple bump allocator for memtable nodes. Memory is only freed when the
+//	arena is destroyed (or DeleteAll is called).
+
+class CAeonRowArena
+	{
+	public:
+		CAeonRowArena (void) : m_pPos(NULL), m_dwLeft(0), m_dwMemoryUsed(0) { }
+		~CAeonRowArena (void) { DeleteAll(); }
+
+		void *Alloc (DWORD dwSize);
+		void DeleteAll (void);
+		inline DWORD GetMemoryUsed (void) const { return m_dwMemoryUsed; }
+
+	private:
+		TArray<char *> m_Chunks;
+		char *m_pPos;						//	Next free byte in current chunk
+		DWORD m_dwLeft;						//	Bytes left in current chunk
+		DWORD m_dwMemoryUsed;				//	Total bytes allocated from the OS
 	};
 
 //	CAeonRowArray
+//
+//	In-memory rows (the memtable). Rows are kept in a skiplist whose nodes and
+//	values are allocated out of an arena. Inserts are serialized by a lock but
+//	readers never lock: nodes are fully initialized before they are linked in
+//	and we never unlink or free a node until the last reference to the array
+//	is released. (Views replace the array when they save it to a segment
+//	rather than clearing it.)
+//
+//	Updating a row adds a new version and leaves the old one in place so that
+//	existing snapshots are unaffected. Each version is stamped with the
+//	array's sequence number at the time of the write, so a reader can ask for
+//	the rows as of any sequence number (see FindDataAt and OpenSnapshotAt).
+//	A range delete is stamped the same way: rows written before it read as nil
+//	and rows written after it are unaffected, so we never touch the rows.
+//	Positional access (the IOrderedRowSet interface used by CRowIterator) goes
+//	through a snapshot, which walks the list rather than copying it.
 
 class CAeonRowArray : public IOrderedRowSet
 	{
 	public:
-		CAeonRowArray (void) : m_dwMemoryUsed(0), m_dwChanges(0) { }
+		CAeonRowArray (void);
 
-		void DeleteAll (void);
+		void DeleteRange (const CRowKey &From, const CRowKey &To, SEQUENCENUMBER TableSeq);
+		bool FindDataAt (const CRowKey &Key, SEQUENCENUMBER Seq, CDatum *retData, SEQUENCENUMBER *retRowID = NULL);
 		inline const CTableDimensions &GetDimensions (void) { return m_Dims; }
-		inline DWORD GetMemoryUsed (void) { return m_dwMemoryUsed; }
+		inline DWORD GetMemoryUsed (void) { return m_Arena.GetMemoryUsed(); }
+		void GetRangeDeletes (CAeonRangeDeletes *retRangeDeletes) const;
+		SEQUENCENUMBER GetSeq (void) const;
 		inline int GetUpdateCount (void) { return m_dwChanges; }
 		void Init (const CTableDimensions &Dims);
 		bool Insert (const CRowKey &Key, CDatum dData, SEQUENCENUMBER RowID);
+		IOrderedRowSet *OpenSnapshotAt (SEQUENCENUMBER Seq);
 
 		//	IOrderedRowSet virtuals
-		virtual bool FindData (const CRowKey &Key, CDatum *retData, SEQUENCENUMBER *retRowID = NULL);
-		virtual bool FindKey (const CRowKey &Key, int *retiIndex);
-		virtual int GetCount (void) { CSmartLock Lock(m_cs); return m_Order.GetCount(); }
-		virtual CDatum GetData (int iIndex);
-		virtual CString GetKey (int iIndex) { CSmartLock Lock(m_cs); return m_Rows[m_Order[iIndex]].sKey; }
-		virtual bool GetRow (int iIndex, CRowKey *retKey, CDatum *retData, SEQUENCENUMBER *retRowID = NULL);
-		virtual SEQUENCENUMBER GetRowID (int iIndex) { CSmartLock Lock(m_cs); return m_Rows[m_Order[iIndex]].RowID; }
-		virtual DWORD GetRowSize (int iIndex);
-		virtual void WriteData (IByteStream &Stream, int iIndex, DWORD *retdwSize = NULL, SEQUENCENUMBER *retRowID = NULL);
+		virtual bool FindData (const CRowKey &Key, CDatum *retData, SEQUENCENUMBER *retRowID = NULL) override;
+		virtual int GetCount (void) override { return (int)m_iCount; }
+		virtual IOrderedRowSet *OpenSnapshot (void) override;
 
 	private:
-		struct SEntry
+		enum Constants
+			{
+			MAX_HEIGHT =					12,
+			BRANCHING =						4,		//	1 in BRANCHING nodes goes up a level
+			};
+
+		struct SVersion
 			{
-			CString sKey;
-			CAeonRowValue Value;
 			SEQUENCENUMBER RowID;
+			SEQUENCENUMBER Seq;				//	Array sequence number when written
+			SVersion *pPrev;				//	Previous version (or NULL)
+			DWORD dwSize;					//	Size of serialized CAeonRowValue
+			DWORD dwSpare;
+
+			//	Followed by serialized CAeonRowValue
 			};
 
-		inline bool IsInitialized (void) { return (m_Dims.GetCount() != 0); }
+		struct SNode
+			{
+			char *pKey;						//	Encoded key, laid out as a CString literal
+			SVersion * volatile pVersion;	//	Latest version
+			int iHeight;
+			SNode * volatile pNext[1];		//	Actually iHeight entries
+			};
 
-		CCriticalSection m_cs;
+		struct SRangeDelete
+			{
+			char *pFrom;					//	Encoded key prefix (or first key in range)
+			char *pTo;						//	Encoded key after range (NULL = pFrom is a prefix)
+			SEQUENCENUMBER Seq;				//	Array sequence number when written
+			SEQUENCENUMBER TableSeq;		//	Table sequence number (see CAeonRangeDeletes)
+			SRangeDelete *pNext;			//	Previous range delete (or NULL)
+			};
+
+		//	A snapshot is a cursor over the rows as of a sequence number.
+		//	Positions are not ranks: position 0 is the first row, FindKey
+		//	returns a position for the row it finds, and the position after one
+		//	we've visited is the next row (which is how CRowIterator walks).
+		//	GetCount is an upper bound; GetKey returns NULL_STR past the end.
+
+		class CSnapshot : public IOrderedRowSet
+			{
+			public:
+				CSnapshot (CAeonRowArray *pRows, SEQUENCENUMBER Seq);
+				CSnapshot (const CSnapshot &Src);
+				virtual ~CSnapshot (void);
+
+				//	IOrderedRowSet virtuals
+				virtual bool FindData (const CRowKey &Key, CDatum *retData, SEQUENCENUMBER *retRowID = NULL) override;
+				virtual bool FindKey (const CRowKey &Key, int *retiIndex) override;
+				virtual int GetCount (void) override { return m_iCount; }
+				virtual CDatum GetData (int iIndex) override;
+				virtual CString GetKey (int iIndex) override;
+				virtual bool GetRow (int iIndex, CRowKey *retKey, CDatum *retData, SEQUENCENUMBER *retRowID = NULL) override;
+				virtual SEQUENCENUMBER GetRowID (int iIndex) override { MoveTo(iIndex); return m_pVersion->RowID; }
+				virtual DWORD GetRowSize (int iIndex) override { MoveTo(iIndex); return m_pVersion->dwSize; }
+				virtual IOrderedRowSet *OpenSnapshot (void) override { return new CSnapshot(*this); }
+				virtual void WriteData (IByteStream &Stream, int iIndex, DWORD *retdwSize = NULL, SEQUENCENUMBER *retRowID = NULL) override;
+
+			private:
+				const SNode *GetNextVisible (const SNode *pNode) const;
+				void MoveTo (int iIndex);
+
+				CAeonRowArray *m_pRows;		//	Keeps the arena alive
+				SEQUENCENUMBER m_Seq;		//	We only see versions at or before this
+				int m_iCount;				//	Distinct keys when opened (at least as many as we see)
+				const SNode *m_pFirst;		//	First row we see (or NULL)
+
+				int m_iPos;					//	Position of cursor (-1 = not yet positioned)
+				const SNode *m_pNode;		//	Row at cursor (NULL = past the end)
+				const SVersion *m_pVersion;	//	Version of m_pNode that we see
+			};
+
+		char *AllocKey (const CString &sKey);
+		SNode *AllocNode (const CString &sKey, int iHeight);
+		SVersion *AllocVersion (CDatum dData, SEQUENCENUMBER RowID);
+		SNode *FindGreaterOrEqual (const CRowKey &Key, SNode **retPrev = NULL);
+		static inline CString GetArenaKey (char *pKey) { return CString(pKey, -1, true); }
+		static inline CString GetNodeKey (const SNode *pNode) { return GetArenaKey(pNode->pKey); }
+		const SVersion *GetVisibleVersion (const SNode *pNode, SEQUENCENUMBER Seq) const;
+		static inline void *GetVersionData (const SVersion *pVersion) { return (void *)&pVersion[1]; }
+		static CDatum GetVersionValue (const SVersion *pVersion);
+		bool IsCovered (const SNode *pNode, const SVersion *pVersion, SEQUENCENUMBER Seq) const;
+		static bool IsVersionNil (const SVersion *pVersion);
+		inline bool IsInitialized (void) { return (m_Dims.GetCount() != 0); }
+		static SNode *LoadNext (const SNode *pNode, int iLevel);
+		SRangeDelete *LoadRangeDeletes (void) const;
+		static SVersion *LoadVersion (const SNode *pNode);
+		int RandomHeight (void);
+		static void StoreNext (SNode *pNode, int iLevel, SNode *pNext);
+		static void StoreVersion (SNode *pNode, SVersion *pVersion);
+
+		CCriticalSection m_cs;				//	Serializes writers
 		CTableDimensions m_Dims;			//	Dimension descriptors
-		DWORD m_dwMemoryUsed;				//	Memory used for all the rows
+		CAeonRowArena m_Arena;				//	Nodes and values
+		SNode *m_pHead;						//	Sentinel (MAX_HEIGHT links)
+		SRangeDelete * volatile m_pRangeDeletes;	//	Latest range delete (or NULL)
+		SVersion *m_pNilVersion;			//	What covered rows read as
+		volatile LONG m_iHeight;			//	Current max height of list
+		volatile LONG m_iCount;				//	Number of distinct keys
 		DWORD m_dwChanges;					//	Number of updates
-		TArray<int> m_Order;				//	Row order
-		TArray<SEntry> m_Rows;				//	Row data
+		volatile LONGLONG m_Seq;			//	Sequence number of last write
+		DWORD m_dwRandom;					//	Random state for node heights
+	};
+
+//	CRowLogFile
+//
+//	The file behind a CRowInsertLog. Inserts append records to a pending
+//	buffer; committing writes everything pending in a single batch, so
+//	threads that commit at the same time share one write (and one flush).
+//	This object is reference counted so that threads can wait for a commit
+//	without holding the table lock.
+
+class CRowLogFile;
+
+//	CRowLogFlusher
+//
+//	Under the syncInterval policy a batch is flushed to disk only when a later
+//	commit comes along. This thread flushes batches that have been waiting
+//	longer than the interval, so that durability lag is bounded even after
+//	writes stop.
+
+class CRowLogFlusher : public TThread<CRowLogFlusher>
+	{
+	public:
+		CRowLogFlusher (void) : m_bRunning(false) { }
+
+		void Register (CRowLogFile *pLog);
+		void Run (void);
+		void StartFlusher (void);
+		void StopFlusher (void);
+		void Unregister (CRowLogFile *pLog);
+
+	private:
+		CCriticalSection m_cs;
+		TArray<CRowLogFile *> m_Logs;		//	Open logs (each owner holds a reference)
+		CManualEvent m_Quit;
+		bool m_bRunning;
+	};
+
+class CRowLogFile
+	{
+	public:
+		enum ESyncPolicies
+			{
+			syncBatch,						//	Flush to disk after every batch
+			syncInterval,					//	Flush to disk at most every N milliseconds
+			syncOS,							//	Let the OS decide when to flush
+			};
+
+		CRowLogFile (void);
+
+		void AddRef (void);
+		void Append (IMemoryBlock &Record, DWORDLONG *retdwSeq = NULL);
+		void Close (void);
+		bool Commit (DWORDLONG dwSeq, CString *retsError = NULL);
+		inline CFile &GetFile (void) { return m_File; }
+		DWORDLONG GetLastSeq (void);
+		bool IsDurable (DWORDLONG dwSeq);
+		void Release (void);
+		bool Reset (void *pHeader, DWORD dwHeaderSize);
+		void SyncIfStale (void);
+
+		static inline CRowLogFlusher &GetFlusher (void) { return m_Flusher; }
+		static ESyncPolicies GetSyncPolicy (DWORD *retdwIntervalMS = NULL);
+		static void SetSyncPolicy (ESyncPolicies iPolicy, DWORD dwIntervalMS = 0);
+
+	private:
+		~CRowLogFile (void) { }
+
+		bool ShouldSync (void);
+
+		CCriticalSection m_cs;				//	Protects everything except the file
+		CCriticalSection m_csWrite;			//	Held by the thread writing a batch
+		int m_iRefCount;
+		CFile m_File;
+		CBuffer m_Pending;					//	Records not yet written
+		DWORDLONG m_dwAppendSeq;			//	Sequence of last record appended
+		DWORDLONG m_dwDurableSeq;			//	Sequence of last record committed
+		DWORD m_dwLastSync;					//	Tick of last flush to disk
+		bool m_bUnsynced;					//	Written but not flushed (under m_csWrite)
+		bool m_bFailed;						//	Write failed; cleared by Reset
+
+		static ESyncPolicies m_iSyncPolicy;
+		static DWORD m_dwSyncInterval;
+		static CRowLogFlusher m_Flusher;
 	};
 
 //	CRowInsertLog
@@ -264,15 +588,27 @@ class CAeonRowArray : public IOrderedRowSet
 class CRowInsertLog
 	{
 	public:
-		CRowInsertLog (void) : m_dwVersion(0) { }
+		struct SCommitPoint
+			{
+			CRowLogFile *pLog;				//	Caller must Release
+			DWORDLONG dwSeq;				//	Commit up to this record
+			};
 
-		inline void Close (void) { m_File.Close(); }
+		CRowInsertLog (void) : m_pLog(NULL), m_dwVersion(0) { }
+		~CRowInsertLog (void) { Close(); }
+
+		bool CanInsertRangeDelete (void) const;
+		void Close (void);
 		bool Create (const CString &sFilename);
-		inline const CString &GetFilespec (void) const { return m_File.GetFilespec(); }
+		bool Flush (CString *retsError = NULL);
+		void GetCommitPoint (SCommitPoint *retCommit);
+		inline const CString &GetFilespec (void) const { return (m_pLog ? m_pLog->GetFile().GetFilespec() : NULL_STR); }
 		inline DWORD GetVersion (void) { return m_dwVersion; }
 		bool Insert (const CRowKey &Key, CDatum dData, SEQUENCENUMBER RowID, CString *retsError = NULL);
+		bool InsertRangeDelete (const CRowKey &From, const CRowKey &To, SEQUENCENUMBER Seq, CString *retsError = NULL);
 		bool Open (const CString &sFilename, CAeonRowArray *pRows, int *retiRowCount, CString *retsError);
 		bool Reset (void);
+		bool WriteTornRecordTest (CString *retsError = NULL);
 
 	private:
 		struct SHeader
@@ -281,41 +617,250 @@ class CRowInsertLog
 			DWORD dwVersion;
 			};
 
+		struct SRecordHeader
+			{
+			DWORD dwSize;					//	Size of record (excluding header)
+			DWORD dwCRC;					//	CRC32C of size and record
+			};
+
+		bool Append (CBuffer &Output, CString *retsError);
+		static DWORD CalcRecordCRC (DWORD dwSize, void *pData);
 		bool Recover (CAeonRowArray *pRows, int *retiRowCount, CString *retsError);
+		bool RecoverRecords (CAeonRowArray *pRows, int *retiRowCount, CString *retsError);
 
 		CString m_sFilename;
-		CFile m_File;
+		CRowLogFile *m_pLog;
 		DWORD m_dwVersion;
 	};
 
+//	CAeonBlockCache
+//
+//	Process-wide cache of segment blocks, shared by all tables. Blocks are
+//	keyed by (segmentID, offset) and the cache is bounded by a byte budget.
+//	Each shard uses a 2Q replacement policy so that a single large scan does
+//	not flush frequently used blocks.
+
+class CAeonBlockCache
+	{
+	public:
+		struct SStats
+			{
+			DWORDLONG dwHits;				//	Block requests satisfied from cache
+			DWORDLONG dwMisses;				//	Block requests that went to disk
+			DWORDLONG dwEvictions;			//	Blocks evicted to stay under budget
+			DWORDLONG dwBytesUsed;			//	Bytes currently cached
+			DWORDLONG dwMaxBytes;			//	Byte budget
+			int iBlockCount;				//	Blocks currently cached
+			};
+
+		CAeonBlockCache (void);
+		~CAeonBlockCache (void);
+
+		DWORD CreateSegmentID (void);
+		void DeleteSegment (DWORD dwSegmentID);
+		void GetStats (SStats *retStats) const;
+		void *LoadBlock (DWORD dwSegmentID, CFile &File, DWORD dwOffset, DWORD dwBlockSize, bool bCompressed = false, const char *pMappedFile = NULL, const DWORD *pChecksum = NULL);
+		void SetMaxMemory (DWORDLONG dwMaxBytes);
+		void UnloadBlock (DWORD dwSegmentID, DWORD dwOffset);
+
+	private:
+		enum Constants
+			{
+			SHARD_COUNT =					16,
+			MIN_GHOST_COUNT =				64,		//	Min blocks remembered after eviction from A1in
+			};
+
+		enum EQueues
+			{
+			queueIn,						//	A1in: FIFO of blocks seen once
+			queueMain,						//	Am: LRU of blocks seen more than once
+			};
+
+		struct SBlock
+			{
+			DWORDLONG dwKey;				//	(segmentID << 32) | offset
+			void *pBlock;
+			DWORD dwSize;
+			DWORD dwRefCount;				//	Non-zero while a caller has the block loaded
+			EQueues iQueue;					//	Queue we belong to (we're in Pinned while in use)
+
+			SBlock *pPrev;					//	Towards most recent
+			SBlock *pNext;					//	Towards least recent
+
+			SBlock *pSegPrev;				//	Blocks of the same segment (in this shard)
+			SBlock *pSegNext;
+			};
+
+		struct SQueue
+			{
+			SQueue (void) : pHead(NULL), pTail(NULL), dwBytes(0) { }
+
+			SBlock *pHead;					//	Most recently inserted/used
+			SBlock *pTail;					//	Least recently inserted/used
+			DWORDLONG dwBytes;
+			};
+
+		struct SGhost
+			{
+			DWORDLONG dwKey;
+			DWORD dwGeneration;
+			};
+
+		struct SShard
+			{
+			SShard (void) : dwHits(0), dwMisses(0), dwEvictions(0), dwNextGhostGen(0) { }
+
+			CCriticalSection cs;
+			THashMap<DWORDLONG, SBlock *> Blocks;
+			THashMap<DWORD, SBlock *> Segments;		//	segmentID -> first block of segment
+			SQueue In;
+			SQueue Main;
+			SQueue Pinned;					//	Blocks in use (never evicted)
+
+			THashMap<DWORDLONG, DWORD> Ghosts;		//	A1out: key -> generation
+			TQueue<SGhost> GhostOrder;
+			DWORD dwNextGhostGen;
+
+			DWORDLONG dwHits;
+			DWORDLONG dwMisses;
+			DWORDLONG dwEvictions;
+			};
+
+		void AddGhost (SShard &Shard, DWORDLONG dwKey);
+		void DeleteBlock (SShard &Shard, SBlock *pBlock);
+		static void DeleteQueue (SQueue &Queue);
+		void EvictBlocks (SShard &Shard);
+		inline DWORDLONG GetMaxBytes (void) const { return (DWORDLONG)::InterlockedCompareExchange64((volatile LONGLONG *)&m_iMaxBytes, 0, 0); }
+		inline SShard &GetShard (DWORDLONG dwKey) { return m_Shards[HashKey(dwKey) % SHARD_COUNT]; }
+		inline DWORDLONG GetShardBudget (void) const { return GetMaxBytes() / SHARD_COUNT; }
+		static inline DWORDLONG GetShardBytes (const SShard &Shard) { return Shard.In.dwBytes + Shard.Main.dwBytes + Shard.Pinned.dwBytes; }
+		static DWORD HashKey (DWORDLONG dwKey);
+		static inline DWORDLONG MakeKey (DWORD dwSegmentID, DWORD dwOffset) { return (((DWORDLONG)dwSegmentID) << 32) | (DWORDLONG)dwOffset; }
+		static void PinBlock (SShard &Shard, SBlock *pBlock);
+		static void QueueInsertHead (SQueue &Queue, SBlock *pBlock);
+		static void QueueRemove (SQueue &Queue, SBlock *pBlock);
+		static char *ReadBlock (CFile &File, DWORD dwOffset, DWORD dwBlockSize, bool bCompressed, const DWORD *pChecksum, DWORD *retdwSize);
+		static void SegmentInsert (SShard &Shard, SBlock *pBlock);
+		static void SegmentRemove (SShard &Shard, SBlock *pBlock);
+		static void UnpinBlock (SShard &Shard, SBlock *pBlock);
+
+		CCriticalSection m_cs;
+		DWORD m_dwNextSegmentID;
+		volatile LONGLONG m_iMaxBytes;		//	Set by SetMaxMemory; read without a lock
+		SShard m_Shards[SHARD_COUNT];
+	};
+
+//	CAeonReadAhead
+//
+//	I/O thread that loads segment blocks before a sequential reader needs them.
+//	Segments queue requests when they see blocks being read in order; a
+//	segment must call Cancel before it is destroyed.
+
+class CAeonReadAhead : public TThread<CAeonReadAhead>
+	{
+	public:
+		CAeonReadAhead (void) : m_pProcessing(NULL), m_bRunning(false), m_bQuit(false) { }
+
+		void Cancel (CAeonSegment *pSegment);
+		void Request (CAeonSegment *pSegment, int iFirstBlock, int iCount);
+		void Run (void);
+		void StartReadAhead (void);
+		void StopReadAhead (void);
+
+	private:
+		struct SRequest
+			{
+			CAeonSegment *pSegment;
+			int iBlock;
+			};
+
+		CCriticalSection m_cs;
+		TArray<SRequest> m_Queue;			//	Blocks to load (in order)
+		CManualEvent m_WorkAvail;			//	Set when m_Queue is not empty (or we should quit)
+		CAeonSegment *m_pProcessing;		//	Segment we're loading from (outside m_cs)
+		bool m_bRunning;
+		bool m_bQuit;
+	};
+
 //	CSegmentBlockCache
+//
+//	Per-segment handle on the shared block cache. We own the file; the blocks
+//	themselves live in the process-wide CAeonBlockCache. If the segment has
+//	compressed blocks, each block on disk starts with an SCompressedBlockHeader
+//	and we cache the decompressed block.
+//
+//	On 64-bit machines we also map the file into memory. Uncompressed blocks
+//	are then used in place (without going through the shared cache) and
+//	compressed blocks are decompressed straight from the mapping. If we can't
+//	map the file we fall back to reading blocks into the shared cache.
 
 class CSegmentBlockCache
 	{
 	public:
-		CSegmentBlockCache (void) : m_iCacheSize(-1) { }
+		struct SCompressedBlockHeader
+			{
+			DWORD dwCodec;					//	ECompressionTypes used for this block
+			DWORD dwSize;					//	Size of the decompressed block
+			};
+
+		CSegmentBlockCache (void) : m_dwSegmentID(0), m_bCompressed(false) { }
 		~CSegmentBlockCache (void);
 
+		static char *DecompressBlock (const char *pData, DWORD dwDataSize, DWORD *retdwSize);
 		inline DWORDLONG GetFileSize (void) { return m_File.GetSize(); }
-		bool Init (const CString &sFilespec, int iCacheSize);
-		void LoadBlock (DWORD dwOffset, DWORD dwBlockSize, void **retpBlock);
+		static inline CAeonReadAhead &GetReadAhead (void) { return m_ReadAhead; }
+		static inline CAeonBlockCache &GetSharedCache (void) { return m_SharedCache; }
+		static inline int GetMappedCount (void) { return (int)m_iMappedCount; }
+		static inline int GetUnmappedCount (void) { return (int)m_iUnmappedCount; }
+		bool Init (const CString &sFilespec, bool bCompressed = false);
+		inline bool IsMapped (void) const { return m_Map.IsOpen(); }
+		void LoadBlock (int iBlock, DWORD dwOffset, DWORD dwBlockSize, void **retpBlock);
+		void Prefetch (int iBlock, DWORD dwOffset, DWORD dwBlockSize);
+		void SetChecksums (const TArray<DWORD> &Checksums);
+		static inline void SetMapSegments (bool bMap) { m_bMapSegments = (bMap && sizeof(void *) >= 8); }
 		void Term (void);
 		void UnloadBlock (DWORD dwOffset);
+		static void VerifyBlock (const CFile &File, DWORD dwOffset, const void *pData, DWORD dwDataSize, DWORD dwChecksum);
 
 	private:
-		struct SEntry
-			{
-			void *pBlock;
-			DWORD dwRefCount;
-			DWORD dwLastAccess;
-			};
-
-		void FreeUnloadedBlocks (void);
+		inline const DWORD *GetChecksum (int iBlock) const { return (iBlock >= 0 && iBlock < m_Checksums.GetCount() ? &m_Checksums[iBlock] : NULL); }
 
 		CFile m_File;
+		CFileBuffer64 m_Map;				//	Read-only view of m_File (if mapped)
+		DWORD m_dwSegmentID;				//	Our ID in the shared cache (0 = not initialized)
+		bool m_bCompressed;					//	Blocks on disk are compressed
+		TArray<DWORD> m_Checksums;			//	CRC32C of each block on disk (empty = not checksummed)
+		TArray<BYTE> m_Verified;			//	Non-zero if we've verified the mapped block in place
+
+		static bool m_bMapSegments;			//	Map segment files into memory
+		static volatile LONG m_iMappedCount;	//	Open segments that are mapped
+		static volatile LONG m_iUnmappedCount;	//	Open segments read through m_File
+		static CAeonReadAhead m_ReadAhead;
+
+		static CAeonBlockCache m_SharedCache;
+	};
+
+//	CSegmentBloomFilter
+//
+//	Bloom filter over the keys in a segment. Lets point lookups skip segments
+//	without loading any blocks.
+
+class CSegmentBloomFilter
+	{
+	public:
+		CSegmentBloomFilter (void) : m_dwBitCount(0), m_dwHashCount(0) { }
+
+		void Create (const TArray<DWORD> &KeyHashes, int iBitsPerKey);
+		static DWORD HashKey (const CString &sKey);
+		inline bool IsEmpty (void) const { return (m_dwBitCount == 0); }
+		bool MayContain (const CString &sKey) const;
+		bool Read (IByteStream &Stream, DWORD dwSize);
+		void Write (IByteStream &Stream, DWORD *retdwSize = NULL) const;
 
-		int m_iCacheSize;
-		TSortMap<DWORD, SEntry> m_Cache;
+	private:
+		DWORD m_dwBitCount;					//	Number of bits in filter (0 = no filter)
+		DWORD m_dwHashCount;				//	Number of probes per key
+		TArray<BYTE> m_Bits;
 	};
 
 //	CAeonSegment
@@ -327,6 +872,10 @@ class CAeonSegment : public IOrderedRowSet
 			{
 			FLAG_SECONDARY_VIEW =			0x00000001,	//	Segment is a secondary view
 			FLAG_HAS_ROW_ID =				0x00000002,	//	Segment stores a rowID
+			FLAG_COMPRESSED_BLOCKS =		0x00000004,	//	Blocks are compressed (see dwCodec)
+			FLAG_PREFIX_KEYS =				0x00000008,	//	Row keys in blocks share prefixes
+			FLAG_BLOCK_CHECKSUMS =			0x00000010,	//	CRC32C of each block (see dwChecksumOffset)
+			FLAG_RANGE_DELETES =			0x00000020,	//	Segment has range deletes (see dwRangeDeletesOffset)
 			};
 
 		struct SInfo
@@ -338,16 +887,20 @@ class CAeonSegment : public IOrderedRowSet
 		CAeonSegment (void);
 		~CAeonSegment (void);
 
-		bool Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENCENUMBER Seq, CRowIterator &Rows, const CString &sFilespec, DWORD dwFlags, CString *retsError);
+		bool Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENCENUMBER Seq, CRowIterator &Rows, const CString &sFilespec, DWORD dwFlags, CString *retsError, CAeonRateLimiter *pLimiter = NULL, const CAeonRangeDeletes *pRangeDeletes = NULL);
 		CDatum DebugDump (void) const;
 		inline DWORDLONG GetFileSize (void) { return m_Blocks.GetFileSize(); }
 		inline const CString &GetFilespec (void) const { return m_sFilespec; }
 		static bool GetInfo (const CString &sFilespec, SInfo *retInfo);
-		inline SEQUENCENUMBER GetSequence (void) { return m_Seq; }
+		bool GetRangeDeletes (CAeonRangeDeletes *retRangeDeletes) const;
 		inline DWORD GetViewID (void) { return m_pHeader->dwViewID; }
 		inline void MarkForDelete (void) { m_bMarkedForDelete = true; }
 		bool Open (const CString &sFilespec, CString *retsError);
+		void ReadAhead (int iBlock);
+		static void SetDefaultBlockSize (DWORD dwSize);
+		static inline void SetDefaultCodec (ECompressionTypes iCodec) { m_iDefaultCodec = iCodec; }
 		inline void SetDimensions (const CTableDimensions &Dims) { m_Dims = Dims; }
+		static bool Verify (const CString &sFilespec, CString *retsError);
 
 		//	IOrderedRowSet
 		virtual bool FindData (const CRowKey &Key, CDatum *retData, SEQUENCENUMBER *retRowID = NULL);
@@ -357,6 +910,7 @@ class CAeonSegment : public IOrderedRowSet
 		virtual CString GetKey (int iIndex);
 		virtual bool GetRow (int iIndex, CRowKey *retKey, CDatum *retData, SEQUENCENUMBER *retRowID = NULL);
 		virtual DWORD GetRowSize (int iIndex);
+		virtual SEQUENCENUMBER GetSequence (void) { return m_Seq; }
 		virtual void WriteData (IByteStream &Stream, int iIndex, DWORD *retdwSize = NULL, SEQUENCENUMBER *retRowID = NULL);
 
 	private:
@@ -371,8 +925,14 @@ class CAeonSegment : public IOrderedRowSet
 			DWORD dwRowCount;				//	Total rows in segment
 			DWORD dwViewID;					//	ViewID of segment
 			DWORD dwFlags;					//	Segment flags
-
-			DWORD dwSpare[6];
+			DWORD dwFilterOffset;			//	Offset to Bloom filter (0 = no filter)
+			DWORD dwFilterSize;				//	Size of Bloom filter
+			DWORD dwCodec;					//	ECompressionTypes for blocks (if FLAG_COMPRESSED_BLOCKS)
+			DWORD dwRestartInterval;		//	Full key every n rows (if FLAG_PREFIX_KEYS)
+			DWORD dwChecksumOffset;			//	Offset to block checksums (if FLAG_BLOCK_CHECKSUMS)
+			DWORD dwIndexChecksum;			//	CRC32C from index to end of file (if FLAG_BLOCK_CHECKSUMS)
+			DWORD dwRangeDeletesOffset;		//	Offset to range deletes (if FLAG_RANGE_DELETES)
+			DWORD dwRangeDeletesSize;		//	Size of range deletes (if FLAG_RANGE_DELETES)
 			};
 
 		struct SIndexEntry
@@ -411,6 +971,7 @@ class CAeonSegment : public IOrderedRowSet
 		bool BlockFindRow (SBlockHeader *pBlock, const CString &sKey, int *retiPos);
 		SBlockIndexEntry *BlockGetIndexEntry (SBlockHeader *pBlock, int iPos);
 		CString BlockGetKey (SBlockHeader *pBlock, int iPos);
+		inline DWORD *BlockGetPrefixKey (SBlockHeader *pBlock, int iPos) { return (DWORD *)(((char *)pBlock) + BlockGetIndexEntry(pBlock, iPos)->dwKeyOffset); }
 		void *BlockGetValue (SBlockHeader *pBlock, int iPos, SEQUENCENUMBER *retRowID = NULL);
 		bool Delete (void);
 		SIndexEntry *GetBlockByKey (const CString &sKey, int *retiPos = NULL);
@@ -418,10 +979,14 @@ class CAeonSegment : public IOrderedRowSet
 		inline SBlockIndexEntryExtra *GetBlockIndexEntryExtra (SBlockIndexEntry *pEntry) { return (SBlockIndexEntryExtra *)(&pEntry[1]); }
 		inline int GetBlockIndexEntrySize (void) { return (sizeof(SBlockIndexEntry) + (HasRowID() ? sizeof(SBlockIndexEntryExtra) : 0)); }
 		inline int GetIndexCount (void) const { return m_pHeader->dwIndexCount; }
+		inline int GetIndexPos (const SIndexEntry *pEntry) const { return (int)(pEntry - m_pIndex); }
 		inline SIndexEntry *GetIndexEntry (int iIndex) { ASSERT(iIndex >= 0 && iIndex < GetIndexCount()); return &m_pIndex[iIndex]; }
 		inline const SIndexEntry *GetIndexEntry (int iIndex) const { ASSERT(iIndex >= 0 && iIndex < GetIndexCount()); return &m_pIndex[iIndex]; }
+		inline bool HasPrefixKeys (void) const { return ((m_pHeader->dwFlags & FLAG_PREFIX_KEYS) ? true : false); }
 		inline bool HasRowID (void) { return ((m_pHeader->dwFlags & FLAG_HAS_ROW_ID) ? true : false); }
 		CString IndexGetKey (const SIndexEntry *pIndex) const;
+		void OnBlockAccess (int iBlock);
+		static void SerializePrefixKey (IByteStream &Stream, const CString &sKey, const CString &sPrevKey, DWORD *retdwSize);
 
 		CCriticalSection m_cs;
 		CString m_sFilespec;				//	Filespec backing this segment
@@ -431,9 +996,48 @@ class CAeonSegment : public IOrderedRowSet
 
 		SSegmentHeader *m_pHeader;			//	Loaded header
 		SIndexEntry *m_pIndex;				//	Loaded index
+		CSegmentBloomFilter m_Filter;		//	Filter of keys (may be empty)
 		CSegmentBlockCache m_Blocks;		//	Cached blocks
+		CString m_sRangeDeletes;			//	Serialized range deletes (may be empty)
 
 		bool m_bMarkedForDelete;			//	If TRUE, delete on final release
+
+		int m_iReadFrontier;				//	Highest block read in the current run
+		int m_iSequentialBlocks;			//	Blocks read in order so far
+		int m_iReadAheadEnd;				//	Blocks before this have been requested
+
+		static ECompressionTypes m_iDefaultCodec;	//	Codec for new segments
+		static DWORD m_dwDefaultBlockSize;			//	Block size target for new segments
+	};
+
+//	CAeonChunkStore
+//
+//	The contents of files in a file table are stored as content-defined chunks
+//	in the table's files directory, named by their SHA-256 hash. The fileDesc
+//	lists the chunks in order, so identical runs of data (across versions of a
+//	file or across paths) are stored once.
+
+class CAeonChunkStore
+	{
+	public:
+		struct SChunk
+			{
+			CString sHash;					//	SHA-256 (hex)
+			DWORD dwSize;					//	Size in bytes
+			};
+
+		static CDatum AsDatum (const TArray<SChunk> &Chunks);
+		static CString GetChunkFilename (const CString &sHash);
+		static DWORDLONG GetFileSize (const TArray<SChunk> &Chunks);
+		static bool IsChunkFilename (const CString &sFilename);
+		static bool ParseChunks (CDatum dChunks, TArray<SChunk> *retChunks);
+		static bool ReadChunks (const CString &sTablePath, const TArray<SChunk> &Chunks, int iPos, int iMaxSize, CDatum *retdData, CString *retsError);
+		static bool StoreFile (const CString &sFilespec, const CString &sTablePath, const CString &sBackupTablePath, TArray<SChunk> *retChunks, bool *retbBackupFailed, CString *retsError);
+		static bool WriteFile (const CString &sTablePath, const TArray<SChunk> &Chunks, const CString &sFilespec, CString *retsError);
+
+	private:
+		static int FindBoundary (const BYTE *pData, int iLength);
+		static bool WriteChunk (const CString &sTablePath, const CString &sHash, const void *pData, int iLength, CString *retsError);
 	};
 
 //	CAeonUploadSessions
@@ -455,6 +1059,7 @@ class CAeonUploadSessions
 			{
 			int iComplete;					//	% complete
 			CString sError;					//	Error (if ProcessUpload returns false)
+			bool bBackupFailed;				//	Unable to write the backup copy of the upload
 
 			//	If 100% complete
 			CString sFilePath;				//	File path
@@ -469,6 +1074,7 @@ class CAeonUploadSessions
 		~CAeonUploadSessions (void);
 
 		void AbortUpload (const SReceipt &Receipt);
+		bool HasSession (const CString &sSessionID);
 		inline void Init (CMachineStorage *pStorage, const CString &sTableName, const CString &sPrimaryVolume, const CString &sBackupVolume) { m_pStorage = pStorage; m_sTableName = sTableName; m_sPrimaryVolume = sPrimaryVolume; m_sBackupVolume = sBackupVolume; }
 		void Mark (void);
 		bool ProcessUpload (CMsgProcessCtx &Ctx, const CString &sSessionID, const CString &sFilePath, CDatum dUploadDesc, CDatum dData, const CString &sCurrentFilespec, SReceipt *retReceipt);
@@ -500,7 +1106,7 @@ class CAeonUploadSessions
 			};
 
 		int CalcUploadCompletion (SUploadSessionCtx *pSession);
-		bool CreateTempFile (CString *retsFilespec, CFileMultiplexer *retFile, CString *retsError);
+		bool CreateTempFile (CString *retsFilespec, CFileMultiplexer *retFile, bool *retbMirrorFailed, CString *retsError);
 		void Delete (const CString &sSessionID);
 		void DeleteTempFile (SUploadSessionCtx *pSession);
 		void DeleteTempFile (SUploadSessionCtx *pSession, CFileMultiplexer *pFile);
@@ -514,6 +1120,121 @@ class CAeonUploadSessions
 		TSortMap<CString, SUploadSessionCtx *> m_Sessions;
 	};
 
+//	ICompactionPolicy
+//
+//	Decides which segments of a view to merge. Segments are passed in order
+//	from newest to oldest; we may only merge a contiguous run of them
+//	(otherwise the merged segment would hide rows in newer segments that we
+//	skipped).
+
+class ICompactionPolicy
+	{
+	public:
+		enum ETypes
+			{
+			typeSizeTiered,					//	Merge runs of similarly-sized segments
+			typeLeveled,					//	Merge newer segments into older ones at the same level
+			};
+
+		virtual ~ICompactionPolicy (void) { }
+
+		virtual bool SelectSegments (const TArray<DWORDLONG> &SegSizes, DWORDLONG dwMaxSize, int *retiStart, int *retiCount) const = 0;
+
+		static const ICompactionPolicy &Get (ETypes iType);
+		static const CString &GetTypeID (ETypes iType);
+		static bool ParseTypeID (const CString &sType, ETypes *retiType);
+	};
+
+class CLeveledCompaction : public ICompactionPolicy
+	{
+	public:
+		virtual bool SelectSegments (const TArray<DWORDLONG> &SegSizes, DWORDLONG dwMaxSize, int *retiStart, int *retiCount) const override;
+
+	private:
+		static int GetLevel (DWORDLONG dwSize);
+	};
+
+class CSizeTieredCompaction : public ICompactionPolicy
+	{
+	public:
+		virtual bool SelectSegments (const TArray<DWORDLONG> &SegSizes, DWORDLONG dwMaxSize, int *retiStart, int *retiCount) const override;
+	};
+
+//	CAeonRateLimiter
+//
+//	Limits the rate of background I/O (e.g., compaction) across threads.
+
+class CAeonRateLimiter
+	{
+	public:
+		CAeonRateLimiter (void) : m_dwBytesPerSecond(0), m_iAvailable(0), m_dwLastRefill(0) { }
+
+		void Consume (DWORD dwBytes);
+		inline DWORD GetRate (void) const { return m_dwBytesPerSecond; }
+		void SetRate (DWORD dwBytesPerSecond);
+
+	private:
+		CCriticalSection m_cs;
+		DWORD m_dwBytesPerSecond;			//	0 = unlimited
+		LONGLONG m_iAvailable;				//	Bytes we can write now (may be negative)
+		DWORD m_dwLastRefill;				//	Tick when we last added to m_iAvailable
+	};
+
+//	CAeonRowCache
+//
+//	Caches decoded rows of a table's primary view. Callers must hold the table
+//	lock. Cached values are shared, so callers must not modify them.
+
+class CAeonRowCache
+	{
+	public:
+		struct SKey
+			{
+			CString sKey;					//	Encoded row key (may contain NULs)
+			};
+
+		CAeonRowCache (void) :
+				m_dwMaxSize(0),
+				m_dwSize(0),
+				m_iClock(0),
+				m_dwHits(0),
+				m_dwMisses(0)
+			{ }
+
+		CDatum DebugDump (void) const;
+		void DeleteAll (void);
+		bool Find (const CRowKey &Path, CDatum *retData, SEQUENCENUMBER *retRowID);
+		inline DWORD GetMaxSize (void) const { return m_dwMaxSize; }
+		void Insert (const CRowKey &Path, CDatum dData, SEQUENCENUMBER RowID);
+		void Invalidate (const CRowKey &Path);
+		inline bool IsEnabled (void) const { return (m_dwMaxSize > 0); }
+		void Mark (void);
+		void SetMaxSize (DWORD dwMaxSize);
+
+		static int CompareKeys (const SKey &Key1, const SKey &Key2);
+
+	private:
+		struct SEntry
+			{
+			CDatum dData;					//	Decoded row (Nil if row not found)
+			SEQUENCENUMBER RowID;
+			DWORD dwSize;					//	Approximate memory used by entry
+			bool bReferenced;				//	Accessed since the clock last passed
+			};
+
+		static DWORD CalcDatumSize (CDatum dData);
+		void Evict (DWORD dwSizeNeeded);
+
+		TSortMap<SKey, SEntry> m_Entries;
+		DWORD m_dwMaxSize;					//	Max bytes to cache (0 = disabled)
+		DWORD m_dwSize;						//	Current bytes cached
+		int m_iClock;						//	Next entry to consider for eviction
+		DWORDLONG m_dwHits;
+		DWORDLONG m_dwMisses;
+	};
+
+inline int KeyCompare (const CAeonRowCache::SKey &Key1, const CAeonRowCache::SKey &Key2) { return CAeonRowCache::CompareKeys(Key1, Key2); }
+
 //	CAeonView
 
 class CAeonView
@@ -530,20 +1251,34 @@ class CAeonView
 
 		CAeonView &operator= (const CAeonView &Obj) { CleanUp(); Copy(Obj); return *this; }
 
+		inline void AddLookupStats (int iProbes) { m_dwLookups++; m_dwLookupProbes += iProbes; }
+		void AddToAggregates (CHexeProcess &Process, CDatum dFullData, TSortMap<CString, CDatum> *ioGroups);
 		bool CanInsert (const CRowKey &Path, CDatum dData, CString *retsError);
+		inline bool CanLogRangeDeletes (void) const { return m_Recovery.CanInsertRangeDelete(); }
 		void CloseRecovery (void);
 		void CloseSegments (bool bMarkForDelete = false);
+		void CreateAggregateRows (const TSortMap<CString, CDatum> &Groups, CAeonRowArray *Rows);
 		bool CreateSecondaryRows (const CTableDimensions &PrimaryDims, CHexeProcess &Process, const CRowKey &PrimaryKey, CDatum dFullData, SEQUENCENUMBER RowID, CAeonRowArray *Rows);
 		bool CreateSegment (const CString &sFilespec, SEQUENCENUMBER Seq, IOrderedRowSet *pRows, CAeonSegment **retpNewSeg, CString *retsError);
 		CDatum DebugDump (void) const;
-		bool GetData (const CRowKey &Path, CDatum *retData, SEQUENCENUMBER *retRowID, CString *retsError);
+		void DeleteRange (const CRowKey &From, const CRowKey &To, SEQUENCENUMBER Seq, bool *retbRecoveryFailed, CString *retsError = NULL);
+		inline bool FlushRecovery (CString *retsError = NULL) { return m_Recovery.Flush(retsError); }
 		inline const CTableDimensions &GetDimensions (void) { return m_Dims; }
+		inline const CAeonRowExpiration &GetExpiration (void) const { return m_Expiration; }
 		inline DWORD GetID (void) { return m_dwID; }
+		inline const CAeonRangeDeletes &GetRangeDeletes (void) const { return m_RangeDeletes; }
+		inline DWORD GetMemoryUsed (void) { return m_pRows->GetMemoryUsed(); }
 		inline const CString &GetName (void) { return m_sName; }
+		inline void GetRecoveryCommitPoint (CRowInsertLog::SCommitPoint *retCommit) { m_Recovery.GetCommitPoint(retCommit); }
 		inline DWORD GetRecoveryFileVersion (void) { return m_Recovery.GetVersion(); }
+		inline const CString &GetRecoveryFilespec (void) const { return m_Recovery.GetFilespec(); }
+		inline DWORD GetRecoveryResetCount (void) const { return m_dwRecoveryResets; }
 		inline const CAeonSegment &GetSegment (int iIndex) const { return *m_Segments[iIndex]; }
+		inline CAeonSegment &GetSegment (int iIndex) { return *m_Segments[iIndex]; }
 		inline int GetSegmentCount (void) { return m_Segments.GetCount(); }
-		bool GetSegmentsToMerge (CAeonSegment **retpSeg1, CAeonSegment **retpSeg2);
+		DWORDLONG GetSegmentRowCount (void) const;
+		bool GetSegmentsToMerge (const ICompactionPolicy &Policy, TArray<CAeonSegment *> *retSegs, bool *retbIncludesOldest = NULL);
+		void GetSplitKeys (int iParts, TArray<CRowKey> *retKeys) const;
 		inline int GetUpdateCount (void) { return m_pRows->GetUpdateCount(); }
 		inline bool HasRowID (void) { return !IsSecondaryView(); }
 		inline bool HasUnsavedRows (void) { return (m_pRows->GetCount() > 0); }
@@ -551,28 +1286,57 @@ class CAeonView
 		bool InitAsPrimaryView (CDatum dDesc, const CString &sRecoveryFilespec, int *retiRowsRecovered, CString *retsError);
 		bool InitAsSecondaryView (CDatum dDesc, CHexeProcess &Process, const CString &sRecoveryFilespec, bool bForceUpdate, CString *retsError);
 		bool InitIterator (CRowIterator *retIterator, DWORD dwFlags = 0);
-		void Insert (const CTableDimensions &PrimaryDims, CHexeProcess &Process, const CRowKey &PrimaryKey, CDatum dData, CDatum dOldData, SEQUENCENUMBER RowID, bool *retbRecoveryFailed, CString *retsError = NULL);
+		void Insert (CAeonView &PrimaryView, CHexeProcess &Process, const CRowKey &PrimaryKey, CDatum dData, CDatum dOldData, SEQUENCENUMBER RowID, bool *retbRecoveryFailed, CString *retsError = NULL);
 		inline void InsertSegment (CAeonSegment *pSeg) { pSeg->SetDimensions(m_Dims); m_Segments.Insert(pSeg->GetSequence(), pSeg); }
-		inline bool IsSecondaryView (void) { return (m_Keys.GetCount() > 0); }
-		inline bool IsUpToDate (void) { return !m_bUpdateNeeded; }
+		inline bool IsAggregateView (void) const { return m_bAggregate; }
+		inline bool IsFullTextView (void) const { return m_bFullText; }
+		inline bool IsSecondaryView (void) { return (m_Keys.GetCount() > 0 || m_bFullText); }
+		inline bool IsUpToDate (void) const { return !m_bUpdateNeeded; }
 		inline bool IsValid (void) const { return !m_bInvalid; }
 		bool LoadRecoveryFile (const CString &sRecoveryFilespec, CAeonRowArray **retpRows, int *retiRowsRecovered, CString *retsError);
 		void Mark (void);
-		void SegmentMergeComplete (CAeonSegment *pSeg1, CAeonSegment *pSeg2, CAeonSegment *pNewSeg);
+		void OpenSnapshot (CAeonViewSnapshot *retSnapshot);
+		void SegmentMergeComplete (const TArray<CAeonSegment *> &Merged, CAeonSegment *pNewSeg);
 		void SegmentSaveComplete (CAeonSegment *pSeg);
+		void SetExpiration (const CAeonRowExpiration &Expiration);
 		inline void SetID (DWORD dwID) { m_dwID = dwID; }
 		void SetUnsavedRows (CAeonRowArray *pRows);
 		inline void SetUpToDate (void) { m_bUpdateNeeded = false; }
+		void UpdateRangeDeletes (void);
 		void WriteDesc (CComplexStruct *pDesc);
+		inline bool WriteTornRecoveryRecordTest (CString *retsError) { return m_Recovery.WriteTornRecordTest(retsError); }
 
 	private:
+		enum EAggregateOps
+			{
+			aggCount,						//	Number of rows with a non-nil value
+			aggSum,
+			aggMin,
+			aggMax,
+			};
+
+		struct SAggregateColumn
+			{
+			CString sName;					//	Column in the view
+			EAggregateOps iOp;
+			CString sField;					//	Field in the primary row
+			};
+
 		void CleanUp (void);
 		CDatum ComputeColumns (CHexeProcess &Process, CDatum dRowData);
 		void Copy (const CAeonView &Src);
 		void CreatePermutedKeys (const TArray<CDatum> &KeyData, int iDim, const TArray<CDatum> &PrevKey, SEQUENCENUMBER RowID, TArray<CRowKey> *retKeys);
 		void CreateSecondaryData (const CTableDimensions &PrimaryDims, const CRowKey &PrimaryKey, CDatum dFullData, SEQUENCENUMBER RowID, CDatum *retdData);
 		bool CreateSecondaryKeys (CHexeProcess &Process, CDatum dData, SEQUENCENUMBER RowID, TArray<CRowKey> *retKeys);
+		bool CreateSecondaryRowData (const CTableDimensions &PrimaryDims, CHexeProcess &Process, const CRowKey &PrimaryKey, CDatum dFullData, SEQUENCENUMBER RowID, TArray<CRowKey> *retKeys, TArray<CDatum> *retData);
+		void CreateTextKeys (CDatum dData, SEQUENCENUMBER RowID, TArray<CRowKey> *retKeys, TArray<int> *retCounts = NULL);
+		CDatum FindAggregateRow (const CRowKey &Key);
+		bool InitAsAggregateView (CDatum dDesc, CString *retsError);
+		bool InitAsFullTextView (CDatum dDesc, CString *retsError);
 		bool InitRows (const CString &sRecoveryFilespec, int *retiRowsRecovered, CString *retsError);
+		void InsertAggregate (CAeonView &PrimaryView, CHexeProcess &Process, CDatum dData, CDatum dOldData, SEQUENCENUMBER RowID, bool *retbRecoveryFailed, CString *retsError);
+		CDatum RecomputeAggregateExtremes (CAeonView &PrimaryView, CHexeProcess &Process, const CRowKey &GroupKey, CDatum dGroup);
+		CDatum UpdateAggregateRow (CDatum dGroup, CDatum dData, int iDelta, bool *retbStale = NULL) const;
 
 		DWORD m_dwID;						//	ID of view
 		CString m_sName;					//	Name of view
@@ -581,7 +1345,10 @@ class CAeonView
 		CAeonRowArray *m_pRows;				//	Rows
 		TSortMap<SEQUENCENUMBER, CAeonSegment *> m_Segments;
 		CRowInsertLog m_Recovery;			//	Recovery file
+		DWORD m_dwRecoveryResets;			//	Number of times we've reset the recovery file
 		bool m_bInvalid;					//	If TRUE, view is not valid.
+		CAeonRowExpiration m_Expiration;	//	When rows expire (from the table's ttl)
+		CAeonRangeDeletes m_RangeDeletes;	//	From segments and rows (see UpdateRangeDeletes)
 
 		//	Used by secondary views only
 		TArray<CDatum> m_Keys;				//	Fields to use as keys (one for each dimension)
@@ -590,10 +1357,200 @@ class CAeonView
 		bool m_bExcludeNil;					//	If TRUE, rows with one or more nil keys are excluded
 		bool m_bUsesListKeys;				//	If TRUE, we use list keys, which means more work
 
+		//	Used by full-text views only
+		bool m_bFullText;					//	If TRUE, rows are keyed by term (see CAeonTextIndex)
+		TArray<CString> m_TextFields;		//	Fields to index
+
+		//	Used by aggregate views only
+		bool m_bAggregate;					//	If TRUE, there is one row per group (see InsertAggregate)
+		TArray<SAggregateColumn> m_Aggregates;
+
 		//	Used when updating a view
 		bool m_bUpdateNeeded;				//	If TRUE then we are updating the view
 											//	to add segments saved before the given
 											//	sequence number
+
+		//	Statistics
+		DWORDLONG m_dwBytesFlushed;			//	Bytes written saving in-memory rows
+		DWORDLONG m_dwBytesCompacted;		//	Bytes written merging segments
+		DWORDLONG m_dwLookups;				//	Number of calls to GetData
+		DWORDLONG m_dwLookupProbes;			//	Row sets searched by GetData
+	};
+
+//	CAeonViewSnapshot
+//
+//	The rows of a view as of a given point. We capture the snapshot inside the
+//	table lock (see CAeonView::OpenSnapshot) and then read from it without any
+//	lock; later inserts, saves, and merges don't affect it.
+
+class CAeonViewSnapshot
+	{
+	public:
+		CAeonViewSnapshot (void) : m_pRows(NULL), m_RowsSeq(0) { }
+		~CAeonViewSnapshot (void) { CleanUp(); }
+
+		void CleanUp (void);
+		bool FindData (const CRowKey &Path, CDatum *retData, SEQUENCENUMBER *retRowID, int *retiProbes, CString *retsError);
+		inline const CTableDimensions &GetDimensions (void) const { return m_Dims; }
+		void Init (const CTableDimensions &Dims, CAeonRowArray *pRows, const TSortMap<SEQUENCENUMBER, CAeonSegment *> &Segments, const CAeonRowExpiration &Expiration, const CAeonRangeDeletes &RangeDeletes);
+		bool InitIterator (CRowIterator *retIterator);
+
+	private:
+		CAeonViewSnapshot (const CAeonViewSnapshot &Src) { }
+		CAeonViewSnapshot &operator= (const CAeonViewSnapshot &Src) { return *this; }
+
+		CTableDimensions m_Dims;
+		CAeonRowArray *m_pRows;				//	In-memory rows
+		SEQUENCENUMBER m_RowsSeq;			//	Version of m_pRows that we see
+		TArray<CAeonSegment *> m_Segments;	//	Segments (most recent first)
+		CAeonRowExpiration m_Expiration;	//	Expired rows read as nil
+		CAeonRangeDeletes m_RangeDeletes;	//	Covered rows read as nil
+	};
+
+//	CAeonCursor
+//
+//	Reads rows out of a view in batches. The iterator works off a snapshot of
+//	the view (see CAeonTable::OpenCursor) so a cursor doesn't need the table
+//	(or its lock) after it is opened.
+
+class CAeonCursor
+	{
+	public:
+		CAeonCursor (void) : m_bIsSecondaryView(false), m_dwFlags(0), m_bKeyNotFound(false) { }
+
+		bool Fetch (int iMaxRows, DWORD dwMaxBytes, CDatum *retdResult, CString *retsError);
+		inline CHexeProcess &GetFilterProcess (void) { return m_FilterProcess; }
+		inline CRowIterator &GetIterator (void) { return m_Rows; }
+		inline bool HasMore (void) { return (!m_bKeyNotFound && m_Rows.HasMore()); }
+		void Init (const CTableDimensions &Dims, bool bIsSecondaryView, DWORD dwFlags, CDatum dFilterFunc, const TArray<CString> &Fields);
+		void Mark (void);
+		inline void SetKeyNotFound (void) { m_bKeyNotFound = true; }
+
+	private:
+		CAeonCursor (const CAeonCursor &Src) { }
+		CAeonCursor &operator= (const CAeonCursor &Src) { return *this; }
+
+		static CDatum ProjectRow (CDatum dData, const TArray<CString> &Fields);
+
+		CRowIterator m_Rows;
+		CTableDimensions m_Dims;
+		bool m_bIsSecondaryView;
+		DWORD m_dwFlags;					//	CAeonTable::FLAG_INCLUDE_KEY, etc.
+		bool m_bKeyNotFound;				//	Starting key not found; we return Nil
+
+		CHexeProcess m_FilterProcess;		//	Process to run the filter
+		CDatum m_dFilterFunc;				//	Row filter (may be Nil)
+		TArray<CString> m_Fields;			//	Fields to return (empty = all)
+	};
+
+//	CAeonCursors
+//
+//	Cursors opened by clients (Aeon.openCursor). Each cursor has a lease that
+//	is renewed on every fetch; we close cursors whose lease has expired.
+
+class CAeonCursors
+	{
+	public:
+		CAeonCursors (void) : m_dwNextID(1) { }
+		~CAeonCursors (void) { DeleteAll(); }
+
+		void Close (const CString &sCursorID);
+		void DeleteAll (void);
+		void DeleteExpired (void);
+		CAeonCursor *Lock (const CString &sCursorID, CString *retsTable, CString *retsError);
+		void Mark (void);
+		bool Open (const CString &sTable, CAeonCursor *pCursor, DWORD dwLease, CString *retsCursorID, CString *retsError);
+		void Unlock (const CString &sCursorID, bool bClose = false);
+
+	private:
+		struct SCursorCtx
+			{
+			CAeonCursor *pCursor;
+			CString sTable;					//	Table that we're reading
+			DWORD dwLease;					//	Lease time (milliseconds)
+			DWORD dwLastActivity;			//	Tick when we last fetched
+			bool bBusy;						//	TRUE if someone is fetching
+			bool bClosePending;				//	Close when we're no longer busy
+			};
+
+		CCriticalSection m_cs;
+		TSortMap<CString, SCursorCtx> m_Cursors;
+		DWORD m_dwNextID;
+	};
+
+//	CAeonTextIndex
+//
+//	Tokenizing and searching for full-text views. A full-text view is keyed by
+//	term and rowID, so the rows for a term form its posting list. Each row
+//	holds the view columns plus the number of times the term appears.
+
+class CAeonTextIndex
+	{
+	public:
+		struct STerm
+			{
+			CString sTerm;
+			bool bPrefix;					//	Match all terms that start with sTerm
+			};
+
+		struct SClause
+			{
+			TArray<STerm> Terms;			//	Rows must match all terms
+			};
+
+		static void AddTermCounts (const CString &sText, TSortMap<CString, int> *ioTerms);
+		static bool ParseQuery (const CString &sQuery, TArray<SClause> *retQuery, CString *retsError);
+		static void ParseTerms (const CString &sText, TArray<CString> *retTerms);
+		static bool Search (CAeonViewSnapshot &Snapshot, const TArray<SClause> &Query, DWORDLONG dwTotalRows, int iMaxResults, CDatum *retdResult, CString *retsError);
+
+	private:
+		struct SHit
+			{
+			SHit (void) : rScore(0.0) { }
+
+			CDatum dData;					//	Row in the view
+			double rScore;
+			};
+
+		static bool FindTerm (CRowIterator &Rows, const CTableDimensions &Dims, const STerm &Term, DWORDLONG dwTotalRows, TSortMap<SEQUENCENUMBER, SHit> *retHits, CString *retsError);
+		static void ScorePostings (const TArray<SEQUENCENUMBER> &RowIDs, const TArray<CDatum> &Data, DWORDLONG dwTotalRows, TSortMap<SEQUENCENUMBER, SHit> *retHits);
+	};
+
+//	CAeonBackupManifest
+//
+//	The list of files that we've copied to a backup volume (with sizes and
+//	checksums). Backups use it to skip files that are already there; restores
+//	use it to check that the files are intact. Filenames are relative to the
+//	table path (e.g., "segments\\0000012a_3f1c.aseg").
+
+class CAeonBackupManifest
+	{
+	public:
+		struct SEntry
+			{
+			DWORDLONG dwSize;
+			DWORD dwChecksum;				//	CRC32C of file contents
+			};
+
+		CAeonBackupManifest (void) : m_bModified(false) { }
+
+		inline void Delete (const CString &sFile) { if (m_Files.GetAt(sFile)) { m_Files.DeleteAt(sFile); m_bModified = true; } }
+		inline void DeleteAll (void) { m_Files.DeleteAll(); m_bModified = true; }
+		void DeleteMissing (const CString &sDir, const TArray<CString> &Files);
+		inline const SEntry *Find (const CString &sFile) const { return m_Files.GetAt(sFile); }
+		inline int GetCount (void) const { return m_Files.GetCount(); }
+		inline bool IsModified (void) const { return m_bModified; }
+		bool Load (const CString &sFilespec, CString *retsError);
+		bool Save (const CString &sFilespec, CString *retsError);
+		bool SetFile (const CString &sTablePath, const CString &sFile, CString *retsError = NULL);
+		void SetFile (const CString &sFile, DWORDLONG dwSize, DWORD dwChecksum);
+		bool Verify (const CString &sTablePath, TArray<CString> *retBadFiles) const;
+
+		static bool CalcChecksum (const CString &sFilespec, DWORD *retdwChecksum, DWORDLONG *retdwSize = NULL, CString *retsError = NULL);
+
+	private:
+		TSortMap<CString, SEntry> m_Files;
+		bool m_bModified;					//	TRUE if we need to save
 	};
 
 //	CAeonTable
@@ -633,12 +1590,46 @@ class CAeonTable
 			typeFile,						//	A table for storing large files.
 			};
 
+		struct SViewUpdateRun
+			{
+			CAeonSegment *pSeg;
+			CString sBackup;
+			};
+
+		struct SViewUpdateRange
+			{
+			SViewUpdateRange (void) : dwViewID(0), pView(NULL), bHasEndKey(false), bSuccess(true) { }
+
+			DWORD dwViewID;					//	Secondary view to update
+			CAeonView *pView;				//	Secondary view
+			CTableDimensions PrimaryDims;	//	Dimensions of primary view
+			CRowIterator Rows;				//	Primary rows, positioned at start of range
+			CRowKey EndKey;					//	First primary key NOT in range
+			bool bHasEndKey;				//	If FALSE, range goes to the end
+
+			TArray<SViewUpdateRun> Runs;	//	Sorted runs of secondary rows
+			bool bSuccess;					//	FALSE if we failed to write a run
+			CString sFailedFilespec;		//	Run that failed
+			CString sError;
+			};
+
+		struct SScrubRange
+			{
+			SScrubRange (void) : iNext(0) { }
+
+			TArray<CString> Files;			//	Segment files to verify
+			TArray<CString> Errors;			//	Error for each file (empty = OK)
+			volatile LONG iNext;			//	Next file for a worker to verify
+			};
+
 		CAeonTable (void);
 		~CAeonTable (void);
 
+		bool Compact (CAeonRateLimiter &Limiter);
 		bool Create (IArchonProcessCtx *pProcess, CMachineStorage *pStorage, CDatum dDesc, CString *retsError);
 		bool DebugDumpView (DWORD dwViewID, CDatum *retdResult) const;
 		bool Delete (void);
+		bool DeleteRange (CDatum dFrom, CDatum dTo, CString *retsError);
 		bool DeleteView (DWORD dwViewID, CString *retsError);
 		bool FileDirectory (const CString &sDirKey, CDatum dRequestedFields, CDatum dOptions, CDatum *retResult, CString *retsError);
 		bool FindView (const CString &sView, DWORD *retdwViewID);
@@ -649,24 +1640,33 @@ class CAeonTable
 		bool GetFileDesc (const CString &sFilePath, CDatum *retdFileDesc, CString *retsError);
 		bool GetKeyRange (int iCount, CDatum *retdResult, CString *retsError);
 		inline const CString &GetName (void) { return m_sName; }
-		bool GetRows (DWORD dwViewID, CDatum dLastKey, int iRowCount, const TArray<int> &Limits, DWORD dwFlags, CDatum *retdResult, CString *retsError);
+		bool GetRows (DWORD dwViewID, CDatum dLastKey, int iRowCount, const TArray<int> &Limits, DWORD dwFlags, CDatum dFilter, const TArray<CString> &Fields, CDatum *retdResult, CString *retsError);
+		inline int GetRowsRecovered (void) const { return m_iRowsRecovered; }
 		inline Types GetType (void) const { return m_iType; }
-		bool GetViewStatus (DWORD dwViewID, bool *retbUpToDate, CString *retsError);
+		bool GetViewStatus (DWORD dwViewID, bool *retbUpToDate, CString *retsError, int *retiProgress = NULL);
 		inline bool HasSecondaryViews (void) { return (m_Views.GetCount() > 1); }
 		bool Housekeeping (DWORD dwMaxMemoryUse);
 		bool InitIterator (DWORD dwViewID, CRowIterator *retIterator, CTableDimensions *retDims = NULL, CString *retsError = NULL);
 		AEONERR Insert (const CRowKey &Path, CDatum dData, bool bInsertNew, CString *retsError);
 		inline bool Insert (const CRowKey &Path, CDatum dData, CString *retsError) { return (Insert(Path, dData, false, retsError) == AEONERR_OK); }
+		AEONERR InsertMany (const TArray<CRowKey> &Paths, const TArray<CDatum> &Data, bool bInsertNew, CString *retsError);
 		void Mark (void);
 		AEONERR Mutate (const CRowKey &Path, CDatum dData, CDatum dMutateDesc, CDatum *retdResult, CString *retsError);
+		AEONERR MutateMany (const TArray<CRowKey> &Paths, const TArray<CDatum> &Data, const TArray<CDatum> &MutateDescs, TArray<CDatum> *retResults, CString *retsError);
 		bool OnVolumesChanged (const TArray<CString> &VolumesDeleted);
 		bool Open (IArchonProcessCtx *pProcess, CMachineStorage *pStorage, const CString &sName, const TArray<CString> &Volumes, CString *retsError);
+		bool OpenCursor (DWORD dwViewID, CDatum dLastKey, const TArray<int> &Limits, DWORD dwFlags, CDatum dFilter, const TArray<CString> &Fields, CAeonCursor *retCursor, CString *retsError);
 		bool ParseDimensionPath (const CString &sView, CDatum dPath, CRowKey *retPath, CString *retsError);
 		bool ParseDimensionPathForCreate (CDatum dPath, CRowKey *retPath, CString *retsError);
 		bool RecoverTableRows (CString *retsError);
 		bool Recreate (IArchonProcessCtx *pProcess, CDatum dDesc, bool *retbUpdated, CString *retsError);
 		bool Save (CString *retsError);
+		void ScrubSegments (SScrubRange &Scrub);
+		bool ScrubTest (int *retiBadFiles, CString *retsError);
+		bool SearchText (DWORD dwViewID, const CString &sQuery, int iMaxResults, CDatum *retdResult, CString *retsError);
+		void UpdateViewRange (SViewUpdateRange &Range);
 		AEONERR UploadFile (CMsgProcessCtx &Ctx, const CString &sSessionID, const CString &sFilePath, CDatum dUploadDesc, CDatum dData, int *retiComplete, CString *retsError);
+		bool WriteTornRecoveryRecordTest (CString *retsError);
 
 		static CDatum GetDimensionDesc (SDimensionDesc &Dim);
 		static CDatum GetDimensionDescForSecondaryView (SDimensionDesc &Dim, CDatum dKey);
@@ -677,6 +1677,7 @@ class CAeonTable
 		static bool ParseFilePath (const CString &sPath, CString *retsTable, CString *retsFilePath, CString *retsError);
 		static bool ParseFilePathForCreate (const CString &sPath, CString *retsTable, CString *retsFilePath, CString *retsError);
 		static CDatum PrepareFileDesc (const CString &sTable, const CString &sFilePath, CDatum dFileDesc, bool bTranspace = false);
+		static void SetViewUpdateThreads (int iMaxThreads, DWORDLONG dwMinRowsPerThread);
 		static bool ValidateTableName (const CString &sName);
 
 	private:
@@ -684,20 +1685,35 @@ class CAeonTable
 			{
 			stateReady,						//	We are ready for housekeeping
 			stateCreatingSegment,			//	We are saving out a new segment
-			stateMergingSegments,			//	We are merging two segments.
 			stateBackup,					//	We are creating a backup.
 			stateRestore,					//	We are restoring the primary from backup.
 			stateUpdatingView,				//	We are updating a newly created secondary view.
+			stateScrubbing,					//	We are verifying segment checksums.
+			stateSweepingChunks,			//	We are deleting unused file chunks.
 			};
 
+		struct SLogBackup
+			{
+			DWORD dwViewID;
+			CString sFilespec;				//	Recovery log on primary volume
+			DWORD dwResets;					//	View's reset count when we copied
+			DWORDLONG dwCopied;				//	Bytes copied to the backup so far
+			};
+
+		void BackupRecoveryLogs (void);
+		bool BackupSegment (const CString &sFilespec, const CString &sBackup);
+		void BeginChunkWrite (CSmartLock &Lock);
 		void CloseSegments (bool bMarkForDelete = false);
 		void CollectGarbage (void);
-		bool CopyDirectory (const CString &sFromPath, const CString &sToPath, CString *retsError);
-		bool CopyVolume (const CString &sFrom, const CString &sTo, CString *retsError);
+		bool CommitRecovery (CSmartLock &Lock, const CString &sOp, CString *retsError);
+		bool CompleteWrite (CSmartLock &Lock, const CString &sOp, bool bLogFailed, CString *retsError);
+		bool CopyDirectory (const CString &sFromTablePath, const CString &sToTablePath, const CString &sDir, CAeonBackupManifest *ioManifest, CString *retsError);
+		bool CopyVolume (const CString &sFrom, const CString &sTo, CAeonBackupManifest *retManifest, CString *retsError);
 		bool Create (const CString &sVolume, CDatum dDesc, CString *retsError);
 		bool CreateCoreDirectories (const CString &sVolume, CDatum dDesc, CString *retsTablePath, CString *retsError);
 		bool CreatePrimaryKey (const CTableDimensions &Dims, CDatum dMutateDesc, SEQUENCENUMBER RowID, CRowKey *retKey, CString *retsError);
 		bool Delete (const CString &sVolume);
+		bool DeleteSegmentBackup (const CString &sBackup);
 		bool DiffDesc (CDatum dDesc, TArray<CDatum> *retNewViews, CString *retsError);
 		bool FindTableVolumes (TArray<CString> *retVolumes);
 		bool FindView (const CString &sView, CAeonView **retpView);
@@ -708,21 +1724,32 @@ class CAeonTable
 		CString GetTableFilenamePrefix (void);
 		bool GetTablePath (const CString &sVolume, CString *retsTablePath, CString *retsError);
 		CString GetUniqueSegmentFilespec (CString *retsBackup);
+		int GetViewUpdateProgress (DWORD dwViewID) const;
 		SEQUENCENUMBER GetVolumeSeq (const CString &sVolume);
 		bool Init (const CString &sTablePath, CDatum dDesc, CString *retsError);
+		AEONERR InsertRow (const CRowKey &Path, CDatum dData, bool bInsertNew, bool *retbLogFailed, CString *retsError);
+		bool MergeViewUpdateRuns (DWORD dwViewID, const CTableDimensions &Dims, TArray<SViewUpdateRun> &Runs, TArray<SViewUpdateRun> *retSegments, CString *retsError);
 		bool MoveToScrap (const CString &sFilespec);
+		AEONERR MutateRow (const CRowKey &Path, CDatum dData, CDatum dMutateDesc, CDatum *retdResult, bool *retbLogFailed, CString *retsError);
 		bool OpenDesc (const CString &sFilespec, CDatum *retdDesc, CString *retsError);
 		bool OpenSegments (const CString &sVolume, SEQUENCENUMBER *retHighSeq, CString *retsError);
 		bool ParseTableType (const CString &sType, Types *retiType, CString *retsError);
 		bool RecoveryBackup (void);
 		bool RecoveryFailure (void);
 		bool RecoveryRestore (void);
-		bool RepairFromBackup (const TArray<CString> &Volumes, CString *retsError);
+		bool RepairFromBackup (DWORD dwViewID, CAeonSegment *pSeg, const CString &sBackup, CString *retsError);
 		bool RowExists (const CTableDimensions &Dims, CDatum dKey);
 		bool SaveDesc (void);
 		bool SaveDesc (CDatum dDesc, const CString &sFilespec, CString *retsError);
+		void ScrapUploadFile (const CString &sFilespec);
+		int Scrub (CSmartLock &Lock);
+		void SweepChunks (CSmartLock &Lock);
 		bool ValidateVolume (const CString &sVolume, CString *retsError) const;
+		bool VerifyBackup (const CString &sTablePath, const CAeonBackupManifest &Manifest);
+		bool WriteViewUpdateRun (SViewUpdateRange &Range, CAeonRowArray &Rows);
 
+		static bool CompileRowFilter (CHexeProcess &Process, CDatum dFilter, CDatum *retdFunc, CString *retsError);
+		static bool CopyLogTail (const CString &sFrom, const CString &sTo, DWORDLONG *iodwCopied, CString *retsError);
 		static CDatum GetDimensionPathElement (EKeyTypes iKeyType, char **iopPos, char *pPosEnd);
 		static void SetDimensionDesc (CComplexStruct *pDesc, const SDimensionDesc &Dim);
 
@@ -742,12 +1769,95 @@ class CAeonTable
 		bool m_bBackupLost;					//	If TRUE the backup volume is invalid or missing.
 		bool m_bBackupNeeded;				//	If TRUE back volume is there, but empty (or invalid)
 		bool m_bValidateBackup;				//	If TRUE validate the backup on next housekeeping.
+		CAeonBackupManifest m_BackupManifest;	//	Files that we've copied to the backup volume
+		TSortMap<DWORD, SLogBackup> m_LogBackup;	//	Recovery logs copied to the backup volume
+		bool m_bCopyingLogs;				//	If TRUE, a thread is copying recovery logs to the backup.
+		DWORD m_dwLastScrub;				//	Tick when we last verified segment checksums
+		DWORD m_dwLastCheckpoint;			//	Tick when we last saved in-memory rows
+		DWORD m_dwLastChunkSweep;			//	Tick when we last deleted unused file chunks
+		int m_iChunkUsers;					//	Threads reading/writing chunks (SweepChunks skips if any)
 
 		EHousekeepingState m_iHousekeeping;	//	If not stateReady then we are busy doing something.
+		ICompactionPolicy::ETypes m_iCompaction;	//	Policy for merging segments
+		bool m_bCompacting;					//	If TRUE, a compaction thread is merging segments.
+		DWORD m_dwViewUpdateID;				//	Secondary view being rebuilt (0 = none)
+		DWORDLONG m_dwViewUpdateTotal;		//	Primary rows to process (approximate)
+		DWORDLONG m_dwViewUpdateDone;		//	Primary rows processed so far
+		SEQUENCENUMBER m_ViewUpdateRunSeq;	//	Sequence numbers for temporary runs
 		CAeonUploadSessions m_UploadSessions;
+		CAeonRowCache m_RowCache;			//	Decoded rows from primary view
+		CAeonRowExpiration m_Expiration;	//	When rows expire (ttl)
 		int m_iRowsRecovered;				//	Number of rows recovered on open.
 
 		CHexeProcess m_Process;				//	Hexe process for evaluation
+
+		static int m_iMaxViewUpdateThreads;	//	Most threads used to rebuild a view
+		static DWORDLONG m_dwMinRowsPerViewUpdateThread;	//	Primary rows needed per thread
+	};
+
+class CAeonEngine;
+
+class CAeonCompactionThread : public TThread<CAeonCompactionThread>
+	{
+	public:
+		CAeonCompactionThread (CAeonEngine *pEngine) : m_pEngine(pEngine) { }
+
+		void Run (void);
+
+	private:
+		CAeonEngine *m_pEngine;
+	};
+
+struct SAeonOpenTableRange
+	{
+	struct STable
+		{
+		CString sName;
+		TArray<CString> Volumes;			//	Volumes that have the table
+
+		CAeonTable *pTable = NULL;			//	Opened table (NULL if error)
+		CString sError;
+		DWORD dwTime = 0;					//	Milliseconds to open
+		};
+
+	TArray<STable> Tables;
+	volatile LONG iNext = 0;				//	Next table for a worker to open
+	};
+
+class CAeonOpenTableThread : public TThread<CAeonOpenTableThread>
+	{
+	public:
+		CAeonOpenTableThread (CAeonEngine *pEngine, SAeonOpenTableRange *pRange) : m_pEngine(pEngine), m_pRange(pRange) { }
+
+		void Run (void);
+
+	private:
+		CAeonEngine *m_pEngine;
+		SAeonOpenTableRange *m_pRange;
+	};
+
+class CAeonScrubThread : public TThread<CAeonScrubThread>
+	{
+	public:
+		CAeonScrubThread (CAeonTable *pTable, CAeonTable::SScrubRange *pScrub) : m_pTable(pTable), m_pScrub(pScrub) { }
+
+		void Run (void);
+
+	private:
+		CAeonTable *m_pTable;
+		CAeonTable::SScrubRange *m_pScrub;
+	};
+
+class CAeonViewUpdateThread : public TThread<CAeonViewUpdateThread>
+	{
+	public:
+		CAeonViewUpdateThread (CAeonTable *pTable, CAeonTable::SViewUpdateRange *pRange) : m_pTable(pTable), m_pRange(pRange) { }
+
+		void Run (void);
+
+	private:
+		CAeonTable *m_pTable;
+		CAeonTable::SViewUpdateRange *m_pRange;
 	};
 
 class CAeonEngine : public TSimpleEngine<CAeonEngine>
@@ -756,7 +1866,10 @@ class CAeonEngine : public TSimpleEngine<CAeonEngine>
 		CAeonEngine (void);
 		virtual ~CAeonEngine (void);
 
+		void CompactTables (void);
+		inline CManualEvent &GetCompactionQuitEvent (void) { return m_CompactionQuit; }
 		bool GetViewStatus (const CString &sTable, DWORD dwViewID, bool *retbUpToDate, CString *retsError);
+		void OpenTables (SAeonOpenTableRange &Range);
 		inline void SetConsoleMode (const CString &sStorage) { m_sConsoleStorage = sStorage; m_bConsoleMode = true; }
 
 		virtual CString ConsoleCommand (const CString &sCmd, const TArray<CDatum> &Args) override;
@@ -783,9 +1896,12 @@ class CAeonEngine : public TSimpleEngine<CAeonEngine>
 		bool OpenTableDefinitions (void);
 
 		//	Message handlers
+		void MsgCloseCursor (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgCreateTable (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgDeleteRange (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgDeleteTable (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgDeleteView (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgFetchCursor (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgFileDirectory (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgFileDownload (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgFileGetDesc (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
@@ -794,22 +1910,41 @@ class CAeonEngine : public TSimpleEngine<CAeonEngine>
 		void MsgGetData (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgGetKeyRange (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgGetRows (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgGetStatus (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgGetTables (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgGetViewInfo (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgHousekeeping (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgInsert (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgInsertMany (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgInsertNew (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgMutate (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgMutateMany (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgOnMachineStart (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgOnMnemosynthModified (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgOpenCursor (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgRecoverTableTest (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgSearchText (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgTranspaceDownload (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgWaitForView (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 		void MsgWaitForVolume (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
 
+#ifdef DEBUG
+		//	Test-only message handlers (debug builds only)
+		void MsgCompactTableTest (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgHousekeepTableTest (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgScrubTableTest (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgSetLegacyRowFormat (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgSetLogSync (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgSetSegmentBlockSize (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgSetSegmentCompression (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgSetSegmentMapping (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+		void MsgSetViewUpdateThreads (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx);
+#endif
+
 		//	Helper routines
 		bool FindTable (const CString &sName, CAeonTable **retpTable);
 		void GetTables (TArray<CAeonTable *> *retTables);
+		bool ParseRowOptions (const SArchonMessage &Msg, CDatum dOptions, CDatum dFields, DWORD *retdwFlags, TArray<CString> *retFields);
 		bool ParseTableAndView (const SArchonMessage &Msg, 
 								const CHexeSecurityCtx *pSecurityCtx, 
 								CDatum dTableAndView, 
@@ -829,4 +1964,9 @@ class CAeonEngine : public TSimpleEngine<CAeonEngine>
 		TSortMap<CString, CAeonTable *> m_Tables;
 
 		CString m_sConsoleStorage;					//	If in console mode, this is the root of our storage
+
+		TArray<CAeonCompactionThread *> m_CompactionThreads;
+		CManualEvent m_CompactionQuit;				//	Set to stop compaction threads
+		CAeonRateLimiter m_CompactionLimiter;		//	Shared by all compaction threads
+		CAeonCursors m_Cursors;						//	Open cursors (Aeon.openCursor)
 	};
@@ -0,0 +1,237 @@
+//	CAeonBackupManifest.cpp
+//
+//	CAeonBackupManifest class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	The manifest lives in the table directory of the backup volume. It lists
+//	every immutable file (segments and data files) that we've copied there,
+//	with its size and CRC32C:
+//
+//	{
+//	version: 1
+//	files: (
+//		("segments\\0000012a_3f1c.aseg" 1048576 -12345678)
+//		...
+//		)
+//	}
+//
+//	Since these files never change once written, a file in the manifest with
+//	the right size does not need to be copied again.
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(FIELD_FILES,						"files")
+DECLARE_CONST_STRING(FIELD_VERSION,						"version")
+
+DECLARE_CONST_STRING(ERR_CANT_READ_FILE,				"Unable to read file: %s.")
+DECLARE_CONST_STRING(ERR_CANT_SAVE_MANIFEST,			"Unable to save backup manifest: %s.")
+DECLARE_CONST_STRING(ERR_INVALID_MANIFEST,				"Invalid backup manifest: %s.")
+
+const int CHECKSUM_BUFFER_SIZE =						64 * 1024;
+const int MANIFEST_VERSION =							1;
+
+bool CAeonBackupManifest::CalcChecksum (const CString &sFilespec, DWORD *retdwChecksum, DWORDLONG *retdwSize, CString *retsError)
+
+//	CalcChecksum
+//
+//	Computes the CRC32C of the file contents.
+
+	{
+	CFile File;
+	if (!File.Create(sFilespec, CFile::FLAG_OPEN_READ_ONLY, retsError))
+		return false;
+
+	DWORDLONG dwSize = File.GetSize();
+	DWORD dwCRC = 0;
+
+	try
+		{
+		CBuffer Buffer(CHECKSUM_BUFFER_SIZE);
+		DWORDLONG dwLeft = dwSize;
+		while (dwLeft > 0)
+			{
+			int iRead = (int)Min((DWORDLONG)CHECKSUM_BUFFER_SIZE, dwLeft);
+			File.Read(Buffer.GetPointer(), iRead);
+			dwCRC = utlCRC32C(Buffer.GetPointer(), iRead, dwCRC);
+			dwLeft -= iRead;
+			}
+		}
+	catch (...)
+		{
+		if (retsError) *retsError = strPattern(ERR_CANT_READ_FILE, sFilespec);
+		return false;
+		}
+
+	*retdwChecksum = dwCRC;
+	if (retdwSize)
+		*retdwSize = dwSize;
+
+	return true;
+	}
+
+void CAeonBackupManifest::DeleteMissing (const CString &sDir, const TArray<CString> &Files)
+
+//	DeleteMissing
+//
+//	Removes all entries in the given directory that are not in Files (which
+//	are filenames relative to the directory).
+
+	{
+	int i;
+
+	CString sPrefix = strPattern("%s\\", sDir);
+
+	for (i = 0; i < m_Files.GetCount(); i++)
+		{
+		const CString &sFile = m_Files.GetKey(i);
+		if (strStartsWith(sFile, sPrefix)
+				&& !Files.Find(fileGetFilename(sFile)))
+			{
+			m_Files.Delete(i);
+			i--;
+			m_bModified = true;
+			}
+		}
+	}
+
+bool CAeonBackupManifest::Load (const CString &sFilespec, CString *retsError)
+
+//	Load
+//
+//	Loads the manifest from the given file.
+
+	{
+	int i;
+
+	DeleteAll();
+
+	CDatum dManifest;
+	if (!CDatum::CreateFromFile(sFilespec, CDatum::formatAEONScript, &dManifest, retsError))
+		return false;
+
+	if ((int)dManifest.GetElement(FIELD_VERSION) != MANIFEST_VERSION)
+		{
+		*retsError = strPattern(ERR_INVALID_MANIFEST, sFilespec);
+		return false;
+		}
+
+	CDatum dFiles = dManifest.GetElement(FIELD_FILES);
+	for (i = 0; i < dFiles.GetCount(); i++)
+		{
+		CDatum dEntry = dFiles.GetElement(i);
+		if (dEntry.GetCount() < 3)
+			{
+			DeleteAll();
+			*retsError = strPattern(ERR_INVALID_MANIFEST, sFilespec);
+			return false;
+			}
+
+		SEntry *pEntry = m_Files.SetAt(dEntry.GetElement(0));
+		pEntry->dwSize = (DWORDLONG)dEntry.GetElement(1);
+		pEntry->dwChecksum = (DWORD)(int)dEntry.GetElement(2);
+		}
+
+	m_bModified = false;
+	return true;
+	}
+
+bool CAeonBackupManifest::Save (const CString &sFilespec, CString *retsError)
+
+//	Save
+//
+//	Saves the manifest to the given file.
+
+	{
+	int i;
+
+	CComplexArray *pFiles = new CComplexArray;
+	for (i = 0; i < m_Files.GetCount(); i++)
+		{
+		CComplexArray *pEntry = new CComplexArray;
+		pEntry->Insert(m_Files.GetKey(i));
+		pEntry->Insert(m_Files[i].dwSize);
+		pEntry->Insert((int)m_Files[i].dwChecksum);
+		pFiles->Insert(CDatum(pEntry));
+		}
+
+	CComplexStruct *pManifest = new CComplexStruct;
+	pManifest->SetElement(FIELD_VERSION, CDatum(MANIFEST_VERSION));
+	pManifest->SetElement(FIELD_FILES, CDatum(pFiles));
+	CDatum dManifest(pManifest);
+
+	CFile File;
+	if (!File.Create(sFilespec, CFile::FLAG_CREATE_ALWAYS))
+		{
+		*retsError = strPattern(ERR_CANT_SAVE_MANIFEST, sFilespec);
+		return false;
+		}
+
+	try
+		{
+		dManifest.Serialize(CDatum::formatAEONScript, File);
+		}
+	catch (...)
+		{
+		*retsError = strPattern(ERR_CANT_SAVE_MANIFEST, sFilespec);
+		return false;
+		}
+
+	m_bModified = false;
+	return true;
+	}
+
+bool CAeonBackupManifest::SetFile (const CString &sTablePath, const CString &sFile, CString *retsError)
+
+//	SetFile
+//
+//	Adds (or replaces) the entry for the given file (relative to sTablePath),
+//	computing its checksum from the copy on disk.
+
+	{
+	DWORD dwChecksum;
+	DWORDLONG dwSize;
+	if (!CalcChecksum(fileAppend(sTablePath, sFile), &dwChecksum, &dwSize, retsError))
+		return false;
+
+	SetFile(sFile, dwSize, dwChecksum);
+	return true;
+	}
+
+void CAeonBackupManifest::SetFile (const CString &sFile, DWORDLONG dwSize, DWORD dwChecksum)
+
+//	SetFile
+//
+//	Adds (or replaces) the entry for the given file.
+
+	{
+	SEntry *pEntry = m_Files.SetAt(sFile);
+	pEntry->dwSize = dwSize;
+	pEntry->dwChecksum = dwChecksum;
+	m_bModified = true;
+	}
+
+bool CAeonBackupManifest::Verify (const CString &sTablePath, TArray<CString> *retBadFiles) const
+
+//	Verify
+//
+//	Reads every file in the manifest and makes sure that it has the expected
+//	size and checksum. Returns FALSE (and the list of files that don't match)
+//	if any are missing or corrupt.
+
+	{
+	int i;
+
+	retBadFiles->DeleteAll();
+
+	for (i = 0; i < m_Files.GetCount(); i++)
+		{
+		DWORD dwChecksum;
+		DWORDLONG dwSize;
+		if (!CalcChecksum(fileAppend(sTablePath, m_Files.GetKey(i)), &dwChecksum, &dwSize)
+				|| dwSize != m_Files[i].dwSize
+				|| dwChecksum != m_Files[i].dwChecksum)
+			retBadFiles->Insert(m_Files.GetKey(i));
+		}
+
+	return (retBadFiles->GetCount() == 0);
+	}
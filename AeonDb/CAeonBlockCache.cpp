@@ -0,0 +1,550 @@
+//	CAeonBlockCache.cpp
+//
+//	CAeonBlockCache class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	We keep a single cache of segment blocks for the whole process so that
+//	memory goes to whichever tables are hot instead of a fixed number of
+//	blocks per segment.
+//
+//	The cache is split into shards (each with its own lock) to reduce
+//	contention. Each shard implements 2Q:
+//
+//	A1in:	FIFO of blocks that have been loaded once. Sized at 1/4 of the
+//			shard budget. Blocks evicted from here are remembered in A1out.
+//	A1out:	Keys (no data) of blocks recently evicted from A1in.
+//	Am:		LRU of blocks that were requested again after being loaded
+//			(either while in A1in or while remembered in A1out).
+//
+//	Blocks and A1out keys are indexed by hash tables, so lookups, inserts, and
+//	evictions are O(1) on average; all queue operations are O(1). Blocks that
+//	are currently loaded by a caller (dwRefCount > 0) are never evicted: they
+//	move to a separate Pinned queue until they are unloaded, so the tail of A1in
+//	and Am is always evictable.
+//
+//	Each shard also links the blocks of a segment together so that closing a
+//	segment only visits that segment's blocks.
+
+#include "stdafx.h"
+
+const DWORDLONG DEFAULT_MAX_BYTES =			256 * 1024 * 1024;
+
+CAeonBlockCache::CAeonBlockCache (void) :
+		m_dwNextSegmentID(1),
+		m_iMaxBytes(DEFAULT_MAX_BYTES)
+
+//	CAeonBlockCache constructor
+
+	{
+	}
+
+CAeonBlockCache::~CAeonBlockCache (void)
+
+//	CAeonBlockCache destructor
+
+	{
+	int i;
+
+	//	Every block is in exactly one of the queues
+
+	for (i = 0; i < SHARD_COUNT; i++)
+		{
+		SShard &Shard = m_Shards[i];
+		DeleteQueue(Shard.In);
+		DeleteQueue(Shard.Main);
+		DeleteQueue(Shard.Pinned);
+		}
+	}
+
+void CAeonBlockCache::AddGhost (SShard &Shard, DWORDLONG dwKey)
+
+//	AddGhost
+//
+//	Remembers a key evicted from A1in. We remember roughly as many keys as we
+//	have blocks in the shard.
+
+	{
+	SGhost Ghost;
+	Ghost.dwKey = dwKey;
+	Ghost.dwGeneration = ++Shard.dwNextGhostGen;
+
+	Shard.Ghosts.Insert(dwKey, Ghost.dwGeneration);
+	Shard.GhostOrder.EnqueueAndGrow(Ghost);
+
+	//	Forget the oldest keys. If a key was re-added since it was queued, then
+	//	the generation won't match and we leave the newer entry alone.
+
+	int iMaxGhosts = Max((int)MIN_GHOST_COUNT, Shard.Blocks.GetCount());
+	while (Shard.GhostOrder.GetCount() > iMaxGhosts)
+		{
+		SGhost Oldest = Shard.GhostOrder.GetAt(0);
+		Shard.GhostOrder.Dequeue();
+
+		DWORD *pGeneration = Shard.Ghosts.GetAt(Oldest.dwKey);
+		if (pGeneration && *pGeneration == Oldest.dwGeneration)
+			Shard.Ghosts.DeleteAt(Oldest.dwKey);
+		}
+	}
+
+DWORD CAeonBlockCache::CreateSegmentID (void)
+
+//	CreateSegmentID
+//
+//	Returns a new unique segment ID
+
+	{
+	CSmartLock Lock(m_cs);
+	return m_dwNextSegmentID++;
+	}
+
+void CAeonBlockCache::DeleteBlock (SShard &Shard, SBlock *pBlock)
+
+//	DeleteBlock
+//
+//	Removes the block from the shard and frees it.
+
+	{
+	if (pBlock->dwRefCount > 0)
+		QueueRemove(Shard.Pinned, pBlock);
+	else
+		QueueRemove((pBlock->iQueue == queueIn ? Shard.In : Shard.Main), pBlock);
+
+	SegmentRemove(Shard, pBlock);
+	Shard.Blocks.DeleteAt(pBlock->dwKey);
+
+	delete [] (char *)pBlock->pBlock;
+	delete pBlock;
+	}
+
+void CAeonBlockCache::DeleteQueue (SQueue &Queue)
+
+//	DeleteQueue
+//
+//	Frees all blocks in the queue (without removing them from the index).
+
+	{
+	SBlock *pBlock = Queue.pHead;
+	while (pBlock)
+		{
+		SBlock *pNext = pBlock->pNext;
+		delete [] (char *)pBlock->pBlock;
+		delete pBlock;
+		pBlock = pNext;
+		}
+
+	Queue.pHead = NULL;
+	Queue.pTail = NULL;
+	Queue.dwBytes = 0;
+	}
+
+void CAeonBlockCache::DeleteSegment (DWORD dwSegmentID)
+
+//	DeleteSegment
+//
+//	Frees all blocks belonging to the given segment. A segment's blocks are
+//	spread across the shards, but each shard keeps a list of them, so we only
+//	visit the segment's own blocks.
+
+	{
+	int i;
+
+	for (i = 0; i < SHARD_COUNT; i++)
+		{
+		SShard &Shard = m_Shards[i];
+		CSmartLock Lock(Shard.cs);
+
+		SBlock **ppFirst;
+		while (ppFirst = Shard.Segments.GetAt(dwSegmentID))
+			{
+			ASSERT((*ppFirst)->dwRefCount == 0);
+			DeleteBlock(Shard, *ppFirst);
+			}
+		}
+	}
+
+void CAeonBlockCache::EvictBlocks (SShard &Shard)
+
+//	EvictBlocks
+//
+//	Evicts blocks until the shard is within budget (or until everything left
+//	is in use).
+
+	{
+	DWORDLONG dwBudget = GetShardBudget();
+	DWORDLONG dwInBudget = dwBudget / 4;
+
+	while (GetShardBytes(Shard) > dwBudget)
+		{
+		//	Prefer to evict from A1in while it is over its share; otherwise
+		//	evict the least recently used block in Am. Blocks in use are in
+		//	Pinned, so the tail of each queue can always be evicted.
+
+		SBlock *pVictim = NULL;
+		if (Shard.In.dwBytes > dwInBudget)
+			pVictim = Shard.In.pTail;
+
+		if (pVictim == NULL)
+			pVictim = Shard.Main.pTail;
+
+		if (pVictim == NULL)
+			pVictim = Shard.In.pTail;
+
+		if (pVictim == NULL)
+			return;
+
+		//	Blocks leaving A1in are remembered so that we can promote them
+		//	straight to Am if they come back.
+
+		if (pVictim->iQueue == queueIn)
+			AddGhost(Shard, pVictim->dwKey);
+
+		DeleteBlock(Shard, pVictim);
+		Shard.dwEvictions++;
+		}
+	}
+
+void CAeonBlockCache::GetStats (SStats *retStats) const
+
+//	GetStats
+//
+//	Returns cache statistics
+
+	{
+	int i;
+
+	retStats->dwHits = 0;
+	retStats->dwMisses = 0;
+	retStats->dwEvictions = 0;
+	retStats->dwBytesUsed = 0;
+	retStats->dwMaxBytes = GetMaxBytes();
+	retStats->iBlockCount = 0;
+
+	for (i = 0; i < SHARD_COUNT; i++)
+		{
+		const SShard &Shard = m_Shards[i];
+		CSmartLock Lock(Shard.cs);
+
+		retStats->dwHits += Shard.dwHits;
+		retStats->dwMisses += Shard.dwMisses;
+		retStats->dwEvictions += Shard.dwEvictions;
+		retStats->dwBytesUsed += GetShardBytes(Shard);
+		retStats->iBlockCount += Shard.Blocks.GetCount();
+		}
+	}
+
+DWORD CAeonBlockCache::HashKey (DWORDLONG dwKey)
+
+//	HashKey
+//
+//	Hashes a key to pick a shard
+
+	{
+	DWORD dwHash = ((DWORD)(dwKey >> 32) * 0x9E3779B1) ^ ((DWORD)dwKey * 0x85EBCA6B);
+	dwHash ^= (dwHash >> 16);
+	return dwHash;
+	}
+
+void *CAeonBlockCache::LoadBlock (DWORD dwSegmentID, CFile &File, DWORD dwOffset, DWORD dwBlockSize, bool bCompressed, const char *pMappedFile, const DWORD *pChecksum)
+
+//	LoadBlock
+//
+//	Returns a pointer to the given block, loading it from the file if
+//	necessary. Caller must call UnloadBlock when done. We throw on error.
+//
+//	If bCompressed is TRUE, dwBlockSize is the size on disk and we cache the
+//	decompressed block (and count its decompressed size against the budget).
+//
+//	If pMappedFile is not NULL, the segment file is mapped into memory and we
+//	decompress straight from it instead of reading from File.
+//
+//	If pChecksum is not NULL, it is the CRC32C of the block on disk. We verify
+//	it whenever we read the block (cached blocks were verified when loaded).
+
+	{
+	DWORDLONG dwKey = MakeKey(dwSegmentID, dwOffset);
+	SShard &Shard = GetShard(dwKey);
+	CSmartLock Lock(Shard.cs);
+
+	//	If the block is cached, we're done. The block stays pinned until it is
+	//	unloaded (see UnpinBlock for how it goes back to its queue).
+
+	SBlock **ppBlock = Shard.Blocks.GetAt(dwKey);
+	if (ppBlock)
+		{
+		SBlock *pBlock = *ppBlock;
+		PinBlock(Shard, pBlock);
+		Shard.dwHits++;
+		return pBlock->pBlock;
+		}
+
+	Shard.dwMisses++;
+
+	//	Read from disk outside the lock so that we don't hold up other
+	//	segments in this shard.
+
+	Lock.Unlock();
+
+	char *pData;
+	if (pMappedFile)
+		{
+		ASSERT(bCompressed);
+		if (pChecksum)
+			CSegmentBlockCache::VerifyBlock(File, dwOffset, pMappedFile + dwOffset, dwBlockSize, *pChecksum);
+
+		pData = CSegmentBlockCache::DecompressBlock(pMappedFile + dwOffset, dwBlockSize, &dwBlockSize);
+		}
+	else
+		pData = ReadBlock(File, dwOffset, dwBlockSize, bCompressed, pChecksum, &dwBlockSize);
+
+	Lock.Lock();
+
+	//	Someone else might have loaded the block while we were reading.
+
+	ppBlock = Shard.Blocks.GetAt(dwKey);
+	if (ppBlock)
+		{
+		delete [] pData;
+		PinBlock(Shard, *ppBlock);
+		return (*ppBlock)->pBlock;
+		}
+
+	//	Add the block. If we evicted it recently, then it goes straight to Am
+	//	(when it is unloaded). Until then it is pinned.
+
+	SBlock *pBlock = new SBlock;
+	pBlock->dwKey = dwKey;
+	pBlock->pBlock = pData;
+	pBlock->dwSize = dwBlockSize;
+	pBlock->dwRefCount = 1;
+
+	if (Shard.Ghosts.GetAt(dwKey))
+		{
+		Shard.Ghosts.DeleteAt(dwKey);
+		pBlock->iQueue = queueMain;
+		}
+	else
+		pBlock->iQueue = queueIn;
+
+	QueueInsertHead(Shard.Pinned, pBlock);
+	SegmentInsert(Shard, pBlock);
+	Shard.Blocks.Insert(dwKey, pBlock);
+
+	//	Make room
+
+	EvictBlocks(Shard);
+
+	return pData;
+	}
+
+void CAeonBlockCache::PinBlock (SShard &Shard, SBlock *pBlock)
+
+//	PinBlock
+//
+//	Adds a reference to the block. The first reference moves it from its queue
+//	to Pinned.
+
+	{
+	if (pBlock->dwRefCount++ == 0)
+		{
+		QueueRemove((pBlock->iQueue == queueIn ? Shard.In : Shard.Main), pBlock);
+		QueueInsertHead(Shard.Pinned, pBlock);
+		}
+	}
+
+void CAeonBlockCache::QueueInsertHead (SQueue &Queue, SBlock *pBlock)
+
+//	QueueInsertHead
+//
+//	Inserts the block at the head (most recent end) of the queue.
+
+	{
+	pBlock->pPrev = NULL;
+	pBlock->pNext = Queue.pHead;
+
+	if (Queue.pHead)
+		Queue.pHead->pPrev = pBlock;
+	else
+		Queue.pTail = pBlock;
+
+	Queue.pHead = pBlock;
+	Queue.dwBytes += pBlock->dwSize;
+	}
+
+void CAeonBlockCache::QueueRemove (SQueue &Queue, SBlock *pBlock)
+
+//	QueueRemove
+//
+//	Removes the block from the queue.
+
+	{
+	if (pBlock->pPrev)
+		pBlock->pPrev->pNext = pBlock->pNext;
+	else
+		Queue.pHead = pBlock->pNext;
+
+	if (pBlock->pNext)
+		pBlock->pNext->pPrev = pBlock->pPrev;
+	else
+		Queue.pTail = pBlock->pPrev;
+
+	pBlock->pPrev = NULL;
+	pBlock->pNext = NULL;
+	Queue.dwBytes -= pBlock->dwSize;
+	}
+
+char *CAeonBlockCache::ReadBlock (CFile &File, DWORD dwOffset, DWORD dwBlockSize, bool bCompressed, const DWORD *pChecksum, DWORD *retdwSize)
+
+//	ReadBlock
+//
+//	Reads a block from the file (verifying and decompressing, if necessary) and
+//	returns a newly allocated buffer. We throw on error.
+//
+//	NOTE: We're called outside the shard lock and other threads (cursors, view
+//	workers, read-ahead) may be reading the same segment, so we must use a
+//	positioned read instead of Seek + Read.
+
+	{
+	char *pData = new char [dwBlockSize];
+	try
+		{
+		File.ReadAt(dwOffset, pData, dwBlockSize);
+
+		if (pChecksum)
+			CSegmentBlockCache::VerifyBlock(File, dwOffset, pData, dwBlockSize, *pChecksum);
+		}
+	catch (...)
+		{
+		delete [] pData;
+		throw;
+		}
+
+	if (!bCompressed)
+		{
+		*retdwSize = dwBlockSize;
+		return pData;
+		}
+
+	char *pBlock;
+	try
+		{
+		pBlock = CSegmentBlockCache::DecompressBlock(pData, dwBlockSize, retdwSize);
+		}
+	catch (...)
+		{
+		delete [] pData;
+		throw;
+		}
+
+	delete [] pData;
+	return pBlock;
+	}
+
+void CAeonBlockCache::SegmentInsert (SShard &Shard, SBlock *pBlock)
+
+//	SegmentInsert
+//
+//	Adds the block to the list of blocks for its segment.
+
+	{
+	bool bNew;
+	SBlock **ppFirst = Shard.Segments.SetAt((DWORD)(pBlock->dwKey >> 32), &bNew);
+
+	pBlock->pSegPrev = NULL;
+	pBlock->pSegNext = (bNew ? NULL : *ppFirst);
+	if (pBlock->pSegNext)
+		pBlock->pSegNext->pSegPrev = pBlock;
+
+	*ppFirst = pBlock;
+	}
+
+void CAeonBlockCache::SegmentRemove (SShard &Shard, SBlock *pBlock)
+
+//	SegmentRemove
+//
+//	Removes the block from the list of blocks for its segment.
+
+	{
+	if (pBlock->pSegNext)
+		pBlock->pSegNext->pSegPrev = pBlock->pSegPrev;
+
+	if (pBlock->pSegPrev)
+		pBlock->pSegPrev->pSegNext = pBlock->pSegNext;
+	else
+		{
+		DWORD dwSegmentID = (DWORD)(pBlock->dwKey >> 32);
+		if (pBlock->pSegNext)
+			Shard.Segments.Insert(dwSegmentID, pBlock->pSegNext);
+		else
+			Shard.Segments.DeleteAt(dwSegmentID);
+		}
+
+	pBlock->pSegPrev = NULL;
+	pBlock->pSegNext = NULL;
+	}
+
+void CAeonBlockCache::SetMaxMemory (DWORDLONG dwMaxBytes)
+
+//	SetMaxMemory
+//
+//	Sets the byte budget for the cache (and evicts blocks, if necessary).
+
+	{
+	int i;
+
+	::InterlockedExchange64(&m_iMaxBytes, (LONGLONG)dwMaxBytes);
+
+	for (i = 0; i < SHARD_COUNT; i++)
+		{
+		CSmartLock Lock(m_Shards[i].cs);
+		EvictBlocks(m_Shards[i]);
+		}
+	}
+
+void CAeonBlockCache::UnloadBlock (DWORD dwSegmentID, DWORD dwOffset)
+
+//	UnloadBlock
+//
+//	Releases a block loaded with LoadBlock.
+
+	{
+	DWORDLONG dwKey = MakeKey(dwSegmentID, dwOffset);
+	SShard &Shard = GetShard(dwKey);
+	CSmartLock Lock(Shard.cs);
+
+	SBlock **ppBlock = Shard.Blocks.GetAt(dwKey);
+	if (ppBlock == NULL)
+		{
+		ASSERT(false);
+		return;
+		}
+
+	SBlock *pBlock = *ppBlock;
+	ASSERT(pBlock->dwRefCount > 0);
+	if (pBlock->dwRefCount == 0)
+		return;
+
+	UnpinBlock(Shard, pBlock);
+
+	//	If we couldn't evict earlier because blocks were in use, try again.
+
+	if (pBlock->dwRefCount == 0
+			&& GetShardBytes(Shard) > GetShardBudget())
+		EvictBlocks(Shard);
+	}
+
+void CAeonBlockCache::UnpinBlock (SShard &Shard, SBlock *pBlock)
+
+//	UnpinBlock
+//
+//	Releases a reference to the block. When the last reference goes away we put
+//	the block back at the head of its queue: for Am that's the LRU position
+//	(we were just used); for A1in we count the block as loaded when it was
+//	released.
+
+	{
+	if (--pBlock->dwRefCount == 0)
+		{
+		QueueRemove(Shard.Pinned, pBlock);
+		QueueInsertHead((pBlock->iQueue == queueIn ? Shard.In : Shard.Main), pBlock);
+		}
+	}
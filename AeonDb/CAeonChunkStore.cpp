@@ -0,0 +1,450 @@
+//	CAeonChunkStore.cpp
+//
+//	CAeonChunkStore class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	We find chunk boundaries with a gear hash (a rolling hash over the last 32
+//	bytes). Since boundaries depend only on the nearby content, an edit in one
+//	part of a file only changes the chunks around it; the rest of the file
+//	hashes to the same chunks as before.
+//
+//	A chunk file never changes once written. We write to a temporary name and
+//	rename it so that a reader never sees a partial chunk (and so that two
+//	uploads of the same data don't interfere). Chunks that no fileDesc refers
+//	to are deleted by CAeonTable::SweepChunks.
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(FILESPEC_CHUNK_CONS,				"files\\%s.achunk")
+DECLARE_CONST_STRING(FILESPEC_CHUNK_EXTENSION,			"achunk")
+DECLARE_CONST_STRING(FILESPEC_CHUNK_TEMP_CONS,			"files\\%s_%s.tmp")
+
+DECLARE_CONST_STRING(ERR_CANT_CREATE_FILE,				"Unable to create file: %s.")
+DECLARE_CONST_STRING(ERR_CANT_READ_CHUNK,				"Unable to read file chunk: %s.")
+DECLARE_CONST_STRING(ERR_CANT_READ_FILE,				"Unable to read file: %s.")
+DECLARE_CONST_STRING(ERR_CANT_WRITE_CHUNK,				"Unable to write file chunk: %s.")
+
+const int MIN_CHUNK_SIZE =								256 * 1024;
+const int MAX_CHUNK_SIZE =								4 * 1024 * 1024;
+const DWORD CHUNK_BOUNDARY_MASK =						0xfffff000;		//	20 bits: ~1 MB average past the minimum
+const int GEAR_WINDOW =									32;
+const int TEMP_NAME_CHARS =								8;
+
+class CGearTable
+	{
+	public:
+		CGearTable (void)
+
+		//	CGearTable constructor
+		//
+		//	The table must never change: it determines where chunk boundaries
+		//	fall, so a new table would stop new uploads from sharing chunks
+		//	with old ones (though nothing would break).
+
+			{
+			int i;
+
+			DWORD dwSeed = 0x9e3779b9;
+			for (i = 0; i < 256; i++)
+				{
+				dwSeed ^= dwSeed << 13;
+				dwSeed ^= dwSeed >> 17;
+				dwSeed ^= dwSeed << 5;
+				m_Gear[i] = dwSeed;
+				}
+			}
+
+		inline DWORD operator [] (BYTE byValue) const { return m_Gear[byValue]; }
+
+	private:
+		DWORD m_Gear[256];
+	};
+
+static const CGearTable g_Gear;
+
+CDatum CAeonChunkStore::AsDatum (const TArray<SChunk> &Chunks)
+
+//	AsDatum
+//
+//	Returns the chunk list as stored in a fileDesc:
+//
+//	( (hash size) (hash size) ... )
+
+	{
+	int i;
+
+	CComplexArray *pChunks = new CComplexArray;
+	for (i = 0; i < Chunks.GetCount(); i++)
+		{
+		CComplexArray *pEntry = new CComplexArray;
+		pEntry->Insert(Chunks[i].sHash);
+		pEntry->Insert((int)Chunks[i].dwSize);
+		pChunks->Insert(CDatum(pEntry));
+		}
+
+	return CDatum(pChunks);
+	}
+
+int CAeonChunkStore::FindBoundary (const BYTE *pData, int iLength)
+
+//	FindBoundary
+//
+//	Returns the length of the chunk that starts at pData. iLength is the
+//	amount of data available; if it is less than MAX_CHUNK_SIZE then we're at
+//	the end of the file.
+
+	{
+	if (iLength <= MIN_CHUNK_SIZE)
+		return iLength;
+
+	int iEnd = Min(iLength, MAX_CHUNK_SIZE);
+
+	//	Prime the hash with the bytes just before the minimum so that the first
+	//	boundary we test depends on a full window.
+
+	DWORD dwHash = 0;
+	const BYTE *pPos = pData + MIN_CHUNK_SIZE - GEAR_WINDOW;
+	const BYTE *pMin = pData + MIN_CHUNK_SIZE;
+	while (pPos < pMin)
+		dwHash = (dwHash << 1) + g_Gear[*pPos++];
+
+	const BYTE *pPosEnd = pData + iEnd;
+	while (pPos < pPosEnd)
+		{
+		dwHash = (dwHash << 1) + g_Gear[*pPos++];
+		if ((dwHash & CHUNK_BOUNDARY_MASK) == 0)
+			return (int)(pPos - pData);
+		}
+
+	return iEnd;
+	}
+
+CString CAeonChunkStore::GetChunkFilename (const CString &sHash)
+
+//	GetChunkFilename
+//
+//	Returns the chunk filename relative to the table path.
+
+	{
+	return strPattern(FILESPEC_CHUNK_CONS, sHash);
+	}
+
+DWORDLONG CAeonChunkStore::GetFileSize (const TArray<SChunk> &Chunks)
+
+//	GetFileSize
+//
+//	Returns the total size of the file.
+
+	{
+	int i;
+
+	DWORDLONG dwSize = 0;
+	for (i = 0; i < Chunks.GetCount(); i++)
+		dwSize += Chunks[i].dwSize;
+
+	return dwSize;
+	}
+
+bool CAeonChunkStore::IsChunkFilename (const CString &sFilename)
+
+//	IsChunkFilename
+//
+//	Returns TRUE if this is the name of a chunk file.
+
+	{
+	return strEquals(fileGetExtension(sFilename), FILESPEC_CHUNK_EXTENSION);
+	}
+
+bool CAeonChunkStore::ParseChunks (CDatum dChunks, TArray<SChunk> *retChunks)
+
+//	ParseChunks
+//
+//	Parses the chunk list from a fileDesc. Returns FALSE if the file is not
+//	stored as chunks (files uploaded before we had chunks have a storagePath
+//	instead).
+
+	{
+	int i;
+
+	retChunks->DeleteAll();
+	if (dChunks.IsNil())
+		return false;
+
+	retChunks->InsertEmpty(dChunks.GetCount());
+	for (i = 0; i < dChunks.GetCount(); i++)
+		{
+		CDatum dEntry = dChunks.GetElement(i);
+		(*retChunks)[i].sHash = dEntry.GetElement(0);
+		(*retChunks)[i].dwSize = (DWORD)(int)dEntry.GetElement(1);
+		}
+
+	return true;
+	}
+
+bool CAeonChunkStore::ReadChunks (const CString &sTablePath, const TArray<SChunk> &Chunks, int iPos, int iMaxSize, CDatum *retdData, CString *retsError)
+
+//	ReadChunks
+//
+//	Reads iMaxSize bytes of the file starting at iPos (iMaxSize = -1 means to
+//	the end of the file). We read straight from the chunk files into the
+//	result, without assembling the whole file.
+
+	{
+	int i;
+
+	DWORDLONG dwFileSize = GetFileSize(Chunks);
+	if ((DWORDLONG)iPos >= dwFileSize)
+		{
+		*retdData = CDatum();
+		return true;
+		}
+
+	int iLeft = (int)(dwFileSize - iPos);
+	int iSize = (iMaxSize < 0 ? iLeft : Min(iMaxSize, iLeft));
+	if (iSize == 0)
+		{
+		*retdData = CDatum();
+		return true;
+		}
+
+	CStringBuffer Buffer;
+	Buffer.SetLength(iSize);
+	char *pDest = Buffer.GetPointer();
+	iLeft = iSize;
+
+	int iChunkPos = 0;
+	for (i = 0; i < Chunks.GetCount() && iLeft > 0; i++)
+		{
+		int iChunkSize = (int)Chunks[i].dwSize;
+		if (iPos >= iChunkPos + iChunkSize)
+			{
+			iChunkPos += iChunkSize;
+			continue;
+			}
+
+		int iOffset = Max(0, iPos - iChunkPos);
+		int iRead = Min(iChunkSize - iOffset, iLeft);
+
+		CString sChunkFilespec = fileAppend(sTablePath, GetChunkFilename(Chunks[i].sHash));
+		CFile ChunkFile;
+		if (!ChunkFile.Create(sChunkFilespec, CFile::FLAG_OPEN_READ_ONLY))
+			{
+			*retsError = strPattern(ERR_CANT_READ_CHUNK, sChunkFilespec);
+			return false;
+			}
+
+		try
+			{
+			if (iOffset)
+				ChunkFile.Seek(iOffset);
+
+			ChunkFile.Read(pDest, iRead);
+			}
+		catch (...)
+			{
+			*retsError = strPattern(ERR_CANT_READ_CHUNK, sChunkFilespec);
+			return false;
+			}
+
+		pDest += iRead;
+		iLeft -= iRead;
+		iChunkPos += iChunkSize;
+		}
+
+	if (iLeft > 0)
+		{
+		*retsError = strPattern(ERR_CANT_READ_FILE, sTablePath);
+		return false;
+		}
+
+	return CDatum::CreateBinaryFromHandoff(Buffer, retdData);
+	}
+
+bool CAeonChunkStore::StoreFile (const CString &sFilespec, const CString &sTablePath, const CString &sBackupTablePath, TArray<SChunk> *retChunks, bool *retbBackupFailed, CString *retsError)
+
+//	StoreFile
+//
+//	Splits the given file into chunks and writes any chunks that we don't
+//	already have (to the table and to the backup, if any). Returns the list of
+//	chunks. If we stored the file but could not write to the backup, we set
+//	retbBackupFailed.
+
+	{
+	int i;
+
+	retChunks->DeleteAll();
+	*retbBackupFailed = false;
+
+	CFile File;
+	if (!File.Create(sFilespec, CFile::FLAG_OPEN_READ_ONLY))
+		{
+		*retsError = strPattern(ERR_CANT_READ_FILE, sFilespec);
+		return false;
+		}
+
+	CBuffer Buffer(MAX_CHUNK_SIZE);
+	BYTE *pBuffer = (BYTE *)Buffer.GetPointer();
+	int iBuffered = 0;
+
+	try
+		{
+		int iFileLeft = File.GetStreamLength();
+		while (iBuffered > 0 || iFileLeft > 0)
+			{
+			//	Top up the buffer so we can always see a maximum-size chunk
+			//	(unless we're at the end of the file).
+
+			int iRead = Min(MAX_CHUNK_SIZE - iBuffered, iFileLeft);
+			if (iRead > 0)
+				{
+				File.Read(pBuffer + iBuffered, iRead);
+				iBuffered += iRead;
+				iFileLeft -= iRead;
+				}
+
+			int iChunkLen = FindBoundary(pBuffer, iBuffered);
+
+			//	Hash
+
+			DIGEST256 Digest;
+			CCryptoDigest Hasher(CCryptoDigest::algSHA256);
+			Hasher.AddData(pBuffer, iChunkLen);
+			Hasher.CalcDigest(Digest);
+
+			char szHash[2 * sizeof(DIGEST256)];
+			for (i = 0; i < (int)sizeof(DIGEST256); i++)
+				{
+				szHash[2 * i] = "0123456789abcdef"[Digest[i] >> 4];
+				szHash[2 * i + 1] = "0123456789abcdef"[Digest[i] & 0x0f];
+				}
+
+			SChunk *pChunk = retChunks->Insert();
+			pChunk->sHash = CString(szHash, (int)sizeof(szHash));
+			pChunk->dwSize = (DWORD)iChunkLen;
+
+			//	Write it, unless we already have it
+
+			if (!WriteChunk(sTablePath, pChunk->sHash, pBuffer, iChunkLen, retsError))
+				return false;
+
+			if (!sBackupTablePath.IsEmpty()
+					&& !*retbBackupFailed
+					&& !WriteChunk(sBackupTablePath, pChunk->sHash, pBuffer, iChunkLen))
+				*retbBackupFailed = true;
+
+			//	Shift the rest of the buffer down
+
+			iBuffered -= iChunkLen;
+			if (iBuffered > 0)
+				memmove(pBuffer, pBuffer + iChunkLen, iBuffered);
+			}
+		}
+	catch (...)
+		{
+		*retsError = strPattern(ERR_CANT_READ_FILE, sFilespec);
+		return false;
+		}
+
+	return true;
+	}
+
+bool CAeonChunkStore::WriteChunk (const CString &sTablePath, const CString &sHash, const void *pData, int iLength, CString *retsError)
+
+//	WriteChunk
+//
+//	Writes the chunk if we don't already have it.
+
+	{
+	CString sFilespec = fileAppend(sTablePath, GetChunkFilename(sHash));
+	if (fileExists(sFilespec))
+		return true;
+
+	CString sTempFilespec = fileAppend(sTablePath, strPattern(FILESPEC_CHUNK_TEMP_CONS, sHash, cryptoRandomCode(TEMP_NAME_CHARS)));
+
+	CFile TempFile;
+	if (!TempFile.Create(sTempFilespec, CFile::FLAG_CREATE_NEW))
+		{
+		if (retsError) *retsError = strPattern(ERR_CANT_WRITE_CHUNK, sTempFilespec);
+		return false;
+		}
+
+	try
+		{
+		TempFile.Write((void *)pData, iLength);
+		TempFile.Flush();
+		TempFile.Close();
+		}
+	catch (...)
+		{
+		TempFile.Close();
+		fileDelete(sTempFilespec);
+		if (retsError) *retsError = strPattern(ERR_CANT_WRITE_CHUNK, sFilespec);
+		return false;
+		}
+
+	//	If someone else stored the same chunk while we were writing, then
+	//	theirs is just as good.
+
+	if (!fileMove(sTempFilespec, sFilespec))
+		{
+		fileDelete(sTempFilespec);
+		if (!fileExists(sFilespec))
+			{
+			if (retsError) *retsError = strPattern(ERR_CANT_WRITE_CHUNK, sFilespec);
+			return false;
+			}
+		}
+
+	return true;
+	}
+
+bool CAeonChunkStore::WriteFile (const CString &sTablePath, const TArray<SChunk> &Chunks, const CString &sFilespec, CString *retsError)
+
+//	WriteFile
+//
+//	Reassembles the file into sFilespec (which must not exist). We use this
+//	when an upload modifies part of an existing file.
+
+	{
+	int i;
+
+	CFile File;
+	if (!File.Create(sFilespec, CFile::FLAG_CREATE_NEW))
+		{
+		*retsError = strPattern(ERR_CANT_CREATE_FILE, sFilespec);
+		return false;
+		}
+
+	CBuffer Buffer(MAX_CHUNK_SIZE);
+	for (i = 0; i < Chunks.GetCount(); i++)
+		{
+		int iChunkSize = (int)Chunks[i].dwSize;
+		CString sChunkFilespec = fileAppend(sTablePath, GetChunkFilename(Chunks[i].sHash));
+
+		CFile ChunkFile;
+		if (iChunkSize > MAX_CHUNK_SIZE
+				|| !ChunkFile.Create(sChunkFilespec, CFile::FLAG_OPEN_READ_ONLY))
+			{
+			File.Close();
+			fileDelete(sFilespec);
+			*retsError = strPattern(ERR_CANT_READ_CHUNK, sChunkFilespec);
+			return false;
+			}
+
+		try
+			{
+			ChunkFile.Read(Buffer.GetPointer(), iChunkSize);
+			File.Write(Buffer.GetPointer(), iChunkSize);
+			}
+		catch (...)
+			{
+			File.Close();
+			fileDelete(sFilespec);
+			*retsError = strPattern(ERR_CANT_READ_CHUNK, sChunkFilespec);
+			return false;
+			}
+		}
+
+	File.Flush();
+	return true;
+	}
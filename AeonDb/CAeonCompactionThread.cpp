@@ -0,0 +1,33 @@
+//	CAeonCompactionThread.cpp
+//
+//	CAeonCompactionThread class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	Compaction threads merge segments outside of the engine's message threads
+//	so that long merges don't hold up housekeeping (flushing rows, backups).
+//	Merging only copies serialized rows, so we never allocate datums here and
+//	don't need to pause for garbage collection.
+
+#include "stdafx.h"
+
+const DWORD COMPACTION_INTERVAL =			5000;
+
+void CAeonCompactionThread::Run (void)
+
+//	Run
+//
+//	Compaction thread
+
+	{
+	while (true)
+		{
+		//	Wait a while (or until we're asked to quit)
+
+		if (m_pEngine->GetCompactionQuitEvent().Wait(COMPACTION_INTERVAL))
+			return;
+
+		//	Merge segments in all tables
+
+		m_pEngine->CompactTables();
+		}
+	}
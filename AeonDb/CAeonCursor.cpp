@@ -0,0 +1,154 @@
+//	CAeonCursor.cpp
+//
+//	CAeonCursor class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	A cursor returns the rows of a view in batches. Aeon.getRows uses a cursor
+//	for a single batch; Aeon.openCursor keeps one around so that clients can
+//	scan a large range without re-seeking (and without seeing rows change in
+//	the middle of the scan).
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(FIELD_PRIMARY_KEY,					"primaryKey")
+DECLARE_CONST_STRING(FIELD_SECONDARY_KEY,				"secondaryKey")
+
+DECLARE_CONST_STRING(ERR_ROW_FILTER_FAILED,				"Row filter failed: %s")
+
+bool CAeonCursor::Fetch (int iMaxRows, DWORD dwMaxBytes, CDatum *retdResult, CString *retsError)
+
+//	Fetch
+//
+//	Returns the next batch of rows. iMaxRows is the maximum number of rows to
+//	return (-1 = no limit). dwMaxBytes is the number of (serialized) row bytes
+//	to read before we stop (0 = no limit). We count rows that the filter skips
+//	so that a selective filter can't make a batch arbitrarily slow.
+//
+//	If the starting key was not found, we return Nil.
+
+	{
+	if (m_bKeyNotFound)
+		{
+		*retdResult = CDatum();
+		return true;
+		}
+
+	//	We return an array of keys
+
+	CComplexArray *pArray = new CComplexArray;
+	DWORD dwBytesRead = 0;
+
+	while (m_Rows.HasMore()
+			&& (iMaxRows > 0 || iMaxRows == -1)
+			&& (dwMaxBytes == 0 || dwBytesRead < dwMaxBytes))
+		{
+		//	Get the key and data for the row
+
+		CRowKey Key;
+		CDatum dData;
+		dwBytesRead += m_Rows.GetRowSize();
+		m_Rows.GetNextRow(&Key, &dData);
+		if (dData.IsNil())
+			continue;
+
+		//	Skip rows that don't match the filter
+
+		if (!m_dFilterFunc.IsNil())
+			{
+			TArray<CDatum> Args;
+			Args.Insert(dData);
+
+			CDatum dMatch;
+			if (m_FilterProcess.Run(m_dFilterFunc, Args, &dMatch) != CHexeProcess::runOK)
+				{
+				*retsError = strPattern(ERR_ROW_FILTER_FAILED, dMatch.AsString());
+				delete pArray;
+				return false;
+				}
+
+			if (dMatch.IsNil())
+				continue;
+			}
+
+		//	Trim to the requested fields
+
+		if (m_Fields.GetCount() > 0)
+			dData = ProjectRow(dData, m_Fields);
+
+		//	Insert the row
+
+		if (m_dwFlags & CAeonTable::FLAG_NO_KEY)
+			pArray->Insert(dData);
+		else if (m_dwFlags & CAeonTable::FLAG_INCLUDE_KEY)
+			{
+			CComplexStruct *pNewData = new CComplexStruct(dData);
+			if (m_bIsSecondaryView)
+				pNewData->SetElement(FIELD_SECONDARY_KEY, Key.AsDatum(m_Dims));
+			else
+				pNewData->SetElement(FIELD_PRIMARY_KEY, Key.AsDatum(m_Dims));
+
+			pArray->Insert(CDatum(pNewData));
+			}
+		else
+			{
+			pArray->Insert(Key.AsDatum(m_Dims));
+			pArray->Insert(dData);
+			}
+
+		if (iMaxRows != -1)
+			iMaxRows--;
+		}
+
+	//	Done
+
+	*retdResult = CDatum(pArray);
+	return true;
+	}
+
+void CAeonCursor::Init (const CTableDimensions &Dims, bool bIsSecondaryView, DWORD dwFlags, CDatum dFilterFunc, const TArray<CString> &Fields)
+
+//	Init
+//
+//	Sets the options for the rows that we return. The caller initializes the
+//	iterator and the filter process separately.
+
+	{
+	m_Dims = Dims;
+	m_bIsSecondaryView = bIsSecondaryView;
+	m_dwFlags = dwFlags;
+	m_dFilterFunc = dFilterFunc;
+	m_Fields = Fields;
+	m_bKeyNotFound = false;
+	}
+
+void CAeonCursor::Mark (void)
+
+//	Mark
+//
+//	Mark data in use
+
+	{
+	m_FilterProcess.Mark();
+	m_dFilterFunc.Mark();
+	}
+
+CDatum CAeonCursor::ProjectRow (CDatum dData, const TArray<CString> &Fields)
+
+//	ProjectRow
+//
+//	Returns a struct with only the given fields from the row. Fields that are
+//	nil in the row are omitted.
+
+	{
+	int i;
+
+	CComplexStruct *pNewData = new CComplexStruct;
+	for (i = 0; i < Fields.GetCount(); i++)
+		{
+		CDatum dValue = dData.GetElement(Fields[i]);
+		if (!dValue.IsNil())
+			pNewData->SetElement(Fields[i], dValue);
+		}
+
+	return CDatum(pNewData);
+	}
@@ -0,0 +1,204 @@
+//	CAeonCursors.cpp
+//
+//	CAeonCursors class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	An open cursor keeps references to the segments of its view, so segments
+//	replaced by a merge stay on disk until the cursor is closed. That's why
+//	every cursor has a lease: clients that go away without closing their
+//	cursors don't pin old segments forever.
+//
+//	Fetching happens outside our lock (it may take a while), so we mark a
+//	cursor busy while someone is using it.
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(STR_CURSOR_ID_PATTERN,				"%d-%s")
+
+DECLARE_CONST_STRING(ERR_CURSOR_BUSY,					"Cursor is busy: %s.")
+DECLARE_CONST_STRING(ERR_TOO_MANY_CURSORS,				"Too many open cursors.")
+DECLARE_CONST_STRING(ERR_UNKNOWN_CURSOR,				"Unknown cursor (it may have expired): %s.")
+
+const int CURSOR_ID_RANDOM_CHARS =						16;
+const int MAX_CURSORS =									1000;
+
+void CAeonCursors::Close (const CString &sCursorID)
+
+//	Close
+//
+//	Closes the cursor. If someone is fetching from it, we close it when they're
+//	done.
+
+	{
+	CSmartLock Lock(m_cs);
+
+	int iPos;
+	if (!m_Cursors.FindPos(sCursorID, &iPos))
+		return;
+
+	if (m_Cursors[iPos].bBusy)
+		{
+		m_Cursors[iPos].bClosePending = true;
+		return;
+		}
+
+	delete m_Cursors[iPos].pCursor;
+	m_Cursors.Delete(iPos);
+	}
+
+void CAeonCursors::DeleteAll (void)
+
+//	DeleteAll
+//
+//	Closes all cursors.
+
+	{
+	CSmartLock Lock(m_cs);
+	int i;
+
+	for (i = 0; i < m_Cursors.GetCount(); i++)
+		delete m_Cursors[i].pCursor;
+
+	m_Cursors.DeleteAll();
+	}
+
+void CAeonCursors::DeleteExpired (void)
+
+//	DeleteExpired
+//
+//	Closes all cursors whose lease has expired.
+
+	{
+	CSmartLock Lock(m_cs);
+	int i;
+
+	DWORD dwNow = sysGetTickCount();
+	for (i = 0; i < m_Cursors.GetCount(); i++)
+		{
+		SCursorCtx &Ctx = m_Cursors[i];
+		if (!Ctx.bBusy && sysGetTicksElapsed(Ctx.dwLastActivity, &dwNow) > Ctx.dwLease)
+			{
+			delete Ctx.pCursor;
+			m_Cursors.Delete(i);
+			i--;
+			}
+		}
+	}
+
+CAeonCursor *CAeonCursors::Lock (const CString &sCursorID, CString *retsTable, CString *retsError)
+
+//	Lock
+//
+//	Returns the cursor and marks it busy (renewing its lease). Callers must
+//	call Unlock when done.
+//
+//	NOTE: Housekeeping only runs every so often, so we also check the lease
+//	here; otherwise a client could keep using a cursor after it expired.
+
+	{
+	CSmartLock Lock(m_cs);
+
+	int iPos;
+	if (!m_Cursors.FindPos(sCursorID, &iPos) || m_Cursors[iPos].bClosePending)
+		{
+		*retsError = strPattern(ERR_UNKNOWN_CURSOR, sCursorID);
+		return NULL;
+		}
+
+	SCursorCtx *pCtx = &m_Cursors[iPos];
+	if (!pCtx->bBusy && sysGetTicksElapsed(pCtx->dwLastActivity) > pCtx->dwLease)
+		{
+		delete pCtx->pCursor;
+		m_Cursors.Delete(iPos);
+
+		*retsError = strPattern(ERR_UNKNOWN_CURSOR, sCursorID);
+		return NULL;
+		}
+
+	if (pCtx->bBusy)
+		{
+		*retsError = strPattern(ERR_CURSOR_BUSY, sCursorID);
+		return NULL;
+		}
+
+	pCtx->bBusy = true;
+	pCtx->dwLastActivity = sysGetTickCount();
+
+	if (retsTable)
+		*retsTable = pCtx->sTable;
+
+	return pCtx->pCursor;
+	}
+
+void CAeonCursors::Mark (void)
+
+//	Mark
+//
+//	Mark data in use
+
+	{
+	CSmartLock Lock(m_cs);
+	int i;
+
+	for (i = 0; i < m_Cursors.GetCount(); i++)
+		m_Cursors[i].pCursor->Mark();
+	}
+
+bool CAeonCursors::Open (const CString &sTable, CAeonCursor *pCursor, DWORD dwLease, CString *retsCursorID, CString *retsError)
+
+//	Open
+//
+//	Adds a cursor and returns its ID. We take ownership of pCursor (even if we
+//	fail).
+
+	{
+	CSmartLock Lock(m_cs);
+
+	if (m_Cursors.GetCount() >= MAX_CURSORS)
+		{
+		delete pCursor;
+		*retsError = ERR_TOO_MANY_CURSORS;
+		return false;
+		}
+
+	//	The ID is hard to guess so that clients can't read each other's
+	//	cursors (we also check table access on every fetch).
+
+	CString sCursorID = strPattern(STR_CURSOR_ID_PATTERN, m_dwNextID++, cryptoRandomCode(CURSOR_ID_RANDOM_CHARS));
+
+	SCursorCtx *pCtx = m_Cursors.SetAt(sCursorID);
+	pCtx->pCursor = pCursor;
+	pCtx->sTable = sTable;
+	pCtx->dwLease = dwLease;
+	pCtx->dwLastActivity = sysGetTickCount();
+	pCtx->bBusy = false;
+	pCtx->bClosePending = false;
+
+	*retsCursorID = sCursorID;
+	return true;
+	}
+
+void CAeonCursors::Unlock (const CString &sCursorID, bool bClose)
+
+//	Unlock
+//
+//	Done using a cursor returned by Lock. If bClose is TRUE (or if someone
+//	closed the cursor while we were using it) we close it.
+
+	{
+	CSmartLock Lock(m_cs);
+
+	int iPos;
+	if (!m_Cursors.FindPos(sCursorID, &iPos))
+		return;
+
+	SCursorCtx &Ctx = m_Cursors[iPos];
+	Ctx.bBusy = false;
+	Ctx.dwLastActivity = sysGetTickCount();
+
+	if (bClose || Ctx.bClosePending)
+		{
+		delete Ctx.pCursor;
+		m_Cursors.Delete(iPos);
+		}
+	}
@@ -34,12 +34,28 @@ DECLARE_CONST_STRING(MSG_MNEMOSYNTH_ON_MODIFIED,		"Mnemosynth.onModified")
 DECLARE_CONST_STRING(MSG_REPLY_DATA,					"Reply.data")
 
 DECLARE_CONST_STRING(OPTION_INCLUDE_KEY,				"includeKey")
+DECLARE_CONST_STRING(OPTION_INSERT_NEW,					"insertNew")
 DECLARE_CONST_STRING(OPTION_NO_KEY,						"noKey")
+DECLARE_CONST_STRING(OPTION_TORN_TAIL,				"tornTail")
+
+DECLARE_CONST_STRING(COMPRESSION_LZ,					"lz")
+DECLARE_CONST_STRING(COMPRESSION_NONE,					"none")
+DECLARE_CONST_STRING(COMPRESSION_ZLIB,					"zlib")
+
+DECLARE_CONST_STRING(SYNC_POLICY_BATCH,					"batch")
+DECLARE_CONST_STRING(SYNC_POLICY_INTERVAL,				"interval")
+DECLARE_CONST_STRING(SYNC_POLICY_OS,					"os")
 
 DECLARE_CONST_STRING(FILESPEC_TABLE_DIR_FILTER,			"*")
 
 DECLARE_CONST_STRING(FIELD_ADDRESS,						"address")
 DECLARE_CONST_STRING(FIELD_BACKUP_VOLUMES,				"backupVolumes")
+DECLARE_CONST_STRING(FIELD_BLOCK_CACHE_BLOCKS,			"Aeon/blockCacheBlocks")
+DECLARE_CONST_STRING(FIELD_BLOCK_CACHE_BYTES,			"Aeon/blockCacheBytes")
+DECLARE_CONST_STRING(FIELD_BLOCK_CACHE_EVICTIONS,		"Aeon/blockCacheEvictions")
+DECLARE_CONST_STRING(FIELD_BLOCK_CACHE_HITS,			"Aeon/blockCacheHits")
+DECLARE_CONST_STRING(FIELD_BLOCK_CACHE_MAX_BYTES,		"Aeon/blockCacheMaxBytes")
+DECLARE_CONST_STRING(FIELD_BLOCK_CACHE_MISSES,			"Aeon/blockCacheMisses")
 DECLARE_CONST_STRING(FIELD_COLLECTIONS,					"collections")
 DECLARE_CONST_STRING(FIELD_DATA,						"data")
 DECLARE_CONST_STRING(FIELD_ENTRIES,						"entries")
@@ -51,6 +67,8 @@ DECLARE_CONST_STRING(FIELD_NAME,						"name")
 DECLARE_CONST_STRING(FIELD_PARTIAL_MAX_SIZE,			"partialMaxSize")
 DECLARE_CONST_STRING(FIELD_PARTIAL_POS,					"partialPos")
 DECLARE_CONST_STRING(FIELD_PRIMARY_VOLUME,				"primaryVolume")
+DECLARE_CONST_STRING(FIELD_SEGMENTS_MAPPED,				"Aeon/segmentsMapped")
+DECLARE_CONST_STRING(FIELD_SEGMENTS_UNMAPPED,			"Aeon/segmentsUnmapped")
 DECLARE_CONST_STRING(FIELD_STORAGE_PATH,				"storagePath")
 DECLARE_CONST_STRING(FIELD_X,							"x")
 DECLARE_CONST_STRING(FIELD_Y,							"y")
@@ -62,6 +80,8 @@ DECLARE_CONST_STRING(STR_FILE_TABLE_DESC_PATTERN,		"{ name: \"%s\" type: file x:
 
 DECLARE_CONST_STRING(STR_AEON_STARTING,					"Aeon database starting up.")
 DECLARE_CONST_STRING(STR_DATABASE_OPEN,					"Aeon database opened.")
+DECLARE_CONST_STRING(STR_TABLE_OPENED,					"Opened table %s in %d ms (%d rows recovered).")
+DECLARE_CONST_STRING(STR_TABLES_OPENED,					"Opened %d tables in %d ms.")
 DECLARE_CONST_STRING(ERR_NOT_READY,						"Aeon is not yet online.")
 DECLARE_CONST_STRING(ERR_ADMIN_REQUIRED,				"Arc.admin right required.")
 DECLARE_CONST_STRING(ERR_INVALID_PARAMETERS,			"Invalid parameters.")
@@ -81,13 +101,25 @@ DECLARE_CONST_STRING(STR_ERROR_UNKNOWN_KEY_TYPE,		"Unknown keyType: %s.")
 DECLARE_CONST_STRING(STR_ERROR_UNKNOWN_TABLE,			"Unknown table: %s.")
 DECLARE_CONST_STRING(ERR_UNABLE_TO_FLUSH,				"Unable to save all tables to disk.")
 DECLARE_CONST_STRING(ERR_INVALID_GET_ROWS_OPTION,		"Invalid %s option: %s.")
+DECLARE_CONST_STRING(ERR_INVALID_SYNC_POLICY,			"Invalid log sync policy: %s.")
+DECLARE_CONST_STRING(ERR_INVALID_SYNC_INTERVAL,			"Invalid log sync interval: %s.")
+DECLARE_CONST_STRING(ERR_INVALID_COMPRESSION,			"Invalid segment compression: %s.")
+DECLARE_CONST_STRING(ERR_INVALID_BLOCK_SIZE,			"Invalid segment block size: %d.")
+DECLARE_CONST_STRING(ERR_BATCH_ROW_FAILED,				"Row %d: %s")
+DECLARE_CONST_STRING(ERR_COMPACTION_FAILED,				"Unable to merge segments in table: %s.")
+DECLARE_CONST_STRING(ERR_HOUSEKEEPING_FAILED,			"Unable to complete housekeeping for table: %s.")
+DECLARE_CONST_STRING(ERR_CURSOR_FAILED,					"Unable to read from cursor: %s")
 
 //	Message Table --------------------------------------------------------------
 
+DECLARE_CONST_STRING(MSG_AEON_CLOSE_CURSOR,				"Aeon.closeCursor")
+DECLARE_CONST_STRING(MSG_AEON_COMPACT_TABLE_TEST,		"Aeon.compactTableTest")
 DECLARE_CONST_STRING(MSG_AEON_CREATE_TABLE,				"Aeon.createTable")
 DECLARE_CONST_STRING(MSG_AEON_DELETE,					"Aeon.delete")
+DECLARE_CONST_STRING(MSG_AEON_DELETE_RANGE,				"Aeon.deleteRange")
 DECLARE_CONST_STRING(MSG_AEON_DELETE_TABLE,				"Aeon.deleteTable")
 DECLARE_CONST_STRING(MSG_AEON_DELETE_VIEW,				"Aeon.deleteView")
+DECLARE_CONST_STRING(MSG_AEON_FETCH_CURSOR,				"Aeon.fetchCursor")
 DECLARE_CONST_STRING(MSG_AEON_FILE_DIRECTORY,			"Aeon.fileDirectory")
 DECLARE_CONST_STRING(MSG_AEON_FILE_DOWNLOAD,			"Aeon.fileDownload")
 DECLARE_CONST_STRING(MSG_AEON_FILE_GET_DESC,			"Aeon.fileGetDesc")
@@ -99,29 +131,68 @@ DECLARE_CONST_STRING(MSG_AEON_GET_ROWS,					"Aeon.getRows")
 DECLARE_CONST_STRING(MSG_AEON_GET_TABLES,				"Aeon.getTables")
 DECLARE_CONST_STRING(MSG_AEON_GET_DATA,					"Aeon.getValue")
 DECLARE_CONST_STRING(MSG_AEON_GET_VIEW_INFO,			"Aeon.getViewInfo")
+DECLARE_CONST_STRING(MSG_AEON_HOUSEKEEP_TABLE_TEST,		"Aeon.housekeepTableTest")
 DECLARE_CONST_STRING(MSG_AEON_INSERT,					"Aeon.insert")
+DECLARE_CONST_STRING(MSG_AEON_INSERT_MANY,				"Aeon.insertMany")
 DECLARE_CONST_STRING(MSG_AEON_INSERT_NEW,				"Aeon.insertNew")
 DECLARE_CONST_STRING(MSG_AEON_MUTATE,					"Aeon.mutate")
+DECLARE_CONST_STRING(MSG_AEON_MUTATE_MANY,				"Aeon.mutateMany")
+DECLARE_CONST_STRING(MSG_AEON_OPEN_CURSOR,				"Aeon.openCursor")
 DECLARE_CONST_STRING(MSG_AEON_RECOVER_TABLE_TEST,		"Aeon.recoverTableTest")
+DECLARE_CONST_STRING(MSG_AEON_SCRUB_TABLE_TEST,			"Aeon.scrubTableTest")
+DECLARE_CONST_STRING(MSG_AEON_SEARCH_TEXT,				"Aeon.searchText")
+DECLARE_CONST_STRING(MSG_AEON_SET_LEGACY_ROW_FORMAT,	"Aeon.setLegacyRowFormat")
+DECLARE_CONST_STRING(MSG_AEON_SET_LOG_SYNC,				"Aeon.setLogSync")
+DECLARE_CONST_STRING(MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	"Aeon.setSegmentBlockSize")
+DECLARE_CONST_STRING(MSG_AEON_SET_SEGMENT_COMPRESSION,	"Aeon.setSegmentCompression")
+DECLARE_CONST_STRING(MSG_AEON_SET_SEGMENT_MAPPING,		"Aeon.setSegmentMapping")
+DECLARE_CONST_STRING(MSG_AEON_SET_VIEW_UPDATE_THREADS,	"Aeon.setViewUpdateThreads")
 DECLARE_CONST_STRING(MSG_AEON_WAIT_FOR_VIEW,			"Aeon.waitForView")
 DECLARE_CONST_STRING(MSG_AEON_WAIT_FOR_VOLUME,			"Aeon.waitForVolume")
+DECLARE_CONST_STRING(MSG_ARC_GET_STATUS,				"Arc.getStatus")
 DECLARE_CONST_STRING(MSG_ARC_HOUSEKEEPING,				"Arc.housekeeping")
 DECLARE_CONST_STRING(MSG_EXARCH_ON_MACHINE_START,		"Exarch.onMachineStart")
 DECLARE_CONST_STRING(MSG_TRANSPACE_DOWNLOAD,			"Transpace.download")
 
+const int COMPACTION_THREAD_COUNT =						2;
+const DWORD DEFAULT_COMPACTION_RATE =					32 * 1024 * 1024;	//	Bytes per second (shared by all threads)
+const DWORD CURSOR_LEASE =								5 * 60 * 1000;		//	Renewed on every fetch
+const DWORD MIN_CURSOR_LEASE =							1000;
+const DWORD DEFAULT_CURSOR_FETCH_SIZE =					1024 * 1024;		//	Bytes per fetch
+const DWORD MAX_CURSOR_FETCH_SIZE =						16 * 1024 * 1024;
+const int DEFAULT_SEARCH_RESULTS =						100;
+const int MAX_OPEN_TABLE_THREADS =						8;
+
 CAeonEngine::SMessageHandler CAeonEngine::m_MsgHandlerList[] =
 	{
+		//	Aeon.closeCursor {cursorID}
+		{	MSG_AEON_CLOSE_CURSOR,				&CAeonEngine::MsgCloseCursor },
+
+#ifdef DEBUG
+		//	Aeon.compactTableTest {tableName}
+		{	MSG_AEON_COMPACT_TABLE_TEST,		&CAeonEngine::MsgCompactTableTest },
+#endif
+
 		//	Aeon.createTable {tableDesc}
 		//
 		//	{tableDesc} = { name: "MyTable1" x: { keyType: "utf8"} y: { keyType: "int32" } z: { keyType: "dateTime" }}
 		{	MSG_AEON_CREATE_TABLE,				&CAeonEngine::MsgCreateTable },
 
+		//	Aeon.deleteRange {tableName} {keyPrefix}
+		//	Aeon.deleteRange {tableName} {fromKey} {toKey}
+		//
+		//	Deletes all rows starting with the prefix, or in [fromKey, toKey).
+		{	MSG_AEON_DELETE_RANGE,				&CAeonEngine::MsgDeleteRange },
+
 		//	Aeon.deleteTable {tableName}
 		{	MSG_AEON_DELETE_TABLE,				&CAeonEngine::MsgDeleteTable },
 
 		//	Aeon.deleteView {tableAndView}
 		{	MSG_AEON_DELETE_VIEW,				&CAeonEngine::MsgDeleteView },
 
+		//	Aeon.fetchCursor {cursorID} [{maxBytes}]
+		{	MSG_AEON_FETCH_CURSOR,				&CAeonEngine::MsgFetchCursor },
+
 		//	Aeon.fileDirectory {filePath}
 		{	MSG_AEON_FILE_DIRECTORY,			&CAeonEngine::MsgFileDirectory },
 
@@ -155,26 +226,71 @@ CAeonEngine::SMessageHandler CAeonEngine::m_MsgHandlerList[] =
 		//	Aeon.getTables
 		{	MSG_AEON_GET_TABLES,				&CAeonEngine::MsgGetTables },
 
+#ifdef DEBUG
+		//	Aeon.housekeepTableTest {tableName} [{maxMemoryUse}]
+		{	MSG_AEON_HOUSEKEEP_TABLE_TEST,		&CAeonEngine::MsgHousekeepTableTest },
+#endif
+
 		//	Aeon.insert {tableName} {rowPath} {data}
 		//
 		//	{rowPath} is an array with as many elements as the table dimensions
 		{	MSG_AEON_INSERT,					&CAeonEngine::MsgInsert },
 
+		//	Aeon.insertMany {tableName} (({rowPath} {data}) ...) [{options}]
+		{	MSG_AEON_INSERT_MANY,				&CAeonEngine::MsgInsertMany },
+
 		//	Aeon.insertNew {tableName} {rowPath} {data}
 		{	MSG_AEON_INSERT_NEW,				&CAeonEngine::MsgInsertNew },
 
 		//	Aeon.mutate {tableName} {rowPath} {struct} {mutationDesc}
 		{	MSG_AEON_MUTATE,					&CAeonEngine::MsgMutate },
 
-		//	Aeon.recoverTableTest {tableName}
+		//	Aeon.mutateMany {tableName} (({rowPath} {struct} {mutationDesc}) ...)
+		{	MSG_AEON_MUTATE_MANY,				&CAeonEngine::MsgMutateMany },
+
+		//	Aeon.openCursor {tableAndView} [{key}] [{options}] [{filter}] [{fields}] [{leaseSeconds}]
+		{	MSG_AEON_OPEN_CURSOR,				&CAeonEngine::MsgOpenCursor },
+
+		//	Aeon.recoverTableTest {tableName} [tornTail]
 		{	MSG_AEON_RECOVER_TABLE_TEST,		&CAeonEngine::MsgRecoverTableTest },
 
+#ifdef DEBUG
+		//	Aeon.scrubTableTest {tableName}
+		{	MSG_AEON_SCRUB_TABLE_TEST,			&CAeonEngine::MsgScrubTableTest },
+#endif
+
+		//	Aeon.searchText {tableAndView} {query} [{count}]
+		{	MSG_AEON_SEARCH_TEXT,				&CAeonEngine::MsgSearchText },
+
+#ifdef DEBUG
+		//	Aeon.setLegacyRowFormat true|nil
+		{	MSG_AEON_SET_LEGACY_ROW_FORMAT,		&CAeonEngine::MsgSetLegacyRowFormat },
+
+		//	Aeon.setLogSync batch|interval|os [{intervalMS}]
+		{	MSG_AEON_SET_LOG_SYNC,				&CAeonEngine::MsgSetLogSync },
+
+		//	Aeon.setSegmentBlockSize {bytes}
+		{	MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	&CAeonEngine::MsgSetSegmentBlockSize },
+
+		//	Aeon.setSegmentCompression none|lz|zlib
+		{	MSG_AEON_SET_SEGMENT_COMPRESSION,	&CAeonEngine::MsgSetSegmentCompression },
+
+		//	Aeon.setSegmentMapping true|nil
+		{	MSG_AEON_SET_SEGMENT_MAPPING,		&CAeonEngine::MsgSetSegmentMapping },
+
+		//	Aeon.setViewUpdateThreads {maxThreads} [{minRowsPerThread}]
+		{	MSG_AEON_SET_VIEW_UPDATE_THREADS,	&CAeonEngine::MsgSetViewUpdateThreads },
+#endif
+
 		//	Aeon.waitForView {tableAndView}
 		{	MSG_AEON_WAIT_FOR_VIEW,				&CAeonEngine::MsgWaitForView },
 
 		//	Aeon.waitForVolume {volume}
 		{	MSG_AEON_WAIT_FOR_VOLUME,			&CAeonEngine::MsgWaitForVolume },
 
+		//	Arc.getStatus
+		{	MSG_ARC_GET_STATUS,					&CAeonEngine::MsgGetStatus },
+
 		//	Arc.housekeeping
 		{	MSG_ARC_HOUSEKEEPING,				&CAeonEngine::MsgHousekeeping },
 
@@ -204,10 +320,37 @@ CAeonEngine::~CAeonEngine (void)
 	{
 	int i;
 
+	for (i = 0; i < m_CompactionThreads.GetCount(); i++)
+		delete m_CompactionThreads[i];
+
 	for (i = 0; i < m_Tables.GetCount(); i++)
 		delete m_Tables[i];
 	}
 
+void CAeonEngine::CompactTables (void)
+
+//	CompactTables
+//
+//	Called periodically by the compaction threads to merge segments.
+
+	{
+	int i;
+
+	if (!m_bReady)
+		return;
+
+	TArray<CAeonTable *> AllTables;
+	GetTables(&AllTables);
+
+	for (i = 0; i < AllTables.GetCount(); i++)
+		{
+		if (m_CompactionQuit.IsSet())
+			break;
+
+		AllTables[i]->Compact(m_CompactionLimiter);
+		}
+	}
+
 bool CAeonEngine::CreateTable (CDatum dDesc, CAeonTable **retpTable, bool *retbExists, CString *retsError)
 
 //	CreateTable
@@ -408,6 +551,64 @@ bool CAeonEngine::GetViewStatus (const CString &sTable, DWORD dwViewID, bool *re
 	return pTable->GetViewStatus(dwViewID, retbUpToDate, retsError);
 	}
 
+void CAeonEngine::MsgCloseCursor (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgCloseCursor
+//
+//	Aeon.closeCursor {cursorID}
+
+	{
+	if (!m_bReady)
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, ERR_NOT_READY, Msg);
+		return;
+		}
+
+	m_Cursors.Close(Msg.dPayload.GetElement(0));
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+
+#ifdef DEBUG
+void CAeonEngine::MsgCompactTableTest (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgCompactTableTest
+//
+//	Aeon.compactTableTest {tableName}
+//
+//	Merges one run of segments in the table now (as a compaction thread
+//	would), if the table's compaction policy picks one.
+
+	{
+	//	This is an admin operation
+
+	if (!ValidateAdminAccess(Msg, pSecurityCtx))
+		return;
+
+	//	Get the table
+
+	const CString &sTable = Msg.dPayload.GetElement(0);
+
+	CAeonTable *pTable;
+	if (!FindTable(sTable, &pTable))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(STR_ERROR_UNKNOWN_TABLE, sTable), Msg);
+		return;
+		}
+
+	//	Compact
+
+	if (!pTable->Compact(m_CompactionLimiter))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_COMPACTION_FAILED, sTable), Msg);
+		return;
+		}
+
+	//	Done
+
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+#endif
+
 void CAeonEngine::MsgCreateTable (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
 
 //	MsgCreateTable
@@ -456,6 +657,46 @@ void CAeonEngine::MsgCreateTable (const SArchonMessage &Msg, const CHexeSecurity
 	SendMessageReply(MSG_OK, CDatum(), Msg);
 	}
 
+void CAeonEngine::MsgDeleteRange (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgDeleteRange
+//
+//	Aeon.deleteRange {tableName} {keyPrefix}
+//	Aeon.deleteRange {tableName} {fromKey} {toKey}
+
+	{
+	const CString &sTable = Msg.dPayload.GetElement(0);
+	CDatum dFrom = Msg.dPayload.GetElement(1);
+	CDatum dTo = Msg.dPayload.GetElement(2);
+
+	//	Make sure we are allowed access to this table
+
+	if (!ValidateTableAccess(Msg, pSecurityCtx, sTable))
+		return;
+
+	//	If the table doesn't exist, then we can't continue
+
+	CAeonTable *pTable;
+	if (!FindTable(sTable, &pTable))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(STR_ERROR_UNKNOWN_TABLE, sTable), Msg);
+		return;
+		}
+
+	//	Delete
+
+	CString sError;
+	if (!pTable->DeleteRange(dFrom, dTo, &sError))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	//	Done
+
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+
 void CAeonEngine::MsgDeleteView (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
 
 //	MsgDeleteView
@@ -532,6 +773,87 @@ void CAeonEngine::MsgDeleteTable (const SArchonMessage &Msg, const CHexeSecurity
 	SendMessageReply(MSG_OK, CDatum(), Msg);
 	}
 
+void CAeonEngine::MsgFetchCursor (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgFetchCursor
+//
+//	Aeon.fetchCursor {cursorID} [{maxBytes}]
+//
+//	Returns the next batch of rows (in the same format as Aeon.getRows). We
+//	stop after about {maxBytes} of row data. When there are no more rows we
+//	return Nil and close the cursor.
+
+	{
+	if (!m_bReady)
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, ERR_NOT_READY, Msg);
+		return;
+		}
+
+	CString sCursorID = Msg.dPayload.GetElement(0);
+
+	//	Figure out how much to return
+
+	DWORD dwMaxBytes = DEFAULT_CURSOR_FETCH_SIZE;
+	CDatum dMaxBytes = Msg.dPayload.GetElement(1);
+	if (!dMaxBytes.IsNil() && (int)dMaxBytes > 0)
+		dwMaxBytes = Min((DWORD)(int)dMaxBytes, MAX_CURSOR_FETCH_SIZE);
+
+	//	Get the cursor. From here on we need to unlock it.
+
+	CString sTable;
+	CString sError;
+	CAeonCursor *pCursor = m_Cursors.Lock(sCursorID, &sTable, &sError);
+	if (pCursor == NULL)
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	//	Make sure the caller can still read the table
+
+	if (!ValidateTableAccess(Msg, pSecurityCtx, sTable))
+		{
+		m_Cursors.Unlock(sCursorID);
+		return;
+		}
+
+	//	Read. The cursor doesn't have the table, so if we get a disk error
+	//	we just close it; the client can reopen (after the table recovers).
+
+	CDatum dResult;
+	bool bSuccess;
+	try
+		{
+		bSuccess = pCursor->Fetch(-1, dwMaxBytes, &dResult, &sError);
+		}
+	catch (CException e)
+		{
+		sError = strPattern(ERR_CURSOR_FAILED, e.GetErrorString());
+		bSuccess = false;
+		}
+	catch (...)
+		{
+		sError = strPattern(ERR_CURSOR_FAILED, sCursorID);
+		bSuccess = false;
+		}
+
+	if (!bSuccess)
+		{
+		m_Cursors.Unlock(sCursorID, true);
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	//	If we're done, close the cursor. NOTE: If the filter skipped every row
+	//	we read, we may return an empty batch before we're done.
+
+	bool bDone = (dResult.GetCount() == 0 && !pCursor->HasMore());
+	m_Cursors.Unlock(sCursorID, bDone);
+
+	SendMessageReply(MSG_REPLY_DATA, (bDone ? CDatum() : dResult), Msg);
+	}
+
 void CAeonEngine::MsgFileDirectory (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
 
 //	MsgFileDirectory
@@ -885,8 +1207,12 @@ void CAeonEngine::MsgGetRows (const SArchonMessage &Msg, const CHexeSecurityCtx
 
 //	MsgGetRows
 //
-//	Aeon.getRows {tableAndView} {key} {count}
-//	Aeon.getMoreRows {tableAndView} {lastKey} {count}
+//	Aeon.getRows {tableAndView} {key} {count} [{options}] [{filter}] [{fields}]
+//	Aeon.getMoreRows {tableAndView} {lastKey} {count} [{options}] [{filter}] [{fields}]
+//
+//	{filter} is a function (or a HexeLisp expression that evaluates to a
+//	function) that takes a row and returns non-nil to include it. {fields} is
+//	a list of fields to return for each row.
 
 	{
 	int i;
@@ -920,30 +1246,20 @@ void CAeonEngine::MsgGetRows (const SArchonMessage &Msg, const CHexeSecurityCtx
 			Limits[i - 1] = (int)dLimits.GetElement(i);
 		}
 
-	//	Set up flags and options
+	//	Set up flags, options, and projection
 
-	DWORD dwFlags = 0;
-	dwFlags |= (strEquals(Msg.sMsg, MSG_AEON_GET_ROWS) ? 0 : CAeonTable::FLAG_MORE_ROWS);
+	DWORD dwFlags;
+	TArray<CString> Fields;
+	if (!ParseRowOptions(Msg, Msg.dPayload.GetElement(3), Msg.dPayload.GetElement(5), &dwFlags, &Fields))
+		return;
 
-	CDatum dOptions = Msg.dPayload.GetElement(3);
-	for (i = 0; i < dOptions.GetCount(); i++)
-		{
-		if (strEquals(dOptions.GetElement(i), OPTION_INCLUDE_KEY))
-			dwFlags |= CAeonTable::FLAG_INCLUDE_KEY;
-		else if (strEquals(dOptions.GetElement(i), OPTION_NO_KEY))
-			dwFlags |= CAeonTable::FLAG_NO_KEY;
-		else
-			{
-			SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_INVALID_GET_ROWS_OPTION, Msg.sMsg, dOptions.GetElement(i).AsString()), Msg);
-			return;
-			}
-		}
+	dwFlags |= (strEquals(Msg.sMsg, MSG_AEON_GET_ROWS) ? 0 : CAeonTable::FLAG_MORE_ROWS);
 
 	//	Ask the table
 
 	CDatum dResult;
 	CString sError;
-	if (!pTable->GetRows(dwViewID, Msg.dPayload.GetElement(1), iRowCount, Limits, dwFlags, &dResult, &sError))
+	if (!pTable->GetRows(dwViewID, Msg.dPayload.GetElement(1), iRowCount, Limits, dwFlags, Msg.dPayload.GetElement(4), Fields, &dResult, &sError))
 		{
 		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
 		return;
@@ -954,6 +1270,33 @@ void CAeonEngine::MsgGetRows (const SArchonMessage &Msg, const CHexeSecurityCtx
 	SendMessageReply(MSG_REPLY_DATA, dResult, Msg);
 	}
 
+void CAeonEngine::MsgGetStatus (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgGetStatus
+//
+//	Arc.getStatus
+
+	{
+	CAeonBlockCache::SStats Stats;
+	CSegmentBlockCache::GetSharedCache().GetStats(&Stats);
+
+	//	Compose into a struct
+
+	CComplexStruct *pResult = new CComplexStruct;
+	pResult->SetElement(FIELD_BLOCK_CACHE_BLOCKS, CDatum(Stats.iBlockCount));
+	pResult->SetElement(FIELD_BLOCK_CACHE_BYTES, CDatum(Stats.dwBytesUsed));
+	pResult->SetElement(FIELD_BLOCK_CACHE_EVICTIONS, CDatum(Stats.dwEvictions));
+	pResult->SetElement(FIELD_BLOCK_CACHE_HITS, CDatum(Stats.dwHits));
+	pResult->SetElement(FIELD_BLOCK_CACHE_MAX_BYTES, CDatum(Stats.dwMaxBytes));
+	pResult->SetElement(FIELD_BLOCK_CACHE_MISSES, CDatum(Stats.dwMisses));
+	pResult->SetElement(FIELD_SEGMENTS_MAPPED, CDatum(CSegmentBlockCache::GetMappedCount()));
+	pResult->SetElement(FIELD_SEGMENTS_UNMAPPED, CDatum(CSegmentBlockCache::GetUnmappedCount()));
+
+	//	Done
+
+	SendMessageReply(MSG_REPLY_DATA, CDatum(pResult), Msg);
+	}
+
 void CAeonEngine::MsgGetTables (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
 
 //	MsgGetTables
@@ -1044,31 +1387,38 @@ void CAeonEngine::MsgHousekeeping (const SArchonMessage &Msg, const CHexeSecurit
 	DWORD dwMemoryPerTable = 2 * m_dwMaxMemoryUse / AllTables.GetCount();
 
 	//	Loop over all tables and let them do some housekeeping tasks (such as
-	//	saving updated rows and compacting segments).
+	//	saving updated rows). Compacting segments happens on the compaction
+	//	threads.
 
 	for (i = 0; i < AllTables.GetCount(); i++)
 		AllTables[i]->Housekeeping(dwMemoryPerTable);
+
+	//	Close cursors whose lease has expired (so that they release the
+	//	segments they hold).
+
+	m_Cursors.DeleteExpired();
 	}
 
-void CAeonEngine::MsgInsert (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+#ifdef DEBUG
+void CAeonEngine::MsgHousekeepTableTest (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
 
-//	MsgInsert
+//	MsgHousekeepTableTest
 //
-//	Aeon.insert {tableName} {rowPath} {data}
+//	Aeon.housekeepTableTest {tableName} [{maxMemoryUse}]
 //
-//	{rowPath} is an array with as many elements as the table dimensions
+//	Runs one housekeeping pass on the table now (as Arc.housekeeping does),
+//	letting it keep up to {maxMemoryUse} bytes of rows in memory before it
+//	saves them to a segment.
 
 	{
-	const CString &sTable = Msg.dPayload.GetElement(0);
-	CDatum dRowPath = Msg.dPayload.GetElement(1);
-	CDatum dData = Msg.dPayload.GetElement(2);
-
-	//	Make sure we are allowed access to this table
+	//	This is an admin operation
 
-	if (!ValidateTableAccess(Msg, pSecurityCtx, sTable))
+	if (!ValidateAdminAccess(Msg, pSecurityCtx))
 		return;
 
-	//	If the table doesn't exist, then we can't continue
+	//	Get the table
+
+	const CString &sTable = Msg.dPayload.GetElement(0);
 
 	CAeonTable *pTable;
 	if (!FindTable(sTable, &pTable))
@@ -1077,21 +1427,14 @@ void CAeonEngine::MsgInsert (const SArchonMessage &Msg, const CHexeSecurityCtx *
 		return;
 		}
 
-	//	Parse the path
-
-	CString sError;
-	CRowKey Path;
-	if (!pTable->ParseDimensionPathForCreate(dRowPath, &Path, &sError))
-		{
-		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
-		return;
-		}
+	CDatum dMaxMemoryUse = Msg.dPayload.GetElement(1);
+	DWORD dwMaxMemoryUse = (dMaxMemoryUse.IsNil() ? m_dwMaxMemoryUse : (DWORD)(int)dMaxMemoryUse);
 
-	//	Insert
+	//	Housekeeping
 
-	if (!pTable->Insert(Path, dData, &sError))
+	if (!pTable->Housekeeping(dwMaxMemoryUse))
 		{
-		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_HOUSEKEEPING_FAILED, sTable), Msg);
 		return;
 		}
 
@@ -1099,18 +1442,17 @@ void CAeonEngine::MsgInsert (const SArchonMessage &Msg, const CHexeSecurityCtx *
 
 	SendMessageReply(MSG_OK, CDatum(), Msg);
 	}
+#endif
 
-void CAeonEngine::MsgInsertNew (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+void CAeonEngine::MsgInsert (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
 
-//	MsgInsertNew
+//	MsgInsert
 //
-//	Aeon.insertNew {tableName} {rowPath} {data}
+//	Aeon.insert {tableName} {rowPath} {data}
 //
 //	{rowPath} is an array with as many elements as the table dimensions
 
 	{
-	AEONERR error;
-
 	const CString &sTable = Msg.dPayload.GetElement(0);
 	CDatum dRowPath = Msg.dPayload.GetElement(1);
 	CDatum dData = Msg.dPayload.GetElement(2);
@@ -1141,12 +1483,9 @@ void CAeonEngine::MsgInsertNew (const SArchonMessage &Msg, const CHexeSecurityCt
 
 	//	Insert
 
-	if (error = pTable->Insert(Path, dData, true, &sError))
+	if (!pTable->Insert(Path, dData, &sError))
 		{
-		if (error == AEONERR_ALREADY_EXISTS)
-			SendMessageReplyError(MSG_ERROR_ALREADY_EXISTS, sError, Msg);
-		else
-			SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
 		return;
 		}
 
@@ -1155,17 +1494,157 @@ void CAeonEngine::MsgInsertNew (const SArchonMessage &Msg, const CHexeSecurityCt
 	SendMessageReply(MSG_OK, CDatum(), Msg);
 	}
 
-void CAeonEngine::MsgMutate (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+void CAeonEngine::MsgInsertMany (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
 
-//	MsgMutate
+//	MsgInsertMany
 //
-//	Aeon.mutate {tableName} {rowPath} {data} {mutationDesc}
+//	Aeon.insertMany {tableName} (({rowPath} {data}) ...) [{options}]
+//
+//	All rows are inserted under a single lock and written to the recovery file
+//	as a single batch. If any row path is invalid, we insert none of them.
+//
+//	options:
+//
+//	insertNew: Like Aeon.insertNew, we fail with Error.alreadyExists (and
+//		insert none of the rows) if any of the rows already exists.
 
 	{
 	AEONERR error;
+	int i;
 
 	const CString &sTable = Msg.dPayload.GetElement(0);
-	CDatum dRowPath = Msg.dPayload.GetElement(1);
+	CDatum dRows = Msg.dPayload.GetElement(1);
+	CDatum dOptions = Msg.dPayload.GetElement(2);
+
+	//	Make sure we are allowed access to this table
+
+	if (!ValidateTableAccess(Msg, pSecurityCtx, sTable))
+		return;
+
+	//	If the table doesn't exist, then we can't continue
+
+	CAeonTable *pTable;
+	if (!FindTable(sTable, &pTable))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(STR_ERROR_UNKNOWN_TABLE, sTable), Msg);
+		return;
+		}
+
+	//	Parse all the paths
+
+	CString sError;
+	TArray<CRowKey> Paths;
+	TArray<CDatum> Data;
+	Paths.InsertEmpty(dRows.GetCount());
+	Data.InsertEmpty(dRows.GetCount());
+	for (i = 0; i < dRows.GetCount(); i++)
+		{
+		CDatum dRow = dRows.GetElement(i);
+		if (!pTable->ParseDimensionPathForCreate(dRow.GetElement(0), &Paths[i], &sError))
+			{
+			SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_BATCH_ROW_FAILED, i, sError), Msg);
+			return;
+			}
+
+		Data[i] = dRow.GetElement(1);
+		}
+
+	//	Parse options
+
+	bool bInsertNew = false;
+	for (i = 0; i < dOptions.GetCount(); i++)
+		{
+		if (strEquals(dOptions.GetElement(i), OPTION_INSERT_NEW))
+			bInsertNew = true;
+		else
+			{
+			SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_INVALID_GET_ROWS_OPTION, Msg.sMsg, dOptions.GetElement(i).AsString()), Msg);
+			return;
+			}
+		}
+
+	//	Insert
+
+	if (error = pTable->InsertMany(Paths, Data, bInsertNew, &sError))
+		{
+		if (error == AEONERR_ALREADY_EXISTS)
+			SendMessageReplyError(MSG_ERROR_ALREADY_EXISTS, sError, Msg);
+		else
+			SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	//	Done
+
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+
+void CAeonEngine::MsgInsertNew (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgInsertNew
+//
+//	Aeon.insertNew {tableName} {rowPath} {data}
+//
+//	{rowPath} is an array with as many elements as the table dimensions
+
+	{
+	AEONERR error;
+
+	const CString &sTable = Msg.dPayload.GetElement(0);
+	CDatum dRowPath = Msg.dPayload.GetElement(1);
+	CDatum dData = Msg.dPayload.GetElement(2);
+
+	//	Make sure we are allowed access to this table
+
+	if (!ValidateTableAccess(Msg, pSecurityCtx, sTable))
+		return;
+
+	//	If the table doesn't exist, then we can't continue
+
+	CAeonTable *pTable;
+	if (!FindTable(sTable, &pTable))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(STR_ERROR_UNKNOWN_TABLE, sTable), Msg);
+		return;
+		}
+
+	//	Parse the path
+
+	CString sError;
+	CRowKey Path;
+	if (!pTable->ParseDimensionPathForCreate(dRowPath, &Path, &sError))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	//	Insert
+
+	if (error = pTable->Insert(Path, dData, true, &sError))
+		{
+		if (error == AEONERR_ALREADY_EXISTS)
+			SendMessageReplyError(MSG_ERROR_ALREADY_EXISTS, sError, Msg);
+		else
+			SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	//	Done
+
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+
+void CAeonEngine::MsgMutate (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgMutate
+//
+//	Aeon.mutate {tableName} {rowPath} {data} {mutationDesc}
+
+	{
+	AEONERR error;
+
+	const CString &sTable = Msg.dPayload.GetElement(0);
+	CDatum dRowPath = Msg.dPayload.GetElement(1);
 	CDatum dData = Msg.dPayload.GetElement(2);
 	CDatum dMutateDesc = Msg.dPayload.GetElement(3);
 
@@ -1214,11 +1693,87 @@ void CAeonEngine::MsgMutate (const SArchonMessage &Msg, const CHexeSecurityCtx *
 	SendMessageReply(MSG_REPLY_DATA, dResult, Msg);
 	}
 
+void CAeonEngine::MsgMutateMany (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgMutateMany
+//
+//	Aeon.mutateMany {tableName} (({rowPath} {data} {mutationDesc}) ...)
+//
+//	Rows are mutated in order under a single lock. We reply with a list of 
+//	results (one per row). If a row fails, we stop and reply with an error;
+//	rows before it remain mutated.
+
+	{
+	AEONERR error;
+	int i;
+
+	const CString &sTable = Msg.dPayload.GetElement(0);
+	CDatum dRows = Msg.dPayload.GetElement(1);
+
+	//	Make sure we are allowed access to this table
+
+	if (!ValidateTableAccess(Msg, pSecurityCtx, sTable))
+		return;
+
+	//	If the table doesn't exist, then we can't continue
+
+	CAeonTable *pTable;
+	if (!FindTable(sTable, &pTable))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(STR_ERROR_UNKNOWN_TABLE, sTable), Msg);
+		return;
+		}
+
+	//	Parse all the paths (see MsgMutate for why we don't validate for create)
+
+	CString sError;
+	TArray<CRowKey> Paths;
+	TArray<CDatum> Data;
+	TArray<CDatum> MutateDescs;
+	Paths.InsertEmpty(dRows.GetCount());
+	Data.InsertEmpty(dRows.GetCount());
+	MutateDescs.InsertEmpty(dRows.GetCount());
+	for (i = 0; i < dRows.GetCount(); i++)
+		{
+		CDatum dRow = dRows.GetElement(i);
+		if (!pTable->ParseDimensionPath(NULL_STR, dRow.GetElement(0), &Paths[i], &sError))
+			{
+			SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_BATCH_ROW_FAILED, i, sError), Msg);
+			return;
+			}
+
+		Data[i] = dRow.GetElement(1);
+		MutateDescs[i] = dRow.GetElement(2);
+		}
+
+	//	Mutate
+
+	TArray<CDatum> Results;
+	if (error = pTable->MutateMany(Paths, Data, MutateDescs, &Results, &sError))
+		{
+		sError = strPattern(ERR_BATCH_ROW_FAILED, Results.GetCount(), sError);
+
+		if (error == AEONERR_OUT_OF_DATE)
+			SendMessageReplyError(MSG_ERROR_OUT_OF_DATE, sError, Msg);
+		else
+			SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	//	Done
+
+	SendMessageReply(MSG_REPLY_DATA, CDatum(new CComplexArray(Results)), Msg);
+	}
+
 void CAeonEngine::MsgRecoverTableTest (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
 
 //	MsgRecoverTableTest
 //
-//	Aeon.recoverTableTest {tableName}
+//	Aeon.recoverTableTest {tableName} [tornTail]
+//
+//	Reloads the table's in-memory rows from its recovery files. With tornTail
+//	we first leave an incomplete record at the end of each file, so that
+//	recovery must discard it.
 
 	{
 	//	This is an admin operation
@@ -1241,7 +1796,15 @@ void CAeonEngine::MsgRecoverTableTest (const SArchonMessage &Msg, const CHexeSec
 
 	//	Recover
 
+	const CString &sOption = Msg.dPayload.GetElement(1);
 	CString sError;
+	if (strEquals(sOption, OPTION_TORN_TAIL)
+			&& !pTable->WriteTornRecoveryRecordTest(&sError))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
 	if (!pTable->RecoverTableRows(&sError))
 		{
 		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
@@ -1253,6 +1816,279 @@ void CAeonEngine::MsgRecoverTableTest (const SArchonMessage &Msg, const CHexeSec
 	SendMessageReply(MSG_OK, CDatum(), Msg);
 	}
 
+#ifdef DEBUG
+void CAeonEngine::MsgScrubTableTest (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgScrubTableTest
+//
+//	Aeon.scrubTableTest {tableName}
+//
+//	Verifies the checksums of every segment in the table now (as the daily
+//	scrub does) and replies with the number of files that failed.
+
+	{
+	//	This is an admin operation
+
+	if (!ValidateAdminAccess(Msg, pSecurityCtx))
+		return;
+
+	//	Get the table
+
+	const CString &sTable = Msg.dPayload.GetElement(0);
+
+	CAeonTable *pTable;
+	if (!FindTable(sTable, &pTable))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(STR_ERROR_UNKNOWN_TABLE, sTable), Msg);
+		return;
+		}
+
+	//	Scrub
+
+	int iBadFiles;
+	CString sError;
+	if (!pTable->ScrubTest(&iBadFiles, &sError))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	//	Done
+
+	SendMessageReply(MSG_REPLY_DATA, CDatum(iBadFiles), Msg);
+	}
+#endif
+
+void CAeonEngine::MsgSearchText (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgSearchText
+//
+//	Aeon.searchText {tableAndView} {query} [{count}]
+//
+//	Searches a full-text view. {query} is a list of words, all of which must
+//	match; use OR between words for alternatives and end a word with * to
+//	match prefixes. We return up to {count} rows (most relevant first), each
+//	with the view's columns and a score.
+
+	{
+	CAeonTable *pTable;
+	DWORD dwViewID;
+	if (!ParseTableAndView(Msg, pSecurityCtx, Msg.dPayload.GetElement(0), &pTable, &dwViewID))
+		return;
+
+	CDatum dCount = Msg.dPayload.GetElement(2);
+	int iMaxResults = (dCount.IsNil() ? DEFAULT_SEARCH_RESULTS : (int)dCount);
+	if (iMaxResults <= 0)
+		iMaxResults = -1;
+
+	CDatum dResult;
+	CString sError;
+	if (!pTable->SearchText(dwViewID, Msg.dPayload.GetElement(1).AsString(), iMaxResults, &dResult, &sError))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	SendMessageReply(MSG_REPLY_DATA, dResult, Msg);
+	}
+
+#ifdef DEBUG
+void CAeonEngine::MsgSetLegacyRowFormat (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgSetLegacyRowFormat
+//
+//	Aeon.setLegacyRowFormat true|nil
+//
+//	Controls whether rows written from now on are serialized as AEONScript
+//	(as they were before the binary format). We use this to test that we can
+//	still read and migrate old segments.
+
+	{
+	//	This is an admin operation
+
+	if (!ValidateAdminAccess(Msg, pSecurityCtx))
+		return;
+
+	CAeonRowValue::SetLegacyFormat(!Msg.dPayload.GetElement(0).IsNil());
+
+	//	Done
+
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+
+void CAeonEngine::MsgSetLogSync (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgSetLogSync
+//
+//	Aeon.setLogSync batch|interval|os [{intervalMS}]
+//
+//	Sets how often recovery files are flushed to disk:
+//
+//	batch: Flush after every group of inserts (the default).
+//	interval: Flush at most once every intervalMS milliseconds.
+//	os: Let the OS decide.
+
+	{
+	//	This is an admin operation
+
+	if (!ValidateAdminAccess(Msg, pSecurityCtx))
+		return;
+
+	const CString &sPolicy = Msg.dPayload.GetElement(0);
+
+	CRowLogFile::ESyncPolicies iPolicy;
+	DWORD dwInterval = 0;
+	if (strEquals(sPolicy, SYNC_POLICY_BATCH))
+		iPolicy = CRowLogFile::syncBatch;
+	else if (strEquals(sPolicy, SYNC_POLICY_INTERVAL))
+		{
+		//	The interval must be a positive integer (we don't round floats or
+		//	parse strings).
+
+		CDatum dInterval = Msg.dPayload.GetElement(1);
+		if (dInterval.GetBasicType() != CDatum::typeInteger32 || (int)dInterval <= 0)
+			{
+			SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_INVALID_SYNC_INTERVAL, dInterval.AsString()), Msg);
+			return;
+			}
+
+		iPolicy = CRowLogFile::syncInterval;
+		dwInterval = (DWORD)(int)dInterval;
+		}
+	else if (strEquals(sPolicy, SYNC_POLICY_OS))
+		iPolicy = CRowLogFile::syncOS;
+	else
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_INVALID_SYNC_POLICY, sPolicy), Msg);
+		return;
+		}
+
+	CRowLogFile::SetSyncPolicy(iPolicy, dwInterval);
+
+	//	Done
+
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+
+void CAeonEngine::MsgSetSegmentBlockSize (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgSetSegmentBlockSize
+//
+//	Aeon.setSegmentBlockSize {bytes}
+//
+//	Sets the target size of blocks in new segments. 0 restores the default.
+
+	{
+	//	This is an admin operation
+
+	if (!ValidateAdminAccess(Msg, pSecurityCtx))
+		return;
+
+	int iSize = Msg.dPayload.GetElement(0);
+	if (iSize < 0)
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_INVALID_BLOCK_SIZE, iSize), Msg);
+		return;
+		}
+
+	CAeonSegment::SetDefaultBlockSize((DWORD)iSize);
+
+	//	Done
+
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+
+void CAeonEngine::MsgSetSegmentCompression (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgSetSegmentCompression
+//
+//	Aeon.setSegmentCompression none|lz|zlib
+//
+//	Sets the codec used for blocks in new segments (existing segments keep
+//	their codec until they are merged):
+//
+//	none: Blocks are not compressed.
+//	lz: Fast LZ compression (the default).
+//	zlib: Smaller but slower to read and write.
+
+	{
+	//	This is an admin operation
+
+	if (!ValidateAdminAccess(Msg, pSecurityCtx))
+		return;
+
+	const CString &sCodec = Msg.dPayload.GetElement(0);
+
+	ECompressionTypes iCodec;
+	if (strEquals(sCodec, COMPRESSION_NONE))
+		iCodec = compressionNone;
+	else if (strEquals(sCodec, COMPRESSION_LZ))
+		iCodec = compressionLZ;
+	else if (strEquals(sCodec, COMPRESSION_ZLIB))
+		iCodec = compressionZlib;
+	else
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_INVALID_COMPRESSION, sCodec), Msg);
+		return;
+		}
+
+	CAeonSegment::SetDefaultCodec(iCodec);
+
+	//	Done
+
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+
+void CAeonEngine::MsgSetSegmentMapping (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgSetSegmentMapping
+//
+//	Aeon.setSegmentMapping true|nil
+//
+//	Controls whether segments opened from now on are mapped into memory or
+//	read into the block cache. Segments that are already open keep their
+//	read path. 32-bit processes never map segments.
+
+	{
+	//	This is an admin operation
+
+	if (!ValidateAdminAccess(Msg, pSecurityCtx))
+		return;
+
+	CSegmentBlockCache::SetMapSegments(!Msg.dPayload.GetElement(0).IsNil());
+
+	//	Done
+
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+
+void CAeonEngine::MsgSetViewUpdateThreads (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgSetViewUpdateThreads
+//
+//	Aeon.setViewUpdateThreads {maxThreads} [{minRowsPerThread}]
+//
+//	Sets how many worker threads rebuild a secondary view. We use one thread
+//	for every minRowsPerThread primary rows, up to maxThreads. Nil or 0 means
+//	use the default.
+
+	{
+	//	This is an admin operation
+
+	if (!ValidateAdminAccess(Msg, pSecurityCtx))
+		return;
+
+	int iMaxThreads = (int)Msg.dPayload.GetElement(0);
+	int iMinRows = (int)Msg.dPayload.GetElement(1);
+
+	CAeonTable::SetViewUpdateThreads(iMaxThreads, (DWORDLONG)Max(0, iMinRows));
+
+	//	Done
+
+	SendMessageReply(MSG_OK, CDatum(), Msg);
+	}
+#endif
+
 void CAeonEngine::MsgOnMachineStart (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
 
 //	MsgOnMachineStart
@@ -1372,6 +2208,62 @@ void CAeonEngine::MsgOnMnemosynthModified (const SArchonMessage &Msg, const CHex
 		}
 	}
 
+void CAeonEngine::MsgOpenCursor (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
+
+//	MsgOpenCursor
+//
+//	Aeon.openCursor {tableAndView} [{key}] [{options}] [{filter}] [{fields}] [{leaseSeconds}]
+//
+//	Opens a cursor starting at {key} (or at the first row) and returns its ID.
+//	Options, filter, and fields are the same as for Aeon.getRows. The cursor
+//	sees the rows as they were when it was opened. Use Aeon.fetchCursor to
+//	read rows; the cursor expires if it is not used for {leaseSeconds} (by
+//	default, and at most, 5 minutes).
+
+	{
+	CAeonTable *pTable;
+	DWORD dwViewID;
+	if (!ParseTableAndView(Msg, pSecurityCtx, Msg.dPayload.GetElement(0), &pTable, &dwViewID))
+		return;
+
+	DWORD dwFlags;
+	TArray<CString> Fields;
+	if (!ParseRowOptions(Msg, Msg.dPayload.GetElement(2), Msg.dPayload.GetElement(4), &dwFlags, &Fields))
+		return;
+
+	DWORD dwLease = CURSOR_LEASE;
+	CDatum dLease = Msg.dPayload.GetElement(5);
+	if (!dLease.IsNil())
+		{
+		int iSeconds = Max(0, Min((int)dLease, (int)(CURSOR_LEASE / 1000)));
+		dwLease = Max(MIN_CURSOR_LEASE, (DWORD)iSeconds * 1000);
+		}
+
+	//	Open the cursor
+
+	CAeonCursor *pCursor = new CAeonCursor;
+	CString sError;
+	if (!pTable->OpenCursor(dwViewID, Msg.dPayload.GetElement(1), TArray<int>(), dwFlags, Msg.dPayload.GetElement(3), Fields, pCursor, &sError))
+		{
+		delete pCursor;
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	//	Remember it (this takes ownership of the cursor).
+
+	CString sCursorID;
+	if (!m_Cursors.Open(pTable->GetName(), pCursor, dwLease, &sCursorID, &sError))
+		{
+		SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, sError, Msg);
+		return;
+		}
+
+	//	Done
+
+	SendMessageReply(MSG_REPLY_DATA, CDatum(sCursorID), Msg);
+	}
+
 void CAeonEngine::MsgTranspaceDownload (const SArchonMessage &Msg, const CHexeSecurityCtx *pSecurityCtx)
 
 //	MsgTranspaceDownload
@@ -1469,6 +2361,15 @@ void CAeonEngine::OnBoot (void)
 
 	m_dwMaxMemoryUse = (DWORD)Min((DWORDLONG)INT_MAX, Memory.dwlTotalPhysicalMemory / 5);
 
+	//	The shared segment block cache gets half as much as the row caches.
+
+	CSegmentBlockCache::GetSharedCache().SetMaxMemory(m_dwMaxMemoryUse / 2);
+
+	//	Limit how fast we write merged segments so that compaction doesn't
+	//	starve foreground I/O.
+
+	m_CompactionLimiter.SetRate(DEFAULT_COMPACTION_RATE);
+
 	//	Register our ports
 
 	AddPort(ADDRESS_AEON_COMMAND);
@@ -1496,6 +2397,8 @@ void CAeonEngine::OnMarkEx (void)
 
 	for (i = 0; i < m_Tables.GetCount(); i++)
 		m_Tables[i]->Mark();
+
+	m_Cursors.Mark();
 	}
 
 void CAeonEngine::OnStartRunning (void)
@@ -1505,6 +2408,8 @@ void CAeonEngine::OnStartRunning (void)
 //	Start running
 
 	{
+	int i;
+
 	//	If we're in console mode, then we never get a machine start message, so 
 	//	we need to initialize everything here.
 
@@ -1517,6 +2422,24 @@ void CAeonEngine::OnStartRunning (void)
 			return;
 			}
 		}
+
+	//	Start the threads that merge segments in the background.
+
+	m_CompactionQuit.Create();
+	for (i = 0; i < COMPACTION_THREAD_COUNT; i++)
+		{
+		CAeonCompactionThread *pThread = new CAeonCompactionThread(this);
+		m_CompactionThreads.Insert(pThread);
+		pThread->Start();
+		}
+
+	//	Start loading blocks ahead of sequential readers.
+
+	CSegmentBlockCache::GetReadAhead().StartReadAhead();
+
+	//	Flush interval-synced recovery logs that go idle.
+
+	CRowLogFile::GetFlusher().StartFlusher();
 	}
 
 void CAeonEngine::OnStopRunning (void)
@@ -1526,8 +2449,23 @@ void CAeonEngine::OnStopRunning (void)
 //	Stop running
 
 	{
+	int i;
+
+	//	Stop compacting. Threads finish the current merge before exiting.
+
+	if (m_CompactionThreads.GetCount() > 0)
+		{
+		m_CompactionQuit.Set();
+		for (i = 0; i < m_CompactionThreads.GetCount(); i++)
+			m_CompactionThreads[i]->Wait();
+		}
+
+	CSegmentBlockCache::GetReadAhead().StopReadAhead();
+
 	FlushTableRows();
 
+	CRowLogFile::GetFlusher().StopFlusher();
+
 #ifdef DEBUG
 	printf("AeonDB terminated.\n");
 #endif
@@ -1584,7 +2522,6 @@ bool CAeonEngine::OpenTableDefinitions (void)
 	CSmartLock Lock(m_cs);
 
 	int i, j;
-	CString sError;
 
 	//	Loop over all volumes and end up with a list of tables and volumes
 
@@ -1603,25 +2540,118 @@ bool CAeonEngine::OpenTableDefinitions (void)
 			}
 		}
 
-	//	Open all tables
+	//	Open all tables in parallel. Most of the time goes to replaying
+	//	recovery logs, and each table has its own.
+	//
+	//	NOTE: We block this thread until the workers are done, so garbage
+	//	collection can't run while they create datums.
+
+	DWORD dwStart = sysGetTickCount();
 
+	SAeonOpenTableRange Range;
+	Range.Tables.InsertEmpty(Tables.GetCount());
 	for (i = 0; i < Tables.GetCount(); i++)
 		{
-		CString sName = Tables.GetKey(i);
+		Range.Tables[i].sName = Tables.GetKey(i);
+		Range.Tables[i].Volumes = Tables[i];
+		}
+
+	TArray<CAeonOpenTableThread *> Threads;
+	int iThreads = Min(MAX_OPEN_TABLE_THREADS, Range.Tables.GetCount());
+	for (i = 0; i < iThreads; i++)
+		{
+		CAeonOpenTableThread *pThread = new CAeonOpenTableThread(this, &Range);
+		pThread->Start();
+		Threads.Insert(pThread);
+		}
+
+	for (i = 0; i < Threads.GetCount(); i++)
+		{
+		Threads[i]->Wait();
+		delete Threads[i];
+		}
+
+	//	Add the tables that we opened
+
+	for (i = 0; i < Range.Tables.GetCount(); i++)
+		{
+		SAeonOpenTableRange::STable &Table = Range.Tables[i];
+		if (Table.pTable == NULL)
+			{
+			Log(MSG_LOG_ERROR, strPattern("Unable to load %s: %s", Table.sName, Table.sError));
+			continue;
+			}
+
+		Log(MSG_LOG_INFO, strPattern(STR_TABLE_OPENED, Table.sName, Table.dwTime, Table.pTable->GetRowsRecovered()));
+		m_Tables.Insert(Table.sName, Table.pTable);
+		}
+
+	Log(MSG_LOG_INFO, strPattern(STR_TABLES_OPENED, m_Tables.GetCount(), sysGetTicksElapsed(dwStart)));
+
+	//	Done
+
+	return true;
+	}
+
+void CAeonEngine::OpenTables (SAeonOpenTableRange &Range)
+
+//	OpenTables
+//
+//	Called on each CAeonOpenTableThread. We open tables until there are none
+//	left. The caller adds the tables to m_Tables when all threads are done.
+
+	{
+	while (true)
+		{
+		int iTable = (int)::InterlockedIncrement(&Range.iNext) - 1;
+		if (iTable >= Range.Tables.GetCount())
+			break;
+
+		SAeonOpenTableRange::STable &Table = Range.Tables[iTable];
+		DWORD dwStart = sysGetTickCount();
 
 		CAeonTable *pTable = new CAeonTable;
-		if (!pTable->Open(GetProcessCtx(), &m_LocalVolumes, sName, Tables[i], &sError))
+		if (!pTable->Open(GetProcessCtx(), &m_LocalVolumes, Table.sName, Table.Volumes, &Table.sError))
 			{
-			Log(MSG_LOG_ERROR, strPattern("Unable to load %s: %s", sName, sError));
 			delete pTable;
 			continue;
 			}
 
-		m_Tables.Insert(sName, pTable);
+		Table.pTable = pTable;
+		Table.dwTime = sysGetTicksElapsed(dwStart);
 		}
+	}
 
-	//	Done
+bool CAeonEngine::ParseRowOptions (const SArchonMessage &Msg, CDatum dOptions, CDatum dFields, DWORD *retdwFlags, TArray<CString> *retFields)
+
+//	ParseRowOptions
+//
+//	Parses the options and fields of Aeon.getRows and Aeon.openCursor. If we
+//	return FALSE, we've already replied with an error.
+
+	{
+	int i;
+
+	DWORD dwFlags = 0;
+	for (i = 0; i < dOptions.GetCount(); i++)
+		{
+		if (strEquals(dOptions.GetElement(i), OPTION_INCLUDE_KEY))
+			dwFlags |= CAeonTable::FLAG_INCLUDE_KEY;
+		else if (strEquals(dOptions.GetElement(i), OPTION_NO_KEY))
+			dwFlags |= CAeonTable::FLAG_NO_KEY;
+		else
+			{
+			SendMessageReplyError(MSG_ERROR_UNABLE_TO_COMPLY, strPattern(ERR_INVALID_GET_ROWS_OPTION, Msg.sMsg, dOptions.GetElement(i).AsString()), Msg);
+			return false;
+			}
+		}
+
+	retFields->DeleteAll();
+	retFields->GrowToFit(dFields.GetCount());
+	for (i = 0; i < dFields.GetCount(); i++)
+		retFields->Insert(dFields.GetElement(i).AsString());
 
+	*retdwFlags = dwFlags;
 	return true;
 	}
 
@@ -0,0 +1,20 @@
+//	CAeonOpenTableThread.cpp
+//
+//	CAeonOpenTableThread class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	At boot we start a few of these threads to open tables (and replay their
+//	recovery logs). Each thread takes the next table from the shared list, so
+//	one large table doesn't hold up the rest.
+
+#include "stdafx.h"
+
+void CAeonOpenTableThread::Run (void)
+
+//	Run
+//
+//	Open table thread
+
+	{
+	m_pEngine->OpenTables(*m_pRange);
+	}
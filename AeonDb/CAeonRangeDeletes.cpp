@@ -0,0 +1,325 @@
+//	CAeonRangeDeletes.cpp
+//
+//	CAeonRangeDeletes class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	A range delete covers either a key prefix (a partial key) or a range of
+//	full keys, which includes from but not to. Each one is stored with the rows
+//	that were written around it: in the in-memory rows and the recovery file
+//	until we save, and then in the segment (see CAeonSegment). Segments never
+//	change, so a row in a segment at or before the sequence number is covered.
+//	A merge drops covered rows; when it includes the oldest segment there is
+//	nothing left to cover, so the merged segment drops the range deletes too.
+//
+//	We serialize a set of range deletes as:
+//
+//	DWORD		Number of range deletes
+//	for each...
+//	CString		Encoded key prefix (or first key in range)
+//	CString		Encoded key after range (empty = prefix)
+//	SEQUENCENUMBER	Sequence number
+//
+//	IsDeleted is called for every segment row we read, so we keep prefixes and
+//	ranges sorted by key and binary search them.
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(ERR_EMPTY_RANGE,					"Range to delete is empty.")
+DECLARE_CONST_STRING(ERR_FULL_KEY_REQUIRED,				"Range to delete must start and end with a full key.")
+DECLARE_CONST_STRING(ERR_PREFIX_REQUIRED,				"Key prefix to delete must have at least one dimension.")
+
+void CAeonRangeDeletes::Add (const CTableDimensions &Dims, const CRowKey &From, const CRowKey &To, SEQUENCENUMBER Seq)
+
+//	Add
+//
+//	Adds a range delete (see ParseRange). If To is empty, then From is a key
+//	prefix.
+
+	{
+	//	Prefixes are kept sorted with no duplicates (a later delete of the same
+	//	prefix covers everything the earlier one did).
+
+	if (To.GetCount() == 0)
+		{
+		int iPos = FindInsertPos(Dims, m_Prefixes, From);
+		if (iPos > 0 && CRowKey::Compare(Dims, CRowKey(Dims, m_Prefixes[iPos - 1].sFrom), From) == 0)
+			{
+			if (Seq > m_Prefixes[iPos - 1].Seq)
+				m_Prefixes[iPos - 1].Seq = Seq;
+			return;
+			}
+
+		SRange *pRange = m_Prefixes.InsertAt(iPos);
+		pRange->sFrom = From.AsEncodedString();
+		pRange->Seq = Seq;
+		}
+
+	//	Ranges are sorted by start.
+
+	else
+		{
+		int iPos = FindInsertPos(Dims, m_Ranges, From);
+		SRange *pRange = m_Ranges.InsertAt(iPos);
+		pRange->sFrom = From.AsEncodedString();
+		pRange->sTo = To.AsEncodedString();
+		pRange->Seq = Seq;
+
+		UpdateMaxTo(Dims, iPos);
+		}
+	}
+
+void CAeonRangeDeletes::DeleteAll (void)
+
+//	DeleteAll
+//
+//	Removes all range deletes.
+
+	{
+	m_Prefixes.DeleteAll();
+	m_Ranges.DeleteAll();
+	}
+
+bool CAeonRangeDeletes::Deserialize (const CTableDimensions &Dims, IByteStream &Stream)
+
+//	Deserialize
+//
+//	Adds the range deletes from the stream (see Serialize). Returns FALSE if
+//	the stream is invalid.
+
+	{
+	int i;
+
+	try
+		{
+		DWORD dwCount;
+		Stream.Read(&dwCount, sizeof(DWORD));
+
+		for (i = 0; i < (int)dwCount; i++)
+			{
+			CString sFrom = CString::Deserialize(Stream);
+			CString sTo = CString::Deserialize(Stream);
+
+			SEQUENCENUMBER Seq;
+			Stream.Read(&Seq, sizeof(Seq));
+
+			if (sFrom.IsEmpty())
+				return false;
+
+			CRowKey To;
+			if (!sTo.IsEmpty())
+				To = CRowKey(Dims, sTo);
+
+			Add(Dims, CRowKey(Dims, sFrom), To, Seq);
+			}
+		}
+	catch (...)
+		{
+		return false;
+		}
+
+	return true;
+	}
+
+int CAeonRangeDeletes::FindInsertPos (const CTableDimensions &Dims, const TArray<SRange> &List, const CRowKey &Key)
+
+//	FindInsertPos
+//
+//	Returns the number of entries in the (sorted) list whose sFrom is at or
+//	before Key. This is where we would insert Key, and the entry before it (if
+//	any) is the last one that could contain Key.
+
+	{
+	int iMin = 0;
+	int iMax = List.GetCount();
+	while (iMin < iMax)
+		{
+		int iMid = (iMin + iMax) / 2;
+		if (CRowKey::Compare(Dims, CRowKey(Dims, List[iMid].sFrom), Key) != -1)
+			iMin = iMid + 1;
+		else
+			iMax = iMid;
+		}
+
+	return iMin;
+	}
+
+SEQUENCENUMBER CAeonRangeDeletes::GetMaxSequence (void) const
+
+//	GetMaxSequence
+//
+//	Returns the highest sequence number of any range delete (0 if none).
+
+	{
+	int i;
+
+	SEQUENCENUMBER MaxSeq = 0;
+	for (i = 0; i < m_Prefixes.GetCount(); i++)
+		if (m_Prefixes[i].Seq > MaxSeq)
+			MaxSeq = m_Prefixes[i].Seq;
+
+	for (i = 0; i < m_Ranges.GetCount(); i++)
+		if (m_Ranges[i].Seq > MaxSeq)
+			MaxSeq = m_Ranges[i].Seq;
+
+	return MaxSeq;
+	}
+
+bool CAeonRangeDeletes::IsDeleted (const CTableDimensions &Dims, const CString &sKey, SEQUENCENUMBER Seq) const
+
+//	IsDeleted
+//
+//	Returns TRUE if the given row (from a segment with the given sequence
+//	number) is covered by a range delete. Seq is 0 for in-memory rows, which
+//	are never covered here (CAeonRowArray covers its own rows).
+
+	{
+	int i;
+
+	if (Seq == 0)
+		return false;
+
+	CRowKey Key(Dims, sKey);
+
+	//	A prefix covers the key only if it equals the key truncated to the same
+	//	number of dimensions, so we look up each truncation.
+
+	if (m_Prefixes.GetCount() > 0)
+		{
+		for (i = 1; i <= Dims.GetCount(); i++)
+			{
+			CRowKey Partial;
+			if (i < Dims.GetCount())
+				CRowKey::CreateFromEncodedKeyPartial(Dims, i, sKey, &Partial);
+			const CRowKey &Prefix = (i < Dims.GetCount() ? Partial : Key);
+
+			int iPos = FindInsertPos(Dims, m_Prefixes, Prefix);
+			if (iPos > 0
+					&& Seq <= m_Prefixes[iPos - 1].Seq
+					&& CRowKey::Compare(Dims, CRowKey(Dims, m_Prefixes[iPos - 1].sFrom), Prefix) == 0)
+				return true;
+			}
+		}
+
+	//	Only ranges that start at or before the key can contain it. We walk back
+	//	from the last one until no earlier range extends past the key.
+
+	if (m_Ranges.GetCount() > 0)
+		{
+		for (i = FindInsertPos(Dims, m_Ranges, Key) - 1; i >= 0; i--)
+			{
+			const SRange &Range = m_Ranges[i];
+			if (CRowKey::Compare(Dims, Key, CRowKey(Dims, Range.sMaxTo)) != 1)
+				break;
+
+			if (Seq <= Range.Seq
+					&& CRowKey::Compare(Dims, Key, CRowKey(Dims, Range.sTo)) == 1)
+				return true;
+			}
+		}
+
+	return false;
+	}
+
+bool CAeonRangeDeletes::IsInRange (const CTableDimensions &Dims, const CRowKey &From, const CRowKey &To, const CRowKey &Key)
+
+//	IsInRange
+//
+//	Returns TRUE if Key is in the range. If To is empty, then From is a prefix.
+
+	{
+	if (To.GetCount() == 0)
+		return CRowKey::ComparePartial(Dims, From, Key);
+
+	return (CRowKey::Compare(Dims, From, Key) != -1
+			&& CRowKey::Compare(Dims, Key, To) == 1);
+	}
+
+bool CAeonRangeDeletes::ParseRange (const CTableDimensions &Dims, CDatum dFrom, CDatum dTo, CRowKey *retFrom, CRowKey *retTo, CString *retsError)
+
+//	ParseRange
+//
+//	Parses a key prefix (if dTo is Nil) or a range of full keys.
+
+	{
+	if (!CRowKey::ParseKey(Dims, dFrom, retFrom, retsError))
+		return false;
+
+	//	A prefix must have at least one dimension (otherwise it would delete
+	//	the whole table).
+
+	if (dTo.IsNil())
+		{
+		if (retFrom->GetCount() == 0)
+			{
+			*retsError = ERR_PREFIX_REQUIRED;
+			return false;
+			}
+
+		return true;
+		}
+
+	//	A range needs full keys
+
+	if (!CRowKey::ParseKey(Dims, dTo, retTo, retsError))
+		return false;
+
+	if (retFrom->GetCount() != Dims.GetCount() || retTo->GetCount() != Dims.GetCount())
+		{
+		*retsError = ERR_FULL_KEY_REQUIRED;
+		return false;
+		}
+
+	if (CRowKey::Compare(Dims, *retFrom, *retTo) != 1)
+		{
+		*retsError = ERR_EMPTY_RANGE;
+		return false;
+		}
+
+	return true;
+	}
+
+void CAeonRangeDeletes::Serialize (IByteStream &Stream) const
+
+//	Serialize
+//
+//	Writes the range deletes to the stream (see Deserialize).
+
+	{
+	int i;
+
+	DWORD dwCount = m_Prefixes.GetCount() + m_Ranges.GetCount();
+	Stream.Write(&dwCount, sizeof(DWORD));
+
+	for (i = 0; i < m_Prefixes.GetCount(); i++)
+		{
+		m_Prefixes[i].sFrom.Serialize(Stream);
+		NULL_STR.Serialize(Stream);
+		Stream.Write(&m_Prefixes[i].Seq, sizeof(SEQUENCENUMBER));
+		}
+
+	for (i = 0; i < m_Ranges.GetCount(); i++)
+		{
+		m_Ranges[i].sFrom.Serialize(Stream);
+		m_Ranges[i].sTo.Serialize(Stream);
+		Stream.Write(&m_Ranges[i].Seq, sizeof(SEQUENCENUMBER));
+		}
+	}
+
+void CAeonRangeDeletes::UpdateMaxTo (const CTableDimensions &Dims, int iStart)
+
+//	UpdateMaxTo
+//
+//	Recomputes sMaxTo for ranges starting at iStart.
+
+	{
+	int i;
+
+	for (i = iStart; i < m_Ranges.GetCount(); i++)
+		{
+		SRange &Range = m_Ranges[i];
+		if (i == 0 || CRowKey::Compare(Dims, CRowKey(Dims, m_Ranges[i - 1].sMaxTo), CRowKey(Dims, Range.sTo)) == 1)
+			Range.sMaxTo = Range.sTo;
+		else
+			Range.sMaxTo = m_Ranges[i - 1].sMaxTo;
+		}
+	}
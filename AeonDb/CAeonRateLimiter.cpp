@@ -0,0 +1,62 @@
+//	CAeonRateLimiter.cpp
+//
+//	CAeonRateLimiter class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	This is a simple token bucket: we add m_dwBytesPerSecond bytes per second
+//	(up to one second's worth) and callers subtract what they write. If the
+//	bucket goes negative, the caller sleeps until it would be positive again.
+
+#include "stdafx.h"
+
+const DWORD MAX_SLEEP_TIME =				1000;
+
+void CAeonRateLimiter::Consume (DWORD dwBytes)
+
+//	Consume
+//
+//	Accounts for the given number of bytes written, sleeping if we're over
+//	the rate.
+
+	{
+	DWORD dwWait;
+
+		{
+		CSmartLock Lock(m_cs);
+		if (m_dwBytesPerSecond == 0)
+			return;
+
+		//	Refill
+
+		DWORD dwNow = sysGetTickCount();
+		DWORD dwElapsed = sysGetTicksElapsed(m_dwLastRefill, &dwNow);
+		m_dwLastRefill = dwNow;
+
+		m_iAvailable = Min((LONGLONG)m_dwBytesPerSecond, m_iAvailable + ((LONGLONG)m_dwBytesPerSecond * dwElapsed / 1000));
+		m_iAvailable -= dwBytes;
+
+		if (m_iAvailable >= 0)
+			return;
+
+		dwWait = (DWORD)Min((LONGLONG)MAX_SLEEP_TIME, (-m_iAvailable * 1000) / m_dwBytesPerSecond);
+		}
+
+	//	Sleep outside the lock so other threads can account for their writes.
+
+	if (dwWait > 0)
+		::Sleep(dwWait);
+	}
+
+void CAeonRateLimiter::SetRate (DWORD dwBytesPerSecond)
+
+//	SetRate
+//
+//	Sets the rate. 0 means unlimited.
+
+	{
+	CSmartLock Lock(m_cs);
+
+	m_dwBytesPerSecond = dwBytesPerSecond;
+	m_iAvailable = dwBytesPerSecond;
+	m_dwLastRefill = sysGetTickCount();
+	}
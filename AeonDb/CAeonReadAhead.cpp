@@ -0,0 +1,157 @@
+//	CAeonReadAhead.cpp
+//
+//	CAeonReadAhead class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	Range scans and merges read segment blocks in order, one at a time. When a
+//	segment sees that happening it asks us to load the next few blocks, so that
+//	by the time the reader gets there the block is already in memory. We never
+//	hold a reference on the segment; instead, segments call Cancel when they
+//	are destroyed and we wait until we're done with them.
+
+#include "stdafx.h"
+
+const int MAX_QUEUE_SIZE =					256;
+
+void CAeonReadAhead::Cancel (CAeonSegment *pSegment)
+
+//	Cancel
+//
+//	Removes all requests for the given segment. On return, we're guaranteed
+//	not to touch the segment again.
+
+	{
+	int i;
+
+	while (true)
+		{
+			{
+			CSmartLock Lock(m_cs);
+
+			for (i = m_Queue.GetCount() - 1; i >= 0; i--)
+				if (m_Queue[i].pSegment == pSegment)
+					m_Queue.Delete(i);
+
+			if (m_pProcessing != pSegment)
+				return;
+			}
+
+		//	We're loading a block from this segment right now. Wait for it to
+		//	finish (this is at most a single block).
+
+		::Sleep(1);
+		}
+	}
+
+void CAeonReadAhead::Request (CAeonSegment *pSegment, int iFirstBlock, int iCount)
+
+//	Request
+//
+//	Asks to load the given blocks. If we're not running (or we're too far
+//	behind) we ignore the request and the reader loads the blocks itself.
+
+	{
+	int i;
+
+	CSmartLock Lock(m_cs);
+	if (!m_bRunning || m_bQuit)
+		return;
+
+	for (i = 0; i < iCount && m_Queue.GetCount() < MAX_QUEUE_SIZE; i++)
+		{
+		SRequest *pRequest = m_Queue.Insert();
+		pRequest->pSegment = pSegment;
+		pRequest->iBlock = iFirstBlock + i;
+		}
+
+	m_WorkAvail.Set();
+	}
+
+void CAeonReadAhead::Run (void)
+
+//	Run
+//
+//	Read-ahead thread
+
+	{
+	while (true)
+		{
+		m_WorkAvail.Wait();
+
+		//	Get the next request
+
+		SRequest Request;
+			{
+			CSmartLock Lock(m_cs);
+			if (m_bQuit)
+				return;
+
+			if (m_Queue.GetCount() == 0)
+				{
+				m_WorkAvail.Reset();
+				continue;
+				}
+
+			Request = m_Queue[0];
+			m_Queue.Delete(0);
+			m_pProcessing = Request.pSegment;
+			}
+
+		//	Load the block. If this fails, the reader will get the error when
+		//	it loads the block itself.
+
+		try
+			{
+			Request.pSegment->ReadAhead(Request.iBlock);
+			}
+		catch (...)
+			{
+			}
+
+			{
+			CSmartLock Lock(m_cs);
+			m_pProcessing = NULL;
+			}
+		}
+	}
+
+void CAeonReadAhead::StartReadAhead (void)
+
+//	StartReadAhead
+//
+//	Starts the thread.
+
+	{
+	CSmartLock Lock(m_cs);
+	if (m_bRunning)
+		return;
+
+	m_WorkAvail.Create();
+	m_bQuit = false;
+	m_bRunning = true;
+
+	Start();
+	}
+
+void CAeonReadAhead::StopReadAhead (void)
+
+//	StopReadAhead
+//
+//	Stops the thread and discards pending requests.
+
+	{
+		{
+		CSmartLock Lock(m_cs);
+		if (!m_bRunning)
+			return;
+
+		m_bQuit = true;
+		m_Queue.DeleteAll();
+		m_WorkAvail.Set();
+		}
+
+	Wait();
+
+	CSmartLock Lock(m_cs);
+	m_bRunning = false;
+	}
@@ -2,22 +2,218 @@
 //
 //	CAeonRowArray class
 //	Copyright (c) 2011 by George Moromisato. All Rights Reserved.
+//
+//	The rows are stored in a skiplist. All nodes, keys, and values are
+//	allocated out of an arena, which means that the memory we report is the
+//	memory we actually use (including overhead and old versions).
+//
+//	Only one thread may modify the list at a time (we take m_cs) but readers
+//	never lock. This works because:
+//
+//	1.	We fully initialize a node (and its version) before linking it in, and
+//		we link it in from the bottom up. A reader sees a node either at all
+//		levels below some height, or not at all. Links, version pointers, and
+//		m_Seq are published with release stores (StoreNext, StoreVersion) and
+//		read with acquire loads (LoadNext, LoadVersion), so neither the
+//		compiler nor the CPU can make a node visible before its contents.
+//
+//	2.	We never unlink or free a node or version until the destructor. Every
+//		reader (including snapshots) holds a reference to the array, and views
+//		replace the array with a new one when they save it to a segment, so
+//		the arena is only freed after the last reader is done with it.
+//
+//	3.	Updating a row allocates a new version and swaps the pointer, so a
+//		reader always sees a complete value.
+//
+//	4.	A version is stamped with its sequence number before it is linked in
+//		and we bump m_Seq only after it is visible. A reader that captured a
+//		sequence number (inside the table lock) ignores later versions, so it
+//		sees the rows exactly as they were at that point.
+//
+//	5.	Range deletes are kept in a list (newest first) that is published the
+//		same way. A version reads as nil if a range delete that covers its key
+//		was written after it (and at or before the reader's sequence number).
 
 #include "stdafx.h"
 
-void CAeonRowArray::DeleteAll (void)
+//	On x86 and x64 every load has acquire semantics, so we only need to stop
+//	the compiler from reordering. Elsewhere we need a real fence.
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define ACQUIRE_FENCE()						_ReadWriteBarrier()
+#else
+#define ACQUIRE_FENCE()						MemoryBarrier()
+#endif
+
+const DWORD ARENA_CHUNK_SIZE =				64 * 1024;
+const DWORD ARENA_ALIGN =					8;
+
+//	CAeonRowArena --------------------------------------------------------------
+
+void *CAeonRowArena::Alloc (DWORD dwSize)
+
+//	Alloc
+//
+//	Allocates a block from the arena. Large blocks get their own chunk.
+
+	{
+	dwSize = AlignUp(dwSize, ARENA_ALIGN);
+
+	if (dwSize > ARENA_CHUNK_SIZE / 4)
+		{
+		char *pChunk = new char [dwSize];
+		m_Chunks.Insert(pChunk);
+		m_dwMemoryUsed += dwSize;
+		return pChunk;
+		}
+
+	if (dwSize > m_dwLeft)
+		{
+		//	We waste whatever is left in the current chunk.
+
+		m_pPos = new char [ARENA_CHUNK_SIZE];
+		m_Chunks.Insert(m_pPos);
+		m_dwLeft = ARENA_CHUNK_SIZE;
+		m_dwMemoryUsed += ARENA_CHUNK_SIZE;
+		}
+
+	void *pResult = m_pPos;
+	m_pPos += dwSize;
+	m_dwLeft -= dwSize;
+
+	return pResult;
+	}
+
+void CAeonRowArena::DeleteAll (void)
 
 //	DeleteAll
 //
-//	Deletes all rows
-	
+//	Frees all memory
+
 	{
-	CSmartLock Lock(m_cs);
+	int i;
 
-	m_Order.DeleteAll();
-	m_Rows.DeleteAll();
+	for (i = 0; i < m_Chunks.GetCount(); i++)
+		delete [] m_Chunks[i];
+
+	m_Chunks.DeleteAll();
+	m_pPos = NULL;
+	m_dwLeft = 0;
 	m_dwMemoryUsed = 0;
-	m_dwChanges = 0;
+	}
+
+//	CAeonRowArray --------------------------------------------------------------
+
+CAeonRowArray::CAeonRowArray (void) :
+		m_pHead(NULL),
+		m_pRangeDeletes(NULL),
+		m_pNilVersion(NULL),
+		m_iHeight(1),
+		m_iCount(0),
+		m_dwChanges(0),
+		m_Seq(0),
+		m_dwRandom(0x9E3779B9)
+
+//	CAeonRowArray constructor
+
+	{
+	m_pHead = AllocNode(NULL_STR, MAX_HEIGHT);
+
+	m_pNilVersion = AllocVersion(CDatum(), 0);
+	m_pNilVersion->Seq = 0;
+	}
+
+char *CAeonRowArray::AllocKey (const CString &sKey)
+
+//	AllocKey
+//
+//	Copies the key into the arena (or returns NULL if it is empty). The key is
+//	stored so that we can wrap it in a CString literal without copying: a
+//	negative length followed by the characters and a NULL.
+
+	{
+	int iKeyLen = sKey.GetLength();
+	if (iKeyLen == 0)
+		return NULL;
+
+	int *pKeyAlloc = (int *)m_Arena.Alloc(sizeof(int) + iKeyLen + 1);
+	*pKeyAlloc = -iKeyLen;
+
+	char *pKey = (char *)&pKeyAlloc[1];
+	utlMemCopy(sKey.GetParsePointer(), pKey, iKeyLen);
+	pKey[iKeyLen] = '\0';
+
+	return pKey;
+	}
+
+CAeonRowArray::SNode *CAeonRowArray::AllocNode (const CString &sKey, int iHeight)
+
+//	AllocNode
+//
+//	Allocates a new node (with no version) out of the arena.
+
+	{
+	int i;
+
+	ASSERT(iHeight > 0 && iHeight <= MAX_HEIGHT);
+
+	SNode *pNode = (SNode *)m_Arena.Alloc(sizeof(SNode) + (iHeight - 1) * sizeof(SNode *));
+	pNode->pVersion = NULL;
+	pNode->iHeight = iHeight;
+	for (i = 0; i < iHeight; i++)
+		pNode->pNext[i] = NULL;
+
+	pNode->pKey = AllocKey(sKey);
+
+	return pNode;
+	}
+
+CAeonRowArray::SVersion *CAeonRowArray::AllocVersion (CDatum dData, SEQUENCENUMBER RowID)
+
+//	AllocVersion
+//
+//	Serializes the value into a new version allocated out of the arena.
+
+	{
+	CAeonRowValue Value;
+	Value.SetValue(dData);
+
+	CBuffer Buffer;
+	Value.Serialize(Buffer);
+
+	SVersion *pVersion = (SVersion *)m_Arena.Alloc(sizeof(SVersion) + Buffer.GetLength());
+	pVersion->RowID = RowID;
+	pVersion->Seq = (SEQUENCENUMBER)m_Seq + 1;
+	pVersion->pPrev = NULL;
+	pVersion->dwSize = Buffer.GetLength();
+	pVersion->dwSpare = 0;
+	utlMemCopy(Buffer.GetPointer(), GetVersionData(pVersion), Buffer.GetLength());
+
+	return pVersion;
+	}
+
+void CAeonRowArray::DeleteRange (const CRowKey &From, const CRowKey &To, SEQUENCENUMBER TableSeq)
+
+//	DeleteRange
+//
+//	Adds a range delete (see CAeonRangeDeletes::ParseRange). Rows written
+//	before it read as nil from now on. We don't touch the rows, so this costs
+//	the same no matter how many rows it covers.
+
+	{
+	CSmartLock Lock(m_cs);
+
+	SRangeDelete *pDelete = (SRangeDelete *)m_Arena.Alloc(sizeof(SRangeDelete));
+	pDelete->pFrom = AllocKey(From.AsEncodedString());
+	pDelete->pTo = (To.GetCount() > 0 ? AllocKey(To.AsEncodedString()) : NULL);
+	pDelete->Seq = (SEQUENCENUMBER)m_Seq + 1;
+	pDelete->TableSeq = TableSeq;
+	pDelete->pNext = m_pRangeDeletes;
+
+	::InterlockedExchangePointer((PVOID volatile *)&m_pRangeDeletes, pDelete);
+	::InterlockedIncrement64(&m_Seq);
+
+	m_dwChanges++;
 	}
 
 bool CAeonRowArray::FindData (const CRowKey &Key, CDatum *retData, SEQUENCENUMBER *retRowID)
@@ -27,112 +223,131 @@ bool CAeonRowArray::FindData (const CRowKey &Key, CDatum *retData, SEQUENCENUMBE
 //	Returns the data at the given path. Returns TRUE if found.
 
 	{
-	CSmartLock Lock(m_cs);
+	return FindDataAt(Key, GetSeq(), retData, retRowID);
+	}
+
+bool CAeonRowArray::FindDataAt (const CRowKey &Key, SEQUENCENUMBER Seq, CDatum *retData, SEQUENCENUMBER *retRowID)
+
+//	FindDataAt
+//
+//	Returns the data at the given path as of the given sequence number. Returns
+//	TRUE if found. This may be called without any lock.
 
-	//	Find the row
+	{
+	SNode *pNode = FindGreaterOrEqual(Key);
+	if (pNode == NULL || CRowKey::Compare(m_Dims, Key, CRowKey(m_Dims, GetNodeKey(pNode))) != 0)
+		return false;
 
-	int iIndexPos;
-	if (!FindKey(Key, &iIndexPos))
+	//	If the row was added after the given sequence, then we don't have it.
+
+	const SVersion *pVersion = GetVisibleVersion(pNode, Seq);
+	if (pVersion == NULL)
 		return false;
 
 	if (retData)
-		*retData = m_Rows[m_Order[iIndexPos]].Value.GetValue();
+		*retData = GetVersionValue(pVersion);
 
 	if (retRowID)
-		*retRowID = m_Rows[m_Order[iIndexPos]].RowID;
+		*retRowID = pVersion->RowID;
 
 	return true;
 	}
 
-bool CAeonRowArray::FindKey (const CRowKey &Key, int *retiPos)
+CAeonRowArray::SNode *CAeonRowArray::FindGreaterOrEqual (const CRowKey &Key, SNode **retPrev)
 
-//	FindKey
+//	FindGreaterOrEqual
 //
-//	Looks for the key in the array. If found, we return TRUE.
-//	If required, we return the position at which the key should be inserted.
+//	Returns the first node whose key is greater than or equal to the given key
+//	(or NULL if there is none). If retPrev is non-NULL, we return the node
+//	before the result at every level (this must be an array of MAX_HEIGHT).
 
 	{
-	CSmartLock Lock(m_cs);
-
-	int iCount = GetCount();
-	int iMin = 0;
-	int iMax = iCount;
-	int iTry = iMax / 2;
+	SNode *pNode = m_pHead;
+	int iLevel = m_iHeight - 1;
+	ACQUIRE_FENCE();
 
 	while (true)
 		{
-		if (iMax <= iMin)
-			{
-			if (retiPos)
-				*retiPos = iMin;
-			return false;
-			}
+		SNode *pNext = LoadNext(pNode, iLevel);
 
-		int iCompare = CRowKey::Compare(m_Dims, Key, CRowKey(m_Dims, GetKey(iTry)));
-		if (iCompare == 0)
-			{
-			if (retiPos)
-				*retiPos = iTry;
-			return true;
-			}
-		else if (iCompare == -1)
-			{
-			iMin = iTry + 1;
-			iTry = iMin + (iMax - iMin) / 2;
-			}
-		else if (iCompare == 1)
+		//	CRowKey::Compare returns -1 if Key is greater than the node key,
+		//	in which case we keep moving forward.
+
+		if (pNext && CRowKey::Compare(m_Dims, Key, CRowKey(m_Dims, GetNodeKey(pNext))) == -1)
+			pNode = pNext;
+		else
 			{
-			iMax = iTry;
-			iTry = iMin + (iMax - iMin) / 2;
+			if (retPrev)
+				retPrev[iLevel] = pNode;
+
+			if (iLevel == 0)
+				return pNext;
+
+			iLevel--;
 			}
 		}
-
-	return false;
 	}
 
-CDatum CAeonRowArray::GetData (int iIndex)
+void CAeonRowArray::GetRangeDeletes (CAeonRangeDeletes *retRangeDeletes) const
 
-//	GetData
+//	GetRangeDeletes
 //
-//	Gets the data at the index
+//	Adds our range deletes (with their table sequence numbers) to the given
+//	set, so that they can cover rows in segments too.
 
 	{
-	CSmartLock Lock(m_cs);
+	const SRangeDelete *pDelete;
+
+	for (pDelete = LoadRangeDeletes(); pDelete; pDelete = pDelete->pNext)
+		{
+		CRowKey To;
+		if (pDelete->pTo)
+			To = CRowKey(m_Dims, GetArenaKey(pDelete->pTo));
 
-	return m_Rows[m_Order[iIndex]].Value.GetValue();
+		retRangeDeletes->Add(m_Dims, CRowKey(m_Dims, GetArenaKey(pDelete->pFrom)), To, pDelete->TableSeq);
+		}
 	}
 
-bool CAeonRowArray::GetRow (int iIndex, CRowKey *retKey, CDatum *retData, SEQUENCENUMBER *retRowID)
+SEQUENCENUMBER CAeonRowArray::GetSeq (void) const
 
-//	GetRow
+//	GetSeq
 //
-//	Returns the row by index
+//	Returns the sequence number of the last write. Every version at or before
+//	this sequence number is visible to the caller.
 
 	{
-	CSmartLock Lock(m_cs);
-
-	SEntry *pEntry = &m_Rows[m_Order[iIndex]];
-
-	if (retKey)
-		CRowKey::CreateFromEncodedKey(m_Dims, pEntry->sKey, retKey);
+	return (SEQUENCENUMBER)::InterlockedCompareExchange64((volatile LONGLONG *)&m_Seq, 0, 0);
+	}
 
-	if (retData)
-		*retData = pEntry->Value.GetValue();
+CDatum CAeonRowArray::GetVersionValue (const SVersion *pVersion)
 
-	if (retRowID)
-		*retRowID = pEntry->RowID;
+//	GetVersionValue
+//
+//	Returns the value of the given version.
 
-	return true;
+	{
+	CAeonRowValue Value;
+	Value.Init(GetVersionData(pVersion));
+	return Value.GetValue();
 	}
 
-DWORD CAeonRowArray::GetRowSize (int iIndex)
+const CAeonRowArray::SVersion *CAeonRowArray::GetVisibleVersion (const SNode *pNode, SEQUENCENUMBER Seq) const
 
-//	GetRowSize
+//	GetVisibleVersion
 //
-//	Returns the serialized size of the given row
+//	Returns the latest version of the node written at or before the given
+//	sequence number (or NULL if the node was added later). If a range delete
+//	covers that version, we return a nil version instead.
 
 	{
-	return m_Rows[m_Order[iIndex]].Value.GetSerializedSize();
+	const SVersion *pVersion = LoadVersion(pNode);
+	while (pVersion && pVersion->Seq > Seq)
+		pVersion = pVersion->pPrev;
+
+	if (pVersion && IsCovered(pNode, pVersion, Seq))
+		return m_pNilVersion;
+
+	return pVersion;
 	}
 
 void CAeonRowArray::Init (const CTableDimensions &Dims)
@@ -156,78 +371,417 @@ bool CAeonRowArray::Insert (const CRowKey &Key, CDatum dData, SEQUENCENUMBER Row
 
 	{
 	CSmartLock Lock(m_cs);
+	int i;
 
-	SEntry *pEntry;
-	int iIndexPos;
+	SNode *Prev[MAX_HEIGHT];
+	SNode *pNode = FindGreaterOrEqual(Key, Prev);
 
-	//	If not found, we need to insert a new row
+	//	If the row already exists, we add a new version. We keep the old
+	//	version around in case a snapshot is using it.
 
-	if (!FindKey(Key, &iIndexPos))
+	if (pNode && CRowKey::Compare(m_Dims, Key, CRowKey(m_Dims, GetNodeKey(pNode))) == 0)
 		{
-		int iValuePos = m_Rows.GetCount();
-		pEntry = m_Rows.Insert();
-		m_Order.Insert(iValuePos, iIndexPos);
+		SVersion *pOldVersion = pNode->pVersion;
 
-		//	Only set RowID if this is a new row
+		//	Only set RowID if this is a new row (or if the old value is nil or
+		//	deleted by a range delete, in which case we treat this as a new
+		//	row).
 
-		pEntry->RowID = RowID;
+		bool bNewRow = (IsVersionNil(pOldVersion) || IsCovered(pNode, pOldVersion, (SEQUENCENUMBER)m_Seq));
+		SVersion *pVersion = AllocVersion(dData, (bNewRow ? RowID : pOldVersion->RowID));
+		pVersion->pPrev = pOldVersion;
+		StoreVersion(pNode, pVersion);
 		}
 
-	//	If it is found, we just overwrite it
+	//	Otherwise, we need a new node
 
 	else
 		{
-		pEntry = &m_Rows[m_Order[iIndexPos]];
+		int iHeight = RandomHeight();
+		if (iHeight > m_iHeight)
+			{
+			for (i = m_iHeight; i < iHeight; i++)
+				Prev[i] = m_pHead;
 
-		//	If the old value is nil then we treat this as a new row
+			//	The new levels of the head are still NULL, so it doesn't matter
+			//	if readers start there before we link the node in.
 
-		if (pEntry->Value.IsNil())
-			pEntry->RowID = RowID;
+			::InterlockedExchange(&m_iHeight, iHeight);
+			}
 
-		//	Decrement the memory used since we're about to overwrite this
+		pNode = AllocNode(Key.AsEncodedString(), iHeight);
+		pNode->pVersion = AllocVersion(dData, RowID);
 
-		m_dwMemoryUsed -= CAeonRowValue::GetSerializedKeySize(pEntry->sKey) + pEntry->Value.GetSerializedSize();
-		}
+		//	Link in from the bottom up so that readers always see a consistent
+		//	list at level 0. The node isn't visible yet, so its own links can
+		//	be plain stores; StoreNext publishes everything before it.
 
-	//	Set the key
+		for (i = 0; i < iHeight; i++)
+			{
+			pNode->pNext[i] = Prev[i]->pNext[i];
+			StoreNext(Prev[i], i, pNode);
+			}
 
-	pEntry->sKey = Key.AsEncodedString();
+		m_iCount++;
+		}
 
-	//	Insert the data to the row
+	//	Now that the version is visible, readers at this sequence number (or
+	//	later) can see it.
 
-	pEntry->Value.SetValue(dData);
+	::InterlockedIncrement64(&m_Seq);
 
-	//	Keep track of memory used
+	//	Done
 
 	m_dwChanges++;
-	m_dwMemoryUsed += CAeonRowValue::GetSerializedKeySize(pEntry->sKey) + pEntry->Value.GetSerializedSize();
+	return true;
+	}
 
-	//	Done
+bool CAeonRowArray::IsCovered (const SNode *pNode, const SVersion *pVersion, SEQUENCENUMBER Seq) const
+
+//	IsCovered
+//
+//	Returns TRUE if a range delete written after the given version of the node
+//	(and at or before Seq) covers it. The list is newest first, so we stop at
+//	the first range delete that is older than the version.
+
+	{
+	const SRangeDelete *pDelete = LoadRangeDeletes();
+	if (pDelete == NULL || pDelete->Seq <= pVersion->Seq)
+		return false;
+
+	CRowKey Key(m_Dims, GetNodeKey(pNode));
+
+	for (; pDelete && pDelete->Seq > pVersion->Seq; pDelete = pDelete->pNext)
+		{
+		if (pDelete->Seq > Seq)
+			continue;
+
+		CRowKey To;
+		if (pDelete->pTo)
+			To = CRowKey(m_Dims, GetArenaKey(pDelete->pTo));
+
+		if (CAeonRangeDeletes::IsInRange(m_Dims, CRowKey(m_Dims, GetArenaKey(pDelete->pFrom)), To, Key))
+			return true;
+		}
+
+	return false;
+	}
+
+bool CAeonRowArray::IsVersionNil (const SVersion *pVersion)
+
+//	IsVersionNil
+//
+//	Returns TRUE if the version holds a nil value.
+
+	{
+	CAeonRowValue Value;
+	Value.Init(GetVersionData(pVersion));
+	return Value.IsNil();
+	}
+
+CAeonRowArray::SNode *CAeonRowArray::LoadNext (const SNode *pNode, int iLevel)
+
+//	LoadNext
+//
+//	Returns the next node at the given level (acquire). Everything written to
+//	the next node before it was linked in is visible to the caller.
+
+	{
+	SNode *pNext = pNode->pNext[iLevel];
+	ACQUIRE_FENCE();
+	return pNext;
+	}
+
+CAeonRowArray::SRangeDelete *CAeonRowArray::LoadRangeDeletes (void) const
+
+//	LoadRangeDeletes
+//
+//	Returns the latest range delete (acquire).
+
+	{
+	SRangeDelete *pDelete = m_pRangeDeletes;
+	ACQUIRE_FENCE();
+	return pDelete;
+	}
+
+CAeonRowArray::SVersion *CAeonRowArray::LoadVersion (const SNode *pNode)
+
+//	LoadVersion
+//
+//	Returns the latest version of the node (acquire).
+
+	{
+	SVersion *pVersion = pNode->pVersion;
+	ACQUIRE_FENCE();
+	return pVersion;
+	}
+
+IOrderedRowSet *CAeonRowArray::OpenSnapshot (void)
+
+//	OpenSnapshot
+//
+//	Returns a snapshot of the current rows. Caller must Release.
+
+	{
+	return OpenSnapshotAt(GetSeq());
+	}
+
+IOrderedRowSet *CAeonRowArray::OpenSnapshotAt (SEQUENCENUMBER Seq)
+
+//	OpenSnapshotAt
+//
+//	Returns a snapshot of the rows as of the given sequence number. This may
+//	be called without any lock. Caller must Release.
+
+	{
+	return new CSnapshot(this, Seq);
+	}
+
+int CAeonRowArray::RandomHeight (void)
+
+//	RandomHeight
+//
+//	Returns a random height for a new node. Must be called inside the lock.
+
+	{
+	int iHeight = 1;
+
+	while (iHeight < MAX_HEIGHT)
+		{
+		//	xorshift32
+
+		m_dwRandom ^= m_dwRandom << 13;
+		m_dwRandom ^= m_dwRandom >> 17;
+		m_dwRandom ^= m_dwRandom << 5;
+
+		if ((m_dwRandom % BRANCHING) != 0)
+			break;
+
+		iHeight++;
+		}
+
+	return iHeight;
+	}
+
+void CAeonRowArray::StoreNext (SNode *pNode, int iLevel, SNode *pNext)
+
+//	StoreNext
+//
+//	Links pNext in after pNode at the given level (release). Must be called
+//	inside the lock.
+
+	{
+	::InterlockedExchangePointer((PVOID volatile *)&pNode->pNext[iLevel], pNext);
+	}
+
+void CAeonRowArray::StoreVersion (SNode *pNode, SVersion *pVersion)
+
+//	StoreVersion
+//
+//	Makes pVersion the latest version of the node (release). Must be called
+//	inside the lock.
+
+	{
+	::InterlockedExchangePointer((PVOID volatile *)&pNode->pVersion, pVersion);
+	}
+
+//	CAeonRowArray::CSnapshot ---------------------------------------------------
+
+CAeonRowArray::CSnapshot::CSnapshot (CAeonRowArray *pRows, SEQUENCENUMBER Seq) :
+		m_pRows(pRows),
+		m_Seq(Seq),
+		m_iPos(-1),
+		m_pNode(NULL),
+		m_pVersion(NULL)
+
+//	CSnapshot constructor
+//
+//	Opens a cursor over the rows as of the given sequence number. New rows and
+//	updates after that point are not visible to the snapshot. We don't copy
+//	anything; we read the version of each node as of Seq when we get to it.
+
+	{
+	m_pRows->AddRef();
+
+	//	Every row that we can see was linked in before Seq, so the current
+	//	count is at least the number of rows that we see.
+
+	m_iCount = (int)::InterlockedCompareExchange(&m_pRows->m_iCount, 0, 0);
+
+	m_pFirst = GetNextVisible(m_pRows->m_pHead);
+	}
+
+CAeonRowArray::CSnapshot::CSnapshot (const CSnapshot &Src) :
+		m_pRows(Src.m_pRows),
+		m_Seq(Src.m_Seq),
+		m_iCount(Src.m_iCount),
+		m_pFirst(Src.m_pFirst),
+		m_iPos(Src.m_iPos),
+		m_pNode(Src.m_pNode),
+		m_pVersion(Src.m_pVersion)
+
+//	CSnapshot constructor
+//
+//	Copies the snapshot (including the cursor position).
+
+	{
+	m_pRows->AddRef();
+	}
+
+CAeonRowArray::CSnapshot::~CSnapshot (void)
+
+//	CSnapshot destructor
+
+	{
+	m_pRows->Release();
+	}
+
+bool CAeonRowArray::CSnapshot::FindData (const CRowKey &Key, CDatum *retData, SEQUENCENUMBER *retRowID)
+
+//	FindData
+//
+//	Returns the data at the given path. Returns TRUE if found.
+
+	{
+	return m_pRows->FindDataAt(Key, m_Seq, retData, retRowID);
+	}
+
+bool CAeonRowArray::CSnapshot::FindKey (const CRowKey &Key, int *retiPos)
+
+//	FindKey
+//
+//	Moves the cursor to the given key (or to the first row after it, if we
+//	don't have the key) and returns TRUE if we found the key. The position
+//	that we return is 0 if the cursor is on the first row and 1 otherwise.
+//	Since there is at least one row before it in the latter case, every
+//	position after it is still less than m_iCount.
+
+	{
+	const CTableDimensions &Dims = m_pRows->GetDimensions();
+
+	const SNode *pNode = m_pRows->FindGreaterOrEqual(Key);
+	if (pNode && m_pRows->GetVisibleVersion(pNode, m_Seq) == NULL)
+		pNode = GetNextVisible(pNode);
+
+	m_iPos = (pNode == m_pFirst ? 0 : 1);
+	m_pNode = pNode;
+	m_pVersion = (pNode ? m_pRows->GetVisibleVersion(pNode, m_Seq) : NULL);
+
+	if (retiPos)
+		*retiPos = m_iPos;
+
+	return (pNode && CRowKey::Compare(Dims, Key, CRowKey(Dims, GetNodeKey(pNode))) == 0);
+	}
+
+CDatum CAeonRowArray::CSnapshot::GetData (int iIndex)
+
+//	GetData
+//
+//	Gets the data at the index
+
+	{
+	MoveTo(iIndex);
+	return GetVersionValue(m_pVersion);
+	}
+
+CString CAeonRowArray::CSnapshot::GetKey (int iIndex)
+
+//	GetKey
+//
+//	Returns the encoded key at the index (or NULL_STR if we're past the last
+//	row). We return a copy because the node key points into the arena.
+
+	{
+	MoveTo(iIndex);
+	if (m_pNode == NULL)
+		return NULL_STR;
+
+	CString sKey = GetNodeKey(m_pNode);
+	return CString(sKey.GetParsePointer(), sKey.GetLength());
+	}
+
+const CAeonRowArray::SNode *CAeonRowArray::CSnapshot::GetNextVisible (const SNode *pNode) const
+
+//	GetNextVisible
+//
+//	Returns the next node after pNode that existed as of our sequence number
+//	(or NULL if there are no more).
+
+	{
+	const SNode *pNext = LoadNext(pNode, 0);
+	while (pNext && m_pRows->GetVisibleVersion(pNext, m_Seq) == NULL)
+		pNext = LoadNext(pNext, 0);
+
+	return pNext;
+	}
+
+bool CAeonRowArray::CSnapshot::GetRow (int iIndex, CRowKey *retKey, CDatum *retData, SEQUENCENUMBER *retRowID)
+
+//	GetRow
+//
+//	Returns the row by index
+
+	{
+	MoveTo(iIndex);
+
+	if (retKey)
+		CRowKey::CreateFromEncodedKey(m_pRows->GetDimensions(), GetNodeKey(m_pNode), retKey);
+
+	if (retData)
+		*retData = GetVersionValue(m_pVersion);
+
+	if (retRowID)
+		*retRowID = m_pVersion->RowID;
 
 	return true;
 	}
 
-void CAeonRowArray::WriteData (IByteStream &Stream, int iIndex, DWORD *retdwSize, SEQUENCENUMBER *retRowID)
+void CAeonRowArray::CSnapshot::MoveTo (int iIndex)
+
+//	MoveTo
+//
+//	Moves the cursor to the given position. Position 0 is the first row and the
+//	position after the cursor is the next row. CRowIterator never asks for
+//	anything else, but if someone does, we treat the position as a rank.
+
+	{
+	int i;
+
+	if (iIndex == m_iPos)
+		return;
+
+	if (iIndex == 0)
+		m_pNode = m_pFirst;
+	else if (iIndex == m_iPos + 1)
+		{
+		if (m_pNode)
+			m_pNode = GetNextVisible(m_pNode);
+		}
+	else
+		{
+		m_pNode = m_pFirst;
+		for (i = 0; i < iIndex && m_pNode; i++)
+			m_pNode = GetNextVisible(m_pNode);
+		}
+
+	m_iPos = iIndex;
+	m_pVersion = (m_pNode ? m_pRows->GetVisibleVersion(m_pNode, m_Seq) : NULL);
+	}
+
+void CAeonRowArray::CSnapshot::WriteData (IByteStream &Stream, int iIndex, DWORD *retdwSize, SEQUENCENUMBER *retRowID)
 
 //	WriteData
 //
 //	Writes the row value to the stream.
 
 	{
-	CSmartLock Lock(m_cs);
-	
-	//	Write out the value
+	MoveTo(iIndex);
 
-	CAeonRowValue &Value = m_Rows[m_Order[iIndex]].Value;
-	Value.Serialize(Stream);
-
-	//	Return size
+	Stream.Write(GetVersionData(m_pVersion), m_pVersion->dwSize);
 
 	if (retdwSize)
-		*retdwSize = Value.GetSerializedSize();
-
-	//	Return rowID
+		*retdwSize = m_pVersion->dwSize;
 
 	if (retRowID)
-		*retRowID = m_Rows[m_Order[iIndex]].RowID;
+		*retRowID = m_pVersion->RowID;
 	}
@@ -0,0 +1,271 @@
+//	CAeonRowCache.cpp
+//
+//	CAeonRowCache class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	We cache rows from the primary view after they've been deserialized so that
+//	hot rows don't have to probe the in-memory rows and every segment. Rows are
+//	removed whenever they are written. When we need room we evict with a clock
+//	sweep over the entries: an entry that was read since the last sweep gets a
+//	second chance.
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(FIELD_HIT_RATE,					"hitRate")
+DECLARE_CONST_STRING(FIELD_HITS,						"hits")
+DECLARE_CONST_STRING(FIELD_MAX_SIZE,					"maxSize")
+DECLARE_CONST_STRING(FIELD_MISSES,						"misses")
+DECLARE_CONST_STRING(FIELD_ROWS,						"rows")
+DECLARE_CONST_STRING(FIELD_SIZE,						"size")
+
+const DWORD ENTRY_OVERHEAD =				64;
+const DWORD DATUM_SIZE =					16;
+const DWORD MAX_ENTRY_FRACTION =			16;
+
+DWORD CAeonRowCache::CalcDatumSize (CDatum dData)
+
+//	CalcDatumSize
+//
+//	Returns the approximate memory used by the given datum.
+
+	{
+	int i;
+
+	switch (dData.GetBasicType())
+		{
+		case CDatum::typeString:
+			return DATUM_SIZE + ((const CString &)dData).GetLength();
+
+		case CDatum::typeBinary:
+			return DATUM_SIZE + dData.GetBinarySize();
+
+		case CDatum::typeArray:
+			{
+			DWORD dwSize = DATUM_SIZE;
+			for (i = 0; i < dData.GetCount(); i++)
+				dwSize += CalcDatumSize(dData.GetElement(i));
+
+			return dwSize;
+			}
+
+		case CDatum::typeStruct:
+			{
+			DWORD dwSize = DATUM_SIZE;
+			for (i = 0; i < dData.GetCount(); i++)
+				dwSize += dData.GetKey(i).GetLength() + CalcDatumSize(dData.GetElement(i));
+
+			return dwSize;
+			}
+
+		default:
+			return DATUM_SIZE;
+		}
+	}
+
+int CAeonRowCache::CompareKeys (const SKey &Key1, const SKey &Key2)
+
+//	CompareKeys
+//
+//	Compares two encoded keys. Encoded keys may have embedded NULs (e.g., for
+//	integer dimensions), so we can't use a string comparison. The order doesn't
+//	need to match the view's order; it just needs to be consistent.
+
+	{
+	int iLen1 = Key1.sKey.GetLength();
+	int iLen2 = Key2.sKey.GetLength();
+
+	int iCompare = ::memcmp(Key1.sKey.GetParsePointer(), Key2.sKey.GetParsePointer(), Min(iLen1, iLen2));
+	if (iCompare > 0)
+		return 1;
+	else if (iCompare < 0)
+		return -1;
+	else if (iLen1 > iLen2)
+		return 1;
+	else if (iLen1 < iLen2)
+		return -1;
+	else
+		return 0;
+	}
+
+CDatum CAeonRowCache::DebugDump (void) const
+
+//	DebugDump
+//
+//	Returns statistics about the cache.
+
+	{
+	CComplexStruct *pData = new CComplexStruct;
+
+	pData->SetElement(FIELD_MAX_SIZE, CDatum(m_dwMaxSize));
+	pData->SetElement(FIELD_SIZE, CDatum(m_dwSize));
+	pData->SetElement(FIELD_ROWS, CDatum(m_Entries.GetCount()));
+	pData->SetElement(FIELD_HITS, CDatum(m_dwHits));
+	pData->SetElement(FIELD_MISSES, CDatum(m_dwMisses));
+	if (m_dwHits + m_dwMisses > 0)
+		pData->SetElement(FIELD_HIT_RATE, CDatum((double)m_dwHits / (double)(m_dwHits + m_dwMisses)));
+
+	return CDatum(pData);
+	}
+
+void CAeonRowCache::DeleteAll (void)
+
+//	DeleteAll
+//
+//	Removes all entries.
+
+	{
+	m_Entries.DeleteAll();
+	m_dwSize = 0;
+	m_iClock = 0;
+	}
+
+void CAeonRowCache::Evict (DWORD dwSizeNeeded)
+
+//	Evict
+//
+//	Evicts entries until we have room for dwSizeNeeded more bytes.
+
+	{
+	while (m_Entries.GetCount() > 0 && m_dwSize + dwSizeNeeded > m_dwMaxSize)
+		{
+		if (m_iClock >= m_Entries.GetCount())
+			m_iClock = 0;
+
+		SEntry &Entry = m_Entries[m_iClock];
+
+		//	If this entry has been read since we last came by, give it another
+		//	chance.
+
+		if (Entry.bReferenced)
+			{
+			Entry.bReferenced = false;
+			m_iClock++;
+			}
+
+		//	Otherwise, evict it. The next entry moves into this slot, so we
+		//	don't advance.
+
+		else
+			{
+			m_dwSize -= Entry.dwSize;
+			m_Entries.Delete(m_iClock);
+			}
+		}
+	}
+
+bool CAeonRowCache::Find (const CRowKey &Path, CDatum *retData, SEQUENCENUMBER *retRowID)
+
+//	Find
+//
+//	Looks for the given row. Returns FALSE if the row is not cached. NOTE: We
+//	also cache rows that don't exist, in which case we return TRUE and Nil.
+
+	{
+	SKey Key;
+	Key.sKey = Path.AsEncodedString();
+
+	SEntry *pEntry = m_Entries.GetAt(Key);
+	if (pEntry == NULL)
+		{
+		m_dwMisses++;
+		return false;
+		}
+
+	pEntry->bReferenced = true;
+	m_dwHits++;
+
+	*retData = pEntry->dData;
+	if (retRowID)
+		*retRowID = pEntry->RowID;
+
+	return true;
+	}
+
+void CAeonRowCache::Insert (const CRowKey &Path, CDatum dData, SEQUENCENUMBER RowID)
+
+//	Insert
+//
+//	Adds a row to the cache, evicting other rows if necessary.
+
+	{
+	if (!IsEnabled())
+		return;
+
+	//	Rows that would take up a large part of the cache aren't worth it; they
+	//	would just push out many smaller rows.
+
+	DWORD dwSize = ENTRY_OVERHEAD + Path.AsEncodedString().GetLength() + CalcDatumSize(dData);
+	if (dwSize > m_dwMaxSize / MAX_ENTRY_FRACTION)
+		return;
+
+	//	Remove any previous value before we make room (so that we don't evict
+	//	the entry we're about to replace).
+
+	Invalidate(Path);
+	Evict(dwSize);
+
+	SKey Key;
+	Key.sKey = Path.AsEncodedString();
+
+	SEntry *pEntry = m_Entries.SetAt(Key);
+	pEntry->dData = dData;
+	pEntry->RowID = RowID;
+	pEntry->dwSize = dwSize;
+	pEntry->bReferenced = false;
+
+	m_dwSize += dwSize;
+	}
+
+void CAeonRowCache::Invalidate (const CRowKey &Path)
+
+//	Invalidate
+//
+//	Removes the given row from the cache (if it is there).
+
+	{
+	if (m_Entries.GetCount() == 0)
+		return;
+
+	SKey Key;
+	Key.sKey = Path.AsEncodedString();
+
+	int iPos;
+	if (!m_Entries.FindPos(Key, &iPos))
+		return;
+
+	m_dwSize -= m_Entries[iPos].dwSize;
+	m_Entries.Delete(iPos);
+
+	//	Keep the clock pointing at the same entry
+
+	if (iPos < m_iClock)
+		m_iClock--;
+	}
+
+void CAeonRowCache::Mark (void)
+
+//	Mark
+//
+//	Mark data in use
+
+	{
+	int i;
+
+	for (i = 0; i < m_Entries.GetCount(); i++)
+		m_Entries[i].dData.Mark();
+	}
+
+void CAeonRowCache::SetMaxSize (DWORD dwMaxSize)
+
+//	SetMaxSize
+//
+//	Sets the maximum number of bytes to cache. 0 disables the cache.
+
+	{
+	m_dwMaxSize = dwMaxSize;
+
+	if (m_dwMaxSize == 0)
+		DeleteAll();
+	else
+		Evict(0);
+	}
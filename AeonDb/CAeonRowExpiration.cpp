@@ -0,0 +1,120 @@
+//	CAeonRowExpiration.cpp
+//
+//	CAeonRowExpiration class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	A table declares a time-to-live in its descriptor:
+//
+//	ttl: { field: "expiresOn" }
+//		Each row expires at the datetime in its expiresOn field.
+//
+//	ttl: { field: "modifiedOn" seconds: 86400 }
+//		Each row expires a day after the datetime in its modifiedOn field.
+//
+//	Expired rows read as nil. Compaction turns them into tombstones (and drops
+//	them entirely when it merges the oldest segment), so we never have to
+//	write anything to get rid of them.
+//
+//	Secondary and full-text views copy the field into their rows (so that they
+//	expire along with the primary row). Unless the view lists the field as a
+//	column, readers never see it (see StripField).
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(FIELD_FIELD,						"field")
+DECLARE_CONST_STRING(FIELD_SECONDS,						"seconds")
+
+DECLARE_CONST_STRING(ERR_INVALID_TTL,					"Invalid ttl: %s.")
+
+CDateTime CAeonRowExpiration::GetCutoff (const CDateTime &Now) const
+
+//	GetCutoff
+//
+//	Returns the time at or before which a row's field value means that the row
+//	has expired. Callers compute this once per scan.
+
+	{
+	if (m_dwLifetime == 0)
+		return Now;
+
+	return timeSubtractTime(Now, CTimeSpan((DWORDLONG)m_dwLifetime * 1000));
+	}
+
+CDatum CAeonRowExpiration::GetDesc (void) const
+
+//	GetDesc
+//
+//	Returns the descriptor (or Nil if rows don't expire).
+
+	{
+	if (!IsEnabled())
+		return CDatum();
+
+	CComplexStruct *pDesc = new CComplexStruct;
+	pDesc->SetElement(FIELD_FIELD, m_sField);
+	if (m_dwLifetime > 0)
+		pDesc->SetElement(FIELD_SECONDS, CDatum((int)m_dwLifetime));
+
+	return CDatum(pDesc);
+	}
+
+bool CAeonRowExpiration::InitFromDesc (CDatum dDesc, CString *retsError)
+
+//	InitFromDesc
+//
+//	Parses the ttl field of a table descriptor. Nil means rows never expire.
+
+	{
+	m_sField = NULL_STR;
+	m_dwLifetime = 0;
+
+	if (dDesc.IsNil())
+		return true;
+
+	CString sField = dDesc.GetElement(FIELD_FIELD);
+	int iSeconds = dDesc.GetElement(FIELD_SECONDS);
+	if (sField.IsEmpty() || iSeconds < 0)
+		{
+		*retsError = strPattern(ERR_INVALID_TTL, dDesc.AsString());
+		return false;
+		}
+
+	m_sField = sField;
+	m_dwLifetime = (DWORD)iSeconds;
+	return true;
+	}
+
+bool CAeonRowExpiration::IsExpired (CDatum dData, const CDateTime &Cutoff) const
+
+//	IsExpired
+//
+//	Returns TRUE if the row has expired. Cutoff comes from GetCutoff.
+
+	{
+	if (!IsEnabled() || dData.IsNil())
+		return false;
+
+	CDatum dTime = dData.GetElement(m_sField);
+	if (dTime.GetBasicType() != CDatum::typeDateTime)
+		return false;
+
+	return ((const CDateTime &)dTime <= Cutoff);
+	}
+
+CDatum CAeonRowExpiration::StripField (CDatum dData) const
+
+//	StripField
+//
+//	Returns the row without our field, if the view only stores the field so
+//	that its rows expire. Otherwise, we return the row unchanged.
+
+	{
+	if (!m_bHideField
+			|| dData.GetBasicType() != CDatum::typeStruct
+			|| dData.GetElement(m_sField).IsNil())
+		return dData;
+
+	CComplexStruct *pData = new CComplexStruct(dData);
+	pData->DeleteElement(m_sField);
+	return CDatum(pData);
+	}
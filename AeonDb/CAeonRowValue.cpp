@@ -10,12 +10,20 @@
 //	BYTEs	datum serialization
 //	...
 //	BYTEs	padding so row is DWORD-aligned
+//
+//	New rows are serialized with CDatum::formatAEONBinary. Older segments and
+//	recovery files have rows serialized as AEONScript. We can tell them apart
+//	because binary serializations always start with AEON_BINARY_SIGNATURE.
 
 #include "stdafx.h"
 
 const int DEFAULT_VAR_BLOCK_SIZE =					4096;
 const int DEFAULT_ROW_COUNT =						16;
 
+#ifdef DEBUG
+bool CAeonRowValue::m_bLegacyFormat = false;
+#endif
+
 CAeonRowValue::CAeonRowValue (void) : 
 		m_dwFixedBlockAlloc(0),
 		m_pFixedBlock(NULL)
@@ -144,6 +152,19 @@ void CAeonRowValue::Init (void *pValue)
 		}
 	}
 
+CDatum::ESerializationFormats CAeonRowValue::GetItemFormat (SItemHeader *pItem)
+
+//	GetItemFormat
+//
+//	Returns the format in which the item was serialized.
+
+	{
+	if (pItem->dwSize > 0 && *(BYTE *)(&pItem[1]) == AEON_BINARY_SIGNATURE)
+		return CDatum::formatAEONBinary;
+	else
+		return CDatum::formatAEONScript;
+	}
+
 CDatum CAeonRowValue::ItemToValue (SItemHeader *pItem)
 
 //	ItemToValue
@@ -154,7 +175,7 @@ CDatum CAeonRowValue::ItemToValue (SItemHeader *pItem)
 	CMemoryBuffer Buffer(&pItem[1], pItem->dwSize);
 
 	CDatum dValue;
-	if (!CDatum::Deserialize(CDatum::formatAEONScript, Buffer, &dValue))
+	if (!CDatum::Deserialize(GetItemFormat(pItem), Buffer, &dValue))
 		//	LATER: Need to handle this better
 		throw CException(errFail);
 
@@ -169,16 +190,32 @@ bool CAeonRowValue::IsNil (void)
 
 	{
 	SItemHeader *pValue = Get0DItem();
+	BYTE *pPos = (BYTE *)(&pValue[1]);
 
-	//	We expect the characters "nil"
+	//	Binary nil is just the signature and the nil tag
+
+	if (pValue->dwSize == 2 && pPos[0] == AEON_BINARY_SIGNATURE)
+		return (pPos[1] == 0x00);
+
+	//	Otherwise, we expect the characters "nil"
 
 	if (pValue->dwSize != 3)
 		return false;
 
-	char *pPos = (char *)(&pValue[1]);
 	return (pPos[0] == 'n' && pPos[1] == 'i' && pPos[2] == 'l');
 	}
 
+bool CAeonRowValue::IsLegacyFormat (void)
+
+//	IsLegacyFormat
+//
+//	Returns TRUE if the value is serialized as AEONScript (which we used before
+//	the binary format).
+
+	{
+	return (GetItemFormat(Get0DItem()) != CDatum::formatAEONBinary);
+	}
+
 void CAeonRowValue::Load (void)
 
 //	Load
@@ -208,6 +245,18 @@ void CAeonRowValue::Serialize (IByteStream &Stream)
 		Stream.Write(m_pFixedBlock, GetFixedBlockSize());
 	}
 
+void CAeonRowValue::UpgradeFormat (void)
+
+//	UpgradeFormat
+//
+//	If the value is serialized in a legacy format, we re-serialize it in the
+//	current format. We use this to migrate old segments when merging.
+
+	{
+	if (m_pFixedBlock && IsLegacyFormat())
+		SetValue(GetValue());
+	}
+
 DWORD CAeonRowValue::GetSerializedKeySize (const CString &sKey)
 
 //	GetSerializedKeySize
@@ -257,8 +306,14 @@ void CAeonRowValue::SetValue (CDatum dValue)
 //	Sets the value of a 0D row
 
 	{
+	CDatum::ESerializationFormats iFormat = CDatum::formatAEONBinary;
+#ifdef DEBUG
+	if (m_bLegacyFormat)
+		iFormat = CDatum::formatAEONScript;
+#endif
+
 	CMemoryBuffer Buffer(4096);
-	dValue.Serialize(CDatum::formatAEONScript, Buffer);
+	dValue.Serialize(iFormat, Buffer);
 
 	//	Allocate a new block
 
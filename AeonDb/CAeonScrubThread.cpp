@@ -0,0 +1,21 @@
+//	CAeonScrubThread.cpp
+//
+//	CAeonScrubThread class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	Housekeeping starts a few of these threads to verify segment checksums.
+//	Each thread takes the next unverified file from the shared list, so a
+//	large segment on one thread doesn't hold up the rest. Housekeeping waits
+//	for all threads to finish before it repairs anything.
+
+#include "stdafx.h"
+
+void CAeonScrubThread::Run (void)
+
+//	Run
+//
+//	Scrub thread
+
+	{
+	m_pTable->ScrubSegments(*m_pScrub);
+	}
@@ -14,9 +14,32 @@
 //	DWORD		Size of index region (including var items)
 //	DWORD		Total rows in segment
 //	DWORD		ViewID
-//	DWORD[7]	Spare
+//	DWORD		Flags
+//	DWORD		Offset to Bloom filter (from start of file; 0 = no filter)
+//	DWORD		Size of Bloom filter
+//	DWORD		Block codec (ECompressionTypes; FLAG_COMPRESSED_BLOCKS)
+//	DWORD		Key restart interval (FLAG_PREFIX_KEYS)
+//	DWORD		Offset to block checksums (FLAG_BLOCK_CHECKSUMS)
+//	DWORD		CRC32C from index region to end of file (FLAG_BLOCK_CHECKSUMS)
+//	DWORD		Offset to range deletes (FLAG_RANGE_DELETES)
+//	DWORD		Size of range deletes (FLAG_RANGE_DELETES)
+//
+//	Version 1: Row data may be serialized as AEONScript.
+//	Version 2: Row data is always serialized as binary (formatAEONBinary).
+//	Version 3: Bloom filter of row keys follows the index.
+//	Version 4: Blocks may be compressed and keys may be prefix-encoded
+//		(see flags).
+//	Version 5: Block checksums follow the Bloom filter.
+//	Version 6: Range deletes saved with the rows may follow the Bloom filter
+//		(see flags).
 //	----------------------- blocks
-//	for each block (SBlockHeader)
+//	for each block...
+//	If FLAG_COMPRESSED_BLOCKS (SCompressedBlockHeader)
+//	DWORD		Codec for this block (compressionNone if it didn't help)
+//	DWORD		Size of decompressed block
+//	BYTEs		compressed block (as below)
+//
+//	(SBlockHeader)
 //	DWORD		Size of block 0
 //	DWORD		Number of rows in block
 //	
@@ -31,6 +54,11 @@
 //	...
 //	DWORD		row data size
 //	BYTEs		padded to DWORD-align
+//
+//	If FLAG_PREFIX_KEYS then each row key is stored as:
+//	DWORD		bytes shared with previous key (0 at restart points)
+//	DWORD		size of remaining bytes
+//	BYTEs		remaining bytes, padded to DWORD-align
 //	----------------------- index entries
 //	for each block... (SIndexEntry)
 //	DWORD		offset to key for block 0 (from start of index)
@@ -43,17 +71,29 @@
 //	DWORD		size of key for block 0
 //	BYTEs		padded to DWORD-align
 //	...
+//	----------------------- Bloom filter (see CSegmentBloomFilter)
+//	----------------------- range deletes (FLAG_RANGE_DELETES)
+//	(see CAeonRangeDeletes::Serialize)
+//	----------------------- block checksums (FLAG_BLOCK_CHECKSUMS)
+//	for each index entry...
+//	DWORD		CRC32C of block as stored on disk (0 for last entry)
 
 #include "stdafx.h"
 
 const DWORD INPROGRESS_SIGNATURE = 'XXXX';
 const DWORD SIGNATURE = 'SOEA';		//	'AEOS' backwards because of little-endianness
-const DWORD CURRENT_VERSION = 1;
-const int BLOCK_CACHE_SIZE = 64;
+const DWORD CURRENT_VERSION = 6;
+const DWORD DEFAULT_BLOCK_SIZE = 64 * 1024;	//	Target size of a block in new segments
+const int FILTER_BITS_PER_KEY = 10;		//	~1% false positive rate
+const DWORD KEY_RESTART_INTERVAL = 16;	//	Rows between full keys in a block
+const int READ_AHEAD_BLOCKS = 8;		//	Blocks to load ahead of a sequential reader
+const int READ_AHEAD_TRIGGER = 2;		//	Blocks read in order before we read ahead
+const DWORD VERIFY_BUFFER_SIZE = 1024 * 1024;	//	Bytes to read at a time when verifying
 
 DECLARE_CONST_STRING(FIELD_BLOCK_INDEX,					"blockIndex")
 DECLARE_CONST_STRING(FIELD_FILE_SIZE,					"fileSize")
 DECLARE_CONST_STRING(FIELD_FILESPEC,					"filespec")
+DECLARE_CONST_STRING(FIELD_FILTER_SIZE,					"filterSize")
 DECLARE_CONST_STRING(FIELD_KEY,							"key")
 DECLARE_CONST_STRING(FIELD_MARKED_FOR_DELETE,			"markedForDelete")
 DECLARE_CONST_STRING(FIELD_OFFSET_X,					"offset")
@@ -62,21 +102,31 @@ DECLARE_CONST_STRING(FIELD_SEQ,							"sequence")
 DECLARE_CONST_STRING(FIELD_SIZE,						"size")
 
 DECLARE_CONST_STRING(ERR_MUST_HAVE_ROWS,				"Unable to create a segment with no rows.")
+DECLARE_CONST_STRING(ERR_BAD_BLOCK_CHECKSUM,			"Checksum mismatch in block %d of segment: %s.")
+DECLARE_CONST_STRING(ERR_BAD_INDEX_CHECKSUM,			"Checksum mismatch in index of segment: %s.")
 DECLARE_CONST_STRING(ERR_CANT_CREATE_FILE,				"Unable to create segment file: %s.")
+DECLARE_CONST_STRING(ERR_CANT_OPEN_FILE,				"Unable to open segment file: %s")
 DECLARE_CONST_STRING(ERR_CANT_READ_SEGMENT,				"Unable to read segment: %s.")
 DECLARE_CONST_STRING(ERR_CANT_WRITE_FILE,				"Unable to write segment: %s.")
+DECLARE_CONST_STRING(ERR_INVALID_SEGMENT,				"Invalid segment file: %s.")
 
 DECLARE_CONST_STRING(ERR_GET_BLOCK_BY_ROW_POS,			"Crash in GetBlockByRowPos.")
 DECLARE_CONST_STRING(ERR_LOAD_BLOCK,					"Crash in LoadBlock.")
 DECLARE_CONST_STRING(ERR_ROW_VALUE,						"Crash loading row value.")
 DECLARE_CONST_STRING(ERR_GET_DATA,						"Crash in GetData.")
 
+ECompressionTypes CAeonSegment::m_iDefaultCodec = compressionLZ;
+DWORD CAeonSegment::m_dwDefaultBlockSize = DEFAULT_BLOCK_SIZE;
+
 CAeonSegment::CAeonSegment (void) : 
 		m_Seq(0),
-		m_dwDesiredBlockSize(64 * 1024),
+		m_dwDesiredBlockSize(m_dwDefaultBlockSize),
 		m_pHeader(NULL),
 		m_pIndex(NULL),
-		m_bMarkedForDelete(false)
+		m_bMarkedForDelete(false),
+		m_iReadFrontier(-1),
+		m_iSequentialBlocks(0),
+		m_iReadAheadEnd(0)
 
 //	CAeonSegment constructor
 
@@ -88,6 +138,10 @@ CAeonSegment::~CAeonSegment (void)
 //	CAeonSegment destructor
 
 	{
+	//	Make sure the read-ahead thread is done with us.
+
+	CSegmentBlockCache::GetReadAhead().Cancel(this);
+
 	if (m_pHeader)
 		delete m_pHeader;
 
@@ -129,7 +183,56 @@ bool CAeonSegment::BlockFindRow (SBlockHeader *pBlock, const CString &sKey, int
 //	Finds the position of the given row in the block.
 
 	{
+	int i;
 	int iCount = pBlock->dwRowCount;
+
+	//	If keys share prefixes then only the keys at restart points can be
+	//	decoded without walking the previous rows. We search those and then
+	//	scan forward from the closest one.
+
+	if (HasPrefixKeys())
+		{
+		int iInterval = (int)m_pHeader->dwRestartInterval;
+		int iMin = 0;
+		int iMax = (iCount + iInterval - 1) / iInterval;
+
+		while (iMin < iMax)
+			{
+			int iTry = iMin + (iMax - iMin) / 2;
+			CString sTryKey = BlockGetKey(pBlock, iTry * iInterval);
+			int iCompare = CRowKey::Compare(m_Dims, CRowKey(m_Dims, sKey), CRowKey(m_Dims, sTryKey));
+
+			if (iCompare == 0)
+				{
+				*retiPos = iTry * iInterval;
+				return true;
+				}
+			else if (iCompare == -1)
+				iMin = iTry + 1;
+			else
+				iMax = iTry;
+			}
+
+		//	The key is after restart point iMin - 1 and before restart point
+		//	iMin.
+
+		int iStart = (iMin == 0 ? 0 : ((iMin - 1) * iInterval) + 1);
+		int iEnd = Min(iCount, iMin * iInterval);
+		for (i = iStart; i < iEnd; i++)
+			{
+			CString sTryKey = BlockGetKey(pBlock, i);
+			int iCompare = CRowKey::Compare(m_Dims, CRowKey(m_Dims, sKey), CRowKey(m_Dims, sTryKey));
+			if (iCompare != -1)
+				{
+				*retiPos = i;
+				return (iCompare == 0);
+				}
+			}
+
+		*retiPos = iEnd;
+		return false;
+		}
+
 	int iMin = 0;
 	int iMax = iCount;
 	int iTry = iMax / 2;
@@ -142,10 +245,12 @@ bool CAeonSegment::BlockFindRow (SBlockHeader *pBlock, const CString &sKey, int
 			return false;
 			}
 
-		//	Get the block
+		//	Compare against the key in place (without copying it out of the
+		//	block).
 
-		CString sTryKey = BlockGetKey(pBlock, iTry);
-		int iCompare = CRowKey::Compare(m_Dims, CRowKey(m_Dims, sKey), CRowKey(m_Dims, sTryKey));
+		SBlockIndexEntry *pEntry = BlockGetIndexEntry(pBlock, iTry);
+		CStringBuffer TryKey(((char *)pBlock) + pEntry->dwKeyOffset + sizeof(DWORD));
+		int iCompare = CRowKey::Compare(m_Dims, CRowKey(m_Dims, sKey), CRowKey(m_Dims, TryKey));
 
 		if (iCompare == 0)
 			{
@@ -197,10 +302,40 @@ CString CAeonSegment::BlockGetKey (SBlockHeader *pBlock, int iPos)
 //	Returns the key at the given position
 
 	{
-	SBlockIndexEntry *pEntry = BlockGetIndexEntry(pBlock, iPos);
-	//	We advance by a DWORD because we point to the string (not the length)
-	CStringBuffer Key(((char *)pBlock) + pEntry->dwKeyOffset + sizeof(DWORD));
-	return Key;
+	int i;
+
+	if (!HasPrefixKeys())
+		{
+		SBlockIndexEntry *pEntry = BlockGetIndexEntry(pBlock, iPos);
+		//	We advance by a DWORD because we point to the string (not the length)
+		CStringBuffer Key(((char *)pBlock) + pEntry->dwKeyOffset + sizeof(DWORD));
+		return Key;
+		}
+
+	//	Each key only stores the bytes after the prefix that it shares with the
+	//	previous key. We work backwards towards the restart point, filling in
+	//	the bytes we still need from each key.
+
+	int iRestart = iPos - (iPos % (int)m_pHeader->dwRestartInterval);
+	DWORD *pPrefixKey = BlockGetPrefixKey(pBlock, iPos);
+	DWORD dwNeeded = pPrefixKey[0] + pPrefixKey[1];
+
+	CString sKey(dwNeeded);
+	char *pDest = sKey.GetPointer();
+
+	for (i = iPos; i >= iRestart && dwNeeded > 0; i--)
+		{
+		pPrefixKey = BlockGetPrefixKey(pBlock, i);
+		DWORD dwShared = pPrefixKey[0];
+		if (dwShared < dwNeeded)
+			{
+			utlMemCopy((char *)&pPrefixKey[2], pDest + dwShared, dwNeeded - dwShared);
+			dwNeeded = dwShared;
+			}
+		}
+
+	ASSERT(dwNeeded == 0);
+	return sKey;
 	}
 
 void *CAeonSegment::BlockGetValue (SBlockHeader *pBlock, int iPos, SEQUENCENUMBER *retRowID)
@@ -227,11 +362,12 @@ void *CAeonSegment::BlockGetValue (SBlockHeader *pBlock, int iPos, SEQUENCENUMBE
 	return ((char *)pBlock) + pEntry->dwValueOffset;
 	}
 
-bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENCENUMBER Seq, CRowIterator &Rows, const CString &sFilespec, DWORD dwFlags, CString *retsError)
+bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENCENUMBER Seq, CRowIterator &Rows, const CString &sFilespec, DWORD dwFlags, CString *retsError, CAeonRateLimiter *pLimiter, const CAeonRangeDeletes *pRangeDeletes)
 
 //	Create
 //
-//	Creates a segment from a row iterator
+//	Creates a segment from a row iterator. If pRangeDeletes is non-NULL we
+//	save the range deletes with the rows (see CAeonView::UpdateRangeDeletes).
 
 	{
 	int i;
@@ -263,10 +399,15 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 		DWORD dwBlockOffset;
 		DWORD dwBlockSize;
 		DWORD dwRowCount;
+		DWORD dwChecksum;
 		};
 
 	TArray<SIndexData> NewBlocks;
 
+	//	Keep track of key hashes so we can build a Bloom filter
+
+	TArray<DWORD> KeyHashes;
+
 	//	Open the file
 
 	if (!SegFile.Create(m_sFilespec, CFile::FLAG_CREATE_ALWAYS))
@@ -284,7 +425,15 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 
 	utlMemSet(m_pHeader, sizeof(SSegmentHeader), 0);
 	m_pHeader->dwSignature = INPROGRESS_SIGNATURE;
-	m_pHeader->dwFlags = dwFlags;
+	m_pHeader->dwFlags = dwFlags | FLAG_PREFIX_KEYS | FLAG_BLOCK_CHECKSUMS;
+	m_pHeader->dwRestartInterval = KEY_RESTART_INTERVAL;
+
+	ECompressionTypes iCodec = m_iDefaultCodec;
+	if (iCodec != compressionNone)
+		{
+		m_pHeader->dwFlags |= FLAG_COMPRESSED_BLOCKS;
+		m_pHeader->dwCodec = iCodec;
+		}
 
 	try
 		{
@@ -319,6 +468,7 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 		pBlock->dwBlockOffset = SegFile.GetStreamLength();
 		pBlock->dwBlockSize = 0;
 		pBlock->dwRowCount = 0;
+		pBlock->dwChecksum = 0;
 
 		//	Loop over writes to figure out how many rows will fit in this block.
 		//	We use a copy of the iterator because we don't want to advance the
@@ -350,7 +500,6 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 
 		DWORD dwBlockHeaderSize = sizeof(SBlockHeader);
 		DWORD dwBlockIndexSize = (pBlock->dwRowCount * iBlockIndexEntrySize);
-		pBlock->dwBlockSize += dwBlockHeaderSize + dwBlockIndexSize;
 
 		//	We're going to write to a temporary buffer first.
 
@@ -362,6 +511,7 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 		//	and the row data (at two different positions in the buffer).
 
 		DWORD dwRowsLeft = pBlock->dwRowCount;
+		CString sPrevKey;
 		while (Rows.HasMore() && dwRowsLeft > 0)
 			{
 			DWORD dwKeySize;
@@ -370,8 +520,11 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 			//	If this is the last row of the last block then get the last
 			//	key.
 
+			CString sKey = Rows.GetKey();
 			if (bLastBlock && dwRowsLeft == 1)
-				sLastKey = Rows.GetKey();
+				sLastKey = sKey;
+
+			KeyHashes.Insert(CSegmentBloomFilter::HashKey(sKey));
 
 			//	Sometimes we need the RowID
 
@@ -384,7 +537,21 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 			//	that we don't ask for the RowID if the segment doesn't store it.
 
 			BlockBuffer.Seek(dwRowDataPos);
-			Rows.WriteNextRow(BlockBuffer, &dwKeySize, &dwDataSize, (HasRowID() ? &Extra.RowID : NULL));
+			if (HasPrefixKeys())
+				{
+				//	Every KEY_RESTART_INTERVAL rows we store the full key so
+				//	that readers don't have to decode from the start.
+
+				DWORD dwRow = pBlock->dwRowCount - dwRowsLeft;
+				if ((dwRow % KEY_RESTART_INTERVAL) == 0)
+					sPrevKey = NULL_STR;
+
+				SerializePrefixKey(BlockBuffer, sKey, sPrevKey, &dwKeySize);
+				Rows.WriteNextValue(BlockBuffer, &dwDataSize, (HasRowID() ? &Extra.RowID : NULL));
+				sPrevKey = sKey;
+				}
+			else
+				Rows.WriteNextRow(BlockBuffer, &dwKeySize, &dwDataSize, (HasRowID() ? &Extra.RowID : NULL));
 
 			//	Write the row index
 
@@ -415,16 +582,44 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 		SBlockHeader BlockHeader;
 		BlockHeader.dwSize = dwRowDataPos;
 		BlockHeader.dwRowCount = pBlock->dwRowCount;
-		ASSERT(BlockHeader.dwSize == pBlock->dwBlockSize);
 
 		BlockBuffer.Seek(0);
 		BlockBuffer.Write(&BlockHeader, sizeof(BlockHeader));
 
-		//	Now write out the block
+		//	Now write out the block (compressing if necessary). If compression
+		//	doesn't help we store the block as is.
+
+		CBuffer DiskBlock;
 
 		try
 			{
-			SegFile.Write(BlockBuffer);
+			if (m_pHeader->dwFlags & FLAG_COMPRESSED_BLOCKS)
+				{
+				CBuffer Compressed;
+				compCompress(BlockBuffer, iCodec, &Compressed);
+
+				CSegmentBlockCache::SCompressedBlockHeader CompressedHeader;
+				CompressedHeader.dwSize = BlockBuffer.GetLength();
+
+				if (Compressed.GetLength() < BlockBuffer.GetLength())
+					{
+					CompressedHeader.dwCodec = iCodec;
+					DiskBlock.Write(&CompressedHeader, sizeof(CompressedHeader));
+					DiskBlock.Write(Compressed);
+					}
+				else
+					{
+					CompressedHeader.dwCodec = compressionNone;
+					DiskBlock.Write(&CompressedHeader, sizeof(CompressedHeader));
+					DiskBlock.Write(BlockBuffer);
+					}
+				}
+			else
+				DiskBlock.TakeHandoff(BlockBuffer);
+
+			pBlock->dwBlockSize = DiskBlock.GetLength();
+			pBlock->dwChecksum = utlCRC32C(DiskBlock.GetPointer(), DiskBlock.GetLength());
+			SegFile.Write(DiskBlock);
 			}
 		catch (...)
 			{
@@ -437,6 +632,12 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 			return false;
 			}
 
+		//	If we're rate limited (e.g., compaction) then we may need to wait
+		//	before writing the next block.
+
+		if (pLimiter)
+			pLimiter->Consume(DiskBlock.GetLength());
+
 		//	Keep incrementing the total rows
 
 		m_pHeader->dwRowCount += pBlock->dwRowCount;
@@ -450,6 +651,7 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 			pBlock->dwBlockOffset = SegFile.GetStreamLength();
 			pBlock->dwBlockSize = 0;
 			pBlock->dwRowCount = 0;
+			pBlock->dwChecksum = 0;
 
 			ASSERT(!Rows.HasMore());
 			}
@@ -502,6 +704,88 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 		return false;
 		}
 
+	//	Build the Bloom filter and write it after the index
+
+	m_Filter.Create(KeyHashes, FILTER_BITS_PER_KEY);
+	m_pHeader->dwFilterOffset = SegFile.GetStreamLength();
+
+	CBuffer FilterBuffer;
+	try
+		{
+		m_Filter.Write(FilterBuffer, &m_pHeader->dwFilterSize);
+		SegFile.Write(FilterBuffer);
+		}
+	catch (...)
+		{
+		delete m_pHeader;
+		m_pHeader = NULL;
+		SegFile.Close();
+		fileDelete(m_sFilespec);
+
+		*retsError = strPattern(ERR_CANT_WRITE_FILE, m_sFilespec);
+		return false;
+		}
+
+	//	Write the range deletes (if any) after the filter
+
+	CBuffer RangeDeletesBuffer;
+	if (pRangeDeletes && !pRangeDeletes->IsEmpty())
+		{
+		pRangeDeletes->Serialize(RangeDeletesBuffer);
+
+		m_pHeader->dwFlags |= FLAG_RANGE_DELETES;
+		m_pHeader->dwRangeDeletesOffset = SegFile.GetStreamLength();
+		m_pHeader->dwRangeDeletesSize = RangeDeletesBuffer.GetLength();
+
+		try
+			{
+			SegFile.Write(RangeDeletesBuffer);
+			}
+		catch (...)
+			{
+			delete m_pHeader;
+			m_pHeader = NULL;
+			SegFile.Close();
+			fileDelete(m_sFilespec);
+
+			*retsError = strPattern(ERR_CANT_WRITE_FILE, m_sFilespec);
+			return false;
+			}
+
+		m_sRangeDeletes = CString(RangeDeletesBuffer.GetPointer(), RangeDeletesBuffer.GetLength());
+		}
+
+	//	Write the block checksums at the end. The header has a checksum of
+	//	everything from the index to here, so Open can trust the index, the
+	//	filter, the range deletes, and the block checksums.
+
+	TArray<DWORD> Checksums;
+	Checksums.InsertEmpty(NewBlocks.GetCount());
+	for (i = 0; i < NewBlocks.GetCount(); i++)
+		Checksums[i] = NewBlocks[i].dwChecksum;
+
+	m_pHeader->dwChecksumOffset = SegFile.GetStreamLength();
+	m_pHeader->dwIndexChecksum = utlCRC32C(SegIndexBuffer.GetPointer(), SegIndexBuffer.GetLength());
+	m_pHeader->dwIndexChecksum = utlCRC32C(FilterBuffer.GetPointer(), FilterBuffer.GetLength(), m_pHeader->dwIndexChecksum);
+	if (RangeDeletesBuffer.GetLength() > 0)
+		m_pHeader->dwIndexChecksum = utlCRC32C(RangeDeletesBuffer.GetPointer(), RangeDeletesBuffer.GetLength(), m_pHeader->dwIndexChecksum);
+	m_pHeader->dwIndexChecksum = utlCRC32C(&Checksums[0], Checksums.GetCount() * (DWORD)sizeof(DWORD), m_pHeader->dwIndexChecksum);
+
+	try
+		{
+		SegFile.Write(&Checksums[0], Checksums.GetCount() * sizeof(DWORD));
+		}
+	catch (...)
+		{
+		delete m_pHeader;
+		m_pHeader = NULL;
+		SegFile.Close();
+		fileDelete(m_sFilespec);
+
+		*retsError = strPattern(ERR_CANT_WRITE_FILE, m_sFilespec);
+		return false;
+		}
+
 	//	Now we can go back and fill in the header properly
 
 	m_pHeader->dwSignature = SIGNATURE;
@@ -534,7 +818,7 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 
 	//	Open the block cache
 
-	if (!m_Blocks.Init(m_sFilespec, BLOCK_CACHE_SIZE))
+	if (!m_Blocks.Init(m_sFilespec, (m_pHeader->dwFlags & FLAG_COMPRESSED_BLOCKS) ? true : false))
 		{
 		delete m_pHeader;
 		m_pHeader = NULL;
@@ -545,6 +829,8 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 		return false;
 		}
 
+	m_Blocks.SetChecksums(Checksums);
+
 	//	Keep the index (because we keep the segment open)
 
 	m_pIndex = (SIndexEntry *)SegIndexBuffer.GetHandoff();
@@ -559,7 +845,7 @@ bool CAeonSegment::Create (DWORD dwViewID, const CTableDimensions &Dims, SEQUENC
 		if (pIndex->dwBlockSize > 0 && GetIndexCount() < 4)
 			{
 			SBlockHeader *pBlock;
-			if (!m_Blocks.LoadBlock(pIndex->dwBlockOffset, pIndex->dwBlockSize, (void **)&pBlock))
+			if (!m_Blocks.LoadBlock(i, pIndex->dwBlockOffset, pIndex->dwBlockSize, (void **)&pBlock))
 				printf("Unable to load block.\n");
 
 			for (int j = 0; j < (int)pIndex->dwRowCount; j++)
@@ -606,6 +892,7 @@ CDatum CAeonSegment::DebugDump (void) const
 		pData->SetElement(FIELD_MARKED_FOR_DELETE, CDatum(CDatum::constTrue));
 
 	pData->SetElement(FIELD_FILE_SIZE, fileGetSize(m_sFilespec));
+	pData->SetElement(FIELD_FILTER_SIZE, (int)m_pHeader->dwFilterSize);
 
 	CComplexArray *pBlockIndex = new CComplexArray;
 	for (i = 0; i < GetIndexCount(); i++)
@@ -651,6 +938,12 @@ bool CAeonSegment::FindData (const CRowKey &Key, CDatum *retData, SEQUENCENUMBER
 //	Finds the data at the given path
 
 	{
+	//	If the filter says the key isn't here, then we don't need to touch
+	//	any blocks.
+
+	if (!m_Filter.MayContain(Key.AsEncodedString()))
+		return false;
+
 	//	Find the block that contains the key
 
 	SIndexEntry *pEntry = GetBlockByKey(Key.AsEncodedString());
@@ -660,7 +953,7 @@ bool CAeonSegment::FindData (const CRowKey &Key, CDatum *retData, SEQUENCENUMBER
 	//	Load the block (we throw on error)
 
 	SBlockHeader *pBlock;
-	m_Blocks.LoadBlock(pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
+	m_Blocks.LoadBlock(GetIndexPos(pEntry), pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
 
 	//	Find the key in the block
 
@@ -696,7 +989,7 @@ bool CAeonSegment::FindKey (const CRowKey &Key, int *retiIndex)
 	//	Load the block (throw on error)
 
 	SBlockHeader *pBlock;
-	m_Blocks.LoadBlock(pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
+	m_Blocks.LoadBlock(GetIndexPos(pEntry), pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
 
 	//	Find the key in the block
 
@@ -762,8 +1055,8 @@ CAeonSegment::SIndexEntry *CAeonSegment::GetBlockByKey (const CString &sKey, int
 		//	Get the block
 
 		SIndexEntry *pTry = GetIndexEntry(iTry);
-		CString sTryKey = IndexGetKey(pTry);
-		int iCompare = CRowKey::Compare(m_Dims, CRowKey(m_Dims, sKey), CRowKey(m_Dims, sTryKey));
+		CStringBuffer TryKey(((char *)m_pIndex) + pTry->dwKeyOffset + sizeof(DWORD));
+		int iCompare = CRowKey::Compare(m_Dims, CRowKey(m_Dims, sKey), CRowKey(m_Dims, TryKey));
 
 		if (iCompare == 0)
 			{
@@ -817,6 +1110,7 @@ CAeonSegment::SIndexEntry *CAeonSegment::GetBlockByRowPos (int iIndex, int *reti
 			if (retiRowInBlock)
 				*retiRowInBlock = iIndex;
 
+			OnBlockAccess(i);
 			return &m_pIndex[i];
 			}
 
@@ -854,7 +1148,7 @@ CDatum CAeonSegment::GetData (int iIndex)
 		//	Load the block (throw on error)
 
 		SBlockHeader *pBlock;
-		m_Blocks.LoadBlock(pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
+		m_Blocks.LoadBlock(GetIndexPos(pEntry), pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
 		bDiagLoadBlock = true;
 
 		//	Construct a row value
@@ -930,6 +1224,21 @@ bool CAeonSegment::GetInfo (const CString &sFilespec, SInfo *retInfo)
 	return true;
 	}
 
+bool CAeonSegment::GetRangeDeletes (CAeonRangeDeletes *retRangeDeletes) const
+
+//	GetRangeDeletes
+//
+//	Adds the range deletes saved with this segment to the given set. Returns
+//	FALSE if they are invalid.
+
+	{
+	if (m_sRangeDeletes.IsEmpty())
+		return true;
+
+	CBuffer Buffer(m_sRangeDeletes);
+	return retRangeDeletes->Deserialize(m_Dims, Buffer);
+	}
+
 CString CAeonSegment::GetKey (int iIndex)
 
 //	GetKey
@@ -957,7 +1266,7 @@ CString CAeonSegment::GetKey (int iIndex)
 	//	Load the block (throw on error)
 
 	SBlockHeader *pBlock;
-	m_Blocks.LoadBlock(pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
+	m_Blocks.LoadBlock(GetIndexPos(pEntry), pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
 
 	//	Get the key from the block
 
@@ -989,7 +1298,7 @@ bool CAeonSegment::GetRow (int iIndex, CRowKey *retKey, CDatum *retData, SEQUENC
 	//	Load the block (throw on error)
 
 	SBlockHeader *pBlock;
-	m_Blocks.LoadBlock(pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
+	m_Blocks.LoadBlock(GetIndexPos(pEntry), pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
 
 	//	Get the key
 
@@ -1036,13 +1345,18 @@ DWORD CAeonSegment::GetRowSize (int iIndex)
 	//	Load the block (throw on error)
 
 	SBlockHeader *pBlock;
-	m_Blocks.LoadBlock(pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
+	m_Blocks.LoadBlock(GetIndexPos(pEntry), pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
 
 	//	Construct a row value
 
 	CAeonRowValue RowValue;
 	RowValue.Init(BlockGetValue(pBlock, iRowPos));
-	DWORD dwSize = RowValue.GetSerializedSize();;
+
+	//	NOTE: WriteData upgrades old rows, so we need to report the upgraded
+	//	size.
+
+	RowValue.UpgradeFormat();
+	DWORD dwSize = RowValue.GetSerializedSize();
 
 	//	Unload
 
@@ -1065,6 +1379,51 @@ CString CAeonSegment::IndexGetKey (const SIndexEntry *pIndex) const
 	return Key;
 	}
 
+void CAeonSegment::OnBlockAccess (int iBlock)
+
+//	OnBlockAccess
+//
+//	Called (inside m_cs) whenever we access a block by row position. If the
+//	caller is walking blocks in order, we ask the read-ahead thread to load the
+//	next few blocks before they're needed.
+
+	{
+	//	We only read ahead on mapped files (otherwise the read-ahead thread
+	//	would contend with the reader for the file handle).
+
+	if (!m_Blocks.IsMapped())
+		return;
+
+	//	Blocks just behind the frontier don't change anything. (A merge
+	//	measures rows slightly ahead of the rows that it writes.)
+
+	if (iBlock <= m_iReadFrontier && iBlock >= m_iReadFrontier - READ_AHEAD_BLOCKS)
+		return;
+
+	if (iBlock == m_iReadFrontier + 1)
+		m_iSequentialBlocks++;
+	else
+		{
+		m_iSequentialBlocks = 0;
+		m_iReadAheadEnd = iBlock + 1;
+		}
+
+	m_iReadFrontier = iBlock;
+	if (m_iSequentialBlocks < READ_AHEAD_TRIGGER)
+		return;
+
+	//	Request blocks that we haven't already asked for. NOTE: The last index
+	//	entry only holds the last key (it has no block).
+
+	int iStart = Max(m_iReadAheadEnd, iBlock + 1);
+	int iEnd = Min(iBlock + 1 + READ_AHEAD_BLOCKS, GetIndexCount() - 1);
+	if (iStart >= iEnd)
+		return;
+
+	CSegmentBlockCache::GetReadAhead().Request(this, iStart, iEnd - iStart);
+	m_iReadAheadEnd = iEnd;
+	}
+
 bool CAeonSegment::Open (const CString &sFilespec, CString *retsError)
 
 //	Open
@@ -1083,6 +1442,9 @@ bool CAeonSegment::Open (const CString &sFilespec, CString *retsError)
 
 	//	Load the header and index
 
+	TArray<DWORD> Checksums;
+	bool bBadChecksum = false;
+
 	try
 		{
 		//	Read the header
@@ -1091,19 +1453,81 @@ bool CAeonSegment::Open (const CString &sFilespec, CString *retsError)
 
 		File.Read(m_pHeader, sizeof(SSegmentHeader));
 
-		//	Make sure we have the right signature
+		//	Make sure we have the right signature and that we understand
+		//	this version.
 
-		if (m_pHeader->dwSignature != SIGNATURE)
+		if (m_pHeader->dwSignature != SIGNATURE
+				|| m_pHeader->dwVersion > CURRENT_VERSION)
 			throw 1;
 
-		//	Now that we know the size of the index, allocate some memory
+		if ((m_pHeader->dwFlags & FLAG_PREFIX_KEYS) && m_pHeader->dwRestartInterval == 0)
+			throw 1;
+
+		//	If we have checksums, then the index, the Bloom filter, the range
+		//	deletes, and the block checksums run to the end of the file. We
+		//	read them all at once so we can verify them before we trust any of
+		//	it.
+
+		if (m_pHeader->dwFlags & FLAG_BLOCK_CHECKSUMS)
+			{
+			DWORDLONG dwTailEnd = (DWORDLONG)m_pHeader->dwChecksumOffset + m_pHeader->dwIndexCount * sizeof(DWORD);
+			if (dwTailEnd != File.GetSize()
+					|| m_pHeader->dwChecksumOffset < m_pHeader->dwIndexOffset
+					|| (DWORDLONG)m_pHeader->dwIndexOffset + m_pHeader->dwIndexSize > dwTailEnd
+					|| (DWORDLONG)m_pHeader->dwFilterOffset + m_pHeader->dwFilterSize > dwTailEnd)
+				throw 1;
+
+			if ((m_pHeader->dwFlags & FLAG_RANGE_DELETES)
+					&& (m_pHeader->dwRangeDeletesOffset < m_pHeader->dwIndexOffset
+						|| (DWORDLONG)m_pHeader->dwRangeDeletesOffset + m_pHeader->dwRangeDeletesSize > dwTailEnd))
+				throw 1;
+
+			CBuffer Tail;
+			Tail.SetLength((int)(dwTailEnd - m_pHeader->dwIndexOffset));
+			File.Seek(m_pHeader->dwIndexOffset);
+			File.Read(Tail.GetPointer(), Tail.GetLength());
+
+			if (utlCRC32C(Tail.GetPointer(), Tail.GetLength()) != m_pHeader->dwIndexChecksum)
+				{
+				bBadChecksum = true;
+				throw 1;
+				}
+
+			m_pIndex = (SIndexEntry *)new char [m_pHeader->dwIndexSize];
+			utlMemCopy(Tail.GetPointer(), m_pIndex, m_pHeader->dwIndexSize);
+
+			if (m_pHeader->dwFilterOffset && m_pHeader->dwFilterSize)
+				{
+				Tail.Seek(m_pHeader->dwFilterOffset - m_pHeader->dwIndexOffset);
+				m_Filter.Read(Tail, m_pHeader->dwFilterSize);
+				}
+
+			if (m_pHeader->dwFlags & FLAG_RANGE_DELETES)
+				m_sRangeDeletes = CString(Tail.GetPointer() + (m_pHeader->dwRangeDeletesOffset - m_pHeader->dwIndexOffset), m_pHeader->dwRangeDeletesSize);
+
+			Checksums.InsertEmpty(m_pHeader->dwIndexCount);
+			utlMemCopy(Tail.GetPointer() + (m_pHeader->dwChecksumOffset - m_pHeader->dwIndexOffset), &Checksums[0], m_pHeader->dwIndexCount * (DWORD)sizeof(DWORD));
+			}
+		else
+			{
+			//	Now that we know the size of the index, allocate some memory
+
+			m_pIndex = (SIndexEntry *)new char [m_pHeader->dwIndexSize];
+
+			//	Read the index
 
-		m_pIndex = (SIndexEntry *)new char [m_pHeader->dwIndexSize];
+			File.Seek(m_pHeader->dwIndexOffset);
+			File.Read(m_pIndex, m_pHeader->dwIndexSize);
 
-		//	Read the index
+			//	Read the Bloom filter, if we have one. If the filter is invalid
+			//	we just do without it.
 
-		File.Seek(m_pHeader->dwIndexOffset);
-		File.Read(m_pIndex, m_pHeader->dwIndexSize);
+			if (m_pHeader->dwFilterOffset && m_pHeader->dwFilterSize)
+				{
+				File.Seek(m_pHeader->dwFilterOffset);
+				m_Filter.Read(File, m_pHeader->dwFilterSize);
+				}
+			}
 		}
 	catch (...)
 		{
@@ -1119,7 +1543,10 @@ bool CAeonSegment::Open (const CString &sFilespec, CString *retsError)
 			m_pIndex = NULL;
 			}
 
-		*retsError = strPattern("Unable to open segment file: %s", sFilespec);
+		if (bBadChecksum)
+			*retsError = strPattern(ERR_BAD_INDEX_CHECKSUM, sFilespec);
+		else
+			*retsError = strPattern("Unable to open segment file: %s", sFilespec);
 		return false;
 		}
 
@@ -1133,7 +1560,7 @@ bool CAeonSegment::Open (const CString &sFilespec, CString *retsError)
 
 	//	Init the cache
 
-	if (!m_Blocks.Init(sFilespec, BLOCK_CACHE_SIZE))
+	if (!m_Blocks.Init(sFilespec, (m_pHeader->dwFlags & FLAG_COMPRESSED_BLOCKS) ? true : false))
 		{
 		delete m_pHeader;
 		m_pHeader = NULL;
@@ -1143,11 +1570,185 @@ bool CAeonSegment::Open (const CString &sFilespec, CString *retsError)
 		return false;
 		}
 
+	m_Blocks.SetChecksums(Checksums);
+
 	//	Done
 
 	return true;
 	}
 
+void CAeonSegment::ReadAhead (int iBlock)
+
+//	ReadAhead
+//
+//	Called by the read-ahead thread to load the given block. We don't take
+//	m_cs because the index doesn't change once the segment is open.
+
+	{
+	if (iBlock < 0 || iBlock >= GetIndexCount())
+		return;
+
+	const SIndexEntry *pEntry = GetIndexEntry(iBlock);
+	m_Blocks.Prefetch(iBlock, pEntry->dwBlockOffset, pEntry->dwBlockSize);
+	}
+
+void CAeonSegment::SerializePrefixKey (IByteStream &Stream, const CString &sKey, const CString &sPrevKey, DWORD *retdwSize)
+
+//	SerializePrefixKey
+//
+//	Serializes a key as the number of bytes it shares with the previous key
+//	plus the remaining bytes.
+//
+//	DWORD	bytes shared with previous key
+//	DWORD	size of remaining bytes
+//	BYTES[]	remaining bytes (padded to DWORD align)
+
+	{
+	char *pKey = sKey.GetParsePointer();
+	char *pPrevKey = sPrevKey.GetParsePointer();
+	DWORD dwMaxShared = Min(sKey.GetLength(), sPrevKey.GetLength());
+
+	DWORD dwShared = 0;
+	while (dwShared < dwMaxShared && pKey[dwShared] == pPrevKey[dwShared])
+		dwShared++;
+
+	DWORD dwSuffixSize = sKey.GetLength() - dwShared;
+
+	Stream.Write(&dwShared, sizeof(DWORD));
+	Stream.Write(&dwSuffixSize, sizeof(DWORD));
+	Stream.Write(pKey + dwShared, dwSuffixSize);
+
+	//	Save padding
+
+	DWORD dwZero = 0;
+	DWORD dwAlignedSize = AlignUp(dwSuffixSize, (DWORD)sizeof(DWORD));
+	Stream.Write(&dwZero, dwAlignedSize - dwSuffixSize);
+
+	//	Done
+
+	if (retdwSize)
+		*retdwSize = 2 * sizeof(DWORD) + dwAlignedSize;
+	}
+
+void CAeonSegment::SetDefaultBlockSize (DWORD dwSize)
+
+//	SetDefaultBlockSize
+//
+//	Sets the target block size for new segments. 0 restores the default.
+//	Tests use a small size to get many blocks out of a few rows.
+
+	{
+	m_dwDefaultBlockSize = (dwSize ? dwSize : DEFAULT_BLOCK_SIZE);
+	}
+
+bool CAeonSegment::Verify (const CString &sFilespec, CString *retsError)
+
+//	Verify
+//
+//	Reads the whole segment file and checks the index and block checksums.
+//	Returns FALSE if the file is corrupt. Segments created before version 5
+//	have no checksums, so all we can check is the header.
+//
+//	This does not use the block cache, so we can call it on any thread (and on
+//	files that we don't have open, such as backups).
+
+	{
+	int i;
+
+	CFile File;
+	if (!File.Create(sFilespec, CFile::FLAG_OPEN_READ_ONLY))
+		{
+		*retsError = strPattern(ERR_CANT_OPEN_FILE, sFilespec);
+		return false;
+		}
+
+	try
+		{
+		SSegmentHeader Header;
+		File.Read(&Header, sizeof(SSegmentHeader));
+		DWORDLONG dwFileSize = File.GetSize();
+
+		if (Header.dwSignature != SIGNATURE
+				|| Header.dwVersion > CURRENT_VERSION
+				|| (DWORDLONG)Header.dwIndexOffset + Header.dwIndexSize > dwFileSize
+				|| Header.dwIndexSize < Header.dwIndexCount * sizeof(SIndexEntry))
+			{
+			*retsError = strPattern(ERR_INVALID_SEGMENT, sFilespec);
+			return false;
+			}
+
+		if (!(Header.dwFlags & FLAG_BLOCK_CHECKSUMS))
+			return true;
+
+		//	The index, filter, and block checksums run to the end of the file.
+
+		if (Header.dwChecksumOffset < Header.dwIndexOffset
+				|| (DWORDLONG)Header.dwChecksumOffset + Header.dwIndexCount * sizeof(DWORD) != dwFileSize)
+			{
+			*retsError = strPattern(ERR_INVALID_SEGMENT, sFilespec);
+			return false;
+			}
+
+		CBuffer Tail;
+		Tail.SetLength((int)(dwFileSize - Header.dwIndexOffset));
+		File.Seek(Header.dwIndexOffset);
+		File.Read(Tail.GetPointer(), Tail.GetLength());
+
+		if (utlCRC32C(Tail.GetPointer(), Tail.GetLength()) != Header.dwIndexChecksum)
+			{
+			*retsError = strPattern(ERR_BAD_INDEX_CHECKSUM, sFilespec);
+			return false;
+			}
+
+		const SIndexEntry *pIndex = (const SIndexEntry *)Tail.GetPointer();
+		const DWORD *pChecksums = (const DWORD *)(Tail.GetPointer() + (Header.dwChecksumOffset - Header.dwIndexOffset));
+
+		//	Blocks are contiguous, so reading them in order is a sequential
+		//	read of the file.
+
+		CBuffer Buffer;
+		Buffer.SetLength(VERIFY_BUFFER_SIZE);
+
+		for (i = 0; i < (int)Header.dwIndexCount; i++)
+			{
+			const SIndexEntry &Entry = pIndex[i];
+			if (Entry.dwBlockSize == 0)
+				continue;
+
+			if ((DWORDLONG)Entry.dwBlockOffset + Entry.dwBlockSize > Header.dwIndexOffset)
+				{
+				*retsError = strPattern(ERR_INVALID_SEGMENT, sFilespec);
+				return false;
+				}
+
+			File.Seek(Entry.dwBlockOffset);
+
+			DWORD dwCRC = 0;
+			DWORD dwLeft = Entry.dwBlockSize;
+			while (dwLeft > 0)
+				{
+				DWORD dwRead = Min(VERIFY_BUFFER_SIZE, dwLeft);
+				File.Read(Buffer.GetPointer(), dwRead);
+				dwCRC = utlCRC32C(Buffer.GetPointer(), dwRead, dwCRC);
+				dwLeft -= dwRead;
+				}
+
+			if (dwCRC != pChecksums[i])
+				{
+				*retsError = strPattern(ERR_BAD_BLOCK_CHECKSUM, i, sFilespec);
+				return false;
+				}
+			}
+		}
+	catch (...)
+		{
+		*retsError = strPattern(ERR_CANT_READ_SEGMENT, sFilespec);
+		return false;
+		}
+
+	return true;
+	}
+
 void CAeonSegment::WriteData (IByteStream &Stream, int iIndex, DWORD *retdwSize, SEQUENCENUMBER *retRowID)
 
 //	WriteData
@@ -1168,12 +1769,17 @@ void CAeonSegment::WriteData (IByteStream &Stream, int iIndex, DWORD *retdwSize,
 	//	Load the block (throw on error)
 
 	SBlockHeader *pBlock;
-	m_Blocks.LoadBlock(pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
+	m_Blocks.LoadBlock(GetIndexPos(pEntry), pEntry->dwBlockOffset, pEntry->dwBlockSize, (void **)&pBlock);
 
 	//	Construct a row value
 
 	CAeonRowValue RowValue;
 	RowValue.Init(BlockGetValue(pBlock, iRowPos, retRowID));
+
+	//	If this row was saved in an older format, convert it now (this is how
+	//	we migrate old segments when we merge them).
+
+	RowValue.UpgradeFormat();
 	RowValue.Serialize(Stream);
 
 	//	Get the size
@@ -1185,4 +1791,3 @@ void CAeonSegment::WriteData (IByteStream &Stream, int iIndex, DWORD *retdwSize,
 
 	m_Blocks.UnloadBlock(pEntry->dwBlockOffset);
 	}
-
@@ -7,13 +7,15 @@
 //
 //	{tableName}
 //		desc.ars					Table descriptor
+//		backup.ars					Backup manifest (backup volume only)
 //
 //		segments					Current segment files
 //			{########_####}.aseg
 //			...
 //
 //		files						Data files (for typeFile tables only)
-//			{########_########}.afile
+//			{sha256}.achunk			File contents (see CAeonChunkStore)
+//			{########_########}.afile	Uploads in progress (and older files)
 //
 //		recovery					Temporary write log for memory rows
 //
@@ -68,10 +70,26 @@ struct SNewSegment
 	CString sBackup;
 	};
 
+const DWORD CHECKPOINT_INTERVAL =						10 * 60 * 1000;
+const DWORD CHUNK_SWEEP_INTERVAL =						6 * 60 * 60 * 1000;
+const int CHUNK_SWEEP_WAIT =							100;
+const int COPY_NAME_CHARS =								16;
+const int LOG_COPY_BUFFER_SIZE =						64 * 1024;
 const int MAX_CHANGES_IN_MEMORY =						100;
+const int MAX_SCRUB_THREADS =							4;
+const int MAX_VIEW_UPDATE_THREADS =						4;
+const DWORDLONG MIN_ROWS_PER_VIEW_UPDATE_THREAD =		100000;
+const int ORPHAN_FILE_AGE =								60 * 60 * 1000;
+const DWORD SCRUB_INTERVAL =								24 * 60 * 60 * 1000;
+const int VIEW_UPDATE_RUN_ROWS =						100000;
+const DWORDLONG VIEW_UPDATE_PROGRESS_ROWS =				10000;
 
 DECLARE_CONST_STRING(FILESPEC_TABLE_DESC_FILE,			"desc.ars")
+DECLARE_CONST_STRING(FILESPEC_BACKUP_MANIFEST,			"backup.ars")
 DECLARE_CONST_STRING(FILESPEC_FILES_DIR,				"files")
+DECLARE_CONST_STRING(FILESPEC_FILE_COPY_CONS,			"files\\%s.afile")
+DECLARE_CONST_STRING(FILESPEC_FILE_EXTENSION,			"afile")
+DECLARE_CONST_STRING(FILESPEC_TEMP_EXTENSION,			"tmp")
 DECLARE_CONST_STRING(FILESPEC_RECOVERY_DIR,				"recovery")
 DECLARE_CONST_STRING(FILESPEC_SCRAP_CONS,				"%s\\scrap\\%s")
 DECLARE_CONST_STRING(FILESPEC_SCRAP_DIR,				"scrap")
@@ -81,6 +99,8 @@ DECLARE_CONST_STRING(FILESPEC_SEGMENT_CONS,				"%s\\segments\\%04x%04x_%04x.aseg
 DECLARE_CONST_STRING(FILESPEC_ALL,						"*.*")
 
 DECLARE_CONST_STRING(FIELD_BACKUP_VOLUMES,				"backupVolumes")
+DECLARE_CONST_STRING(FIELD_CHUNKS,						"chunks")
+DECLARE_CONST_STRING(FIELD_COMPACTION,					"compaction")
 DECLARE_CONST_STRING(FIELD_DATA,						"data")
 DECLARE_CONST_STRING(FIELD_FILE_DESC,					"fileDesc")
 DECLARE_CONST_STRING(FIELD_FILE_PATH,					"filePath")
@@ -95,12 +115,16 @@ DECLARE_CONST_STRING(FIELD_NAME,						"name")
 DECLARE_CONST_STRING(FIELD_PARTIAL_POS,					"partialPos")
 DECLARE_CONST_STRING(FIELD_PRIMARY_KEY,					"primaryKey")
 DECLARE_CONST_STRING(FIELD_PRIMARY_VOLUME,				"primaryVolume")
-DECLARE_CONST_STRING(FIELD_SECONDARY_KEY,				"secondaryKey")
+DECLARE_CONST_STRING(FIELD_ROW_CACHE,					"rowCache")
+DECLARE_CONST_STRING(FIELD_ROW_CACHE_SIZE,				"rowCacheSize")
 DECLARE_CONST_STRING(FIELD_SECONDARY_VIEWS,				"secondaryViews")
 DECLARE_CONST_STRING(FIELD_SIZE,						"size")
 DECLARE_CONST_STRING(FIELD_STORAGE_PATH,				"storagePath")
+DECLARE_CONST_STRING(FIELD_TTL,							"ttl")
 DECLARE_CONST_STRING(FIELD_TYPE,						"type")
 DECLARE_CONST_STRING(FIELD_UNMODIFIED,					"unmodified")
+DECLARE_CONST_STRING(FIELD_UPDATE_PROGRESS,				"updateProgress")
+DECLARE_CONST_STRING(FIELD_UPLOAD_POS,					"uploadPos")
 DECLARE_CONST_STRING(FIELD_VERSION,						"version")
 DECLARE_CONST_STRING(FIELD_X,							"x")
 DECLARE_CONST_STRING(FIELD_Y,							"y")
@@ -143,6 +167,7 @@ DECLARE_CONST_STRING(MUTATE_WRITE,						"write")
 DECLARE_CONST_STRING(MUTATE_WRITE_NEW,					"writeNew")
 
 DECLARE_CONST_STRING(OP_CREATE_CORE_DIRECTORIES,		"creating core directories")
+DECLARE_CONST_STRING(OP_DELETE_RANGE,					"deleting a range of rows")
 DECLARE_CONST_STRING(OP_INSERT,							"inserting a row")
 DECLARE_CONST_STRING(OP_MUTATE,							"mutating a row")
 DECLARE_CONST_STRING(OP_UPDATING_VIEW,					"updating a view")
@@ -162,17 +187,22 @@ DECLARE_CONST_STRING(ERR_CANT_CREATE_KEY_TYPE,			"Unique keys cannot be of type
 DECLARE_CONST_STRING(ERR_CANT_DELETE_DEFAULT_VIEW,		"Default view cannot be deleted.")
 DECLARE_CONST_STRING(STR_ERROR_FILE_TABLE_EXPECTED,		"File table expected.")
 DECLARE_CONST_STRING(ERR_NOT_ENOUGH_DISK_SPACE,			"Insufficient disk space at: %s.")
-DECLARE_CONST_STRING(ERR_NOT_ENOUGH_SPACE_TO_MERGE,		"Insufficient disk space to merge segments: %s and %s.")
+DECLARE_CONST_STRING(ERR_NOT_ENOUGH_SPACE_TO_MERGE,		"Table %s: Insufficient disk space to merge %d segments.")
 DECLARE_CONST_STRING(ERR_INVALID_FILE_PATH,				"Invalid filePath: %s.")
+DECLARE_CONST_STRING(ERR_INVALID_ROW_FILTER,				"Invalid row filter: %s")
 DECLARE_CONST_STRING(STR_ERROR_INVALID_TABLE_TYPE,		"Invalid table type: %s.")
+DECLARE_CONST_STRING(ERR_INVALID_COMPACTION_POLICY,		"Invalid compaction policy: %s.")
+DECLARE_CONST_STRING(ERR_INVALID_ROW_CACHE_SIZE,			"Invalid row cache size: %d.")
 DECLARE_CONST_STRING(ERR_INVALID_VOLUME,				"Invalid volume: %s.")
-DECLARE_CONST_STRING(ERR_MERGING_SEGMENTS,				"Merging segments in table %s: %s (%d rows) with %s (%d rows).")
+DECLARE_CONST_STRING(ERR_MERGING_SEGMENTS,				"Merging segments in table %s: %d segments (%d rows) using %s policy.")
 DECLARE_CONST_STRING(ERR_CANT_CREATE_MULTI_D_KEY,		"Multidimensional keys cannot be generated.")
 DECLARE_CONST_STRING(ERR_PATH_EXISTS,					"Path already exists.")
+DECLARE_CONST_STRING(ERR_RANGE_DELETE_WITH_VIEWS,		"Range deletes are not supported on tables with secondary views; delete the rows individually.")
+DECLARE_CONST_STRING(ERR_BATCH_ROW_EXISTS,				"Row %d: Path already exists.")
 DECLARE_CONST_STRING(ERR_KEY_REQUIRED,					"Secondary views must specify key.")
 DECLARE_CONST_STRING(ERR_SEGMENT_FOR_INVALID_VIEW,		"Segment %s refers to unknown view: %x.")
-DECLARE_CONST_STRING(ERR_MERGE_TOO_BIG,					"Segment merge exceeds size limits: %s and %s.")
 DECLARE_CONST_STRING(STR_BACKING_UP,					"Table %s: Backing up to: %s.")
+DECLARE_CONST_STRING(ERR_BACKUP_FILE_MISMATCH,			"Table %s: Backup file does not match manifest: %s.")
 DECLARE_CONST_STRING(STR_BACKUP_COMPLETE,				"Table %s: Backup complete.")
 DECLARE_CONST_STRING(ERR_INVALID_BACKUP,				"Table %s: Backup volume %s is invalid: %s")
 DECLARE_CONST_STRING(STR_BACKUP_OK,						"Table %s: Backup volume %s is healthy.")
@@ -193,8 +223,16 @@ DECLARE_CONST_STRING(STR_PRIMARY_ONLINE_BACKUP_NEEDED,	"Table %s: Primary volume
 DECLARE_CONST_STRING(STR_PRIMARY_ONLINE_BACKUP_WAITING,	"Table %s: Primary volume reconnected. Waiting for new volume for backup.")
 DECLARE_CONST_STRING(STR_RECOVERED_ROWS,				"Table %s: Recovered %d row%p.")
 DECLARE_CONST_STRING(STR_RESTORING,						"Table %s: Restoring primary to: %s.")
+DECLARE_CONST_STRING(ERR_LOG_BACKUP_FAILED,				"Table %s: Unable to back up recovery log: %s")
 DECLARE_CONST_STRING(STR_RESTORE_COMPLETE,				"Table %s: Restore complete.")
+DECLARE_CONST_STRING(STR_SCRUB_COMPLETE,				"Table %s: Scrub complete. %d segment file%p failed verification.")
+DECLARE_CONST_STRING(STR_CHUNK_SWEEP_COMPLETE,			"Table %s: Deleted %d unused file%p.")
+DECLARE_CONST_STRING(ERR_CHUNK_BACKUP_FAILED,			"Table %s: Unable to back up file chunks for %s.")
+DECLARE_CONST_STRING(ERR_UPLOAD_BACKUP_FAILED,			"Table %s: Unable to write backup of upload for %s.")
+DECLARE_CONST_STRING(ERR_SEGMENT_CORRUPT,				"Table %s: Segment failed verification: %s")
+DECLARE_CONST_STRING(ERR_TABLE_BUSY,					"Table %s: Unable to verify segments during housekeeping.")
 DECLARE_CONST_STRING(ERR_MERGE_COMPLETE,				"Table %s: Segment merge complete.")
+DECLARE_CONST_STRING(STR_SEGMENT_REPAIRED,				"Table %s: Segment restored from backup: %s.")
 DECLARE_CONST_STRING(STR_SWAP_TO_BACKUP,				"Table %s: Using backup volume as primary.")
 DECLARE_CONST_STRING(STR_NEW_BACKUP,					"Table %s: Using new volume for backup: %s.")
 DECLARE_CONST_STRING(STR_NEW_PRIMARY,					"Table %s: Using new volume for primary: %s.")
@@ -218,6 +256,7 @@ DECLARE_CONST_STRING(ERR_UNABLE_TO_LIST_FILES,			"Unable to list files in: %s.")
 DECLARE_CONST_STRING(ERR_CANT_LOAD_SEGMENT,				"Unable to load segment file: %s.")
 DECLARE_CONST_STRING(STR_ERROR_CANT_PARSE_DESC,			"Unable to parse table desc: %s.")
 DECLARE_CONST_STRING(ERR_UNABLE_TO_READ_STORAGE,		"Unable to read file in arcology storage: %s.")
+DECLARE_CONST_STRING(ERR_CANT_REPAIR_SEGMENT,			"Unable to restore segment from backup: %s.")
 DECLARE_CONST_STRING(STR_ERROR_CANT_SAVE_DESC,			"Unable to save table desc: %s.")
 DECLARE_CONST_STRING(STR_ERROR_CANT_WRITE_FILE,			"Unable to write file to table: %s.")
 DECLARE_CONST_STRING(ERR_UNKNOWN,						"Unknown error accessing table: %s.")
@@ -225,9 +264,11 @@ DECLARE_CONST_STRING(ERR_UNKNOWN_MUTATE_OP,				"Unknown mutation: %s.")
 DECLARE_CONST_STRING(ERR_UNKNOWN_VIEW,					"Unknown view: %s.")
 DECLARE_CONST_STRING(ERR_UNKNOWN_VIEW_ID,				"Unknown viewID: %d.")
 DECLARE_CONST_STRING(ERR_UNKNOWN_VOLUME,				"Unknown volume: %s.")
+DECLARE_CONST_STRING(ERR_NOT_FULL_TEXT_VIEW,			"View %s is not a full-text view.")
 DECLARE_CONST_STRING(ERR_VIEW_NOT_READY,				"View %s: Unable to query until update is complete.")
 DECLARE_CONST_STRING(STR_VIEW_UPDATED,					"View update complete: view %s in table %s.")
 DECLARE_CONST_STRING(ERR_MISSING_FILE,					"Volume does not have required file: %s.")
+DECLARE_CONST_STRING(ERR_INCOMPLETE_FILE,				"Volume file is incomplete: %s.")
 DECLARE_CONST_STRING(STR_UPDATING_VIEW,					"Updating view %s in table %s.")
 DECLARE_CONST_STRING(ERR_UPDATE_VIEW_ABORTED,			"Unable to update view %s in table %s.")
 DECLARE_CONST_STRING(ERR_OLD_RECOVERY_FILE,				"Table %s: View %s using old version of recovery file.")
@@ -238,13 +279,27 @@ DECLARE_CONST_STRING(ERR_UPDATE_VERSION_OUT_OF_DATE,	"Unable to mutate row %s. F
 DECLARE_CONST_STRING(ERR_CANNOT_CONSUME,				"Unable to mutate row %s. Field %s value (%s) insufficient.")
 DECLARE_CONST_STRING(ERR_UPDATE_NIL,					"Unable to mutate row %s. Field %s is not nil.")
 
+int CAeonTable::m_iMaxViewUpdateThreads = MAX_VIEW_UPDATE_THREADS;
+DWORDLONG CAeonTable::m_dwMinRowsPerViewUpdateThread = MIN_ROWS_PER_VIEW_UPDATE_THREAD;
+
 CAeonTable::CAeonTable (void) : 
 		m_pStorage(NULL), 
 		m_bPrimaryLost(false),
 		m_bBackupLost(false),
 		m_bBackupNeeded(false),
 		m_bValidateBackup(false),
+		m_bCopyingLogs(false),
+		m_dwLastScrub(sysGetTickCount()),
+		m_dwLastCheckpoint(sysGetTickCount()),
+		m_dwLastChunkSweep(sysGetTickCount()),
+		m_iChunkUsers(0),
 		m_iHousekeeping(stateReady),
+		m_iCompaction(ICompactionPolicy::typeSizeTiered),
+		m_bCompacting(false),
+		m_dwViewUpdateID(0),
+		m_dwViewUpdateTotal(0),
+		m_dwViewUpdateDone(0),
+		m_ViewUpdateRunSeq(0),
 		m_iRowsRecovered(0)
 
 //	CAeonTable constructor
@@ -259,6 +314,145 @@ CAeonTable::~CAeonTable (void)
 	{
 	}
 
+void CAeonTable::BackupRecoveryLogs (void)
+
+//	BackupRecoveryLogs
+//
+//	Copies new recovery log records to the backup volume, so that a backup has
+//	the rows that are not yet in a segment. We only copy what was appended
+//	since last time; when a view saves its rows to a segment its log starts
+//	over, and so does the copy. We also save the backup manifest, if it
+//	changed.
+//
+//	Must be called outside the lock.
+
+	{
+	CSmartLock Lock(m_cs);
+	int i;
+	CString sError;
+
+	//	Only one thread copies logs at a time
+
+	while (m_bCopyingLogs)
+		{
+		Lock.Unlock();
+		::Sleep(100);
+		Lock.Lock();
+		}
+
+	if (m_bBackupLost || m_bBackupNeeded || m_sBackupVolume.IsEmpty())
+		return;
+
+	CString sBackupTablePath = fileAppend(m_pStorage->GetPath(m_sBackupVolume), m_sName);
+
+	//	Get the list of logs and how much of each we've already copied.
+
+	TArray<SLogBackup> Logs;
+	for (i = 0; i < m_Views.GetCount(); i++)
+		{
+		const CString &sLog = m_Views[i].GetRecoveryFilespec();
+		if (sLog.IsEmpty())
+			continue;
+
+		SLogBackup *pLog = Logs.Insert();
+		pLog->dwViewID = m_Views.GetKey(i);
+		pLog->sFilespec = sLog;
+		pLog->dwResets = m_Views[i].GetRecoveryResetCount();
+
+		SLogBackup *pPrev = m_LogBackup.GetAt(pLog->dwViewID);
+		pLog->dwCopied = (pPrev && pPrev->dwResets == pLog->dwResets ? pPrev->dwCopied : 0);
+		}
+
+	//	Copy outside the lock
+
+	m_bCopyingLogs = true;
+	Lock.Unlock();
+
+	for (i = 0; i < Logs.GetCount(); i++)
+		{
+		CString sBackup = fileAppend(fileAppend(sBackupTablePath, FILESPEC_RECOVERY_DIR), fileGetFilename(Logs[i].sFilespec));
+		if (!CopyLogTail(Logs[i].sFilespec, sBackup, &Logs[i].dwCopied, &sError))
+			{
+			m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_LOG_BACKUP_FAILED, m_sName, sError));
+
+			//	Copy the whole log next time
+
+			Logs[i].dwCopied = 0;
+			}
+		}
+
+	Lock.Lock();
+	m_bCopyingLogs = false;
+
+	//	Remember where we are
+
+	m_LogBackup.DeleteAll();
+	for (i = 0; i < Logs.GetCount(); i++)
+		m_LogBackup.SetAt(Logs[i].dwViewID, Logs[i]);
+
+	//	Save the manifest (unless the backup changed while we were unlocked).
+
+	if (m_BackupManifest.IsModified()
+			&& !m_bBackupLost
+			&& !m_bBackupNeeded)
+		{
+		if (!m_BackupManifest.Save(fileAppend(sBackupTablePath, FILESPEC_BACKUP_MANIFEST), &sError))
+			m_pProcess->Log(MSG_LOG_ERROR, sError);
+		}
+	}
+
+bool CAeonTable::BackupSegment (const CString &sFilespec, const CString &sBackup)
+
+//	BackupSegment
+//
+//	Copies a new segment to the backup volume and adds it to the backup
+//	manifest. We checksum the copy so that the manifest describes what actually
+//	landed on the backup.
+//
+//	Must be called outside the lock.
+
+	{
+	DWORD dwChecksum;
+	DWORDLONG dwSize;
+	if (!fileCopy(sFilespec, sBackup)
+			|| !CAeonBackupManifest::CalcChecksum(sBackup, &dwChecksum, &dwSize))
+		return false;
+
+	//	If the backup volume changed while we were copying, then the manifest
+	//	is not for this volume.
+
+	CSmartLock Lock(m_cs);
+	if (m_bBackupLost || m_bBackupNeeded
+			|| !strStartsWithNoCase(sBackup, m_pStorage->GetPath(m_sBackupVolume)))
+		return true;
+
+	m_BackupManifest.SetFile(fileAppend(FILESPEC_SEGMENTS_DIR, fileGetFilename(sBackup)), dwSize, dwChecksum);
+	return true;
+	}
+
+void CAeonTable::BeginChunkWrite (CSmartLock &Lock)
+
+//	BeginChunkWrite
+//
+//	Called with the lock held before we write chunk files outside the lock.
+//	We wait for any sweep in progress (which would not know about the new
+//	chunks). The caller decrements m_iChunkUsers (under the lock) when done.
+//
+//	NOTE: Readers just increment m_iChunkUsers. Any fileDesc that a reader
+//	sees during a sweep is in the sweep's snapshot (since no one can store new
+//	chunks), so its chunks are safe.
+
+	{
+	while (m_iHousekeeping == stateSweepingChunks)
+		{
+		Lock.Unlock();
+		::Sleep(CHUNK_SWEEP_WAIT);
+		Lock.Lock();
+		}
+
+	m_iChunkUsers++;
+	}
+
 void CAeonTable::CloseSegments (bool bMarkForDelete)
 
 //	CloseSegments
@@ -301,19 +495,375 @@ void CAeonTable::CollectGarbage (void)
 		}
 	}
 
-bool CAeonTable::CopyDirectory (const CString &sFromPath, const CString &sToPath, CString *retsError)
+bool CAeonTable::CommitRecovery (CSmartLock &Lock, const CString &sOp, CString *retsError)
+
+//	CommitRecovery
+//
+//	Waits until everything written to the recovery files so far is durable.
+//	We must be called inside the lock, but we unlock while waiting so that
+//	other inserts can join the same batch. Returns with the lock held.
+//
+//	NOTE: The rows are already in memory, so readers can see them before they
+//	are durable. See DURABILITY in ReadMe.txt.
+//
+//	If we fail to commit then we switch to the backup volume. Returns FALSE if
+//	the primary volume was lost.
+
+	{
+	int i;
+
+	TArray<CRowInsertLog::SCommitPoint> Commits;
+	for (i = 0; i < m_Views.GetCount(); i++)
+		if (m_Views[i].IsValid())
+			{
+			CRowInsertLog::SCommitPoint Commit;
+			m_Views[i].GetRecoveryCommitPoint(&Commit);
+			if (Commit.pLog)
+				Commits.Insert(Commit);
+			}
+
+	//	Wait outside the lock
+
+	Lock.Unlock();
+
+	bool bFailed = false;
+	CString sError;
+	for (i = 0; i < Commits.GetCount(); i++)
+		if (!Commits[i].pLog->Commit(Commits[i].dwSeq, &sError))
+			bFailed = true;
+
+	Lock.Lock();
+
+	//	If we failed, another thread might have already switched to the backup
+	//	(which saves all rows and resets the logs). In that case we're done.
+
+	if (bFailed)
+		{
+		bFailed = false;
+		for (i = 0; i < Commits.GetCount(); i++)
+			if (!Commits[i].pLog->IsDurable(Commits[i].dwSeq))
+				bFailed = true;
+		}
+
+	for (i = 0; i < Commits.GetCount(); i++)
+		Commits[i].pLog->Release();
+
+	//	If we failed to write to the recovery file then it means that the 
+	//	primary volume is bad, so we switch to the back up.
+
+	if (bFailed)
+		{
+		m_pProcess->Log(MSG_LOG_ERROR, sError);
+		m_pProcess->ReportVolumeFailure(fileAppend(fileAppend(m_pStorage->GetPath(m_sPrimaryVolume), m_sName), FILESPEC_RECOVERY_DIR), sOp);
+
+		if (!RecoveryRestore())
+			{
+			*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+			return false;
+			}
+		}
+
+	return true;
+	}
+
+bool CAeonTable::Compact (CAeonRateLimiter &Limiter)
+
+//	Compact
+//
+//	This is called periodically by a compaction thread to merge segments. We
+//	merge at most one run of segments per call.
+//	Returns FALSE if there is an error.
+
+	{
+	CSmartLock Lock(m_cs);
+	int i, j;
+	CString sError;
+
+	//	If another thread is already merging, or if we're backing up,
+	//	updating a view, or scrubbing (all of which need the set of segments
+	//	to stay put) then skip.
+
+	if (m_bCompacting
+			|| m_bPrimaryLost
+			|| m_iHousekeeping == stateBackup
+			|| m_iHousekeeping == stateUpdatingView
+			|| m_iHousekeeping == stateScrubbing)
+		return true;
+
+	const ICompactionPolicy &Policy = ICompactionPolicy::Get(m_iCompaction);
+
+	//	Loop over all views until we find segments to merge.
+
+	for (i = 0; i < m_Views.GetCount(); i++)
+		{
+		TArray<CAeonSegment *> Merge;
+		bool bIncludesOldest;
+		if (!m_Views[i].GetSegmentsToMerge(Policy, &Merge, &bIncludesOldest))
+			continue;
+
+		DWORD dwViewID = m_Views[i].GetID();
+
+		//	Remember the files so we can delete the backups later.
+
+		TArray<CString> MergeFiles;
+		DWORDLONG dwTotalSize = 0;
+		int iTotalRows = 0;
+		for (j = 0; j < Merge.GetCount(); j++)
+			{
+			MergeFiles.Insert(m_pStorage->MachineToCanonicalRelative(Merge[j]->GetFilespec()));
+			dwTotalSize += Merge[j]->GetFileSize();
+			iTotalRows += Merge[j]->GetCount();
+			}
+
+		//	Log
+
+		m_pProcess->Log(MSG_LOG_INFO, strPattern(ERR_MERGING_SEGMENTS, m_sName, Merge.GetCount(), iTotalRows, ICompactionPolicy::GetTypeID(m_iCompaction)));
+
+		//	See if we have enough disk space.
+
+		DWORDLONG dwAvailable;
+		fileGetDriveSpace(Merge[0]->GetFilespec(), &dwAvailable);
+		if (dwAvailable < dwTotalSize)
+			{
+			m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_NOT_ENOUGH_SPACE_TO_MERGE, m_sName, Merge.GetCount()));
+			continue;	//	Loop to the next view.
+			}
+
+		//	Create an iterator that will traverse all segments in order. We
+		//	copy the dimensions because the view can move while we're unlocked.
+
+		CTableDimensions Dims = m_Views[i].GetDimensions();
+		CRowIterator Rows;
+		Rows.Init(Dims);
+		for (j = 0; j < Merge.GetCount(); j++)
+			Rows.AddSegment(Merge[j]);
+
+		//	Expired rows and rows covered by a range delete are written as nil
+		//	(which drops their data). If we're merging the oldest segment then
+		//	there is nothing older for a nil row to hide, so we drop those rows
+		//	entirely.
+
+		const CAeonRowExpiration &Expiration = m_Views[i].GetExpiration();
+		const CAeonRangeDeletes &RangeDeletes = m_Views[i].GetRangeDeletes();
+		bool bDropNil = false;
+		if (Expiration.IsEnabled())
+			{
+			Rows.SetExpiration(Expiration);
+			bDropNil = bIncludesOldest;
+			}
+
+		if (!RangeDeletes.IsEmpty())
+			{
+			Rows.SetRangeDeletes(RangeDeletes);
+			bDropNil = bIncludesOldest;
+			}
+
+		//	The range deletes saved with the merged segments go in the new
+		//	segment, since they still cover older segments. If there are no
+		//	older segments, we drop them.
+
+		CAeonRangeDeletes MergedRangeDeletes;
+		if (!bIncludesOldest)
+			{
+			for (j = 0; j < Merge.GetCount(); j++)
+				Merge[j]->GetRangeDeletes(&MergedRangeDeletes);
+			}
+
+		//	Get the name of the new segment
+
+		CString sBackup;
+		bool bBackup = !m_bBackupLost;
+		bool bBackupFailed = false;
+
+		CString sFilespec = GetUniqueSegmentFilespec(&sBackup);
+
+		//	Get the new sequence number (we always use the first segment
+		//	because it is most recent).
+
+		SEQUENCENUMBER NewSeq = Merge[0]->GetSequence();
+
+		DWORD dwSegFlags = 0;
+		dwSegFlags |= (i == 0 ? CAeonSegment::FLAG_HAS_ROW_ID : 0);
+		dwSegFlags |= (i != 0 ? CAeonSegment::FLAG_SECONDARY_VIEW : 0);
+
+		//	Merge the segments. We do this outside the lock because no other
+		//	thread will merge segments (because of the flag) and because 
+		//	existing segments are not modified. New segments saved while we're
+		//	unlocked are always newer than the ones we're merging.
+
+		m_bCompacting = true;
+		Lock.Unlock();
+
+		//	We never drop every row because a segment must have at least one
+		//	row.
+
+		if (bDropNil)
+			{
+			Rows.SetIncludeNil(false);
+			Rows.Reset();
+			if (!Rows.HasMore())
+				Rows.SetIncludeNil(true);
+			}
+
+		CAeonSegment *pNewSeg = new CAeonSegment;
+		bool bSuccess = pNewSeg->Create(dwViewID, Dims, NewSeq, Rows, sFilespec, dwSegFlags, &sError, &Limiter, &MergedRangeDeletes);
+
+		//	Make a backup
+
+		if (bSuccess && bBackup)
+			{
+			if (!BackupSegment(sFilespec, sBackup))
+				bBackupFailed = true;
+			}
+
+		Lock.Lock();
+		m_bCompacting = false;
+
+		if (!bSuccess)
+			{
+			m_pProcess->Log(MSG_LOG_ERROR, sError);
+			pNewSeg->Release();
+			return false;
+			}
+
+		//	If the view got deleted while we were merging, then we throw away
+		//	the new segment.
+
+		CAeonView *pView = m_Views.GetAt(dwViewID);
+		if (pView == NULL)
+			{
+			pNewSeg->MarkForDelete();
+			pNewSeg->Release();
+
+			if (bBackup && !bBackupFailed)
+				DeleteSegmentBackup(sBackup);
+
+			return true;
+			}
+
+		//	Replace the segments in the view's data structure
+
+		pView->SegmentMergeComplete(Merge, pNewSeg);
+
+		//	If the backup failed we need to recover
+
+		if (bBackupFailed)
+			{
+			m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_SEGMENT_BACKUP_FAILED, sBackup));
+
+			//	LATER:
+			}
+
+		//	Otherwise, delete the old segment backups
+
+		else if (bBackup && !m_bBackupLost)
+			{
+			for (j = 0; j < MergeFiles.GetCount(); j++)
+				{
+				CString sOldBackup = m_pStorage->CanonicalRelativeToMachine(m_sBackupVolume, MergeFiles[j]);
+				if (!DeleteSegmentBackup(sOldBackup))
+					m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CANT_DELETE_FILE, sOldBackup));
+				}
+			}
+
+		//	Done. Wait for next call to do more.
+
+		m_pProcess->Log(MSG_LOG_INFO, strPattern(ERR_MERGE_COMPLETE, m_sName));
+		return true;
+		}
+
+	return true;
+	}
+
+bool CAeonTable::CompileRowFilter (CHexeProcess &Process, CDatum dFilter, CDatum *retdFunc, CString *retsError)
+
+//	CompileRowFilter
+//
+//	Returns a function that takes a row and returns non-nil if the row should
+//	be included. dFilter is either a Hexe function or a HexeLisp expression
+//	that evaluates to a function, e.g., "(lambda (row) (= (@ row 'status) 'open))".
+//	We compile once per request so the iterator loop only has to invoke.
+
+	{
+	if (strEquals(dFilter.GetTypename(), TYPENAME_HEXE_FUNCTION))
+		{
+		*retdFunc = dFilter;
+		retdFunc->SetElement(FIELD_GLOBAL_ENV, Process.GetGlobalEnv());
+		return true;
+		}
+
+	if (dFilter.GetBasicType() != CDatum::typeString)
+		{
+		*retsError = strPattern(ERR_INVALID_ROW_FILTER, dFilter.AsString());
+		return false;
+		}
+
+	CDatum dCode;
+	CString sError;
+	if (!CHexeDocument::ParseLispExpression(dFilter, &dCode, &sError))
+		{
+		*retsError = strPattern(ERR_INVALID_ROW_FILTER, sError);
+		return false;
+		}
+
+	CDatum dResult;
+	if (Process.Run(dCode, &dResult) != CHexeProcess::runOK
+			|| !dResult.CanInvoke())
+		{
+		*retsError = strPattern(ERR_INVALID_ROW_FILTER, dResult.AsString());
+		return false;
+		}
+
+	*retdFunc = dResult;
+	return true;
+	}
+
+bool CAeonTable::CompleteWrite (CSmartLock &Lock, const CString &sOp, bool bLogFailed, CString *retsError)
+
+//	CompleteWrite
+//
+//	Called after inserting one or more rows. If we failed to log to the 
+//	recovery file then it means that the primary volume is bad, so we switch to
+//	the backup. Otherwise, we wait until the rows are durable (which unlocks
+//	temporarily).
+//
+//	Returns FALSE if the primary volume was lost.
+
+	{
+	if (bLogFailed)
+		{
+		m_pProcess->ReportVolumeFailure(fileAppend(fileAppend(m_pStorage->GetPath(m_sPrimaryVolume), m_sName), FILESPEC_RECOVERY_DIR), sOp);
+
+		if (!RecoveryRestore())
+			{
+			*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+			return false;
+			}
+
+		return true;
+		}
+
+	return CommitRecovery(Lock, sOp, retsError);
+	}
+
+bool CAeonTable::CopyDirectory (const CString &sFromTablePath, const CString &sToTablePath, const CString &sDir, CAeonBackupManifest *ioManifest, CString *retsError)
 
 //	CopyDirectory
 //
-//	Copies the files in a directory from sFromPath to sToPath.
+//	Copies the files in the given directory from one table path to another.
 //
-//	If any files in the destination are the same as the source, then it
-//	(optimistically) leaves them. If there are files in the destination that are
-//	not in the source, it deletes them.
+//	We skip files that the manifest says are already at the destination (these
+//	files never change once written, so a matching size means the copy is
+//	complete). Files not in the manifest, we compare. If there are files in the
+//	destination that are not in the source, we delete them. We update the
+//	manifest to match the destination.
 
 	{
 	int i;
 
+	CString sFromPath = fileAppend(sFromTablePath, sDir);
+	CString sToPath = fileAppend(sToTablePath, sDir);
+
 	//	Make a list of all files in the source.
 
 	TArray<CString> SourceFiles;
@@ -360,18 +910,37 @@ bool CAeonTable::CopyDirectory (const CString &sFromPath, const CString &sToPath
 			}
 		}
 
+	ioManifest->DeleteMissing(sDir, SourceFiles);
+
 	//	Figure out which files we need to copy and add up the total disk space
 	//	that we will need.
 
 	DWORDLONG dwSpaceNeeded = 0;
 	for (i = 0; i < SourceFiles.GetCount(); i++)
 		{
+		CString sFile = fileAppend(sDir, SourceFiles[i]);
 		CString sSource = fileAppend(sFromPath, SourceFiles[i]);
 		CString sDest = fileAppend(sToPath, SourceFiles[i]);
+		DWORDLONG dwSourceSize = fileGetSize(sSource);
+
+		//	If the manifest says that we've already copied the file, then we
+		//	skip it.
+
+		const CAeonBackupManifest::SEntry *pEntry = ioManifest->Find(sFile);
+		if (pEntry 
+				&& pEntry->dwSize == dwSourceSize
+				&& fileExists(sDest)
+				&& fileGetSize(sDest) == dwSourceSize)
+			{
+			SourceFiles[i] = NULL_STR;
+			continue;
+			}
 
-		//	If the file is already at the destination, then we skip it
+		//	If the file is already at the destination (but not in the manifest)
+		//	then we add it to the manifest and skip it.
 
-		if (fileCompare(sSource, sDest, true))
+		if (fileCompare(sSource, sDest, true)
+				&& ioManifest->SetFile(sToTablePath, sFile))
 			{
 			SourceFiles[i] = NULL_STR;
 			continue;
@@ -379,7 +948,7 @@ bool CAeonTable::CopyDirectory (const CString &sFromPath, const CString &sToPath
 
 		//	Otherwise, add up the size
 
-		dwSpaceNeeded += fileGetSize(sSource) - fileGetSize(sDest);
+		dwSpaceNeeded += dwSourceSize - fileGetSize(sDest);
 		}
 
 	//	Do we have enough space?
@@ -397,29 +966,95 @@ bool CAeonTable::CopyDirectory (const CString &sFromPath, const CString &sToPath
 	for (i = 0; i < SourceFiles.GetCount(); i++)
 		if (!SourceFiles[i].IsEmpty())
 			{
+			CString sFile = fileAppend(sDir, SourceFiles[i]);
 			CString sSource = fileAppend(sFromPath, SourceFiles[i]);
 			CString sDest = fileAppend(sToPath, SourceFiles[i]);
 
-			//	Copy
+			//	Copy
+
+			if (!fileCopy(sSource, sDest))
+				{
+				//	LATER: Don't know which filespec failed, so we can't report it.
+				*retsError = strPattern(ERR_CANNOT_COPY_FILE, sSource, sDest);
+				return false;
+				}
+
+			//	Add to the manifest
+
+			if (!ioManifest->SetFile(sToTablePath, sFile, retsError))
+				return false;
+			}
+
+	//	Done
+
+	return true;
+	}
+
+bool CAeonTable::CopyLogTail (const CString &sFrom, const CString &sTo, DWORDLONG *iodwCopied, CString *retsError)
+
+//	CopyLogTail
+//
+//	Appends the part of sFrom past *iodwCopied to sTo and updates *iodwCopied.
+//	If sTo is not the size we expect (or if sFrom got shorter because it was
+//	reset) then we copy the whole file.
+
+	{
+	CFile From;
+	if (!From.Create(sFrom, CFile::FLAG_OPEN_READ_ONLY, retsError))
+		return false;
+
+	DWORDLONG dwSize = From.GetSize();
+	DWORDLONG dwCopied = *iodwCopied;
+
+	bool bExists = fileExists(sTo);
+	if (!bExists || dwSize < dwCopied || fileGetSize(sTo) != dwCopied)
+		dwCopied = 0;
+
+	//	If nothing new, we're done
+
+	if (bExists && dwCopied == dwSize)
+		{
+		*iodwCopied = dwSize;
+		return true;
+		}
+
+	CFile To;
+	if (!To.Create(sTo, (dwCopied == 0 ? CFile::FLAG_CREATE_ALWAYS : CFile::FLAG_OPEN_ALWAYS), retsError))
+		return false;
+
+	try
+		{
+		CBuffer Buffer(LOG_COPY_BUFFER_SIZE);
+
+		From.Seek((int)dwCopied);
+		To.Seek((int)dwCopied);
 
-			if (!fileCopy(sSource, sDest))
-				{
-				//	LATER: Don't know which filespec failed, so we can't report it.
-				*retsError = strPattern(ERR_CANNOT_COPY_FILE, sSource, sDest);
-				return false;
-				}
+		while (dwCopied < dwSize)
+			{
+			int iChunk = (int)Min((DWORDLONG)LOG_COPY_BUFFER_SIZE, dwSize - dwCopied);
+			From.Read(Buffer.GetPointer(), iChunk);
+			To.Write(Buffer.GetPointer(), iChunk);
+			dwCopied += iChunk;
 			}
+		}
+	catch (...)
+		{
+		*retsError = strPattern(ERR_CANNOT_COPY_FILE, sFrom, sTo);
+		return false;
+		}
 
-	//	Done
-
+	*iodwCopied = dwCopied;
 	return true;
 	}
 
-bool CAeonTable::CopyVolume (const CString &sFrom, const CString &sTo, CString *retsError)
+bool CAeonTable::CopyVolume (const CString &sFrom, const CString &sTo, CAeonBackupManifest *retManifest, CString *retsError)
 
 //	CopyVolume
 //
-//	Copies a volume
+//	Copies a volume. We only copy files that are not already at the destination
+//	(according to the manifest there), so re-syncing a backup that was offline
+//	for a while only costs the segments written in the meantime. Returns the
+//	destination's manifest.
 
 	{
 	//	Get the paths
@@ -441,19 +1076,22 @@ bool CAeonTable::CopyVolume (const CString &sFrom, const CString &sTo, CString *
 	CString sFromTablePath = fileAppend(sFromPath, m_sName);
 	CString sToTablePath = fileAppend(sToPath, m_sName);
 
-	//	Delete the path, in case it has some stale files. We ignore errors 
-	//	because the path might not exist.
-
-	filePathDelete(sToTablePath, FPD_FLAG_RECURSIVE);
-
 	//	Create the destination path
 
-	if (!filePathCreate(sToTablePath))
+	if (!fileExists(sToTablePath) && !filePathCreate(sToTablePath))
 		{
 		*retsError = strPattern(ERR_CANT_CREATE_DIRECTORY, sToTablePath);
 		return false;
 		}
 
+	//	Load the manifest of what is already there. If we can't, then we start
+	//	with an empty manifest (and compare each file instead).
+
+	CString sManifestFilespec = fileAppend(sToTablePath, FILESPEC_BACKUP_MANIFEST);
+	CString sError;
+	if (!fileExists(sManifestFilespec) || !retManifest->Load(sManifestFilespec, &sError))
+		retManifest->DeleteAll();
+
 	//	Copy the descriptor
 
 	if (!fileCopy(fileAppend(sFromTablePath, FILESPEC_TABLE_DESC_FILE), fileAppend(sToTablePath, FILESPEC_TABLE_DESC_FILE)))
@@ -464,14 +1102,14 @@ bool CAeonTable::CopyVolume (const CString &sFrom, const CString &sTo, CString *
 
 	//	Copy the segments directory
 
-	if (!CopyDirectory(fileAppend(sFromTablePath, FILESPEC_SEGMENTS_DIR), fileAppend(sToTablePath, FILESPEC_SEGMENTS_DIR), retsError))
+	if (!CopyDirectory(sFromTablePath, sToTablePath, FILESPEC_SEGMENTS_DIR, retManifest, retsError))
 		return false;
 
 	//	Copy the files directory (if necessary)
 
 	if (GetType() == typeFile)
 		{
-		if (!CopyDirectory(fileAppend(sFromTablePath, FILESPEC_FILES_DIR), fileAppend(sToTablePath, FILESPEC_FILES_DIR), retsError))
+		if (!CopyDirectory(sFromTablePath, sToTablePath, FILESPEC_FILES_DIR, retManifest, retsError))
 			return false;
 		}
 	else
@@ -479,16 +1117,24 @@ bool CAeonTable::CopyVolume (const CString &sFrom, const CString &sTo, CString *
 		//	Delete it if it is not supposed to be there.
 
 		filePathDelete(fileAppend(sToTablePath, FILESPEC_FILES_DIR), FPD_FLAG_RECURSIVE);
+		retManifest->DeleteMissing(FILESPEC_FILES_DIR, TArray<CString>());
 		}
 
 	//	Make sure scrap directory exists
 
 	filePathCreate(fileAppend(sToTablePath, FILESPEC_SCRAP_DIR));
 
-	//	Make sure recovery directory exists
+	//	Old recovery logs would replay stale rows, so we start the recovery
+	//	directory over (BackupRecoveryLogs copies the current logs).
 
+	filePathDelete(fileAppend(sToTablePath, FILESPEC_RECOVERY_DIR), FPD_FLAG_RECURSIVE);
 	filePathCreate(fileAppend(sToTablePath, FILESPEC_RECOVERY_DIR));
 
+	//	Save the manifest
+
+	if (!retManifest->Save(sManifestFilespec, retsError))
+		return false;
+
 	return true;
 	}
 
@@ -795,6 +1441,11 @@ bool CAeonTable::DebugDumpView (DWORD dwViewID, CDatum *retdResult) const
 	//	Get data
 
 	*retdResult = pView->DebugDump();
+	if (!pView->IsUpToDate())
+		retdResult->SetElement(FIELD_UPDATE_PROGRESS, GetViewUpdateProgress(dwViewID));
+
+	if (dwViewID == DEFAULT_VIEW && m_RowCache.IsEnabled())
+		retdResult->SetElement(FIELD_ROW_CACHE, m_RowCache.DebugDump());
 
 	//	Done
 
@@ -812,6 +1463,18 @@ bool CAeonTable::Delete (void)
 	int i;
 	bool bSuccess = true;
 
+	//	Wait for any compaction thread to finish with us.
+
+	CSmartLock Lock(m_cs);
+	while (m_bCompacting)
+		{
+		Lock.Unlock();
+		::Sleep(250);
+		Lock.Lock();
+		}
+
+	Lock.Unlock();
+
 	//	Close the recovery file on all views
 
 	for (i = 0; i < m_Views.GetCount(); i++)
@@ -879,6 +1542,88 @@ bool CAeonTable::Delete (const CString &sVolume)
 	return bSuccess;
 	}
 
+bool CAeonTable::DeleteRange (CDatum dFrom, CDatum dTo, CString *retsError)
+
+//	DeleteRange
+//
+//	Deletes all rows whose key starts with the prefix dFrom (if dTo is Nil) or
+//	which are in the range [dFrom, dTo). Instead of writing a tombstone for
+//	every row, we log a single range delete. It covers the rows in memory and
+//	in older segments, and it is saved with the next segment (compaction drops
+//	it once it has merged the oldest segment).
+
+	{
+	CSmartLock Lock(m_cs);
+
+	//	Make sure we have the primary volume
+
+	if (m_bPrimaryLost)
+		{
+		*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+		return false;
+		}
+
+	//	Secondary views are keyed by row values, so a range of primary keys
+	//	does not map to a range of secondary keys. Callers must delete the rows
+	//	one at a time so that we can update the views.
+
+	if (HasSecondaryViews())
+		{
+		*retsError = ERR_RANGE_DELETE_WITH_VIEWS;
+		return false;
+		}
+
+	CAeonView *pView = m_Views.GetAt(DEFAULT_VIEW);
+	const CTableDimensions &Dims = pView->GetDimensions();
+
+	CRowKey From;
+	CRowKey To;
+	if (!CAeonRangeDeletes::ParseRange(Dims, dFrom, dTo, &From, &To, retsError))
+		return false;
+
+	//	A recovery file from an older version cannot hold range deletes, so we
+	//	save its rows first (which starts a new file).
+
+	if (!pView->CanLogRangeDeletes() && pView->HasUnsavedRows())
+		{
+		if (!Save(retsError))
+			return false;
+		}
+
+	//	The range delete covers everything written so far, and we bump the
+	//	sequence number so that anything written later is newer.
+
+	bool bLogFailed;
+	pView->DeleteRange(From, To, m_Seq, &bLogFailed, retsError);
+	m_Seq++;
+
+	//	Cached rows might be covered now.
+
+	m_RowCache.DeleteAll();
+
+	//	Wait until the delete is durable (this unlocks temporarily).
+
+	if (!CompleteWrite(Lock, OP_DELETE_RANGE, bLogFailed, retsError))
+		return false;
+
+	//	Done
+
+	return true;
+	}
+
+bool CAeonTable::DeleteSegmentBackup (const CString &sBackup)
+
+//	DeleteSegmentBackup
+//
+//	Deletes a segment from the backup volume (and from the backup manifest).
+
+	{
+	CSmartLock Lock(m_cs);
+
+	m_BackupManifest.Delete(fileAppend(FILESPEC_SEGMENTS_DIR, fileGetFilename(sBackup)));
+	return fileDelete(sBackup);
+	}
+
 bool CAeonTable::DeleteView (DWORD dwViewID, CString *retsError)
 
 //	DeleteView
@@ -1061,7 +1806,8 @@ bool CAeonTable::FileDirectory (const CString &sDirKey, CDatum dRequestedFields,
 							const CString &sField = dFileDesc.GetKey(i);
 
 							if (!strEquals(sField, FIELD_FILE_PATH)
-									&& !strEquals(sField, FIELD_STORAGE_PATH))
+									&& !strEquals(sField, FIELD_STORAGE_PATH)
+									&& !strEquals(sField, FIELD_CHUNKS))
 								pNewFileDesc->SetElement(sField, dFileDesc.GetElement(sField));
 							}
 						}
@@ -1280,7 +2026,9 @@ bool CAeonTable::GetData (DWORD dwViewID, const CRowKey &Path, CDatum *retData,
 
 //	GetData
 //
-//	Returns the data at the given row
+//	Returns the data at the given row. We only hold the lock long enough to
+//	take a snapshot of the view; we search the rows outside the lock so that
+//	we don't block writers.
 
 	{
 	CSmartLock Lock(m_cs);
@@ -1296,6 +2044,40 @@ bool CAeonTable::GetData (DWORD dwViewID, const CRowKey &Path, CDatum *retData,
 	//	Get the view
 
 	CAeonView *pView = m_Views.GetAt(dwViewID);
+	if (pView == NULL)
+		{
+		*retsError = strPattern(ERR_UNKNOWN_VIEW_ID, dwViewID);
+		return false;
+		}
+
+	bool bIsSecondaryView = pView->IsSecondaryView();
+
+	//	If the row cache is enabled, look there first.
+
+	bool bUseCache = (dwViewID == DEFAULT_VIEW && m_RowCache.IsEnabled());
+	if (bUseCache && m_RowCache.Find(Path, retData, retRowID))
+		{
+		//	The row may have expired since we cached it
+
+		if (m_Expiration.IsEnabled()
+				&& m_Expiration.IsExpired(*retData, m_Expiration.GetCutoff(CDateTime(CDateTime::Now))))
+			*retData = CDatum();
+
+		return true;
+		}
+
+	//	Take a snapshot of primary views. (Secondary views get a snapshot
+	//	through InitIterator below.)
+
+	CAeonViewSnapshot Snapshot;
+	if (!bIsSecondaryView)
+		pView->OpenSnapshot(&Snapshot);
+
+	SEQUENCENUMBER ReadSeq = m_Seq;
+
+	//	OK to unlock
+
+	Lock.Unlock();
 
 	//	Try to get the data, but if we fail, we recover
 
@@ -1305,8 +2087,31 @@ bool CAeonTable::GetData (DWORD dwViewID, const CRowKey &Path, CDatum *retData,
 		{
 		//	If this is a primary view then we can get the data directly
 
-		if (!pView->IsSecondaryView())
-			return pView->GetData(Path, retData, retRowID, retsError);
+		if (!bIsSecondaryView)
+			{
+			SEQUENCENUMBER RowID;
+			int iProbes;
+			if (!Snapshot.FindData(Path, retData, &RowID, &iProbes, retsError))
+				return false;
+
+			if (retRowID)
+				*retRowID = RowID;
+
+			//	Update statistics. If no one has written to the table since
+			//	we took the snapshot, we cache the result (even if the row
+			//	doesn't exist).
+
+			Lock.Lock();
+
+			pView = m_Views.GetAt(dwViewID);
+			if (pView)
+				pView->AddLookupStats(iProbes);
+
+			if (bUseCache && m_Seq == ReadSeq)
+				m_RowCache.Insert(Path, *retData, RowID);
+
+			return true;
+			}
 
 		//	Otherwise we need to search for it (because we don't know the last
 		//	column value, which is a rowID).
@@ -1403,6 +2208,21 @@ CDatum CAeonTable::GetDesc (void)
 			break;
 		}
 
+	//	Compaction policy (only if not the default)
+
+	if (m_iCompaction != ICompactionPolicy::typeSizeTiered)
+		pDesc->SetElement(FIELD_COMPACTION, ICompactionPolicy::GetTypeID(m_iCompaction));
+
+	//	Row cache (only if enabled)
+
+	if (m_RowCache.IsEnabled())
+		pDesc->SetElement(FIELD_ROW_CACHE_SIZE, CDatum(m_RowCache.GetMaxSize()));
+
+	//	Row expiration (only if enabled)
+
+	if (m_Expiration.IsEnabled())
+		pDesc->SetElement(FIELD_TTL, m_Expiration.GetDesc());
+
 	//	Default view
 
 	CAeonView *pView = m_Views.GetAt(DEFAULT_VIEW);
@@ -1566,49 +2386,77 @@ bool CAeonTable::GetFileData (const CString &sFilePath, int iMaxSize, int iPos,
 		return true;
 		}
 
-	//	Open the file
-
-	CString sFilespec = m_pStorage->CanonicalRelativeToMachine(m_sPrimaryVolume, dFileDesc.GetElement(FIELD_STORAGE_PATH));
+	//	Most files are stored as chunks. Chunk files never change, so we only
+	//	need the lock to get the list (and to keep SweepChunks away).
 
-	CFile theFile;
-	if (!theFile.Create(sFilespec, CFile::FLAG_OPEN_READ_ONLY))
+	CDatum dData;
+	TArray<CAeonChunkStore::SChunk> Chunks;
+	if (CAeonChunkStore::ParseChunks(dFileDesc.GetElement(FIELD_CHUNKS), &Chunks))
 		{
-		*retsError = strPattern(ERR_UNABLE_TO_READ_STORAGE, sFilespec);
-		return false;
-		}
+		CString sTablePath;
+		if (!GetTablePath(m_sPrimaryVolume, &sTablePath, retsError))
+			return false;
+
+		m_iChunkUsers++;
+		Lock.Unlock();
 
-	//	Seek to the right position
+		bool bSuccess = CAeonChunkStore::ReadChunks(sTablePath, Chunks, iPos, iMaxSize, &dData, retsError);
 
-	try
-		{
-		if (iPos != 0)
-			theFile.Seek(iPos);
+		Lock.Lock();
+		m_iChunkUsers--;
+		Lock.Unlock();
+
+		if (!bSuccess)
+			return false;
 		}
-	catch (...)
+
+	//	Otherwise, this file was stored before we had chunks.
+
+	else
 		{
-		if (retsError)
+		//	Open the file
+
+		CString sFilespec = m_pStorage->CanonicalRelativeToMachine(m_sPrimaryVolume, dFileDesc.GetElement(FIELD_STORAGE_PATH));
+
+		CFile theFile;
+		if (!theFile.Create(sFilespec, CFile::FLAG_OPEN_READ_ONLY))
+			{
 			*retsError = strPattern(ERR_UNABLE_TO_READ_STORAGE, sFilespec);
-		return false;
-		}
+			return false;
+			}
 
-	//	Unlock because we're only protecting the connection between
-	//	the fileDesc and the file itself.
+		//	Seek to the right position
 
-	Lock.Unlock();
+		try
+			{
+			if (iPos != 0)
+				theFile.Seek(iPos);
+			}
+		catch (...)
+			{
+			if (retsError)
+				*retsError = strPattern(ERR_UNABLE_TO_READ_STORAGE, sFilespec);
+			return false;
+			}
 
-	//	Read the file into a datum
+		//	Unlock because we're only protecting the connection between
+		//	the fileDesc and the file itself.
 
-	CDatum dData;
-	if (!CDatum::CreateBinary(theFile, iMaxSize, &dData))
-		{
-		if (retsError)
-			*retsError = strPattern(ERR_UNABLE_TO_READ_STORAGE, sFilespec);
-		return false;
-		}
+		Lock.Unlock();
+
+		//	Read the file into a datum
+
+		if (!CDatum::CreateBinary(theFile, iMaxSize, &dData))
+			{
+			if (retsError)
+				*retsError = strPattern(ERR_UNABLE_TO_READ_STORAGE, sFilespec);
+			return false;
+			}
 
-	//	Close
+		//	Close
 
-	theFile.Close();
+		theFile.Close();
+		}
 
 	//	Return a fileDownloadDesc
 	//
@@ -1754,127 +2602,34 @@ void CAeonTable::GetSegmentFilespecs (const CString &sTablePath, TArray<CString>
 //
 //	Returns a list of all segment files for the table
 
-	{
-	fileGetFileList(fileAppend(sTablePath, FILESPEC_SEGMENTS_FILTER),
-			0,
-			retList);
-	}
-
-bool CAeonTable::GetRows (DWORD dwViewID, CDatum dLastKey, int iRowCount, const TArray<int> &Limits, DWORD dwFlags, CDatum *retdResult, CString *retsError)
-
-//	GetRows
-//
-//	Returns rows in the table.
-
-	{
-	CSmartLock Lock(m_cs);
-
-	//	Make sure we have the primary volume
-
-	if (m_bPrimaryLost)
-		{
-		*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
-		return false;
-		}
-
-	//	Some flags
-
-	CAeonView *pView = m_Views.GetAt(dwViewID);
-	if (pView == NULL)
-		{
-		*retsError = strPattern(ERR_UNKNOWN_VIEW_ID, dwViewID);
-		return false;
-		}
-
-	bool bMore = ((dwFlags & FLAG_MORE_ROWS) ? true : false);
-	bool bIsSecondaryView = (pView->IsSecondaryView());
-
-	//	OK to unlock
-
-	Lock.Unlock();
-
-	bool bRecovery = false;
-	CString sDiskError;
-	try
-		{
-		CTableDimensions Dims;
-		CRowIterator Sel;
-
-		//	Do not include nil (deleted) rows
-
-		Sel.SetIncludeNil(false);
-		if (!InitIterator(dwViewID, &Sel, &Dims, retsError))
-			return false;
-
-		//	If we have a last key, advance the selector appropriately.
-
-		if (!dLastKey.IsNil())
-			{
-			CRowKey LastKey;
-			if (!CRowKey::ParseKey(Dims, dLastKey, &LastKey, retsError))
-				return false;
-
-			if (!Sel.SelectKey(LastKey))
-				{
-				//	If not found, we return Nil
-
-				*retdResult = CDatum();
-				return true;
-				}
-
-			//	Advance one, since we want the first row after the last key.
-
-			if (bMore)
-				Sel.GetNextKey();
-			}
-
-		//	Set limits
-
-		if (Limits.GetCount() > 0)
-			Sel.SetLimits(Limits);
-
-		//	We return an array of keys
-
-		CComplexArray *pArray = new CComplexArray;
-
-		while (Sel.HasMore() && (iRowCount > 0 || iRowCount == -1))
-			{
-			//	Get the key and data for the row
-
-			CRowKey Key;
-			CDatum dData;
-			Sel.GetNextRow(&Key, &dData);
-
-			//	Insert two elements, but only if not deleted
-
-			if (!dData.IsNil())
-				{
-				if (dwFlags & FLAG_NO_KEY)
-					pArray->Insert(dData);
-				else if (dwFlags & FLAG_INCLUDE_KEY)
-					{
-					CComplexStruct *pNewData = new CComplexStruct(dData);
-					if (bIsSecondaryView)
-						pNewData->SetElement(FIELD_SECONDARY_KEY, Key.AsDatum(Dims));
-					else
-						pNewData->SetElement(FIELD_PRIMARY_KEY, Key.AsDatum(Dims));
+	{
+	fileGetFileList(fileAppend(sTablePath, FILESPEC_SEGMENTS_FILTER),
+			0,
+			retList);
+	}
 
-					pArray->Insert(CDatum(pNewData));
-					}
-				else
-					{
-					pArray->Insert(Key.AsDatum(Dims));
-					pArray->Insert(dData);
-					}
+bool CAeonTable::GetRows (DWORD dwViewID, CDatum dLastKey, int iRowCount, const TArray<int> &Limits, DWORD dwFlags, CDatum dFilter, const TArray<CString> &Fields, CDatum *retdResult, CString *retsError)
 
-				if (iRowCount != -1)
-					iRowCount--;
-				}
-			}
+//	GetRows
+//
+//	Returns rows in the table.
+//
+//	If dFilter is not nil, we only return rows for which the filter returns
+//	non-nil. If Fields is not empty, we only return those fields of each row.
+//	Both are applied here so that we only serialize the rows that the caller
+//	wants.
 
-		//	Done
+	{
+	CAeonCursor Cursor;
+	if (!OpenCursor(dwViewID, dLastKey, Limits, dwFlags, dFilter, Fields, &Cursor, retsError))
+		return false;
 
-		*retdResult = CDatum(pArray);
+	bool bRecovery = false;
+	CString sDiskError;
+	try
+		{
+		if (!Cursor.Fetch(iRowCount, 0, retdResult, retsError))
+			return false;
 		}
 	catch (CFileException e)
 		{
@@ -1904,7 +2659,7 @@ bool CAeonTable::GetRows (DWORD dwViewID, CDatum dLastKey, int iRowCount, const
 			return false;
 			}
 
-		return GetRows(dwViewID, dLastKey, iRowCount, Limits, dwFlags, retdResult, retsError);
+		return GetRows(dwViewID, dLastKey, iRowCount, Limits, dwFlags, dFilter, Fields, retdResult, retsError);
 		}
 
 	return true;
@@ -1978,11 +2733,12 @@ CString CAeonTable::GetUniqueSegmentFilespec (CString *retsBackup)
 	return sFilespec;
 	}
 
-bool CAeonTable::GetViewStatus (DWORD dwViewID, bool *retbUpToDate, CString *retsError)
+bool CAeonTable::GetViewStatus (DWORD dwViewID, bool *retbUpToDate, CString *retsError, int *retiProgress)
 
 //	GetViewStatus
 //
-//	Returns the status of the view
+//	Returns the status of the view. If requested, we also return the percent
+//	of the view that has been built (100 if the view is up to date).
 
 	{
 	CSmartLock Lock(m_cs);
@@ -1997,9 +2753,27 @@ bool CAeonTable::GetViewStatus (DWORD dwViewID, bool *retbUpToDate, CString *ret
 	//	Done
 
 	*retbUpToDate = pView->IsUpToDate();
+	if (retiProgress)
+		*retiProgress = (*retbUpToDate ? 100 : GetViewUpdateProgress(dwViewID));
+
 	return true;
 	}
 
+int CAeonTable::GetViewUpdateProgress (DWORD dwViewID) const
+
+//	GetViewUpdateProgress
+//
+//	Returns the percent of primary rows processed while rebuilding the given
+//	view. We never return 100 because the view is not up to date until we've
+//	merged the runs. Must be called inside the lock.
+
+	{
+	if (dwViewID != m_dwViewUpdateID || m_dwViewUpdateTotal == 0)
+		return 0;
+
+	return (int)Min((DWORDLONG)99, m_dwViewUpdateDone * 100 / m_dwViewUpdateTotal);
+	}
+
 SEQUENCENUMBER CAeonTable::GetVolumeSeq (const CString &sVolume)
 
 //	GetVolumeSeq
@@ -2103,7 +2877,7 @@ bool CAeonTable::Housekeeping (DWORD dwMaxMemoryUse)
 
 	//	If we need to do a backup, do it now.
 
-	if (m_bBackupNeeded)
+	if (m_bBackupNeeded && !m_bCompacting)
 		{
 		m_pProcess->Log(MSG_LOG_INFO, strPattern(STR_BACKING_UP, m_sName, m_sBackupVolume));
 
@@ -2119,7 +2893,8 @@ bool CAeonTable::Housekeeping (DWORD dwMaxMemoryUse)
 
 		Lock.Unlock();
 
-		if (!CopyVolume(sFrom, sTo, &sError))
+		CAeonBackupManifest Manifest;
+		if (!CopyVolume(sFrom, sTo, &Manifest, &sError))
 			{
 			//	LATER: Need to figure something out.
 			m_pProcess->Log(MSG_LOG_ERROR, sError);
@@ -2133,6 +2908,7 @@ bool CAeonTable::Housekeeping (DWORD dwMaxMemoryUse)
 
 		m_bBackupNeeded = false;
 		m_bBackupLost = false;
+		m_BackupManifest = Manifest;
 
 		//	Save new descriptor
 
@@ -2151,11 +2927,29 @@ bool CAeonTable::Housekeeping (DWORD dwMaxMemoryUse)
 		return true;
 		}
 
+	//	Once a day, read every segment on both volumes and verify its
+	//	checksums.
+
+	if (!m_bCompacting && sysGetTicksElapsed(m_dwLastScrub) >= SCRUB_INTERVAL)
+		{
+		Scrub(Lock);
+		return true;
+		}
+
+	//	Every few hours, delete file chunks that no file uses any more.
+
+	if (m_iType == typeFile && sysGetTicksElapsed(m_dwLastChunkSweep) >= CHUNK_SWEEP_INTERVAL)
+		{
+		SweepChunks(Lock);
+		return true;
+		}
+
 	//	If we have any secondary views that need to be updated then we do that
-	//	now before we merge any segments.
+	//	now. We wait until no one is merging segments because we add old
+	//	segments to the view.
 
 	DWORD dwViewID = 0;
-	for (i = 0; i < m_Views.GetCount(); i++)
+	for (i = 0; i < m_Views.GetCount() && !m_bCompacting; i++)
 		if (!m_Views[i].IsUpToDate() 
 				&& m_Views[i].IsSecondaryView()
 				&& m_Views[i].IsValid())
@@ -2183,107 +2977,147 @@ bool CAeonTable::Housekeeping (DWORD dwMaxMemoryUse)
 		pPrimaryView->InitIterator(&Rows, CAeonView::FLAG_EXCLUDE_MEMORY_ROWS);
 		CTableDimensions PrimaryDims = pPrimaryView->GetDimensions();
 
-		//	We generate secondary view records from each row and save them
-		//	to a separate (in memory) array
+		//	Split the primary rows into key ranges, one for each worker thread.
+		//	Each worker generates the secondary view rows for its range and
+		//	writes them out as sorted runs, which we merge below.
 
-		CAeonRowArray SecondaryRows;
-		SecondaryRows.Init(pSecondaryView->GetDimensions());
+		CTableDimensions SecondaryDims = pSecondaryView->GetDimensions();
+		DWORDLONG dwTotalRows = pPrimaryView->GetSegmentRowCount();
+		int iWorkers = (int)Max((DWORDLONG)1, Min((DWORDLONG)m_iMaxViewUpdateThreads, dwTotalRows / m_dwMinRowsPerViewUpdateThread));
 
-		//	Keep track of segments we've created
+		//	Aggregate views need all the rows of a group in one place, so we
+		//	use a single worker (which keeps all groups in memory).
 
-		TArray<SNewSegment> NewSegments;
+		if (pSecondaryView->IsAggregateView())
+			iWorkers = 1;
+
+		TArray<CRowKey> SplitKeys;
+		pPrimaryView->GetSplitKeys(iWorkers, &SplitKeys);
+
+		TArray<SViewUpdateRange> Ranges;
+		Ranges.InsertEmpty(SplitKeys.GetCount() + 1);
+		for (i = 0; i < Ranges.GetCount(); i++)
+			{
+			SViewUpdateRange &Range = Ranges[i];
+			Range.dwViewID = dwViewID;
+			Range.pView = pSecondaryView;
+			Range.PrimaryDims = PrimaryDims;
+
+			pPrimaryView->InitIterator(&Range.Rows, CAeonView::FLAG_EXCLUDE_MEMORY_ROWS);
+			if (i > 0)
+				Range.Rows.SelectKey(SplitKeys[i - 1]);
+
+			if (i < SplitKeys.GetCount())
+				{
+				Range.EndKey = SplitKeys[i];
+				Range.bHasEndKey = true;
+				}
+			}
+
+		//	Keep track of progress (for GetViewStatus)
+
+		m_dwViewUpdateID = dwViewID;
+		m_dwViewUpdateTotal = dwTotalRows;
+		m_dwViewUpdateDone = 0;
 
 		//	We assign arbitrary sequence numbers to the new segments. Only the
-		//	relative numbers matter (seqments superceed others). Though in this
-		//	case even that doesn't matter since we're looping over all segments
-		//	at the same time.
+		//	relative numbers matter (seqments superceed others), and since the
+		//	runs come from different primary rows, they never overlap.
+
+		m_ViewUpdateRunSeq = 0;
 
-		SEQUENCENUMBER SegSeq = 1;
+		//	Keep track of segments we've created
+
+		TArray<SNewSegment> NewSegments;
 
 		//	Create a process for evaluation. We create our own process instead 
 		//	of using the table process because we're doing this outside a lock.
+		//	(Each worker thread creates its own process too.)
 
 		CHexeProcess Process;
 		if (!Process.LoadStandardLibraries(&sError))
 			m_pProcess->Log(MSG_LOG_ERROR, sError);
 
-		//	We loop outside the lock because the segments aren't going 
-		//	anywhere.
+		//	We run the workers outside the lock because the segments aren't
+		//	going anywhere.
 
 		Lock.Unlock();
 
-		//	Keep looping until we've saved all rows
-
-		while (Rows.HasMore())
+		TArray<CAeonViewUpdateThread *> Workers;
+		for (i = 0; i < Ranges.GetCount(); i++)
 			{
-			CRowKey Key;
-			CDatum dData;
-			SEQUENCENUMBER RowID;
-
-			//	Get the row from the primary table
-
-			Rows.GetNextRow(&Key, &dData, &RowID);
+			CAeonViewUpdateThread *pWorker = new CAeonViewUpdateThread(this, &Ranges[i]);
+			pWorker->Start();
+			Workers.Insert(pWorker);
+			}
 
-			//	Create the secondary view row (but only if not deleted)
+		for (i = 0; i < Workers.GetCount(); i++)
+			{
+			Workers[i]->Wait();
+			delete Workers[i];
+			}
 
-			if (!dData.IsNil())
-				pSecondaryView->CreateSecondaryRows(PrimaryDims, Process, Key, dData, RowID, &SecondaryRows);
+		//	Collect all the runs (in key range order, though that doesn't
+		//	matter since secondary keys are not ordered by primary key).
 
-			//	After a certain number of rows we save out a segment so we don't have to
-			//	keep everything in memory.
+		TArray<SViewUpdateRun> Runs;
+		TArray<SViewUpdateRun> FinalSegments;
+		bool bSuccess = true;
+		for (i = 0; i < Ranges.GetCount(); i++)
+			{
+			Runs.Insert(Ranges[i].Runs);
 
-			if (SecondaryRows.GetCount() > 10000 || (!Rows.HasMore() && SecondaryRows.GetCount() > 0))
+			if (!Ranges[i].bSuccess && bSuccess)
 				{
-				Lock.Lock();
-
-				//	After we lock we need to recompute the view pointers because
-				//	they may have changed.
-
-				pSecondaryView = m_Views.GetAt(dwViewID);
+				m_pProcess->ReportVolumeFailure(Ranges[i].sFailedFilespec);
+				m_pProcess->Log(MSG_LOG_ERROR, Ranges[i].sError);
+				bSuccess = false;
+				}
+			}
 
-				//	Figure out the name for the new segment
+		//	Merge the runs into the final segments
 
-				CString sBackup;
-				CString sFilespec = GetUniqueSegmentFilespec(&sBackup);
+		if (bSuccess && !MergeViewUpdateRuns(dwViewID, SecondaryDims, Runs, &FinalSegments, &sError))
+			{
+			m_pProcess->Log(MSG_LOG_ERROR, sError);
+			bSuccess = false;
+			}
 
-				//	Create a segment
+		if (!bSuccess)
+			{
+			//	Delete all the runs and segments we created
 
-				CString sError;
-				CAeonSegment *pNewSeg;
-				if (!pSecondaryView->CreateSegment(sFilespec, SegSeq, &SecondaryRows, &pNewSeg, &sError))
+			for (i = 0; i < Runs.GetCount(); i++)
+				if (Runs[i].pSeg)
 					{
-					m_pProcess->ReportVolumeFailure(sFilespec);
-
-					//	Delete all previously created segments
-
-					for (i = 0; i < NewSegments.GetCount(); i++)
-						NewSegments[i].pSeg->Release();
-
-					//	We abort this process and wait for a better time.
-
-					m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_UPDATE_VIEW_ABORTED, pSecondaryView->GetName(), m_sName));
-					m_iHousekeeping = stateReady;
-					return false;
+					Runs[i].pSeg->MarkForDelete();
+					Runs[i].pSeg->Release();
 					}
 
-				//	Add the new segment to our array and remember the backup filespec
-				//	also.
-
-				SNewSegment *pEntry = NewSegments.Insert();
-				pEntry->dwViewID = dwViewID;
-				pEntry->pSeg = pNewSeg;
-				pEntry->sFilespec = sFilespec;
-				pEntry->sBackup = sBackup;
+			for (i = 0; i < FinalSegments.GetCount(); i++)
+				{
+				FinalSegments[i].pSeg->MarkForDelete();
+				FinalSegments[i].pSeg->Release();
+				}
 
-				//	Delete all rows
+			//	We abort this process and wait for a better time.
 
-				SecondaryRows.DeleteAll();
+			Lock.Lock();
+			pSecondaryView = m_Views.GetAt(dwViewID);
 
-				//	Unlock and continue adding rows.
+			m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_UPDATE_VIEW_ABORTED, (pSecondaryView ? pSecondaryView->GetName() : NULL_STR), m_sName));
+			m_dwViewUpdateID = 0;
+			m_iHousekeeping = stateReady;
+			return false;
+			}
 
-				SegSeq++;
-				Lock.Unlock();
-				}
+		for (i = 0; i < FinalSegments.GetCount(); i++)
+			{
+			SNewSegment *pEntry = NewSegments.Insert();
+			pEntry->dwViewID = dwViewID;
+			pEntry->pSeg = FinalSegments[i].pSeg;
+			pEntry->sFilespec = FinalSegments[i].pSeg->GetFilespec();
+			pEntry->sBackup = FinalSegments[i].sBackup;
 			}
 
 		//	Lock again
@@ -2303,6 +3137,7 @@ bool CAeonTable::Housekeeping (DWORD dwMaxMemoryUse)
 		//	works.)
 
 		pSecondaryView->SetUpToDate();
+		m_dwViewUpdateID = 0;
 
 		//	Save the descriptors
 
@@ -2343,6 +3178,11 @@ bool CAeonTable::Housekeeping (DWORD dwMaxMemoryUse)
 				bFallback = true;
 			}
 
+		//	Write out all the rows we just logged
+
+		if (!bFallback && !pSecondaryView->FlushRecovery())
+			bFallback = true;
+
 		//	If we failed to write to the log file then we need to recover to
 		//	the backup volume.
 
@@ -2370,7 +3210,7 @@ bool CAeonTable::Housekeeping (DWORD dwMaxMemoryUse)
 			{
 			for (i = 0; i < NewSegments.GetCount(); i++)
 				{
-				if (!fileCopy(NewSegments[i].sFilespec, NewSegments[i].sBackup))
+				if (!BackupSegment(NewSegments[i].sFilespec, NewSegments[i].sBackup))
 					{
 					m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_SEGMENT_BACKUP_FAILED, NewSegments[i].sBackup));
 
@@ -2394,8 +3234,20 @@ bool CAeonTable::Housekeeping (DWORD dwMaxMemoryUse)
 	//	If we have more than a certain number of updates in memory then we
 	//	need to flush to a segment. (We only check the default view, but this
 	//	will save all views).
+	//
+	//	We also checkpoint if the in-memory rows use more than our share of
+	//	memory, or if they've been waiting for a while. Every unsaved row has
+	//	to be replayed from the recovery log on the next boot, so this bounds
+	//	how long we take to open the table after a crash.
+
+	DWORD dwMemoryUsed = 0;
+	for (i = 0; i < m_Views.GetCount(); i++)
+		dwMemoryUsed += m_Views[i].GetMemoryUsed();
 
-	if (m_Views.GetAt(DEFAULT_VIEW)->GetUpdateCount() > MAX_CHANGES_IN_MEMORY)
+	int iUpdates = m_Views.GetAt(DEFAULT_VIEW)->GetUpdateCount();
+	if (iUpdates > MAX_CHANGES_IN_MEMORY
+			|| (iUpdates > 0 && dwMemoryUsed > dwMaxMemoryUse)
+			|| (iUpdates > 0 && sysGetTicksElapsed(m_dwLastCheckpoint) >= CHECKPOINT_INTERVAL))
 		{
 		m_iHousekeeping = stateCreatingSegment;
 
@@ -2418,133 +3270,20 @@ bool CAeonTable::Housekeeping (DWORD dwMaxMemoryUse)
 		return true;
 		}
 
-	//	If we have a lot of segments then we should consolidate a couple.
-	//	We loop over all views until we find segments to merge.
-	//
-	//	Set a flag so a different thread doesn't try to merge the same
-	//	segments.
-
-	m_iHousekeeping = stateMergingSegments;
-
-	//	Loop
+	//	Otherwise, copy any new recovery log records to the backup.
 
-	for (i = 0; i < m_Views.GetCount(); i++)
+	if (!m_bBackupLost && !m_bBackupNeeded)
 		{
-		CAeonSegment *pSeg1;
-		CAeonSegment *pSeg2;
-
-		if (m_Views[i].GetSegmentsToMerge(&pSeg1, &pSeg2))
-			{
-			CString sSeg1File = m_pStorage->MachineToCanonicalRelative(pSeg1->GetFilespec());
-			CString sSeg2File = m_pStorage->MachineToCanonicalRelative(pSeg2->GetFilespec());
-
-			//	Log
-
-			m_pProcess->Log(MSG_LOG_INFO, strPattern(ERR_MERGING_SEGMENTS, m_sName, sSeg1File, pSeg1->GetCount(), sSeg2File, pSeg2->GetCount()));
-
-			//	If the resulting segment is too big, then we can't do anything
-
-			DWORDLONG dwSeg1Size = pSeg1->GetFileSize();
-			DWORDLONG dwSeg2Size = pSeg2->GetFileSize();
-			if (dwSeg1Size + dwSeg2Size > GIGABYTE_DISK)
-				{
-				m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_MERGE_TOO_BIG, sSeg1File, sSeg2File));
-				continue;	//	Loop to the next view.
-				}
-
-			//	See if we have enough disk space.
-
-			DWORDLONG dwAvailable;
-			fileGetDriveSpace(pSeg1->GetFilespec(), &dwAvailable);
-			if (dwAvailable < dwSeg1Size + dwSeg2Size)
-				{
-				m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_NOT_ENOUGH_SPACE_TO_MERGE, sSeg1File, sSeg2File));
-				continue;	//	Loop to the next view.
-				}
-
-			//	Create an iterator that will traverse both segments in order.
-
-			CRowIterator Rows;
-			Rows.Init(m_Views[i].GetDimensions());
-			Rows.AddSegment(pSeg1);
-			Rows.AddSegment(pSeg2);
-
-			//	Get the name of the new segment
-
-			CString sBackup;
-			bool bBackupFailed = false;
-
-			CString sFilespec = GetUniqueSegmentFilespec(&sBackup);
-
-			//	Get the new sequence number (we always use the first segment
-			//	because it is most recent).
-
-			SEQUENCENUMBER NewSeq = pSeg1->GetSequence();
-
-			//	Merge the segments. We do this outside the lock because no other
-			//	thread should try to merge segments (because of the flag) and
-			//	because existing segments are not modified.
-
-			Lock.Unlock();
-
-			//	Create the segment
-
-			DWORD dwSegFlags = 0;
-			dwSegFlags |= (i == 0 ? CAeonSegment::FLAG_HAS_ROW_ID : 0);
-			dwSegFlags |= (i != 0 ? CAeonSegment::FLAG_SECONDARY_VIEW : 0);
-
-			CAeonSegment *pNewSeg = new CAeonSegment;
-			if (!pNewSeg->Create(m_Views[i].GetID(), m_Views[i].GetDimensions(), NewSeq, Rows, sFilespec, dwSegFlags, &sError))
-				{
-				m_pProcess->Log(MSG_LOG_ERROR, sError);
-				pNewSeg->Release();
-				break;	//	Stop looping over views.
-				}
-
-			//	Make a backup
-
-			if (!m_bBackupLost)
-				{
-				if (!fileCopy(sFilespec, sBackup))
-					bBackupFailed = true;
-				}
-
-			Lock.Lock();
-
-			//	Replace the segments in the view's data structure
-
-			m_Views[i].SegmentMergeComplete(pSeg1, pSeg2, pNewSeg);
-
-			//	If the backup failed we need to recover
-
-			if (bBackupFailed)
-				{
-				m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_SEGMENT_BACKUP_FAILED, sBackup));
-
-				//	LATER:
-				}
-
-			//	Otherwise, delete the old segment backups
-
-			else if (!m_bBackupLost)
-				{
-				if (!fileDelete(m_pStorage->CanonicalRelativeToMachine(m_sBackupVolume, sSeg1File)))
-					m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CANT_DELETE_FILE, m_pStorage->CanonicalRelativeToMachine(m_sBackupVolume, sSeg1File)));
-
-				if (!fileDelete(m_pStorage->CanonicalRelativeToMachine(m_sBackupVolume, sSeg2File)))
-					m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CANT_DELETE_FILE, m_pStorage->CanonicalRelativeToMachine(m_sBackupVolume, sSeg2File)));
-				}
+		m_iHousekeeping = stateBackup;
+		Lock.Unlock();
 
-			//	Done. Wait for next housekeeping event to do more.
+		BackupRecoveryLogs();
 
-			m_pProcess->Log(MSG_LOG_INFO, strPattern(ERR_MERGE_COMPLETE, m_sName));
-			break;
-			}
+		Lock.Lock();
+		m_iHousekeeping = stateReady;
 		}
 
-	//	Done merging
-
-	m_iHousekeeping = stateReady;
+	//	NOTE: Merging segments is done by the compaction threads (see Compact).
 
 	return true;
 	}
@@ -2591,6 +3330,33 @@ bool CAeonTable::Init (const CString &sTablePath, CDatum dDesc, CString *retsErr
 	if (!ParseTableType(dDesc.GetElement(FIELD_TYPE), &m_iType, retsError))
 		return false;
 
+	//	Parse the compaction policy
+
+	CString sCompaction = dDesc.GetElement(FIELD_COMPACTION);
+	if (sCompaction.IsEmpty())
+		m_iCompaction = ICompactionPolicy::typeSizeTiered;
+	else if (!ICompactionPolicy::ParseTypeID(sCompaction, &m_iCompaction))
+		{
+		*retsError = strPattern(ERR_INVALID_COMPACTION_POLICY, sCompaction);
+		return false;
+		}
+
+	//	Parse the row cache size (0 = no cache)
+
+	int iRowCacheSize = dDesc.GetElement(FIELD_ROW_CACHE_SIZE);
+	if (iRowCacheSize < 0)
+		{
+		*retsError = strPattern(ERR_INVALID_ROW_CACHE_SIZE, iRowCacheSize);
+		return false;
+		}
+
+	m_RowCache.SetMaxSize(iRowCacheSize);
+
+	//	Parse the row expiration (if any)
+
+	if (!m_Expiration.InitFromDesc(dDesc.GetElement(FIELD_TTL), retsError))
+		return false;
+
 	//	The default view is special
 
 	CAeonView *pDefaultView = m_Views.Insert(DEFAULT_VIEW);
@@ -2612,6 +3378,8 @@ bool CAeonTable::Init (const CString &sTablePath, CDatum dDesc, CString *retsErr
 			return false;
 		}
 
+	pDefaultView->SetExpiration(m_Expiration);
+
 	//	If we recovered rows then we need to increment the sequence number (but
 	//	we have to wait until the segment files are loaded).
 
@@ -2637,6 +3405,8 @@ bool CAeonTable::Init (const CString &sTablePath, CDatum dDesc, CString *retsErr
 
 		if (!pView->InitAsSecondaryView(dViewDesc, m_Process, GetRecoveryFilespec(sTablePath, dwViewID), false, retsError))
 			return false;
+
+		pView->SetExpiration(m_Expiration);
 		}
 
 	//	If any of the views are using an old version of the recovery file, then
@@ -2659,7 +3429,8 @@ bool CAeonTable::InitIterator (DWORD dwViewID, CRowIterator *retIterator, CTable
 
 //	InitIterator
 //
-//	Initialize an iterator
+//	Initialize an iterator. The iterator works off a snapshot of the view, so
+//	callers may use it without holding the lock.
 
 	{
 	CSmartLock Lock(m_cs);
@@ -2674,51 +3445,167 @@ bool CAeonTable::InitIterator (DWORD dwViewID, CRowIterator *retIterator, CTable
 		return false;
 		}
 
-	//	If the view is not ready, then we cannot continue
+	//	If the view is not ready, then we cannot continue
+
+	if (!pView->IsUpToDate())
+		{
+		if (retsError)
+			*retsError = strPattern(ERR_VIEW_NOT_READY, pView->GetName());
+		return false;
+		}
+
+	//	Get dimensions
+
+	if (retDims)
+		*retDims = pView->GetDimensions();
+
+	//	Take a snapshot and unlock. We build the iterator outside the lock since
+	//	it needs to copy the in-memory rows.
+
+	CAeonViewSnapshot Snapshot;
+	pView->OpenSnapshot(&Snapshot);
+
+	Lock.Unlock();
+
+	if (!Snapshot.InitIterator(retIterator))
+		{
+		if (retsError)
+			*retsError = strPattern(STR_ERROR_BAD_ITERATOR, m_sName);
+		return false;
+		}
+
+	//	Done
+
+	return true;
+	}
+
+AEONERR CAeonTable::Insert (const CRowKey &Path, CDatum dData, bool bInsertNew, CString *retsError)
+
+//	Insert
+//
+//	Insert the data into the table.
+
+	{
+	CSmartLock Lock(m_cs);
+
+	//	Make sure we have the primary volume
+
+	if (m_bPrimaryLost)
+		{
+		*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+		return AEONERR_FAIL;
+		}
+
+	//	Insert
+
+	bool bLogFailed;
+	AEONERR error = InsertRow(Path, dData, bInsertNew, &bLogFailed, retsError);
+	if (error != AEONERR_OK)
+		return error;
+
+	//	Wait until the row is durable
+
+	if (!CompleteWrite(Lock, OP_INSERT, bLogFailed, retsError))
+		return AEONERR_FAIL;
+
+	//	Done
+
+	return AEONERR_OK;
+	}
+
+AEONERR CAeonTable::InsertMany (const TArray<CRowKey> &Paths, const TArray<CDatum> &Data, CString *retsError)
+
+//	InsertMany
+//
+//	Inserts multiple rows under a single lock. All rows go out to the recovery
+//	files as a single batch. If bInsertNew is TRUE and any of the rows already
+//	exists (or a path appears twice), we return AEONERR_ALREADY_EXISTS without
+//	inserting anything.
+
+	{
+	CSmartLock Lock(m_cs);
+	AEONERR error;
+	int i, j;
+
+	ASSERT(Paths.GetCount() == Data.GetCount());
+
+	//	Make sure we have the primary volume
+
+	if (m_bPrimaryLost)
+		{
+		*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+		return AEONERR_FAIL;
+		}
+
+	//	Make sure we can insert all rows before we insert any of them.
+
+	for (i = 0; i < Paths.GetCount(); i++)
+		for (j = 0; j < m_Views.GetCount(); j++)
+			if (m_Views[j].IsValid() && !m_Views[j].CanInsert(Paths[i], Data[i], retsError))
+				return AEONERR_FAIL;
+
+	if (bInsertNew)
+		{
+		TSortMap<CString, bool> Seen;
+
+		for (i = 0; i < Paths.GetCount(); i++)
+			{
+			CDatum dOldData;
+			SEQUENCENUMBER RowID;
+			if (!GetData(DEFAULT_VIEW, Paths[i], &dOldData, &RowID, retsError))
+				return AEONERR_FAIL;
+
+			bool bNew;
+			Seen.SetAt(Paths[i].AsEncodedString(), true, &bNew);
+			if (!dOldData.IsNil() || !bNew)
+				{
+				*retsError = strPattern(ERR_BATCH_ROW_EXISTS, i);
+				return AEONERR_ALREADY_EXISTS;
+				}
+			}
+		}
+
+	//	Insert all rows
 
-	if (!pView->IsUpToDate())
+	bool bLogFailed = false;
+	for (i = 0; i < Paths.GetCount(); i++)
 		{
-		if (retsError)
-			*retsError = strPattern(ERR_VIEW_NOT_READY, pView->GetName());
-		return false;
-		}
+		bool bRowLogFailed;
+		if (error = InsertRow(Paths[i], Data[i], false, &bRowLogFailed, retsError))
+			{
+			//	We still need to commit the rows that we inserted.
 
-	//	Get dimensions
+			CString sError;
+			CompleteWrite(Lock, OP_INSERT, bLogFailed, &sError);
+			return error;
+			}
 
-	if (retDims)
-		*retDims = pView->GetDimensions();
+		if (bRowLogFailed)
+			bLogFailed = true;
+		}
 
-	//	Let the view initialize
+	//	Wait until all rows are durable
 
-	if (!pView->InitIterator(retIterator))
-		{
-		if (retsError)
-			*retsError = strPattern(STR_ERROR_BAD_ITERATOR, m_sName);
-		return false;
-		}
+	if (!CompleteWrite(Lock, OP_INSERT, bLogFailed, retsError))
+		return AEONERR_FAIL;
 
 	//	Done
 
-	return true;
+	return AEONERR_OK;
 	}
 
-AEONERR CAeonTable::Insert (const CRowKey &Path, CDatum dData, bool bInsertNew, CString *retsError)
+AEONERR CAeonTable::InsertRow (const CRowKey &Path, CDatum dData, bool bInsertNew, bool *retbLogFailed, CString *retsError)
 
-//	Insert
+//	InsertRow
 //
-//	Insert the data into the table.
+//	Inserts a row into all views. We must be called inside the lock. If we
+//	failed to write to a recovery file we set retbLogFailed; callers must call
+//	CompleteWrite afterwards.
 
 	{
-	CSmartLock Lock(m_cs);
 	int i;
 
-	//	Make sure we have the primary volume
-
-	if (m_bPrimaryLost)
-		{
-		*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
-		return AEONERR_FAIL;
-		}
+	*retbLogFailed = false;
 
 	//	If we have secondary views then we need the previous value.
 	//	If we insert only if new, then we also need the previous value.
@@ -2766,39 +3653,26 @@ AEONERR CAeonTable::Insert (const CRowKey &Path, CDatum dData, bool bInsertNew,
 	//	Insert in all views. This method cannot (should not) fail since
 	//	we checked above.
 
-	bool bFallback = false;
 	for (i = 0; i < m_Views.GetCount(); i++)
 		if (m_Views[i].IsValid())
 			{
 			bool bLogFailed;
 			CString sError;
 
-			m_Views[i].Insert(PrimaryDims, m_Process, Path, dData, dOldData, RowID, &bLogFailed, &sError);
+			m_Views[i].Insert(*m_Views.GetAt(DEFAULT_VIEW), m_Process, Path, dData, dOldData, RowID, &bLogFailed, &sError);
 			if (bLogFailed)
 				{
 				m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_VIEW_INSERT_FAILURE, m_Views[i].GetName(), sError));
-				bFallback = true;
+				*retbLogFailed = true;
 				}
 			}
 
+	m_RowCache.Invalidate(Path);
+
 	//	Increment sequence number
 
 	m_Seq++;
 
-	//	If we failed to log to the recovery file then it means that the primary
-	//	volume is bad, so we switch to the back up.
-
-	if (bFallback)
-		{
-		m_pProcess->ReportVolumeFailure(fileAppend(fileAppend(m_pStorage->GetPath(m_sPrimaryVolume), m_sName), FILESPEC_RECOVERY_DIR), OP_INSERT);
-
-		if (!RecoveryRestore())
-			{
-			*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
-			return AEONERR_FAIL;
-			}
-		}
-
 	//	Done
 
 	return AEONERR_OK;
@@ -2844,12 +3718,94 @@ void CAeonTable::Mark (void)
 
 	m_UploadSessions.Mark();
 
+	//	Mark cached rows
+
+	m_RowCache.Mark();
+
 	//	Since we know the world is stopped we take this opportunity to collect
 	//	garbage (i.e., delete some unused structures).
 
 	CollectGarbage();
 	}
 
+bool CAeonTable::MergeViewUpdateRuns (DWORD dwViewID, const CTableDimensions &Dims, TArray<SViewUpdateRun> &Runs, TArray<SViewUpdateRun> *retSegments, CString *retsError)
+
+//	MergeViewUpdateRuns
+//
+//	Merges the sorted runs created by UpdateViewRange into final segments. We
+//	merge consecutive runs until we reach the maximum segment size (a run by
+//	itself becomes a segment without being copied). Runs that we consume are
+//	set to NULL in the array; on failure the caller must free the rest.
+
+	{
+	int i;
+
+	int iStart = 0;
+	while (iStart < Runs.GetCount())
+		{
+		DWORDLONG dwTotalSize = Runs[iStart].pSeg->GetFileSize();
+		int iEnd = iStart + 1;
+		while (iEnd < Runs.GetCount() && dwTotalSize + Runs[iEnd].pSeg->GetFileSize() <= GIGABYTE_DISK)
+			{
+			dwTotalSize += Runs[iEnd].pSeg->GetFileSize();
+			iEnd++;
+			}
+
+		//	If we only have a single run, then it is already a segment.
+
+		if (iEnd - iStart == 1)
+			{
+			retSegments->Insert(Runs[iStart]);
+			Runs[iStart].pSeg = NULL;
+			iStart = iEnd;
+			continue;
+			}
+
+		//	Get a name and sequence number for the merged segment
+
+		CString sBackup;
+		CString sFilespec;
+		SEQUENCENUMBER Seq;
+			{
+			CSmartLock Lock(m_cs);
+			sFilespec = GetUniqueSegmentFilespec(&sBackup);
+			Seq = ++m_ViewUpdateRunSeq;
+			}
+
+		//	Merge
+
+		CRowIterator Rows;
+		Rows.Init(Dims);
+		for (i = iStart; i < iEnd; i++)
+			Rows.AddSegment(Runs[i].pSeg);
+
+		CAeonSegment *pNewSeg = new CAeonSegment;
+		if (!pNewSeg->Create(dwViewID, Dims, Seq, Rows, sFilespec, CAeonSegment::FLAG_SECONDARY_VIEW, retsError))
+			{
+			pNewSeg->Release();
+			m_pProcess->ReportVolumeFailure(sFilespec);
+			return false;
+			}
+
+		SViewUpdateRun *pEntry = retSegments->Insert();
+		pEntry->pSeg = pNewSeg;
+		pEntry->sBackup = sBackup;
+
+		//	We don't need the runs any more
+
+		for (i = iStart; i < iEnd; i++)
+			{
+			Runs[i].pSeg->MarkForDelete();
+			Runs[i].pSeg->Release();
+			Runs[i].pSeg = NULL;
+			}
+
+		iStart = iEnd;
+		}
+
+	return true;
+	}
+
 bool CAeonTable::MoveToScrap (const CString &sFilespec)
 
 //	MoveToScrap
@@ -2875,10 +3831,49 @@ AEONERR CAeonTable::Mutate (const CRowKey &Path, CDatum dData, CDatum dMutateDes
 //
 //	Mutates a row
 
+	{
+	CSmartLock Lock(m_cs);
+
+	//	Make sure we have the primary volume
+
+	if (m_bPrimaryLost)
+		{
+		*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+		return AEONERR_FAIL;
+		}
+
+	//	Mutate
+
+	bool bLogFailed;
+	AEONERR error = MutateRow(Path, dData, dMutateDesc, retdResult, &bLogFailed, retsError);
+	if (error != AEONERR_OK)
+		return error;
+
+	//	Wait until the row is durable
+
+	if (!CompleteWrite(Lock, OP_MUTATE, bLogFailed, retsError))
+		return AEONERR_FAIL;
+
+	//	Done
+
+	return AEONERR_OK;
+	}
+
+AEONERR CAeonTable::MutateMany (const TArray<CRowKey> &Paths, const TArray<CDatum> &Data, const TArray<CDatum> &MutateDescs, TArray<CDatum> *retResults, CString *retsError)
+
+//	MutateMany
+//
+//	Mutates multiple rows under a single lock. All rows go out to the recovery
+//	files as a single batch. We mutate rows in order and stop at the first
+//	failure, in which case the rows before it have already been mutated (and
+//	retResults has their results).
+
 	{
 	CSmartLock Lock(m_cs);
 	int i;
 
+	ASSERT(Paths.GetCount() == Data.GetCount() && Paths.GetCount() == MutateDescs.GetCount());
+
 	//	Make sure we have the primary volume
 
 	if (m_bPrimaryLost)
@@ -2887,6 +3882,53 @@ AEONERR CAeonTable::Mutate (const CRowKey &Path, CDatum dData, CDatum dMutateDes
 		return AEONERR_FAIL;
 		}
 
+	//	Mutate all rows
+
+	retResults->DeleteAll();
+	retResults->GrowToFit(Paths.GetCount());
+
+	AEONERR error = AEONERR_OK;
+	bool bLogFailed = false;
+	for (i = 0; i < Paths.GetCount(); i++)
+		{
+		bool bRowLogFailed;
+		CDatum dResult;
+		error = MutateRow(Paths[i], Data[i], MutateDescs[i], &dResult, &bRowLogFailed, retsError);
+		if (error != AEONERR_OK)
+			break;
+
+		retResults->Insert(dResult);
+		if (bRowLogFailed)
+			bLogFailed = true;
+		}
+
+	//	Wait until all rows are durable (even if we failed part way through).
+
+	CString sError;
+	if (!CompleteWrite(Lock, OP_MUTATE, bLogFailed, &sError))
+		{
+		*retsError = sError;
+		return AEONERR_FAIL;
+		}
+
+	//	Done
+
+	return error;
+	}
+
+AEONERR CAeonTable::MutateRow (const CRowKey &Path, CDatum dData, CDatum dMutateDesc, CDatum *retdResult, bool *retbLogFailed, CString *retsError)
+
+//	MutateRow
+//
+//	Mutates a row in all views. We must be called inside the lock. If we failed
+//	to write to a recovery file we set retbLogFailed; callers must call 
+//	CompleteWrite afterwards.
+
+	{
+	int i;
+
+	*retbLogFailed = false;
+
 	//	Get the dimensions of the primary view
 
 	const CTableDimensions &PrimaryDims = m_Views.GetAt(DEFAULT_VIEW)->GetDimensions();
@@ -3293,35 +4335,22 @@ AEONERR CAeonTable::Mutate (const CRowKey &Path, CDatum dData, CDatum dMutateDes
 	//	Insert in all views. This method cannot (should not) fail since
 	//	we checked above.
 
-	bool bFallback = false;
 	for (i = 0; i < m_Views.GetCount(); i++)
 		if (m_Views[i].IsValid())
 			{
 			bool bLogFailed;
 
-			m_Views[i].Insert(PrimaryDims, m_Process, *pPath, dNewData, dOriginalData, RowID, &bLogFailed);
+			m_Views[i].Insert(*m_Views.GetAt(DEFAULT_VIEW), m_Process, *pPath, dNewData, dOriginalData, RowID, &bLogFailed);
 			if (bLogFailed)
-				bFallback = true;
+				*retbLogFailed = true;
 			}
 
+	m_RowCache.Invalidate(*pPath);
+
 	//	Increment sequence number
 
 	m_Seq++;
 
-	//	If we failed to log to the recovery file then it means that the primary
-	//	volume is bad, so we switch to the back up.
-
-	if (bFallback)
-		{
-		m_pProcess->ReportVolumeFailure(fileAppend(fileAppend(m_pStorage->GetPath(m_sPrimaryVolume), m_sName), FILESPEC_RECOVERY_DIR), OP_MUTATE);
-
-		if (!RecoveryRestore())
-			{
-			*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
-			return AEONERR_FAIL;
-			}
-		}
-
 	//	If necessary, return the primary key in the data
 
 	if (bReturnPrimaryKey)
@@ -3524,6 +4553,15 @@ bool CAeonTable::Open (IArchonProcessCtx *pProcess, CMachineStorage *pStorage, c
 
 		m_pProcess->Log(MSG_LOG_INFO, strPattern(STR_MOVING_PRIMARY, m_sName, m_sPrimaryVolume));
 
+		//	If this volume was a backup, check its files against the manifest
+		//	that we saved there.
+
+		CAeonBackupManifest Manifest;
+		CString sManifestFilespec = fileAppend(sTablePath, FILESPEC_BACKUP_MANIFEST);
+		CString sError;
+		if (fileExists(sManifestFilespec) && Manifest.Load(sManifestFilespec, &sError))
+			VerifyBackup(sTablePath, Manifest);
+
 		//	If necessary we find a new backup volume.
 
 		if (strEquals(m_sPrimaryVolume, m_sBackupVolume))
@@ -3566,7 +4604,7 @@ bool CAeonTable::Open (IArchonProcessCtx *pProcess, CMachineStorage *pStorage, c
 			{
 			m_bBackupLost = true;
 			m_sBackupVolume = m_pStorage->GetRedundantVolume(m_sPrimaryVolume);
-			m_bBackupNeeded = !m_sBackupVolume.IsEmpty();
+			m_bBackupNeeded = true;
 
 			if (m_bBackupNeeded)
 				m_pProcess->Log(MSG_LOG_INFO, strPattern(STR_NEW_BACKUP, m_sName, m_sBackupVolume));
@@ -3577,6 +4615,17 @@ bool CAeonTable::Open (IArchonProcessCtx *pProcess, CMachineStorage *pStorage, c
 		bSaveDesc = true;
 		}
 
+	//	Load the manifest of the files on the backup (so that we know what we
+	//	don't need to copy again).
+
+	if (!m_bBackupNeeded && !m_sBackupVolume.IsEmpty())
+		{
+		CString sManifestFilespec = fileAppend(fileAppend(m_pStorage->GetPath(m_sBackupVolume), m_sName), FILESPEC_BACKUP_MANIFEST);
+		CString sError;
+		if (fileExists(sManifestFilespec) && !m_BackupManifest.Load(sManifestFilespec, &sError))
+			m_pProcess->Log(MSG_LOG_ERROR, sError);
+		}
+
 	//	Now the we have valid primary and secondary volumes, initialize upload sessions
 
 	m_UploadSessions.Init(m_pStorage, m_sName, m_sPrimaryVolume, m_sBackupVolume);
@@ -3614,11 +4663,133 @@ bool CAeonTable::Open (IArchonProcessCtx *pProcess, CMachineStorage *pStorage, c
 			}
 		}
 
-	//	If we have a backup volume, validate the backup at our next opportunity.
+	//	If we have a backup volume, validate the backup at our next opportunity.
+
+	m_bValidateBackup = (!m_bBackupNeeded && !m_sBackupVolume.IsEmpty());
+
+	//	Done
+
+	return true;
+	}
+
+bool CAeonTable::OpenCursor (DWORD dwViewID, CDatum dLastKey, const TArray<int> &Limits, DWORD dwFlags, CDatum dFilter, const TArray<CString> &Fields, CAeonCursor *retCursor, CString *retsError)
+
+//	OpenCursor
+//
+//	Initializes a cursor over the given view, positioned at dLastKey (or after
+//	it, if FLAG_MORE_ROWS is set). The cursor reads from a snapshot, so it does
+//	not need the table after this returns.
+
+	{
+	CSmartLock Lock(m_cs);
+
+	//	Make sure we have the primary volume
+
+	if (m_bPrimaryLost)
+		{
+		*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+		return false;
+		}
+
+	//	Some flags
+
+	CAeonView *pView = m_Views.GetAt(dwViewID);
+	if (pView == NULL)
+		{
+		*retsError = strPattern(ERR_UNKNOWN_VIEW_ID, dwViewID);
+		return false;
+		}
+
+	bool bMore = ((dwFlags & FLAG_MORE_ROWS) ? true : false);
+	bool bIsSecondaryView = (pView->IsSecondaryView());
+
+	//	The filter runs outside the lock, so it gets its own process (which
+	//	shares the table's global environment).
+
+	if (!dFilter.IsNil())
+		retCursor->GetFilterProcess().InitFrom(m_Process);
+
+	//	OK to unlock
+
+	Lock.Unlock();
+
+	CDatum dFilterFunc;
+	if (!dFilter.IsNil()
+			&& !CompileRowFilter(retCursor->GetFilterProcess(), dFilter, &dFilterFunc, retsError))
+		return false;
+
+	bool bRecovery = false;
+	CString sDiskError;
+	try
+		{
+		CTableDimensions Dims;
+		CRowIterator &Sel = retCursor->GetIterator();
+
+		//	Do not include nil (deleted) rows
+
+		Sel.SetIncludeNil(false);
+		if (!InitIterator(dwViewID, &Sel, &Dims, retsError))
+			return false;
+
+		retCursor->Init(Dims, bIsSecondaryView, dwFlags, dFilterFunc, Fields);
+
+		//	If we have a last key, advance the selector appropriately.
+
+		if (!dLastKey.IsNil())
+			{
+			CRowKey LastKey;
+			if (!CRowKey::ParseKey(Dims, dLastKey, &LastKey, retsError))
+				return false;
+
+			if (!Sel.SelectKey(LastKey))
+				{
+				//	If not found, the cursor returns Nil
+
+				retCursor->SetKeyNotFound();
+				return true;
+				}
+
+			//	Advance one, since we want the first row after the last key.
+
+			if (bMore)
+				Sel.GetNextKey();
+			}
+
+		//	Set limits
+
+		if (Limits.GetCount() > 0)
+			Sel.SetLimits(Limits);
+		}
+	catch (CFileException e)
+		{
+		bRecovery = true;
+		sDiskError = e.GetFilespec();
+		}
+	catch (CException e)
+		{
+		m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_EXCEPTION, CString(__FUNCTION__), e.GetErrorString()));
+		*retsError = strPattern(ERR_UNKNOWN, m_sName);
+		return false;
+		}
+	catch (...)
+		{
+		m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CRASH, CString(__FUNCTION__)));
+		*retsError = strPattern(ERR_UNKNOWN, m_sName);
+		return false;
+		}
+
+	if (bRecovery)
+		{
+		m_pProcess->ReportVolumeFailure(sDiskError);
 
-	m_bValidateBackup = (!m_bBackupNeeded && !m_sBackupVolume.IsEmpty());
+		if (!RecoveryRestore())
+			{
+			*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+			return false;
+			}
 
-	//	Done
+		return OpenCursor(dwViewID, dLastKey, Limits, dwFlags, dFilter, Fields, retCursor, retsError);
+		}
 
 	return true;
 	}
@@ -3713,6 +4884,19 @@ bool CAeonTable::OpenSegments (const CString &sVolume, SEQUENCENUMBER *retHighSe
 		pView->InsertSegment(pNewSeg);
 		}
 
+	//	Collect the range deletes saved with the segments (and the ones we
+	//	recovered into memory).
+
+	for (i = 0; i < m_Views.GetCount(); i++)
+		m_Views[i].UpdateRangeDeletes();
+
+	//	Range deletes cover every segment at or before their sequence number, so
+	//	any segment we create from now on must be newer.
+
+	SEQUENCENUMBER RangeDeleteSeq = m_Views.GetAt(DEFAULT_VIEW)->GetRangeDeletes().GetMaxSequence();
+	if (RangeDeleteSeq >= HighSeq)
+		HighSeq = RangeDeleteSeq + 1;
+
 	//	Done
 
 	if (retHighSeq)
@@ -4080,7 +5264,8 @@ CDatum CAeonTable::PrepareFileDesc (const CString &sTable, const CString &sFileP
 		const CString &sField = dFileDesc.GetKey(i);
 
 		if (!strEquals(sField, FIELD_FILE_PATH)
-				&& !strEquals(sField, FIELD_STORAGE_PATH))
+				&& !strEquals(sField, FIELD_STORAGE_PATH)
+				&& !strEquals(sField, FIELD_CHUNKS))
 			pNewFileDesc->SetElement(sField, dFileDesc.GetElement(sField));
 		}
 
@@ -4225,17 +5410,21 @@ bool CAeonTable::RecoveryRestore (void)
 
 	//	NOTE: At this point we don't bother checking to see if the backup is
 	//	stale (i.e., sequence number less than current). It's probably the best
-	//	we're going to get at this point.
+	//	we're going to get at this point. For the same reason, if some files
+	//	don't match the backup manifest we just log them.
+
+	VerifyBackup(fileAppend(m_pStorage->GetPath(m_sBackupVolume), m_sName), m_BackupManifest);
 
 	m_sPrimaryVolume = m_sBackupVolume;
 	m_bPrimaryLost = false;
 	m_bBackupLost = true;
 	m_bBackupNeeded = false;
+	m_BackupManifest.DeleteAll();
 
 	//	We need to write out any segments in memory. We wait until the 
 	//	housekeeping thread is done.
 
-	while (m_iHousekeeping != stateReady)
+	while (m_iHousekeeping != stateReady || m_bCompacting)
 		{
 		Lock.Unlock();
 		::Sleep(250);
@@ -4262,6 +5451,10 @@ bool CAeonTable::RecoveryRestore (void)
 		return RecoveryFailure();
 		}
 
+	//	Cached rows came from the old segments
+
+	m_RowCache.DeleteAll();
+
 	//	Set the upload sessions volumes
 
 	m_UploadSessions.SetVolumes(m_sPrimaryVolume, m_sBackupVolume);
@@ -4300,6 +5493,44 @@ bool CAeonTable::Recreate (IArchonProcessCtx *pProcess, CDatum dDesc, bool *retb
 	if (!DiffDesc(dDesc, &NewViews, retsError))
 		return false;
 
+	//	The row cache size can change at any time
+
+	int iRowCacheSize = dDesc.GetElement(FIELD_ROW_CACHE_SIZE);
+	if (iRowCacheSize < 0)
+		{
+		*retsError = strPattern(ERR_INVALID_ROW_CACHE_SIZE, iRowCacheSize);
+		return false;
+		}
+
+	if ((DWORD)iRowCacheSize != m_RowCache.GetMaxSize())
+		{
+		m_RowCache.SetMaxSize(iRowCacheSize);
+		SaveDesc();
+
+		if (retbUpdated)
+			*retbUpdated = true;
+		}
+
+	//	So can the row expiration. Rows that were hidden (or not) under the
+	//	old setting may be cached, so we clear the cache.
+
+	CAeonRowExpiration NewExpiration;
+	if (!NewExpiration.InitFromDesc(dDesc.GetElement(FIELD_TTL), retsError))
+		return false;
+
+	if (!NewExpiration.IsEqual(m_Expiration))
+		{
+		m_Expiration = NewExpiration;
+		for (i = 0; i < m_Views.GetCount(); i++)
+			m_Views[i].SetExpiration(m_Expiration);
+
+		m_RowCache.DeleteAll();
+		SaveDesc();
+
+		if (retbUpdated)
+			*retbUpdated = true;
+		}
+
 	//	Add new views, if necessary
 
 	if (NewViews.GetCount() > 0)
@@ -4335,7 +5566,10 @@ bool CAeonTable::Recreate (IArchonProcessCtx *pProcess, CDatum dDesc, bool *retb
 			if (!pView->InitAsSecondaryView(NewViews[i], m_Process, GetRecoveryFilespec(dwViewID), true, retsError))
 				bSomeFailures = true;
 			else
+				{
+				pView->SetExpiration(m_Expiration);
 				bSomeSuccesses = true;
+				}
 			}
 
 		//	If we created at least one view then we need to save the descriptors
@@ -4362,6 +5596,81 @@ bool CAeonTable::Recreate (IArchonProcessCtx *pProcess, CDatum dDesc, bool *retb
 	return true;
 	}
 
+bool CAeonTable::RepairFromBackup (DWORD dwViewID, CAeonSegment *pSeg, const CString &sBackup, CString *retsError)
+
+//	RepairFromBackup
+//
+//	Replaces a corrupt segment with a copy of its backup (which the caller has
+//	verified). The corrupt file is still open, so the copy gets a new name and
+//	we back it up under that name.
+//
+//	Must be called outside the lock (while scrubbing, so compaction is not
+//	replacing segments under us).
+
+	{
+	CSmartLock Lock(m_cs);
+	CString sNewBackup;
+	CString sFilespec = GetUniqueSegmentFilespec(&sNewBackup);
+	Lock.Unlock();
+
+	//	Copy and make sure the copy is good
+
+	if (!fileCopy(sBackup, sFilespec))
+		{
+		*retsError = strPattern(ERR_CANNOT_COPY_FILE, sBackup, sFilespec);
+		return false;
+		}
+
+	if (!CAeonSegment::Verify(sFilespec, retsError))
+		{
+		fileDelete(sFilespec);
+		return false;
+		}
+
+	CAeonSegment *pNewSeg = new CAeonSegment;
+	if (!pNewSeg->Open(sFilespec, retsError))
+		{
+		pNewSeg->Release();
+		fileDelete(sFilespec);
+		return false;
+		}
+
+	bool bBackup = (!sNewBackup.IsEmpty() && BackupSegment(sFilespec, sNewBackup));
+
+	//	Replace the segment in the view
+
+	Lock.Lock();
+
+	CAeonView *pView = m_Views.GetAt(dwViewID);
+	if (pView == NULL)
+		{
+		pNewSeg->MarkForDelete();
+		pNewSeg->Release();
+
+		if (bBackup)
+			DeleteSegmentBackup(sNewBackup);
+
+		return true;
+		}
+
+	TArray<CAeonSegment *> Replaced;
+	Replaced.Insert(pSeg);
+
+	pNewSeg->SetDimensions(pView->GetDimensions());
+	pView->SegmentMergeComplete(Replaced, pNewSeg);
+
+	//	The old backup has the old name, so we don't need it any more (unless
+	//	we couldn't back up the new copy).
+
+	if (bBackup)
+		DeleteSegmentBackup(sBackup);
+	else if (!sNewBackup.IsEmpty())
+		m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_SEGMENT_BACKUP_FAILED, sNewBackup));
+
+	m_RowCache.DeleteAll();
+	return true;
+	}
+
 bool CAeonTable::RowExists (const CTableDimensions &Dims, CDatum dKey)
 
 //	RowExists
@@ -4460,15 +5769,24 @@ bool CAeonTable::Save (CString *retsError)
 		pView->SegmentSaveComplete(SegmentsCreated[i].pSeg);
 		}
 
+	m_dwLastCheckpoint = sysGetTickCount();
+
 	//	Outside of the lock we create backups
 
 	Lock.Unlock();
 
 	if (!m_bBackupLost)
 		{
+		//	The views that we saved have started their recovery logs over.
+		//	Copy the new logs first so that the backup never has old log rows
+		//	on top of the new segments.
+
+		if (SegmentsCreated.GetCount() > 0)
+			BackupRecoveryLogs();
+
 		for (i = 0; i < SegmentsCreated.GetCount(); i++)
 			{
-			if (!fileCopy(SegmentsCreated[i].sFilespec, SegmentsCreated[i].sBackup))
+			if (!BackupSegment(SegmentsCreated[i].sFilespec, SegmentsCreated[i].sBackup))
 				{
 				m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_SEGMENT_BACKUP_FAILED, SegmentsCreated[i].sBackup));
 
@@ -4541,28 +5859,322 @@ bool CAeonTable::SaveDesc (CDatum dDesc, const CString &sFilespec, CString *rets
 	{
 	//	Open the file
 
-	CFile DescFile;
-	if (!DescFile.Create(sFilespec, CFile::FLAG_CREATE_ALWAYS))
-		{
-		m_pProcess->ReportVolumeFailure(sFilespec);
-		*retsError = strPattern(STR_ERROR_CANT_SAVE_DESC, sFilespec);
+	CFile DescFile;
+	if (!DescFile.Create(sFilespec, CFile::FLAG_CREATE_ALWAYS))
+		{
+		m_pProcess->ReportVolumeFailure(sFilespec);
+		*retsError = strPattern(STR_ERROR_CANT_SAVE_DESC, sFilespec);
+		return false;
+		}
+
+	//	Write
+
+	try
+		{
+		dDesc.Serialize(CDatum::formatAEONScript, DescFile);
+		}
+	catch (...)
+		{
+		m_pProcess->ReportVolumeFailure(sFilespec);
+		*retsError = strPattern(STR_ERROR_CANT_SAVE_DESC, sFilespec);
+		return false;
+		}
+
+	//	Done
+
+	return true;
+	}
+
+void CAeonTable::ScrapUploadFile (const CString &sFilespec)
+
+//	ScrapUploadFile
+//
+//	Moves a file that we no longer need (an upload, or a file stored before we
+//	had chunks) to scrap, along with its copy on the backup volume.
+
+	{
+	if (!MoveToScrap(sFilespec))
+		m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CANT_MOVE_TO_SCRAP, sFilespec));
+
+	if (!m_bBackupLost && !m_sBackupVolume.IsEmpty())
+		{
+		CString sBackupFilespec = m_pStorage->CanonicalRelativeToMachine(m_sBackupVolume, m_pStorage->MachineToCanonicalRelative(sFilespec));
+		if (fileExists(sBackupFilespec) && !MoveToScrap(sBackupFilespec))
+			m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CANT_MOVE_TO_SCRAP, sBackupFilespec));
+		}
+	}
+
+int CAeonTable::Scrub (CSmartLock &Lock)
+
+//	Scrub
+//
+//	Reads every segment on the primary and backup volumes and verifies its
+//	checksums, using a few threads so that we run at disk speed. If a backup
+//	copy is corrupt we copy the segment again; if the primary copy is corrupt
+//	we replace it with the backup. Either way we only touch the bad files
+//	instead of copying the whole volume.
+//
+//	Called by housekeeping with the lock held. We unlock while we read.
+//	Returns the number of files that failed verification.
+
+	{
+	int i, j;
+	CString sError;
+
+	m_iHousekeeping = stateScrubbing;
+	m_dwLastScrub = sysGetTickCount();
+
+	//	Get the list of segments. We keep a reference to each so the files
+	//	don't get deleted while we read them (e.g., if a view is deleted).
+	//	Compaction waits for us, so nothing else replaces them.
+
+	bool bScrubBackup = (!m_bBackupLost && !m_bBackupNeeded && !m_sBackupVolume.IsEmpty());
+
+	TArray<CAeonSegment *> Segments;
+	TArray<DWORD> ViewIDs;
+	for (i = 0; i < m_Views.GetCount(); i++)
+		for (j = 0; j < m_Views[i].GetSegmentCount(); j++)
+			{
+			CAeonSegment *pSeg = &m_Views[i].GetSegment(j);
+			pSeg->AddRef();
+			Segments.Insert(pSeg);
+			ViewIDs.Insert(m_Views[i].GetID());
+			}
+
+	//	The first half of the files are on the primary; the second half are
+	//	the corresponding backups.
+
+	SScrubRange Scrub;
+	for (i = 0; i < Segments.GetCount(); i++)
+		Scrub.Files.Insert(Segments[i]->GetFilespec());
+
+	if (bScrubBackup)
+		{
+		for (i = 0; i < Segments.GetCount(); i++)
+			Scrub.Files.Insert(m_pStorage->CanonicalRelativeToMachine(m_sBackupVolume, m_pStorage->MachineToCanonicalRelative(Segments[i]->GetFilespec())));
+		}
+
+	Scrub.Errors.InsertEmpty(Scrub.Files.GetCount());
+
+	Lock.Unlock();
+
+	TArray<CAeonScrubThread *> Workers;
+	for (i = 0; i < Min(MAX_SCRUB_THREADS, Scrub.Files.GetCount()); i++)
+		{
+		CAeonScrubThread *pWorker = new CAeonScrubThread(this, &Scrub);
+		pWorker->Start();
+		Workers.Insert(pWorker);
+		}
+
+	for (i = 0; i < Workers.GetCount(); i++)
+		{
+		Workers[i]->Wait();
+		delete Workers[i];
+		}
+
+	//	Repair what we can
+
+	int iBadFiles = 0;
+	for (i = 0; i < Segments.GetCount(); i++)
+		{
+		const CString &sPrimaryError = Scrub.Errors[i];
+		bool bBackupOK = (bScrubBackup && Scrub.Errors[Segments.GetCount() + i].IsEmpty());
+
+		if (!sPrimaryError.IsEmpty())
+			{
+			m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_SEGMENT_CORRUPT, m_sName, sPrimaryError));
+			iBadFiles++;
+			}
+
+		if (bScrubBackup && !bBackupOK)
+			{
+			m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_SEGMENT_CORRUPT, m_sName, Scrub.Errors[Segments.GetCount() + i]));
+			iBadFiles++;
+			}
+
+		//	If the primary is bad, we replace it with the backup (if the
+		//	backup is good). Otherwise we wait until a read fails and we
+		//	switch volumes.
+
+		if (!sPrimaryError.IsEmpty())
+			{
+			if (bBackupOK)
+				{
+				const CString &sBackup = Scrub.Files[Segments.GetCount() + i];
+				if (RepairFromBackup(ViewIDs[i], Segments[i], sBackup, &sError))
+					m_pProcess->Log(MSG_LOG_INFO, strPattern(STR_SEGMENT_REPAIRED, m_sName, Segments[i]->GetFilespec()));
+				else
+					{
+					m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CANT_REPAIR_SEGMENT, Segments[i]->GetFilespec()));
+					m_pProcess->Log(MSG_LOG_ERROR, sError);
+					}
+				}
+			}
+
+		//	If only the backup is bad, we copy it again from the primary
+
+		else if (bScrubBackup && !bBackupOK)
+			{
+			const CString &sBackup = Scrub.Files[Segments.GetCount() + i];
+			if (!BackupSegment(Segments[i]->GetFilespec(), sBackup))
+				m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_SEGMENT_BACKUP_FAILED, sBackup));
+			}
+		}
+
+	//	Done
+
+	for (i = 0; i < Segments.GetCount(); i++)
+		Segments[i]->Release();
+
+	m_pProcess->Log((iBadFiles ? MSG_LOG_ERROR : MSG_LOG_INFO), strPattern(STR_SCRUB_COMPLETE, m_sName, iBadFiles));
+
+	Lock.Lock();
+	m_iHousekeeping = stateReady;
+
+	return iBadFiles;
+	}
+
+void CAeonTable::ScrubSegments (SScrubRange &Scrub)
+
+//	ScrubSegments
+//
+//	Called on each CAeonScrubThread. We verify files until there are none
+//	left.
+
+	{
+	while (true)
+		{
+		int iFile = (int)::InterlockedIncrement(&Scrub.iNext) - 1;
+		if (iFile >= Scrub.Files.GetCount())
+			break;
+
+		CString sError;
+		if (!CAeonSegment::Verify(Scrub.Files[iFile], &sError))
+			Scrub.Errors[iFile] = sError;
+		}
+	}
+
+bool CAeonTable::ScrubTest (int *retiBadFiles, CString *retsError)
+
+//	ScrubTest
+//
+//	Verifies every segment now (instead of waiting for the daily scrub) and
+//	returns the number of files that failed. Used by Aeon.scrubTableTest.
+
+	{
+	CSmartLock Lock(m_cs);
+
+	if (m_bPrimaryLost)
+		{
+		*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+		return false;
+		}
+
+	if (m_bCompacting || m_iHousekeeping != stateReady)
+		{
+		*retsError = strPattern(ERR_TABLE_BUSY, m_sName);
+		return false;
+		}
+
+	*retiBadFiles = Scrub(Lock);
+	return true;
+	}
+
+bool CAeonTable::SearchText (DWORD dwViewID, const CString &sQuery, int iMaxResults, CDatum *retdResult, CString *retsError)
+
+//	SearchText
+//
+//	Searches a full-text view and returns the matching rows, most relevant
+//	first. Like GetData, we only hold the lock long enough to take a snapshot.
+
+	{
+	CSmartLock Lock(m_cs);
+
+	//	Make sure we have the primary volume
+
+	if (m_bPrimaryLost)
+		{
+		*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+		return false;
+		}
+
+	//	Get the view
+
+	CAeonView *pView = m_Views.GetAt(dwViewID);
+	if (pView == NULL)
+		{
+		*retsError = strPattern(ERR_UNKNOWN_VIEW_ID, dwViewID);
+		return false;
+		}
+
+	if (!pView->IsFullTextView())
+		{
+		*retsError = strPattern(ERR_NOT_FULL_TEXT_VIEW, pView->GetName());
+		return false;
+		}
+
+	if (!pView->IsUpToDate())
+		{
+		*retsError = strPattern(ERR_VIEW_NOT_READY, pView->GetName());
+		return false;
+		}
+
+	//	We need the number of rows in the table to weigh terms (an estimate is
+	//	fine).
+
+	CAeonView *pPrimaryView = m_Views.GetAt(DEFAULT_VIEW);
+	DWORDLONG dwTotalRows = (pPrimaryView ? pPrimaryView->GetSegmentRowCount() : 0);
+
+	CAeonViewSnapshot Snapshot;
+	pView->OpenSnapshot(&Snapshot);
+
+	Lock.Unlock();
+
+	//	Parse the query
+
+	TArray<CAeonTextIndex::SClause> Query;
+	if (!CAeonTextIndex::ParseQuery(sQuery, &Query, retsError))
 		return false;
-		}
 
-	//	Write
+	//	Search
 
+	bool bRecovery = false;
+	CString sDiskError;
 	try
 		{
-		dDesc.Serialize(CDatum::formatAEONScript, DescFile);
+		if (!CAeonTextIndex::Search(Snapshot, Query, dwTotalRows, iMaxResults, retdResult, retsError))
+			return false;
+		}
+	catch (CFileException e)
+		{
+		bRecovery = true;
+		sDiskError = e.GetFilespec();
+		}
+	catch (CException e)
+		{
+		m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_EXCEPTION, CString(__FUNCTION__), e.GetErrorString()));
+		*retsError = strPattern(ERR_UNKNOWN, m_sName);
+		return false;
 		}
 	catch (...)
 		{
-		m_pProcess->ReportVolumeFailure(sFilespec);
-		*retsError = strPattern(STR_ERROR_CANT_SAVE_DESC, sFilespec);
+		m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CRASH, CString(__FUNCTION__)));
+		*retsError = strPattern(ERR_UNKNOWN, m_sName);
 		return false;
 		}
 
-	//	Done
+	if (bRecovery)
+		{
+		m_pProcess->ReportVolumeFailure(sDiskError);
+
+		if (!RecoveryRestore())
+			{
+			*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+			return false;
+			}
+
+		return SearchText(dwViewID, sQuery, iMaxResults, retdResult, retsError);
+		}
 
 	return true;
 	}
@@ -4615,6 +6227,223 @@ void CAeonTable::SetDimensionDesc (CComplexStruct *pDesc, const SDimensionDesc &
 		}
 	}
 
+void CAeonTable::SetViewUpdateThreads (int iMaxThreads, DWORDLONG dwMinRowsPerThread)
+
+//	SetViewUpdateThreads
+//
+//	Sets how many worker threads we use to rebuild a secondary view. We use
+//	one thread for every dwMinRowsPerThread primary rows, up to iMaxThreads.
+//	0 means use the default.
+
+	{
+	m_iMaxViewUpdateThreads = (iMaxThreads > 0 ? iMaxThreads : MAX_VIEW_UPDATE_THREADS);
+	m_dwMinRowsPerViewUpdateThread = (dwMinRowsPerThread > 0 ? dwMinRowsPerThread : MIN_ROWS_PER_VIEW_UPDATE_THREAD);
+	}
+
+void CAeonTable::SweepChunks (CSmartLock &Lock)
+
+//	SweepChunks
+//
+//	Deletes chunk files that no fileDesc refers to (because the file was
+//	deleted or replaced). We also delete old upload files that no session or
+//	fileDesc uses (e.g., from sessions that timed out). We do this on both the
+//	primary and the backup.
+//
+//	Called by housekeeping with the lock held. We unlock while we scan.
+
+	{
+	int i, j;
+	CString sError;
+
+	//	If anyone is using chunks, try again next time.
+
+	if (m_iChunkUsers > 0)
+		return;
+
+	m_iHousekeeping = stateSweepingChunks;
+	m_dwLastChunkSweep = sysGetTickCount();
+
+	TArray<CString> TablePaths;
+	CString sTablePath;
+	if (GetTablePath(m_sPrimaryVolume, &sTablePath, &sError))
+		TablePaths.Insert(sTablePath);
+
+	bool bSweepBackup = (!m_bBackupLost && !m_bBackupNeeded && !m_sBackupVolume.IsEmpty());
+	if (bSweepBackup && GetTablePath(m_sBackupVolume, &sTablePath, &sError))
+		TablePaths.Insert(sTablePath);
+
+	Lock.Unlock();
+
+	//	Make a list of all the files that some fileDesc uses. No one can store
+	//	chunks until we're done, so nothing gets added behind our back.
+
+	TSortMap<CString, bool> InUse;
+	CRowIterator Rows;
+	Rows.SetIncludeNil(false);
+	if (!InitIterator(DEFAULT_VIEW, &Rows, NULL, &sError))
+		{
+		m_pProcess->Log(MSG_LOG_ERROR, sError);
+		Lock.Lock();
+		m_iHousekeeping = stateReady;
+		return;
+		}
+
+	while (Rows.HasMore())
+		{
+		CDatum dFileDesc;
+		Rows.GetNextRow(&dFileDesc);
+
+		TArray<CAeonChunkStore::SChunk> Chunks;
+		if (CAeonChunkStore::ParseChunks(dFileDesc.GetElement(FIELD_CHUNKS), &Chunks))
+			{
+			for (j = 0; j < Chunks.GetCount(); j++)
+				InUse.SetAt(fileGetFilename(CAeonChunkStore::GetChunkFilename(Chunks[j].sHash)), true);
+			}
+		else
+			InUse.SetAt(fileGetFilename(dFileDesc.GetElement(FIELD_STORAGE_PATH)), true);
+		}
+
+	//	Upload files are only garbage if they haven't been touched in a while
+	//	(otherwise they may belong to an upload in progress).
+
+	CDateTime OrphanTime = timeSubtractTime(CDateTime(CDateTime::Now), CTimeSpan(ORPHAN_FILE_AGE));
+
+	int iDeleted = 0;
+	for (i = 0; i < TablePaths.GetCount(); i++)
+		{
+		CString sFilesPath = fileAppend(TablePaths[i], FILESPEC_FILES_DIR);
+
+		TArray<CString> Files;
+		if (!fileGetFileList(sFilesPath, NULL_STR, FILESPEC_ALL, FFL_FLAG_RELATIVE_FILESPEC, &Files))
+			{
+			m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_UNABLE_TO_LIST_FILES, sFilesPath));
+			continue;
+			}
+
+		for (j = 0; j < Files.GetCount(); j++)
+			{
+			const CString &sFile = Files[j];
+			if (InUse.GetAt(sFile))
+				continue;
+
+			CString sFilespec = fileAppend(sFilesPath, sFile);
+			CString sExtension = fileGetExtension(sFile);
+			if (CAeonChunkStore::IsChunkFilename(sFile)
+					|| ((strEquals(sExtension, FILESPEC_FILE_EXTENSION) || strEquals(sExtension, FILESPEC_TEMP_EXTENSION))
+						&& fileGetModifiedTime(sFilespec) < OrphanTime))
+				{
+				if (!fileDelete(sFilespec))
+					continue;
+
+				iDeleted++;
+
+				//	Files on the backup may be in the manifest
+
+				if (i > 0)
+					{
+					Lock.Lock();
+					m_BackupManifest.Delete(fileAppend(FILESPEC_FILES_DIR, sFile));
+					Lock.Unlock();
+					}
+				}
+			}
+		}
+
+	//	Done
+
+	m_pProcess->Log(MSG_LOG_INFO, strPattern(STR_CHUNK_SWEEP_COMPLETE, m_sName, iDeleted));
+
+	Lock.Lock();
+	m_iHousekeeping = stateReady;
+	}
+
+void CAeonTable::UpdateViewRange (SViewUpdateRange &Range)
+
+//	UpdateViewRange
+//
+//	Generates secondary view rows for all primary rows in the range and writes
+//	them out as sorted runs. This is called on a CAeonViewUpdateThread while we
+//	are in stateUpdatingView, so segments in the primary view don't change.
+
+	{
+	CString sError;
+
+	//	Each worker needs its own process for evaluating keys and computed
+	//	columns.
+
+	CHexeProcess Process;
+	if (!Process.LoadStandardLibraries(&sError))
+		m_pProcess->Log(MSG_LOG_ERROR, sError);
+
+	CAeonRowArray SecondaryRows;
+	SecondaryRows.Init(Range.pView->GetDimensions());
+
+	//	Aggregate views accumulate groups (indexed by encoded key) instead of
+	//	rows.
+
+	bool bAggregate = Range.pView->IsAggregateView();
+	TSortMap<CString, CDatum> Groups;
+
+	DWORDLONG dwProgress = 0;
+	while (Range.Rows.HasMore())
+		{
+		//	Stop when we reach the next range
+
+		if (Range.bHasEndKey
+				&& CRowKey::Compare(Range.PrimaryDims, CRowKey(Range.PrimaryDims, Range.Rows.GetKey()), Range.EndKey) != 1)
+			break;
+
+		CRowKey Key;
+		CDatum dData;
+		SEQUENCENUMBER RowID;
+
+		//	Get the row from the primary table
+
+		Range.Rows.GetNextRow(&Key, &dData, &RowID);
+
+		//	Create the secondary view row (but only if not deleted)
+
+		if (!dData.IsNil())
+			{
+			if (bAggregate)
+				Range.pView->AddToAggregates(Process, dData, &Groups);
+			else
+				Range.pView->CreateSecondaryRows(Range.PrimaryDims, Process, Key, dData, RowID, &SecondaryRows);
+			}
+
+		//	Report progress
+
+		if (++dwProgress == VIEW_UPDATE_PROGRESS_ROWS)
+			{
+			CSmartLock Lock(m_cs);
+			m_dwViewUpdateDone += dwProgress;
+			dwProgress = 0;
+			}
+
+		//	After a certain number of rows we write out a run so we don't have
+		//	to keep everything in memory.
+
+		if (SecondaryRows.GetCount() >= VIEW_UPDATE_RUN_ROWS)
+			{
+			if (!WriteViewUpdateRun(Range, SecondaryRows))
+				return;
+
+			SecondaryRows.DeleteAll();
+			}
+		}
+
+	//	Write out the remaining rows
+
+	if (bAggregate)
+		Range.pView->CreateAggregateRows(Groups, &SecondaryRows);
+
+	if (SecondaryRows.GetCount() > 0)
+		WriteViewUpdateRun(Range, SecondaryRows);
+
+	CSmartLock Lock(m_cs);
+	m_dwViewUpdateDone += dwProgress;
+	}
+
 AEONERR CAeonTable::UploadFile (CMsgProcessCtx &Ctx, const CString &sSessionID, const CString &sFilePath, CDatum dUploadDesc, CDatum dData, int *retiComplete, CString *retsError)
 
 //	UploadFile
@@ -4662,8 +6491,13 @@ AEONERR CAeonTable::UploadFile (CMsgProcessCtx &Ctx, const CString &sSessionID,
 	if (!GetData(DEFAULT_VIEW, Path, &dCurrentFileDesc, NULL, retsError))
 		return AEONERR_FAIL;
 
+	//	sCurrentFilespec is only set for files stored before we had chunks.
+
+	TArray<CAeonChunkStore::SChunk> CurrentChunks;
+	bool bCurrentIsChunked = CAeonChunkStore::ParseChunks(dCurrentFileDesc.GetElement(FIELD_CHUNKS), &CurrentChunks);
+
 	CString sCurrentFilespec;
-	if (!dCurrentFileDesc.IsNil())
+	if (!dCurrentFileDesc.IsNil() && !bCurrentIsChunked)
 		sCurrentFilespec = m_pStorage->CanonicalRelativeToMachine(m_sPrimaryVolume, dCurrentFileDesc.GetElement(FIELD_STORAGE_PATH));
 
 	//	If dUploadDesc and dData are empty then we are deleting the file.
@@ -4678,7 +6512,8 @@ AEONERR CAeonTable::UploadFile (CMsgProcessCtx &Ctx, const CString &sSessionID,
 			return AEONERR_FAIL;
 			}
 
-		//	Move the original file to scrap
+		//	Move the original file to scrap (if it was stored before we had
+		//	chunks). SweepChunks deletes chunks that are no longer used.
 
 		if (!sCurrentFilespec.IsEmpty())
 			{
@@ -4699,14 +6534,63 @@ AEONERR CAeonTable::UploadFile (CMsgProcessCtx &Ctx, const CString &sSessionID,
 		return AEONERR_OK;
 		}
 
+	//	If this upload changes part of a chunked file, then the new session
+	//	needs the current contents in a file, so we assemble a copy.
+
+	CDatum dUploadPos = dUploadDesc.GetElement(FIELD_UPLOAD_POS);
+	bool bCopyNeeded = (bCurrentIsChunked && !dUploadPos.IsNil() && !m_UploadSessions.HasSession(sSessionID));
+
+	CString sTablePath;
+	if (!GetTablePath(m_sPrimaryVolume, &sTablePath, retsError))
+		return AEONERR_FAIL;
+
+	if (bCopyNeeded)
+		m_iChunkUsers++;
+
 	//	Unlock while we process the upload
 
 	Lock.Unlock();
 
+	CString sCopyFilespec;
+	if (bCopyNeeded)
+		{
+		sCopyFilespec = fileAppend(sTablePath, strPattern(FILESPEC_FILE_COPY_CONS, cryptoRandomCode(COPY_NAME_CHARS)));
+		bool bSuccess = CAeonChunkStore::WriteFile(sTablePath, CurrentChunks, sCopyFilespec, retsError);
+
+		Lock.Lock();
+		m_iChunkUsers--;
+		Lock.Unlock();
+
+		if (!bSuccess)
+			return AEONERR_FAIL;
+		}
+
 	//	Process the upload until we get the entire thing
 
 	CAeonUploadSessions::SReceipt Receipt;
-	if (!m_UploadSessions.ProcessUpload(Ctx, sSessionID, sFilePath, dUploadDesc, dData, sCurrentFilespec, &Receipt))
+	bool bSuccess = m_UploadSessions.ProcessUpload(Ctx, sSessionID, sFilePath, dUploadDesc, dData, (bCopyNeeded ? sCopyFilespec : sCurrentFilespec), &Receipt);
+
+	//	When we overwrite part of the file, the session copies what it needs
+	//	from the original on the first call, so we no longer need our copy.
+	//	(When we append, the session appends to our copy, which becomes the
+	//	upload file.)
+
+	if (bCopyNeeded && (!bSuccess || (int)dUploadPos != -1))
+		fileDelete(sCopyFilespec);
+
+	//	If we couldn't write to the backup volume then it needs to be
+	//	restored.
+
+	if (Receipt.bBackupFailed)
+		{
+		m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_UPLOAD_BACKUP_FAILED, m_sName, sFilePath));
+
+		Lock.Lock();
+		m_bBackupNeeded = true;
+		Lock.Unlock();
+		}
+
+	if (!bSuccess)
 		{
 		if (retsError)
 			*retsError = Receipt.sError;
@@ -4723,9 +6607,43 @@ AEONERR CAeonTable::UploadFile (CMsgProcessCtx &Ctx, const CString &sSessionID,
 		return AEONERR_OK;
 		}
 
-	//	Lock while we update the table
+	//	Split the upload into chunks and store any that we don't already have.
+	//	We do this outside the lock since it reads the whole file.
+
+	Lock.Lock();
+	BeginChunkWrite(Lock);
+
+	CString sBackupTablePath;
+	if (!m_bBackupLost && !m_bBackupNeeded && !m_sBackupVolume.IsEmpty())
+		{
+		CString sError;
+		if (!GetTablePath(m_sBackupVolume, &sBackupTablePath, &sError))
+			sBackupTablePath = NULL_STR;
+		}
+
+	Lock.Unlock();
+
+	TArray<CAeonChunkStore::SChunk> Chunks;
+	bool bBackupFailed;
+	bSuccess = CAeonChunkStore::StoreFile(Receipt.sFilespec, sTablePath, sBackupTablePath, &Chunks, &bBackupFailed, retsError);
+
+	//	Lock while we update the table. We hold the lock until we've written
+	//	the fileDesc, so SweepChunks can't run before it sees the new chunks.
 
 	Lock.Lock();
+	m_iChunkUsers--;
+
+	if (!bSuccess)
+		{
+		m_UploadSessions.AbortUpload(Receipt);
+		return AEONERR_FAIL;
+		}
+
+	if (bBackupFailed)
+		{
+		m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CHUNK_BACKUP_FAILED, m_sName, sFilePath));
+		m_bBackupNeeded = true;
+		}
 
 	//	Look up the file in the database again because it might have
 	//	changed while we were outside the lock.
@@ -4751,9 +6669,10 @@ AEONERR CAeonTable::UploadFile (CMsgProcessCtx &Ctx, const CString &sSessionID,
 	//	Update the file descriptor
 
 	CComplexStruct *pNewFileDesc = new CComplexStruct(Receipt.dFileDesc);
+	pNewFileDesc->DeleteElement(FIELD_STORAGE_PATH);
 	pNewFileDesc->SetElement(FIELD_VERSION, CDatum((int)(dwCurrentVersion + 1)));
 	pNewFileDesc->SetElement(FIELD_FILE_PATH, sFilePath);
-	pNewFileDesc->SetElement(FIELD_STORAGE_PATH, m_pStorage->MachineToCanonicalRelative(Receipt.sFilespec));
+	pNewFileDesc->SetElement(FIELD_CHUNKS, CAeonChunkStore::AsDatum(Chunks));
 	pNewFileDesc->SetElement(FIELD_MODIFIED_ON, CDateTime(CDateTime::Now));
 	pNewFileDesc->SetElement(FIELD_SIZE, Receipt.iFileSize);
 
@@ -4766,29 +6685,14 @@ AEONERR CAeonTable::UploadFile (CMsgProcessCtx &Ctx, const CString &sSessionID,
 		return AEONERR_FAIL;
 		}
 
-	//	Move the original file to scrap
-
-	if (Receipt.bNewFile && !sCurrentFilespec.IsEmpty())
-		{
-		if (!MoveToScrap(sCurrentFilespec))
-			{
-			//	This is not an error, since the file was uploaded properly.
-			//	We can find this file later while checking for consistency.
-
-			m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CANT_MOVE_TO_SCRAP, sCurrentFilespec));
-			}
-
-		//	Also move the backup file
+	//	The contents are in chunks now, so we no longer need the upload file
+	//	or the original file (if it was stored before we had chunks). This is
+	//	not an error if it fails, since the file was uploaded properly. We can
+	//	find these files later while checking for consistency.
 
-		if (!m_bBackupLost)
-			{
-			CString sBackupFilespec = m_pStorage->CanonicalRelativeToMachine(m_sBackupVolume, m_pStorage->MachineToCanonicalRelative(sCurrentFilespec));
-			if (!MoveToScrap(sBackupFilespec))
-				{
-				m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_CANT_MOVE_TO_SCRAP, sBackupFilespec));
-				}
-			}
-		}
+	ScrapUploadFile(Receipt.sFilespec);
+	if (!sCurrentFilespec.IsEmpty() && !strEqualsNoCase(sCurrentFilespec, Receipt.sFilespec))
+		ScrapUploadFile(sCurrentFilespec);
 
 	//	Done
 
@@ -4894,6 +6798,7 @@ bool CAeonTable::ValidateVolume (const CString &sVolume, CString *retsError) con
 
 	CString sTablePath = fileAppend(sVolPath, m_sName);
 	bool bOtherVol = !strEqualsNoCase(sVolume, m_sPrimaryVolume);
+	bool bBackupVol = strEqualsNoCase(sVolume, m_sBackupVolume);
 
 	//	Loop over all views checking each segment
 
@@ -4920,6 +6825,19 @@ bool CAeonTable::ValidateVolume (const CString &sVolume, CString *retsError) con
 				if (retsError) *retsError = strPattern(ERR_MISSING_FILE, sSegFile);
 				return false;
 				}
+
+			//	On the backup, make sure the file is the size that we copied
+			//	(otherwise the copy got cut short).
+
+			if (bBackupVol)
+				{
+				const CAeonBackupManifest::SEntry *pEntry = m_BackupManifest.Find(fileAppend(FILESPEC_SEGMENTS_DIR, fileGetFilename(sSegFile)));
+				if (pEntry && pEntry->dwSize != fileGetSize(sSegFile))
+					{
+					if (retsError) *retsError = strPattern(ERR_INCOMPLETE_FILE, sSegFile);
+					return false;
+					}
+				}
 			}
 		}
 
@@ -4927,3 +6845,90 @@ bool CAeonTable::ValidateVolume (const CString &sVolume, CString *retsError) con
 
 	return true;
 	}
+
+bool CAeonTable::VerifyBackup (const CString &sTablePath, const CAeonBackupManifest &Manifest)
+
+//	VerifyBackup
+//
+//	Checks the files at sTablePath against the manifest and logs any that are
+//	missing or corrupt. Returns FALSE if any are.
+
+	{
+	int i;
+
+	TArray<CString> BadFiles;
+	if (Manifest.Verify(sTablePath, &BadFiles))
+		return true;
+
+	for (i = 0; i < BadFiles.GetCount(); i++)
+		m_pProcess->Log(MSG_LOG_ERROR, strPattern(ERR_BACKUP_FILE_MISMATCH, m_sName, fileAppend(sTablePath, BadFiles[i])));
+
+	return false;
+	}
+
+bool CAeonTable::WriteTornRecoveryRecordTest (CString *retsError)
+
+//	WriteTornRecoveryRecordTest
+//
+//	Leaves an incomplete record at the end of every view's recovery file (as
+//	if we had crashed in the middle of a write). Used by Aeon.recoverTableTest.
+
+	{
+	CSmartLock Lock(m_cs);
+	int i;
+
+	if (m_bPrimaryLost)
+		{
+		*retsError = strPattern(ERR_PRIMARY_OFFLINE, m_sName);
+		return false;
+		}
+
+	for (i = 0; i < m_Views.GetCount(); i++)
+		if (!m_Views[i].WriteTornRecoveryRecordTest(retsError))
+			return false;
+
+	return true;
+	}
+
+bool CAeonTable::WriteViewUpdateRun (SViewUpdateRange &Range, CAeonRowArray &Rows)
+
+//	WriteViewUpdateRun
+//
+//	Writes the given secondary rows out as a run. Returns FALSE if we failed
+//	(Range has the error).
+
+	{
+	//	Get a name and sequence number for the run. The sequence number only
+	//	needs to be unique; the runs never have overlapping rows.
+
+	CString sBackup;
+	CString sFilespec;
+	SEQUENCENUMBER Seq;
+		{
+		CSmartLock Lock(m_cs);
+		sFilespec = GetUniqueSegmentFilespec(&sBackup);
+		Seq = ++m_ViewUpdateRunSeq;
+		}
+
+	//	Create the run
+
+	const CTableDimensions &Dims = Range.pView->GetDimensions();
+	CRowIterator RunRows;
+	RunRows.Init(Dims);
+	RunRows.AddSegment(&Rows);
+
+	CAeonSegment *pRun = new CAeonSegment;
+	if (!pRun->Create(Range.dwViewID, Dims, Seq, RunRows, sFilespec, CAeonSegment::FLAG_SECONDARY_VIEW, &Range.sError))
+		{
+		pRun->Release();
+		Range.bSuccess = false;
+		Range.sFailedFilespec = sFilespec;
+		return false;
+		}
+
+	SViewUpdateRun *pEntry = Range.Runs.Insert();
+	pEntry->pSeg = pRun;
+	pEntry->sBackup = sBackup;
+
+	return true;
+	}
@@ -0,0 +1,321 @@
+//	CAeonTextIndex.cpp
+//
+//	CAeonTextIndex class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	A term is a run of letters and digits (as classified by Unicode), folded to
+//	lowercase. Everything else separates terms.
+//
+//	Queries are words separated by spaces. All words must match unless they
+//	are separated by OR (which has lower precedence). A word ending in * matches
+//	all terms that start with it. We rank rows by the sum of tf-idf over the
+//	matching terms.
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(FIELD_SCORE,						"score")
+DECLARE_CONST_STRING(FIELD_TERM_COUNT,					"termCount")
+
+DECLARE_CONST_STRING(QUERY_AND,							"AND")
+DECLARE_CONST_STRING(QUERY_OR,							"OR")
+
+DECLARE_CONST_STRING(ERR_EMPTY_QUERY,					"Query has no terms to search for.")
+
+const int MAX_TERM_CHARS =								64;
+
+void CAeonTextIndex::AddTermCounts (const CString &sText, TSortMap<CString, int> *ioTerms)
+
+//	AddTermCounts
+//
+//	Adds the terms in the given text to ioTerms (incrementing the count of
+//	terms that are already there).
+
+	{
+	int i;
+
+	TArray<CString> Terms;
+	ParseTerms(sText, &Terms);
+
+	for (i = 0; i < Terms.GetCount(); i++)
+		{
+		bool bNew;
+		int *pCount = ioTerms->SetAt(Terms[i], &bNew);
+		*pCount = (bNew ? 1 : *pCount + 1);
+		}
+	}
+
+bool CAeonTextIndex::FindTerm (CRowIterator &Rows, const CTableDimensions &Dims, const STerm &Term, DWORDLONG dwTotalRows, TSortMap<SEQUENCENUMBER, SHit> *retHits, CString *retsError)
+
+//	FindTerm
+//
+//	Adds all rows that match the given term to retHits. For prefix terms we
+//	may match several terms, each of which has its own posting list.
+
+	{
+	retHits->DeleteAll();
+
+	//	Position at the first posting for the term (a partial key).
+
+	CRowKey StartKey;
+	if (!CRowKey::ParseKey(Dims, CDatum(Term.sTerm), &StartKey, retsError))
+		return false;
+
+	Rows.SelectKey(StartKey);
+
+	//	Read postings until we get to a different term
+
+	CString sCurTerm;
+	TArray<SEQUENCENUMBER> RowIDs;
+	TArray<CDatum> Data;
+	while (Rows.HasMore())
+		{
+		CRowKey Key;
+		CDatum dData;
+		SEQUENCENUMBER RowID;
+		Rows.GetNextRow(&Key, &dData, &RowID);
+
+		CString sKeyTerm = Key.AsDatum(Dims).GetElement(0);
+		if (Term.bPrefix ? !strStartsWith(sKeyTerm, Term.sTerm) : !strEquals(sKeyTerm, Term.sTerm))
+			break;
+
+		if (dData.IsNil())
+			continue;
+
+		//	Each term's postings are scored together (since the idf depends
+		//	on how many rows have the term).
+
+		if (!strEquals(sKeyTerm, sCurTerm))
+			{
+			ScorePostings(RowIDs, Data, dwTotalRows, retHits);
+			RowIDs.DeleteAll();
+			Data.DeleteAll();
+			sCurTerm = sKeyTerm;
+			}
+
+		RowIDs.Insert(RowID);
+		Data.Insert(dData);
+		}
+
+	ScorePostings(RowIDs, Data, dwTotalRows, retHits);
+	return true;
+	}
+
+bool CAeonTextIndex::ParseQuery (const CString &sQuery, TArray<SClause> *retQuery, CString *retsError)
+
+//	ParseQuery
+//
+//	Parses a query into clauses (any of which may match). Each clause is a list
+//	of terms (all of which must match).
+
+	{
+	int i, j;
+
+	retQuery->DeleteAll();
+	SClause *pClause = retQuery->Insert();
+
+	TArray<CString> Words;
+	strSplit(sQuery, CString(" "), &Words, -1, SSP_FLAG_NO_EMPTY_ITEMS);
+	for (i = 0; i < Words.GetCount(); i++)
+		{
+		const CString &sWord = Words[i];
+
+		if (strEquals(sWord, QUERY_OR))
+			{
+			if (pClause->Terms.GetCount() > 0)
+				pClause = retQuery->Insert();
+			continue;
+			}
+		else if (strEquals(sWord, QUERY_AND))
+			continue;
+
+		//	Words may have more than one term (e.g., "e-mail"); we require all
+		//	of them. Only the last term of a word can be a prefix.
+
+		bool bPrefix = (*(sWord.GetParsePointer() + sWord.GetLength() - 1) == '*');
+
+		TArray<CString> Terms;
+		ParseTerms(sWord, &Terms);
+
+		for (j = 0; j < Terms.GetCount(); j++)
+			{
+			STerm *pTerm = pClause->Terms.Insert();
+			pTerm->sTerm = Terms[j];
+			pTerm->bPrefix = (bPrefix && j == Terms.GetCount() - 1);
+			}
+		}
+
+	//	Remove a trailing empty clause
+
+	if (pClause->Terms.GetCount() == 0)
+		retQuery->Delete(retQuery->GetCount() - 1);
+
+	if (retQuery->GetCount() == 0)
+		{
+		*retsError = ERR_EMPTY_QUERY;
+		return false;
+		}
+
+	return true;
+	}
+
+void CAeonTextIndex::ParseTerms (const CString &sText, TArray<CString> *retTerms)
+
+//	ParseTerms
+//
+//	Splits the text into lowercase terms (in order, including duplicates). We
+//	truncate very long terms.
+
+	{
+	char *pPos = sText.GetParsePointer();
+	char *pPosEnd = pPos + sText.GetLength();
+
+	retTerms->DeleteAll();
+
+	CStringBuffer Term;
+	int iTermChars = 0;
+	while (pPos < pPosEnd)
+		{
+		UTF32 dwCodePoint = strParseUTF8Char(&pPos, pPosEnd);
+
+		if (strIsAlphaNumeric(dwCodePoint))
+			{
+			if (iTermChars < MAX_TERM_CHARS)
+				strEncodeUTF8Char(strToLowerChar(dwCodePoint), Term);
+
+			iTermChars++;
+			}
+		else if (iTermChars > 0)
+			{
+			retTerms->Insert(CString::CreateFromHandoff(Term));
+			Term.Seek(0);
+			iTermChars = 0;
+			}
+		}
+
+	if (iTermChars > 0)
+		retTerms->Insert(CString::CreateFromHandoff(Term));
+	}
+
+void CAeonTextIndex::ScorePostings (const TArray<SEQUENCENUMBER> &RowIDs, const TArray<CDatum> &Data, DWORDLONG dwTotalRows, TSortMap<SEQUENCENUMBER, SHit> *retHits)
+
+//	ScorePostings
+//
+//	Adds the postings for a single term to retHits. The score is tf-idf, where
+//	tf is dampened (1 + log(count)).
+
+	{
+	int i;
+
+	if (RowIDs.GetCount() == 0)
+		return;
+
+	double rTotal = Max((double)dwTotalRows, (double)RowIDs.GetCount());
+	double rIDF = log(1.0 + rTotal / (double)RowIDs.GetCount());
+
+	for (i = 0; i < RowIDs.GetCount(); i++)
+		{
+		int iCount = Max(1, (int)Data[i].GetElement(FIELD_TERM_COUNT));
+
+		SHit *pHit = retHits->SetAt(RowIDs[i]);
+		pHit->dData = Data[i];
+		pHit->rScore += (1.0 + log((double)iCount)) * rIDF;
+		}
+	}
+
+bool CAeonTextIndex::Search (CAeonViewSnapshot &Snapshot, const TArray<SClause> &Query, DWORDLONG dwTotalRows, int iMaxResults, CDatum *retdResult, CString *retsError)
+
+//	Search
+//
+//	Returns an array of matching rows (most relevant first). Each row has the
+//	view columns (by default, the primary key) plus its score. dwTotalRows is
+//	the number of rows in the table (for computing idf).
+
+	{
+	int i, j, k;
+
+	CRowIterator Rows;
+	Rows.SetIncludeNil(false);
+	if (!Snapshot.InitIterator(&Rows))
+		{
+		*retdResult = CDatum(new CComplexArray);
+		return true;
+		}
+
+	const CTableDimensions &Dims = Snapshot.GetDimensions();
+
+	//	A row matches if it matches any clause; its score is the sum over the
+	//	clauses that it matches.
+
+	TSortMap<SEQUENCENUMBER, SHit> Results;
+	for (i = 0; i < Query.GetCount(); i++)
+		{
+		const SClause &Clause = Query[i];
+
+		TSortMap<SEQUENCENUMBER, SHit> ClauseHits;
+		if (!FindTerm(Rows, Dims, Clause.Terms[0], dwTotalRows, &ClauseHits, retsError))
+			return false;
+
+		//	Intersect with the rest of the terms
+
+		for (j = 1; j < Clause.Terms.GetCount() && ClauseHits.GetCount() > 0; j++)
+			{
+			TSortMap<SEQUENCENUMBER, SHit> TermHits;
+			if (!FindTerm(Rows, Dims, Clause.Terms[j], dwTotalRows, &TermHits, retsError))
+				return false;
+
+			for (k = 0; k < ClauseHits.GetCount(); k++)
+				{
+				SHit *pHit = TermHits.GetAt(ClauseHits.GetKey(k));
+				if (pHit == NULL)
+					{
+					ClauseHits.Delete(k);
+					k--;
+					}
+				else
+					ClauseHits[k].rScore += pHit->rScore;
+				}
+			}
+
+		//	Add to results
+
+		for (j = 0; j < ClauseHits.GetCount(); j++)
+			{
+			bool bNew;
+			SHit *pHit = Results.SetAt(ClauseHits.GetKey(j), &bNew);
+			if (bNew)
+				*pHit = ClauseHits[j];
+			else
+				pHit->rScore += ClauseHits[j].rScore;
+			}
+		}
+
+	//	Rank
+
+	TSortMap<double, int> Ranked(DescendingSort);
+	for (i = 0; i < Results.GetCount(); i++)
+		Ranked.Insert(Results[i].rScore, i);
+
+	//	Return the top results (without the term count, which only applies to
+	//	one of the terms).
+
+	int iCount = (iMaxResults == -1 ? Ranked.GetCount() : Min(iMaxResults, Ranked.GetCount()));
+	CComplexArray *pResult = new CComplexArray;
+	for (i = 0; i < iCount; i++)
+		{
+		const SHit &Hit = Results[Ranked[i]];
+
+		CComplexStruct *pRow = new CComplexStruct;
+		for (j = 0; j < Hit.dData.GetCount(); j++)
+			{
+			const CString &sField = Hit.dData.GetKey(j);
+			if (!strEquals(sField, FIELD_TERM_COUNT))
+				pRow->SetElement(sField, Hit.dData.GetElement(j));
+			}
+
+		pRow->SetElement(FIELD_SCORE, CDatum(Hit.rScore));
+		pResult->Insert(CDatum(pRow));
+		}
+
+	*retdResult = CDatum(pResult);
+	return true;
+	}
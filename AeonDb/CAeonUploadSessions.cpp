@@ -66,11 +66,12 @@ int CAeonUploadSessions::CalcUploadCompletion (SUploadSessionCtx *pSession)
 	return 100 * (pSession->iUploadLen - iTotalNeeded) / pSession->iUploadLen;
 	}
 
-bool CAeonUploadSessions::CreateTempFile (CString *retsFilespec, CFileMultiplexer *retFile, CString *retsError)
+bool CAeonUploadSessions::CreateTempFile (CString *retsFilespec, CFileMultiplexer *retFile, bool *retbMirrorFailed, CString *retsError)
 
 //	CreateTempFile
 //
-//	Creates a temporary file for the upload
+//	Creates a temporary file for the upload. If we could not create the backup
+//	copy we still succeed, but we set retbMirrorFailed.
 
 	{
 	CString sFilespec;
@@ -98,8 +99,9 @@ bool CAeonUploadSessions::CreateTempFile (CString *retsFilespec, CFileMultiplexe
 
 		//	Create a backup file
 
-		if (!sBackupVolumePath.IsEmpty())
-			retFile->CreateMirror(fileAppend(sBackupVolumePath, sFilename));
+		if (!sBackupVolumePath.IsEmpty()
+				&& !retFile->CreateMirror(fileAppend(sBackupVolumePath, sFilename)))
+			*retbMirrorFailed = true;
 		}
 	while (!bSuccess && iTries < 20);
 
@@ -169,6 +171,17 @@ void CAeonUploadSessions::DeleteTempFile (SUploadSessionCtx *pSession)
 		}
 	}
 
+bool CAeonUploadSessions::HasSession (const CString &sSessionID)
+
+//	HasSession
+//
+//	Returns TRUE if we have an upload in progress with the given session ID.
+
+	{
+	CSmartLock Lock(m_cs);
+	return (m_Sessions.GetAt(sSessionID) != NULL);
+	}
+
 void CAeonUploadSessions::Mark (void)
 
 //	Mark
@@ -214,6 +227,8 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 	CSmartLock Lock(m_cs);
 	int i;
 
+	retReceipt->bBackupFailed = false;
+
 	//	Sometimes we have to copy data from the existing file
 
 	CFile CurrentFile;
@@ -232,6 +247,7 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 	CString sTempFilespec;
 	int iTempFileOffset = 0;
 	int iUploadPos = 0;
+	int iPreallocate = 0;
 
 	if (!m_Sessions.Find(sSessionID, &pSession))
 		{
@@ -309,9 +325,7 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 				{
 				CString sFilespec = m_pStorage->MachineToCanonicalRelative(sTempFilespec);
 				if (!TempFile.CreateMirror(m_pStorage->CanonicalRelativeToMachine(m_sBackupVolume, sFilespec)))
-					{
-					//	LATER: Log error
-					}
+					retReceipt->bBackupFailed = true;
 				}
 			}
 
@@ -322,7 +336,7 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 			{
 			//	Create a temporary file to store the upload
 
-			if (!CreateTempFile(&sTempFilespec, &TempFile, &retReceipt->sError))
+			if (!CreateTempFile(&sTempFilespec, &TempFile, &retReceipt->bBackupFailed, &retReceipt->sError))
 				{
 				delete pSession;
 				retReceipt->iComplete = 0;
@@ -367,6 +381,7 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 			//	Compute size
 
 			pSession->iTempFileSize = Max(iCurrentFileLen, iUploadPos + pSession->iUploadLen);
+			iPreallocate = pSession->iTempFileSize;
 			}
 
 		//	Otherwise, we just create a temp file
@@ -375,7 +390,7 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 			{
 			//	Create a temporary file to store the upload
 
-			if (!CreateTempFile(&sTempFilespec, &TempFile, &retReceipt->sError))
+			if (!CreateTempFile(&sTempFilespec, &TempFile, &retReceipt->bBackupFailed, &retReceipt->sError))
 				{
 				delete pSession;
 				retReceipt->iComplete = 0;
@@ -391,6 +406,7 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 			//	The size of the final file is the same as the total upload size
 
 			pSession->iTempFileSize = pSession->iUploadLen;
+			iPreallocate = pSession->iTempFileSize;
 			}
 
 		//	Add the session to our map
@@ -418,9 +434,7 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 			{
 			CString sFilespec = m_pStorage->MachineToCanonicalRelative(sTempFilespec);
 			if (!TempFile.CreateMirror(m_pStorage->CanonicalRelativeToMachine(m_sBackupVolume, sFilespec)))
-				{
-				//	LATER: Log error
-				}
+				retReceipt->bBackupFailed = true;
 			}
 		}
 
@@ -446,6 +460,13 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 
         CMsgProcessKeepAlive KeepAlive(Ctx);
 
+		//	If we just created the temp file, allocate the whole thing now so
+		//	that the file doesn't grow (and fragment) with each partial, and so
+		//	that we find out now if the disk is full.
+
+		if (iPreallocate > 0 && !TempFile.SetLength(iPreallocate))
+			throw CException(errFail);
+
 		//	Copy from the original, if necessary
 
 		for (i = 0; i < 2; i++)
@@ -456,16 +477,27 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 				CurrentFile.Seek(CopySeg[i]);
 				CurrentFile.Read(pBuffer, CopySegLen[i]);
 
-				TempFile.Seek(CopySeg[i]);
-				TempFile.Write(pBuffer, CopySegLen[i]);
+				TempFile.WriteAt(CopySeg[i], pBuffer, CopySegLen[i]);
 
 				delete [] pBuffer;
 				}
 
-		//	Copy the uploaded data
+		//	Copy the uploaded data. Usually the data is in a memory block (the
+		//	message buffer) so we write it directly to its position in the
+		//	file (and the backup, in parallel). Large messages may be stored
+		//	in a file instead, and we have to stream those.
+
+		if (dData.IsMemoryBlock())
+			{
+			const CString &sData = dData;
+			TempFile.WriteAt(iTempFileOffset + iPartialPos, sData.GetPointer(), sData.GetLength());
+			}
+		else
+			{
+			TempFile.Seek(iTempFileOffset + iPartialPos);
+			dData.WriteBinaryToStream(TempFile, 0, -1, &KeepAlive);
+			}
 
-		TempFile.Seek(iTempFileOffset + iPartialPos);
-		dData.WriteBinaryToStream(TempFile, 0, -1, &KeepAlive);
 		bSuccess = true;
 		}
 	catch (...)
@@ -473,6 +505,12 @@ bool CAeonUploadSessions::ProcessUpload (CMsgProcessCtx &Ctx,
 		bSuccess = false;
 		}
 
+	//	Mirror failures don't fail the upload, but the caller needs to know
+	//	that the backup is out of date.
+
+	if (TempFile.MirrorFailed())
+		retReceipt->bBackupFailed = true;
+
 	//	After writing we need to reacquire the lock and look up session
 	//	again (since it could have been trashed).
 
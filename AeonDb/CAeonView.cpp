@@ -5,43 +5,67 @@
 
 #include "stdafx.h"
 
-const int MIN_SEGMENTS_TO_MERGE =						3;		//	Merge if we have at least this many segments
-const DWORDLONG SMALL_MERGE_SIZE =						10000000;	//	10 MB is considered a small merge
-const double MIN_MERGE_RATIO =							0.8;
-const double MAX_MERGE_RATIO =							1.25;
-
 DECLARE_CONST_STRING(STR_ERROR_KEY,						"(Cannot evaluate key function)")
 DECLARE_CONST_STRING(STR_EMPTY_KEY,						"(nil)")
 DECLARE_CONST_STRING(STR_ALL_COLUMNS,					"*")
 
+DECLARE_CONST_STRING(AGGREGATE_COUNT,					"count")
+DECLARE_CONST_STRING(AGGREGATE_MAX,						"max")
+DECLARE_CONST_STRING(AGGREGATE_MIN,						"min")
+DECLARE_CONST_STRING(AGGREGATE_SUM,						"sum")
+
+DECLARE_CONST_STRING(FIELD_AGGREGATES,					"aggregates")
+DECLARE_CONST_STRING(FIELD_BYTES_COMPACTED,				"bytesCompacted")
+DECLARE_CONST_STRING(FIELD_BYTES_FLUSHED,				"bytesFlushed")
 DECLARE_CONST_STRING(FIELD_COLUMNS,						"columns")
 DECLARE_CONST_STRING(FIELD_COMPUTED_COLUMNS,			"computedColumns")
+DECLARE_CONST_STRING(FIELD_COUNT,						"count")
 DECLARE_CONST_STRING(FIELD_ERROR,						"error")
 DECLARE_CONST_STRING(FIELD_EXCLUDE_NIL_KEYS,			"excludeNilKeys")
+DECLARE_CONST_STRING(FIELD_FIELDS,						"fields")
 DECLARE_CONST_STRING(FIELD_GLOBAL_ENV,					"globalEnv")
 DECLARE_CONST_STRING(FIELD_ID,							"id")
 DECLARE_CONST_STRING(FIELD_NAME,						"name")
+DECLARE_CONST_STRING(FIELD_LOOKUPS,						"lookups")
 DECLARE_CONST_STRING(FIELD_PRIMARY_KEY,					"primaryKey")
+DECLARE_CONST_STRING(FIELD_READ_AMPLIFICATION,			"readAmplification")
 DECLARE_CONST_STRING(FIELD_RECOVERY_FILESPEC,			"recoveryFilespec")
 DECLARE_CONST_STRING(FIELD_SEGMENTS,					"segments")
+DECLARE_CONST_STRING(FIELD_TERM_COUNT,					"termCount")
+DECLARE_CONST_STRING(FIELD_TYPE,						"type")
 DECLARE_CONST_STRING(FIELD_UPDATE_NEEDED,				"updateNeeded")
+DECLARE_CONST_STRING(FIELD_WRITE_AMPLIFICATION,			"writeAmplification")
 DECLARE_CONST_STRING(FIELD_X,							"x")
 DECLARE_CONST_STRING(FIELD_Y,							"y")
 DECLARE_CONST_STRING(FIELD_Z,							"z")
 
 DECLARE_CONST_STRING(TYPENAME_HEXE_FUNCTION,			"hexeFunction")
 
+DECLARE_CONST_STRING(VIEW_TYPE_AGGREGATE,				"aggregate")
+DECLARE_CONST_STRING(VIEW_TYPE_FULL_TEXT,				"fullText")
+
+DECLARE_CONST_STRING(ERR_AGGREGATE_FIELD_REQUIRED,		"Aggregate column %s requires a field.")
 DECLARE_CONST_STRING(ERR_COMPUTED_COLUMN,				"Cannot evaluate computed column function.")
 DECLARE_CONST_STRING(ERR_DIMENSIONS_REQUIRED,			"Cannot create a table without dimensions.")
 DECLARE_CONST_STRING(ERR_PRIMARY_KEY_CANT_BE_LIST,		"List-type keys not supported for primary views.")
 DECLARE_CONST_STRING(ERR_INVALID_PATH,					"Path does not have the correct number of dimensions.")
+DECLARE_CONST_STRING(ERR_TEXT_FIELDS_REQUIRED,			"Full-text view requires a list of fields to index.")
+DECLARE_CONST_STRING(ERR_UNKNOWN_AGGREGATE,				"Unknown aggregate function: %s.")
+DECLARE_CONST_STRING(ERR_UNKNOWN_VIEW_TYPE,				"Unknown view type: %s.")
 
 CAeonView::CAeonView (void) : m_pRows(NULL),
 		m_Segments(DescendingSort),
+		m_dwRecoveryResets(0),
 		m_bInvalid(false),
 		m_bExcludeNil(false),
 		m_bUsesListKeys(false),
-		m_bUpdateNeeded(false)
+		m_bFullText(false),
+		m_bAggregate(false),
+		m_bUpdateNeeded(false),
+		m_dwBytesFlushed(0),
+		m_dwBytesCompacted(0),
+		m_dwLookups(0),
+		m_dwLookupProbes(0)
 
 //	CAeonView constructor
 
@@ -56,6 +80,29 @@ CAeonView::~CAeonView (void)
 	CleanUp();
 	}
 
+void CAeonView::AddToAggregates (CHexeProcess &Process, CDatum dFullData, TSortMap<CString, CDatum> *ioGroups)
+
+//	AddToAggregates
+//
+//	Adds the given primary row to the groups that it belongs to. This is used
+//	when building the view from scratch; ioGroups is indexed by encoded key.
+
+	{
+	int i;
+
+	dFullData = ComputeColumns(Process, dFullData);
+
+	TArray<CRowKey> Keys;
+	if (!CreateSecondaryKeys(Process, dFullData, 0, &Keys))
+		return;
+
+	for (i = 0; i < Keys.GetCount(); i++)
+		{
+		CDatum *pGroup = ioGroups->SetAt(Keys[i].AsEncodedString());
+		*pGroup = UpdateAggregateRow(*pGroup, dFullData, 1);
+		}
+	}
+
 bool CAeonView::CanInsert (const CRowKey &Path, CDatum dData, CString *retsError)
 
 //	CanInsert
@@ -206,10 +253,22 @@ void CAeonView::Copy (const CAeonView &Src)
 	m_Keys = Src.m_Keys;
 	m_Columns = Src.m_Columns;
 	m_ComputedColumns = Src.m_ComputedColumns;
+	m_dwRecoveryResets = Src.m_dwRecoveryResets;
 	m_bInvalid = Src.m_bInvalid;
+	m_Expiration = Src.m_Expiration;
+	m_RangeDeletes = Src.m_RangeDeletes;
 	m_bExcludeNil = Src.m_bExcludeNil;
 	m_bUsesListKeys = Src.m_bUsesListKeys;
+	m_bFullText = Src.m_bFullText;
+	m_TextFields = Src.m_TextFields;
+	m_bAggregate = Src.m_bAggregate;
+	m_Aggregates = Src.m_Aggregates;
 	m_bUpdateNeeded = Src.m_bUpdateNeeded;
+
+	m_dwBytesFlushed = Src.m_dwBytesFlushed;
+	m_dwBytesCompacted = Src.m_dwBytesCompacted;
+	m_dwLookups = Src.m_dwLookups;
+	m_dwLookupProbes = Src.m_dwLookupProbes;
 	}
 
 void CAeonView::CreatePermutedKeys (const TArray<CDatum> &KeyData, int iDim, const TArray<CDatum> &PrevKey, SEQUENCENUMBER RowID, TArray<CRowKey> *retKeys)
@@ -333,6 +392,17 @@ void CAeonView::CreateSecondaryData (const CTableDimensions &PrimaryDims, const
 			}
 		}
 
+	//	If rows expire, we need the field that tells us when, so that our row
+	//	expires along with the primary row. (If the field is not one of our
+	//	columns, readers don't see it; see SetExpiration.)
+
+	if (m_Expiration.IsEnabled())
+		{
+		CDatum dTime = dFullData.GetElement(m_Expiration.GetField());
+		if (!dTime.IsNil())
+			pData->SetElement(m_Expiration.GetField(), dTime);
+		}
+
 	//	Done
 
 	*retdData = CDatum(pData);
@@ -349,6 +419,14 @@ bool CAeonView::CreateSecondaryKeys (CHexeProcess &Process, CDatum dData, SEQUEN
 	int i;
 	bool bAllValid = true;
 
+	//	Full-text views have a key for each term
+
+	if (m_bFullText)
+		{
+		CreateTextKeys(dData, RowID, retKeys);
+		return true;
+		}
+
 	//	Pull the dimensions from the data
 
 	TArray<CDatum> KeyData;
@@ -425,6 +503,23 @@ bool CAeonView::CreateSecondaryKeys (CHexeProcess &Process, CDatum dData, SEQUEN
 	return bAllValid;
 	}
 
+void CAeonView::CreateAggregateRows (const TSortMap<CString, CDatum> &Groups, CAeonRowArray *Rows)
+
+//	CreateAggregateRows
+//
+//	Adds the groups built by AddToAggregates to the given rows.
+
+	{
+	int i;
+
+	for (i = 0; i < Groups.GetCount(); i++)
+		{
+		CRowKey Key;
+		CRowKey::CreateFromEncodedKey(m_Dims, Groups.GetKey(i), &Key);
+		Rows->Insert(Key, Groups[i], 0);
+		}
+	}
+
 bool CAeonView::CreateSecondaryRows (const CTableDimensions &PrimaryDims, CHexeProcess &Process, const CRowKey &PrimaryKey, CDatum dFullData, SEQUENCENUMBER RowID, CAeonRowArray *Rows)
 
 //	CreateSecondaryRow
@@ -439,19 +534,65 @@ bool CAeonView::CreateSecondaryRows (const CTableDimensions &PrimaryDims, CHexeP
 
 	dFullData = ComputeColumns(Process, dFullData);
 
-	//	Create keys
+	//	Create keys and data
 
 	TArray<CRowKey> Keys;
-	if (!CreateSecondaryKeys(Process, dFullData, RowID, &Keys))
+	TArray<CDatum> Data;
+	if (!CreateSecondaryRowData(PrimaryDims, Process, PrimaryKey, dFullData, RowID, &Keys, &Data))
 		return false;
 
-	//	Create row data
+	for (i = 0; i < Keys.GetCount(); i++)
+		Rows->Insert(Keys[i], Data[i], RowID);
+
+	return true;
+	}
+
+bool CAeonView::CreateSecondaryRowData (const CTableDimensions &PrimaryDims, CHexeProcess &Process, const CRowKey &PrimaryKey, CDatum dFullData, SEQUENCENUMBER RowID, TArray<CRowKey> *retKeys, TArray<CDatum> *retData)
+
+//	CreateSecondaryRowData
+//
+//	Returns the keys and data for all the secondary view rows of the given
+//	primary row (which must already have computed columns). Returns FALSE if
+//	the row is excluded from the view.
+
+	{
+	int i;
+
+	retData->DeleteAll();
+
+	//	For full-text views, each term gets its own row, with the number of
+	//	times that the term appears in the primary row.
+
+	if (m_bFullText)
+		{
+		TArray<int> Counts;
+		CreateTextKeys(dFullData, RowID, retKeys, &Counts);
+
+		CDatum dRowData;
+		CreateSecondaryData(PrimaryDims, PrimaryKey, dFullData, RowID, &dRowData);
+
+		retData->GrowToFit(retKeys->GetCount());
+		for (i = 0; i < retKeys->GetCount(); i++)
+			{
+			CComplexStruct *pPosting = new CComplexStruct(dRowData);
+			pPosting->SetElement(FIELD_TERM_COUNT, CDatum(Counts[i]));
+			retData->Insert(CDatum(pPosting));
+			}
+
+		return true;
+		}
+
+	//	Otherwise, all keys share the same data
+
+	if (!CreateSecondaryKeys(Process, dFullData, RowID, retKeys))
+		return false;
 
 	CDatum dRowData;
 	CreateSecondaryData(PrimaryDims, PrimaryKey, dFullData, RowID, &dRowData);
 
-	for (i = 0; i < Keys.GetCount(); i++)
-		Rows->Insert(Keys[i], dRowData, RowID);
+	retData->GrowToFit(retKeys->GetCount());
+	for (i = 0; i < retKeys->GetCount(); i++)
+		retData->Insert(dRowData);
 
 	return true;
 	}
@@ -478,13 +619,22 @@ bool CAeonView::CreateSegment (const CString &sFilespec, SEQUENCENUMBER Seq, IOr
 	dwSegFlags |= (HasRowID() ? CAeonSegment::FLAG_HAS_ROW_ID : 0);
 	dwSegFlags |= (IsSecondaryView() ? CAeonSegment::FLAG_SECONDARY_VIEW : 0);
 
+	//	Range deletes in the rows are saved with them (so that they keep
+	//	covering older segments after we reset the recovery file).
+
+	CAeonRangeDeletes RangeDeletes;
+	if (pRows == NULL)
+		m_pRows->GetRangeDeletes(&RangeDeletes);
+
 	CAeonSegment *pNewSeg = new CAeonSegment;
-	if (!pNewSeg->Create(GetID(), m_Dims, Seq, Rows, sFilespec, dwSegFlags, retsError))
+	if (!pNewSeg->Create(GetID(), m_Dims, Seq, Rows, sFilespec, dwSegFlags, retsError, NULL, &RangeDeletes))
 		{
 		pNewSeg->Release();
 		return false;
 		}
 
+	m_dwBytesFlushed += pNewSeg->GetFileSize();
+
 	//	Done
 
 	*retpNewSeg = pNewSeg;
@@ -492,6 +642,53 @@ bool CAeonView::CreateSegment (const CString &sFilespec, SEQUENCENUMBER Seq, IOr
 	return true;
 	}
 
+void CAeonView::CreateTextKeys (CDatum dData, SEQUENCENUMBER RowID, TArray<CRowKey> *retKeys, TArray<int> *retCounts)
+
+//	CreateTextKeys
+//
+//	Creates a key for each distinct term in the indexed fields of the row. If
+//	retCounts is not NULL, we return the number of times each term appears.
+
+	{
+	int i, j;
+
+	TSortMap<CString, int> Terms;
+	for (i = 0; i < m_TextFields.GetCount(); i++)
+		{
+		CDatum dValue = dData.GetElement(m_TextFields[i]);
+
+		//	Lists (e.g., tags) are indexed element by element
+
+		if (dValue.GetBasicType() == CDatum::typeArray)
+			{
+			for (j = 0; j < dValue.GetCount(); j++)
+				CAeonTextIndex::AddTermCounts(dValue.GetElement(j).AsString(), &Terms);
+			}
+		else if (!dValue.IsNil())
+			CAeonTextIndex::AddTermCounts(dValue.AsString(), &Terms);
+		}
+
+	retKeys->DeleteAll();
+	retKeys->GrowToFit(Terms.GetCount());
+	if (retCounts)
+		{
+		retCounts->DeleteAll();
+		retCounts->GrowToFit(Terms.GetCount());
+		}
+
+	for (i = 0; i < Terms.GetCount(); i++)
+		{
+		TArray<CDatum> KeyData;
+		KeyData.Insert(CDatum(Terms.GetKey(i)));
+
+		CRowKey *pNewKey = retKeys->Insert();
+		CRowKey::CreateFromDatumAndRowID(m_Dims, KeyData, RowID, pNewKey);
+
+		if (retCounts)
+			retCounts->Insert(Terms[i]);
+		}
+	}
+
 CDatum CAeonView::DebugDump (void) const
 
 //	DebugDump
@@ -511,51 +708,96 @@ CDatum CAeonView::DebugDump (void) const
 
 	pData->SetElement(FIELD_SEGMENTS, CDatum(pSegments));
 
+	//	Statistics. Write amplification is the total bytes written to segments
+	//	per byte flushed from memory; read amplification is the average number
+	//	of row sets that we search for each lookup.
+
+	pData->SetElement(FIELD_BYTES_FLUSHED, CDatum(m_dwBytesFlushed));
+	pData->SetElement(FIELD_BYTES_COMPACTED, CDatum(m_dwBytesCompacted));
+	if (m_dwBytesFlushed > 0)
+		pData->SetElement(FIELD_WRITE_AMPLIFICATION, CDatum((double)(m_dwBytesFlushed + m_dwBytesCompacted) / (double)m_dwBytesFlushed));
+
+	pData->SetElement(FIELD_LOOKUPS, CDatum(m_dwLookups));
+	if (m_dwLookups > 0)
+		pData->SetElement(FIELD_READ_AMPLIFICATION, CDatum((double)m_dwLookupProbes / (double)m_dwLookups));
+
 	return CDatum(pData);
 	}
 
-bool CAeonView::GetData (const CRowKey &Path, CDatum *retData, SEQUENCENUMBER *retRowID, CString *retsError)
+void CAeonView::DeleteRange (const CRowKey &From, const CRowKey &To, SEQUENCENUMBER Seq, bool *retbRecoveryFailed, CString *retsError)
 
-//	GetData
+//	DeleteRange
 //
-//	Returns data for the given key
+//	Deletes the rows under a key prefix (or in a key range) that were written
+//	before now. We log the range delete and add it to the in-memory rows, which
+//	cover their own rows; when we save, it goes in the segment with them.
+//
+//	NOTE: If the recovery file predates range deletes, callers must save the
+//	rows first (see CanLogRangeDeletes).
 
 	{
-	int i;
+	*retbRecoveryFailed = false;
 
-	//	If dimensions don't match, then we have an error
+	//	If an older recovery file has no rows, we can start it over at the
+	//	current version.
 
-	if (!Path.MatchesDimensions(m_Dims))
-		{
-		*retsError = ERR_INVALID_PATH;
-		return false;
-		}
+	if (!m_Recovery.CanInsertRangeDelete() && !HasUnsavedRows())
+		m_Recovery.Reset();
 
-	//	First look for the value in the in-memory rows
+	m_pRows->DeleteRange(From, To, Seq);
+	m_RangeDeletes.Add(m_Dims, From, To, Seq);
 
-	if (m_pRows->FindData(Path, retData, retRowID))
-		return true;
+	if (!m_Recovery.InsertRangeDelete(From, To, Seq, retsError))
+		*retbRecoveryFailed = true;
+	}
 
-	//	Otherwise, look in the segments
+CDatum CAeonView::FindAggregateRow (const CRowKey &Key)
+
+//	FindAggregateRow
+//
+//	Returns the current row for the given group (or Nil if the group is empty).
+//	Must be called inside the table lock.
+
+	{
+	int i;
+
+	CDatum dData;
+	if (m_pRows->FindData(Key, &dData))
+		return dData;
+
+	//	Segments are ordered from most recent to least recent
 
 	for (i = 0; i < m_Segments.GetCount(); i++)
-		if (m_Segments[i]->FindData(Path, retData, retRowID))
-			return true;
+		if (m_Segments[i]->FindData(Key, &dData))
+			return dData;
 
-	//	Otherwise, we succeed, but the value is not found
+	return CDatum();
+	}
 
-	*retData = CDatum();
-	if (retRowID)
-		*retRowID = 0;
+DWORDLONG CAeonView::GetSegmentRowCount (void) const
 
-	return true;
+//	GetSegmentRowCount
+//
+//	Returns the total number of rows in all segments. Rows that appear in more
+//	than one segment are counted more than once.
+
+	{
+	int i;
+
+	DWORDLONG dwTotal = 0;
+	for (i = 0; i < m_Segments.GetCount(); i++)
+		dwTotal += m_Segments[i]->GetCount();
+
+	return dwTotal;
 	}
 
-bool CAeonView::GetSegmentsToMerge (CAeonSegment **retpSeg1, CAeonSegment **retpSeg2)
+bool CAeonView::GetSegmentsToMerge (const ICompactionPolicy &Policy, TArray<CAeonSegment *> *retSegs, bool *retbIncludesOldest)
 
 //	GetSegmentsToMerge
 //
-//	Returns two segments to merge (or FALSE if no merge is needed).
+//	Asks the policy for a run of segments to merge. Returns FALSE if no merge is
+//	needed. Otherwise, retSegs has the segments from newest to oldest and
+//	retbIncludesOldest is TRUE if the run ends with the view's oldest segment.
 
 	{
 	int i;
@@ -566,58 +808,107 @@ bool CAeonView::GetSegmentsToMerge (CAeonSegment **retpSeg1, CAeonSegment **retp
 	if (iSegCount < 2)
 		return false;
 
-	//	Pick two segments to merge. Find two segments of about the same,
-	//	starting with the last two segments (i.e., oldest).
+	TArray<DWORDLONG> SegSizes;
+	SegSizes.InsertEmpty(iSegCount);
+	for (i = 0; i < iSegCount; i++)
+		SegSizes[i] = m_Segments[i]->GetFileSize();
 
-	CAeonSegment *pSeg1 = NULL;
-	CAeonSegment *pSeg2 = NULL;
+	//	We don't currently handle files larger than a gigabyte.
 
-	for (i = iSegCount - 2; i >= 0; i--)
-		{
-		DWORDLONG dwSeg1Size = m_Segments[i]->GetFileSize();
-		DWORDLONG dwSeg2Size = m_Segments[i + 1]->GetFileSize();
+	int iStart;
+	int iCount;
+	if (!Policy.SelectSegments(SegSizes, GIGABYTE_DISK, &iStart, &iCount)
+			|| iCount < 2
+			|| iStart < 0
+			|| iStart + iCount > iSegCount)
+		return false;
 
-		//	If the combined file if greater than a gigabyte, then skip because
-		//	we don't currently handle files that size.
+	//	Done
 
-		if (dwSeg1Size + dwSeg2Size > GIGABYTE_DISK)
-			continue;
+	retSegs->DeleteAll();
+	for (i = iStart; i < iStart + iCount; i++)
+		retSegs->Insert(m_Segments[i]);
 
-		//	Compute the ratio of segment 1 to segment 2
+	if (retbIncludesOldest)
+		*retbIncludesOldest = (iStart + iCount == iSegCount);
 
-		double rRatio = (double)dwSeg1Size / (double)dwSeg2Size;
+	return true;
+	}
 
-		//	If the final segment size is pretty small or if both are about the
-		//	same size, then pick this pair.
+void CAeonView::GetSplitKeys (int iParts, TArray<CRowKey> *retKeys) const
 
-		if ((dwSeg1Size + dwSeg2Size <= SMALL_MERGE_SIZE)
-				|| (rRatio >= MIN_MERGE_RATIO && rRatio <= MAX_MERGE_RATIO))
-			{
-			pSeg1 = m_Segments[i];
-			pSeg2 = m_Segments[i + 1];
-			break;
-			}
-		}
+//	GetSplitKeys
+//
+//	Returns up to iParts - 1 keys that divide the view into ranges of roughly
+//	equal size. We sample the largest segment, which is a good approximation
+//	of the key distribution (and we don't need to read any rows).
+
+	{
+	int i;
+
+	retKeys->DeleteAll();
+
+	CAeonSegment *pLargest = NULL;
+	for (i = 0; i < m_Segments.GetCount(); i++)
+		if (pLargest == NULL || m_Segments[i]->GetCount() > pLargest->GetCount())
+			pLargest = m_Segments[i];
+
+	if (pLargest == NULL || pLargest->GetCount() < iParts)
+		return;
 
-	//	If we did not find segments to merge and if we've got more than the
-	//	maximum number of segments, merge the first two.
+	for (i = 1; i < iParts; i++)
+		CRowKey::CreateFromEncodedKey(m_Dims, pLargest->GetKey(i * pLargest->GetCount() / iParts), retKeys->Insert());
+	}
+
+bool CAeonView::InitAsAggregateView (CDatum dDesc, CString *retsError)
+
+//	InitAsAggregateView
+//
+//	Parses the aggregate columns of the view. Each column is of the form:
+//
+//	name:(count [field])
+//	name:(sum field)
+//	name:(min field)
+//	name:(max field)
+//
+//	The group keys are the x, y, and z dimensions (as for other secondary
+//	views) and every row also has a count of rows in the group.
 
-	if (pSeg1 == NULL || pSeg2 == NULL)
+	{
+	int i;
+
+	CDatum dAggregates = dDesc.GetElement(FIELD_AGGREGATES);
+	for (i = 0; i < dAggregates.GetCount(); i++)
 		{
-		if (iSegCount >= MIN_SEGMENTS_TO_MERGE)
+		CDatum dColDesc = dAggregates.GetElement(i);
+		const CString &sOp = dColDesc.GetElement(0);
+
+		SAggregateColumn *pCol = m_Aggregates.Insert();
+		pCol->sName = dAggregates.GetKey(i);
+		pCol->sField = dColDesc.GetElement(1);
+
+		if (strEquals(sOp, AGGREGATE_COUNT))
+			pCol->iOp = aggCount;
+		else if (strEquals(sOp, AGGREGATE_SUM))
+			pCol->iOp = aggSum;
+		else if (strEquals(sOp, AGGREGATE_MIN))
+			pCol->iOp = aggMin;
+		else if (strEquals(sOp, AGGREGATE_MAX))
+			pCol->iOp = aggMax;
+		else
 			{
-			pSeg1 = m_Segments[0];
-			pSeg2 = m_Segments[1];
+			*retsError = strPattern(ERR_UNKNOWN_AGGREGATE, sOp);
+			return false;
 			}
-		else
+
+		if (pCol->sField.IsEmpty() && pCol->iOp != aggCount)
+			{
+			*retsError = strPattern(ERR_AGGREGATE_FIELD_REQUIRED, pCol->sName);
 			return false;
+			}
 		}
 
-	//	Done
-
-	*retpSeg1 = pSeg1;
-	*retpSeg2 = pSeg2;
-
+	m_bAggregate = true;
 	return true;
 	}
 
@@ -640,6 +931,39 @@ bool CAeonView::InitAsFileView (const CString &sRecoveryFilespec, int *retiRowsR
 	return true;
 	}
 
+bool CAeonView::InitAsFullTextView (CDatum dDesc, CString *retsError)
+
+//	InitAsFullTextView
+//
+//	Initializes the dimensions of a full-text view. The view is keyed by term
+//	and then by rowID (so each term has a posting list of rows).
+
+	{
+	int i;
+
+	CDatum dFields = dDesc.GetElement(FIELD_FIELDS);
+	for (i = 0; i < dFields.GetCount(); i++)
+		{
+		const CString &sField = dFields.GetElement(i);
+		if (!sField.IsEmpty())
+			m_TextFields.Insert(sField);
+		}
+
+	if (m_TextFields.GetCount() == 0)
+		{
+		*retsError = ERR_TEXT_FIELDS_REQUIRED;
+		return false;
+		}
+
+	m_bFullText = true;
+
+	SDimensionDesc *pDimDesc = m_Dims.Insert();
+	pDimDesc->iKeyType = keyUTF8;
+	pDimDesc->iSort = AscendingSort;
+
+	return true;
+	}
+
 bool CAeonView::InitAsPrimaryView (CDatum dDesc, const CString &sRecoveryFilespec, int *retiRowsRecovered, CString *retsError)
 
 //	InitAsPrimaryView
@@ -725,10 +1049,28 @@ bool CAeonView::InitAsSecondaryView (CDatum dDesc, CHexeProcess &Process, const
 
 	m_bUsesListKeys = false;
 
-	//	Parse the x dimension
+	//	Full-text views have their own dimensions
 
+	const CString &sType = dDesc.GetElement(FIELD_TYPE);
 	CDatum dimDesc = dDesc.GetElement(FIELD_X);
-	if (!dimDesc.IsNil())
+	if (strEquals(sType, VIEW_TYPE_FULL_TEXT))
+		{
+		if (!InitAsFullTextView(dDesc, retsError))
+			{
+			m_bInvalid = true;
+			return false;
+			}
+		}
+	else if (!sType.IsEmpty() && !strEquals(sType, VIEW_TYPE_AGGREGATE))
+		{
+		*retsError = strPattern(ERR_UNKNOWN_VIEW_TYPE, sType);
+		m_bInvalid = true;
+		return false;
+		}
+
+	//	Parse the x dimension
+
+	else if (!dimDesc.IsNil())
 		{
 		SDimensionDesc *pDimDesc = m_Dims.Insert();
 		CDatum *pKey = m_Keys.Insert();
@@ -785,9 +1127,18 @@ bool CAeonView::InitAsSecondaryView (CDatum dDesc, CHexeProcess &Process, const
 		return false;
 		}
 
+	//	Aggregate views also need the columns to compute
+
+	if (strEquals(sType, VIEW_TYPE_AGGREGATE) && !InitAsAggregateView(dDesc, retsError))
+		{
+		m_bInvalid = true;
+		return false;
+		}
+
 	//	Secondary views always have an extra dimension. We use the rowID as a
 	//	way to break ties in the other parts of the key (since secondary keys
-	//	need not be unique).
+	//	need not be unique). Aggregate views always use 0 so that each group
+	//	has a single row.
 
 	SDimensionDesc *pDimDesc = m_Dims.Insert();
 	pDimDesc->iKeyType = keyInt64;
@@ -849,6 +1200,9 @@ bool CAeonView::InitIterator (CRowIterator *retIterator, DWORD dwFlags)
 	if (!retIterator->Init(m_Dims))
 		return false;
 
+	retIterator->SetExpiration(m_Expiration);
+	retIterator->SetRangeDeletes(m_RangeDeletes);
+
 	//	Add the rows first because they are the latest
 
 	if (m_pRows->GetCount() > 0 && !(dwFlags & FLAG_EXCLUDE_MEMORY_ROWS))
@@ -880,11 +1234,12 @@ bool CAeonView::InitRows (const CString &sRecoveryFilespec, int *retiRowsRecover
 	return LoadRecoveryFile(sRecoveryFilespec, &m_pRows, retiRowsRecovered, retsError);
 	}
 
-void CAeonView::Insert (const CTableDimensions &PrimaryDims, CHexeProcess &Process, const CRowKey &PrimaryKey, CDatum dData, CDatum dOldData, SEQUENCENUMBER RowID, bool *retbRecoveryFailed, CString *retsError)
+void CAeonView::Insert (CAeonView &PrimaryView, CHexeProcess &Process, const CRowKey &PrimaryKey, CDatum dData, CDatum dOldData, SEQUENCENUMBER RowID, bool *retbRecoveryFailed, CString *retsError)
 
 //	Insert
 //
-//	Insert a row
+//	Insert a row. Callers insert into the primary view first, so secondary
+//	views may read the primary view's new state.
 //
 //	NOTE: We cannot fail here because callers should have called CanInsert
 //	(above).
@@ -893,6 +1248,7 @@ void CAeonView::Insert (const CTableDimensions &PrimaryDims, CHexeProcess &Proce
 	int i;
 	CString sError;
 	*retbRecoveryFailed = false;
+	const CTableDimensions &PrimaryDims = PrimaryView.GetDimensions();
 
 	//	If this is a primary view then all we have to do is insert the row
 
@@ -913,6 +1269,14 @@ void CAeonView::Insert (const CTableDimensions &PrimaryDims, CHexeProcess &Proce
 		if (!IsUpToDate())
 			return;
 
+		//	Aggregate views update the groups in place
+
+		if (m_bAggregate)
+			{
+			InsertAggregate(PrimaryView, Process, dData, dOldData, RowID, retbRecoveryFailed, retsError);
+			return;
+			}
+
 		//	If we are updating an existing row, then we need to remove the old
 		//	value. Note that it is OK if OldKey and NewKey end up being the
 		//	same; we just end up overwriting it.
@@ -944,23 +1308,17 @@ void CAeonView::Insert (const CTableDimensions &PrimaryDims, CHexeProcess &Proce
 
 			dData = ComputeColumns(Process, dData);
 
-			//	Generate a key for the new value. If all key values are non-nil
-			//	then we insert the row into the secondary view.
+			//	Generate keys and data for the new value. If all key values are
+			//	non-nil then we insert the rows into the secondary view.
 
 			TArray<CRowKey> NewKeys;
-			if (CreateSecondaryKeys(Process, dData, RowID, &NewKeys))
+			TArray<CDatum> NewData;
+			if (CreateSecondaryRowData(PrimaryDims, Process, PrimaryKey, dData, RowID, &NewKeys, &NewData))
 				{
-				//	Generate data for secondary key
-
-				CDatum dViewData;
-				CreateSecondaryData(PrimaryDims, PrimaryKey, dData, RowID, &dViewData);
-
-				//	Insert it
-
 				for (i = 0; i < NewKeys.GetCount(); i++)
 					{
-					m_pRows->Insert(NewKeys[i], dViewData, RowID);
-					if (!m_Recovery.Insert(NewKeys[i], dViewData, RowID, retsError))
+					m_pRows->Insert(NewKeys[i], NewData[i], RowID);
+					if (!m_Recovery.Insert(NewKeys[i], NewData[i], RowID, retsError))
 						*retbRecoveryFailed = true;
 					}
 				}
@@ -968,6 +1326,46 @@ void CAeonView::Insert (const CTableDimensions &PrimaryDims, CHexeProcess &Proce
 		}
 	}
 
+void CAeonView::InsertAggregate (CAeonView &PrimaryView, CHexeProcess &Process, CDatum dData, CDatum dOldData, SEQUENCENUMBER RowID, bool *retbRecoveryFailed, CString *retsError)
+
+//	InsertAggregate
+//
+//	Removes the old value of a primary row from its groups and adds the new
+//	value. Each group row is read, updated, and written back, so a write costs
+//	O(groups touched) instead of a scan. The exception is removing a group's
+//	current min or max, which requires a scan of the primary view to find the
+//	new one.
+
+	{
+	int i, j;
+
+	for (i = 0; i < 2; i++)
+		{
+		CDatum dRow = (i == 0 ? dOldData : dData);
+		int iDelta = (i == 0 ? -1 : 1);
+		if (dRow.IsNil())
+			continue;
+
+		dRow = ComputeColumns(Process, dRow);
+
+		TArray<CRowKey> Keys;
+		if (!CreateSecondaryKeys(Process, dRow, 0, &Keys))
+			continue;
+
+		for (j = 0; j < Keys.GetCount(); j++)
+			{
+			bool bStale;
+			CDatum dGroup = UpdateAggregateRow(FindAggregateRow(Keys[j]), dRow, iDelta, &bStale);
+			if (bStale)
+				dGroup = RecomputeAggregateExtremes(PrimaryView, Process, Keys[j], dGroup);
+
+			m_pRows->Insert(Keys[j], dGroup, RowID);
+			if (!m_Recovery.Insert(Keys[j], dGroup, RowID, retsError))
+				*retbRecoveryFailed = true;
+			}
+		}
+	}
+
 bool CAeonView::LoadRecoveryFile (const CString &sRecoveryFilespec, CAeonRowArray **retpRows, int *retiRowsRecovered, CString *retsError)
 
 //	LoadRecoveryFile
@@ -1012,11 +1410,101 @@ void CAeonView::Mark (void)
 	m_ComputedColumns.Mark();
 	}
 
-void CAeonView::SegmentMergeComplete (CAeonSegment *pSeg1, CAeonSegment *pSeg2, CAeonSegment *pNewSeg)
+void CAeonView::OpenSnapshot (CAeonViewSnapshot *retSnapshot)
+
+//	OpenSnapshot
+//
+//	Captures the current rows and segments so that callers can read them
+//	outside of the table lock. Must be called inside the table lock.
+
+	{
+	retSnapshot->Init(m_Dims, m_pRows, m_Segments, m_Expiration, m_RangeDeletes);
+	}
+
+CDatum CAeonView::RecomputeAggregateExtremes (CAeonView &PrimaryView, CHexeProcess &Process, const CRowKey &GroupKey, CDatum dGroup)
+
+//	RecomputeAggregateExtremes
+//
+//	Recomputes the min and max columns of the given group from the rows in the
+//	primary view (which must already reflect the current write). Returns the
+//	updated group row.
+
+	{
+	int i, j;
+
+	if (dGroup.IsNil())
+		return dGroup;
+
+	//	Start with no value for every min/max column.
+
+	TArray<CDatum> Values;
+	Values.InsertEmpty(m_Aggregates.GetCount());
+
+	CRowIterator Rows;
+	if (!PrimaryView.InitIterator(&Rows))
+		return dGroup;
+
+	while (Rows.HasMore())
+		{
+		CRowKey Key;
+		CDatum dData;
+		Rows.GetNextRow(&Key, &dData);
+		if (dData.IsNil())
+			continue;
+
+		//	Skip rows that are not in this group
+
+		dData = ComputeColumns(Process, dData);
+
+		TArray<CRowKey> Keys;
+		if (!CreateSecondaryKeys(Process, dData, 0, &Keys))
+			continue;
+
+		bool bInGroup = false;
+		for (i = 0; i < Keys.GetCount() && !bInGroup; i++)
+			bInGroup = (CRowKey::Compare(m_Dims, Keys[i], GroupKey) == 0);
+
+		if (!bInGroup)
+			continue;
+
+		//	Accumulate
+
+		for (j = 0; j < m_Aggregates.GetCount(); j++)
+			{
+			const SAggregateColumn &Col = m_Aggregates[j];
+			if (Col.iOp != aggMin && Col.iOp != aggMax)
+				continue;
+
+			CDatum dValue = dData.GetElement(Col.sField);
+			if (dValue.IsNil() || !CNumberValue(dValue).IsValidNumber())
+				continue;
+
+			int iCompare = (Values[j].IsNil() ? 0 : CNumberValue(Values[j]).Compare(dValue));
+			if (Values[j].IsNil()
+					|| (Col.iOp == aggMin && iCompare == 1)
+					|| (Col.iOp == aggMax && iCompare == -1))
+				Values[j] = dValue;
+			}
+		}
+
+	//	Update the group
+
+	CComplexStruct *pGroup = new CComplexStruct(dGroup);
+	for (j = 0; j < m_Aggregates.GetCount(); j++)
+		{
+		const SAggregateColumn &Col = m_Aggregates[j];
+		if (Col.iOp == aggMin || Col.iOp == aggMax)
+			pGroup->SetElement(Col.sName, Values[j]);
+		}
+
+	return CDatum(pGroup);
+	}
+
+void CAeonView::SegmentMergeComplete (const TArray<CAeonSegment *> &Merged, CAeonSegment *pNewSeg)
 
 //	SegmentMergeComplete
 //
-//	Replace two segments with the new one.
+//	Replace the merged segments with the new one.
 
 	{
 	int i;
@@ -1026,24 +1514,25 @@ void CAeonView::SegmentMergeComplete (CAeonSegment *pSeg1, CAeonSegment *pSeg2,
 	//	deleted at the next garbage collection point.
 
 	for (i = 0; i < m_Segments.GetCount(); i++)
-		if (m_Segments[i] == pSeg1)
-			{
-			pSeg1->MarkForDelete();
-			pSeg1->Release();
-			m_Segments.Delete(i);
-			i--;
-			}
-		else if (m_Segments[i] == pSeg2)
+		{
+		CAeonSegment *pSeg = m_Segments[i];
+		if (Merged.Find(pSeg))
 			{
-			pSeg2->MarkForDelete();
-			pSeg2->Release();
+			pSeg->MarkForDelete();
+			pSeg->Release();
 			m_Segments.Delete(i);
 			i--;
 			}
+		}
 
 	//	Add the new segment
 
 	m_Segments.Insert(pNewSeg->GetSequence(), pNewSeg);
+	m_dwBytesCompacted += pNewSeg->GetFileSize();
+
+	//	The new segment may have dropped range deletes
+
+	UpdateRangeDeletes();
 	}
 
 void CAeonView::SegmentSaveComplete (CAeonSegment *pSeg)
@@ -1065,6 +1554,36 @@ void CAeonView::SegmentSaveComplete (CAeonSegment *pSeg)
 	m_pRows->Init(m_Dims);
 
 	m_Recovery.Reset();
+	m_dwRecoveryResets++;
+
+	//	The range deletes in the rows are now in the segment
+
+	UpdateRangeDeletes();
+	}
+
+void CAeonView::SetExpiration (const CAeonRowExpiration &Expiration)
+
+//	SetExpiration
+//
+//	Sets when rows expire. Must be called after the view is initialized.
+//	Aggregate rows summarize many primary rows, so they never expire.
+
+	{
+	int i;
+
+	if (m_bAggregate)
+		return;
+
+	m_Expiration = Expiration;
+
+	//	Secondary rows always store the expiration field (see
+	//	CreateSecondaryData), but we only return it if it is one of our columns.
+
+	bool bIsColumn = false;
+	for (i = 0; i < m_Columns.GetCount() && !bIsColumn; i++)
+		bIsColumn = (strEquals(m_Columns[i], STR_ALL_COLUMNS) || strEquals(m_Columns[i], Expiration.GetField()));
+
+	m_Expiration.SetHideField(Expiration.IsEnabled() && IsSecondaryView() && !bIsColumn);
 	}
 
 void CAeonView::SetUnsavedRows (CAeonRowArray *pRows)
@@ -1077,6 +1596,116 @@ void CAeonView::SetUnsavedRows (CAeonRowArray *pRows)
 	{
 	m_pRows->Release();
 	m_pRows = pRows;
+
+	UpdateRangeDeletes();
+	}
+
+CDatum CAeonView::UpdateAggregateRow (CDatum dGroup, CDatum dData, int iDelta, bool *retbStale) const
+
+//	UpdateAggregateRow
+//
+//	Returns the group row after adding (iDelta = 1) or removing (iDelta = -1)
+//	the given primary row. We return Nil when the group becomes empty.
+//
+//	If we remove a row holding the group's min or max, we can't tell what the
+//	new one is (we would need the other rows in the group), so we set
+//	retbStale and the caller must call RecomputeAggregateExtremes.
+
+	{
+	int i;
+
+	if (retbStale)
+		*retbStale = false;
+
+	int iCount = (dGroup.IsNil() ? 0 : (int)dGroup.GetElement(FIELD_COUNT)) + iDelta;
+	if (iCount <= 0)
+		return CDatum();
+
+	CComplexStruct *pGroup = (dGroup.IsNil() ? new CComplexStruct : new CComplexStruct(dGroup));
+	pGroup->SetElement(FIELD_COUNT, CDatum(iCount));
+
+	for (i = 0; i < m_Aggregates.GetCount(); i++)
+		{
+		const SAggregateColumn &Col = m_Aggregates[i];
+		CDatum dCurrent = pGroup->GetElement(Col.sName);
+
+		//	count with no field is the same as the group count
+
+		if (Col.sField.IsEmpty())
+			{
+			pGroup->SetElement(Col.sName, CDatum(iCount));
+			continue;
+			}
+
+		CDatum dValue = dData.GetElement(Col.sField);
+		if (dValue.IsNil())
+			continue;
+
+		//	Only numbers are summed and compared
+
+		if (Col.iOp != aggCount && !CNumberValue(dValue).IsValidNumber())
+			continue;
+
+		switch (Col.iOp)
+			{
+			case aggCount:
+				pGroup->SetElement(Col.sName, CDatum((dCurrent.IsNil() ? 0 : (int)dCurrent) + iDelta));
+				break;
+
+			case aggSum:
+				{
+				CNumberValue Sum(dCurrent.IsNil() ? CDatum((int)0) : dCurrent);
+				if (iDelta > 0)
+					Sum.Add(dValue);
+				else
+					Sum.Subtract(dValue);
+
+				pGroup->SetElement(Col.sName, Sum.GetDatum());
+				break;
+				}
+
+			case aggMin:
+				if (iDelta > 0)
+					{
+					if (dCurrent.IsNil() || CNumberValue(dCurrent).Compare(dValue) == 1)
+						pGroup->SetElement(Col.sName, dValue);
+					}
+				else if (retbStale && !dCurrent.IsNil() && CNumberValue(dCurrent).Compare(dValue) != -1)
+					*retbStale = true;
+				break;
+
+			case aggMax:
+				if (iDelta > 0)
+					{
+					if (dCurrent.IsNil() || CNumberValue(dCurrent).Compare(dValue) == -1)
+						pGroup->SetElement(Col.sName, dValue);
+					}
+				else if (retbStale && !dCurrent.IsNil() && CNumberValue(dCurrent).Compare(dValue) != 1)
+					*retbStale = true;
+				break;
+			}
+		}
+
+	return CDatum(pGroup);
+	}
+
+void CAeonView::UpdateRangeDeletes (void)
+
+//	UpdateRangeDeletes
+//
+//	Collects the range deletes saved with our segments and the ones in our
+//	in-memory rows, so that readers can hide the segment rows they cover. We
+//	call this whenever our segments or rows are replaced.
+
+	{
+	int i;
+
+	m_RangeDeletes.DeleteAll();
+
+	for (i = 0; i < m_Segments.GetCount(); i++)
+		m_Segments[i]->GetRangeDeletes(&m_RangeDeletes);
+
+	m_pRows->GetRangeDeletes(&m_RangeDeletes);
 	}
 
 void CAeonView::WriteDesc (CComplexStruct *pDesc)
@@ -1100,7 +1729,16 @@ void CAeonView::WriteDesc (CComplexStruct *pDesc)
 
 	//	Dimensions
 
-	if (IsSecondaryView())
+	if (m_bFullText)
+		{
+		CComplexArray *pFields = new CComplexArray;
+		for (i = 0; i < m_TextFields.GetCount(); i++)
+			pFields->Insert(CDatum(m_TextFields[i]));
+
+		pDesc->SetElement(FIELD_TYPE, VIEW_TYPE_FULL_TEXT);
+		pDesc->SetElement(FIELD_FIELDS, CDatum(pFields));
+		}
+	else if (IsSecondaryView())
 		{
 		//	Secondary views always have an extra dimension (used for the disambiguating rowKey).
 
@@ -1127,6 +1765,45 @@ void CAeonView::WriteDesc (CComplexStruct *pDesc)
 			}
 		}
 
+	//	Aggregates
+
+	if (m_bAggregate)
+		{
+		CComplexStruct *pAggregates = new CComplexStruct;
+		for (i = 0; i < m_Aggregates.GetCount(); i++)
+			{
+			const SAggregateColumn &Col = m_Aggregates[i];
+
+			CComplexArray *pColDesc = new CComplexArray;
+			switch (Col.iOp)
+				{
+				case aggCount:
+					pColDesc->Insert(CDatum(AGGREGATE_COUNT));
+					break;
+
+				case aggSum:
+					pColDesc->Insert(CDatum(AGGREGATE_SUM));
+					break;
+
+				case aggMin:
+					pColDesc->Insert(CDatum(AGGREGATE_MIN));
+					break;
+
+				case aggMax:
+					pColDesc->Insert(CDatum(AGGREGATE_MAX));
+					break;
+				}
+
+			if (!Col.sField.IsEmpty())
+				pColDesc->Insert(CDatum(Col.sField));
+
+			pAggregates->SetElement(Col.sName, CDatum(pColDesc));
+			}
+
+		pDesc->SetElement(FIELD_TYPE, VIEW_TYPE_AGGREGATE);
+		pDesc->SetElement(FIELD_AGGREGATES, CDatum(pAggregates));
+		}
+
 	//	Write out columns
 
 	if (m_Columns.GetCount() > 0)
@@ -0,0 +1,163 @@
+//	CAeonViewSnapshot.cpp
+//
+//	CAeonViewSnapshot class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	A snapshot holds a reference to the in-memory rows and to each segment of
+//	a view. Segments never change once written, and the in-memory rows keep
+//	old versions around (stamped with a sequence number), so a snapshot can
+//	read everything as of the moment it was taken without any lock. When a
+//	save or merge replaces these row sets, our references keep them alive
+//	until we're done.
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(ERR_INVALID_PATH,					"Path does not have the correct number of dimensions.")
+
+void CAeonViewSnapshot::CleanUp (void)
+
+//	CleanUp
+//
+//	Releases all row sets.
+
+	{
+	int i;
+
+	if (m_pRows)
+		{
+		m_pRows->Release();
+		m_pRows = NULL;
+		}
+
+	for (i = 0; i < m_Segments.GetCount(); i++)
+		m_Segments[i]->Release();
+
+	m_Segments.DeleteAll();
+	}
+
+bool CAeonViewSnapshot::FindData (const CRowKey &Path, CDatum *retData, SEQUENCENUMBER *retRowID, int *retiProbes, CString *retsError)
+
+//	FindData
+//
+//	Returns data for the given key. If the row does not exist (or has expired,
+//	or is covered by a range delete), we succeed but return Nil. retiProbes is
+//	the number of row sets that we searched.
+
+	{
+	int i;
+
+	//	If dimensions don't match, then we have an error
+
+	if (!Path.MatchesDimensions(m_Dims))
+		{
+		*retsError = ERR_INVALID_PATH;
+		return false;
+		}
+
+	//	First look for the value in the in-memory rows (as of our snapshot)
+
+	int iProbes = 1;
+	bool bFound = m_pRows->FindDataAt(Path, m_RowsSeq, retData, retRowID);
+
+	//	Otherwise, look in the segments
+
+	for (i = 0; i < m_Segments.GetCount() && !bFound; i++)
+		{
+		iProbes++;
+		bFound = m_Segments[i]->FindData(Path, retData, retRowID);
+
+		if (bFound
+				&& !m_RangeDeletes.IsEmpty()
+				&& m_RangeDeletes.IsDeleted(m_Dims, Path.AsEncodedString(), m_Segments[i]->GetSequence()))
+			*retData = CDatum();
+		}
+
+	//	If not found, we succeed, but the value is nil
+
+	if (!bFound)
+		{
+		*retData = CDatum();
+		if (retRowID)
+			*retRowID = 0;
+		}
+
+	//	Expired rows look like deleted rows (we keep the RowID, like we do for
+	//	a deleted row).
+
+	else if (m_Expiration.IsEnabled()
+			&& m_Expiration.IsExpired(*retData, m_Expiration.GetCutoff(CDateTime(CDateTime::Now))))
+		*retData = CDatum();
+
+	else
+		*retData = m_Expiration.StripField(*retData);
+
+	if (retiProbes)
+		*retiProbes = iProbes;
+
+	return true;
+	}
+
+void CAeonViewSnapshot::Init (const CTableDimensions &Dims, CAeonRowArray *pRows, const TSortMap<SEQUENCENUMBER, CAeonSegment *> &Segments, const CAeonRowExpiration &Expiration, const CAeonRangeDeletes &RangeDeletes)
+
+//	Init
+//
+//	Captures the given row sets. Must be called inside the table lock (so that
+//	no one is inserting into pRows).
+
+	{
+	int i;
+
+	CleanUp();
+
+	m_Dims = Dims;
+	m_Expiration = Expiration;
+	m_RangeDeletes = RangeDeletes;
+
+	m_pRows = pRows;
+	m_pRows->AddRef();
+	m_RowsSeq = pRows->GetSeq();
+
+	m_Segments.GrowToFit(Segments.GetCount());
+	for (i = 0; i < Segments.GetCount(); i++)
+		{
+		CAeonSegment *pSeg = Segments[i];
+		pSeg->AddRef();
+		m_Segments.Insert(pSeg);
+		}
+	}
+
+bool CAeonViewSnapshot::InitIterator (CRowIterator *retIterator)
+
+//	InitIterator
+//
+//	Initializes an iterator over the snapshot. We open the in-memory rows at
+//	our sequence number here (instead of inside the table lock) so that
+//	writers don't wait on us.
+
+	{
+	int i;
+
+	if (!retIterator->Init(m_Dims))
+		return false;
+
+	retIterator->SetExpiration(m_Expiration);
+	retIterator->SetRangeDeletes(m_RangeDeletes);
+
+	//	Add the rows first because they are the latest
+
+	IOrderedRowSet *pRows = m_pRows->OpenSnapshotAt(m_RowsSeq);
+	if (pRows->GetCount() > 0)
+		retIterator->AddSegment(pRows);
+	pRows->Release();
+
+	//	Next add all the segments (which are ordered from most recent to least
+	//	recent).
+
+	for (i = 0; i < m_Segments.GetCount(); i++)
+		retIterator->AddSegment(m_Segments[i]);
+
+	//	Done
+
+	retIterator->Reset();
+	return true;
+	}
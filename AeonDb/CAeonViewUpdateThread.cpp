@@ -0,0 +1,21 @@
+//	CAeonViewUpdateThread.cpp
+//
+//	CAeonViewUpdateThread class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	When we add a secondary view, housekeeping splits the primary rows into
+//	key ranges and starts one of these threads for each range. Housekeeping
+//	waits for all threads to finish before returning, so garbage collection
+//	(which waits for housekeeping) never runs while we're creating datums.
+
+#include "stdafx.h"
+
+void CAeonViewUpdateThread::Run (void)
+
+//	Run
+//
+//	Update thread
+
+	{
+	m_pTable->UpdateViewRange(*m_pRange);
+	}
@@ -2,6 +2,15 @@
 //
 //	CRowInsertLog class
 //	Copyright (c) 2012 by Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	Version 0: No header; data serialized as AEONScript.
+//	Version 1: Data serialized as AEONScript followed by a space terminator.
+//	Version 2: Data serialized as binary (formatAEONBinary); no terminator.
+//	Version 3: Each record is preceded by SRecordHeader (size and CRC32C) so
+//		that we can detect a torn write at the end of the file.
+//	Version 4: A record with an empty key is a range delete: the encoded key
+//		prefix (or first key in range), the encoded key after the range
+//		(empty for a prefix), and the table sequence number.
 
 #include "stdafx.h"
 
@@ -11,9 +20,79 @@ DECLARE_CONST_STRING(ERR_CANT_OPEN_RECOVERY,			"Unable to open recovery file: %s
 DECLARE_CONST_STRING(ERR_CANT_PARSE,					"Unable to parse data in recovery file")
 DECLARE_CONST_STRING(ERR_CRASH_LOADING,					"Unable to read recovery file")
 DECLARE_CONST_STRING(ERR_CRASH,							"Crash while inserting")
+DECLARE_CONST_STRING(ERR_NOT_OPEN,						"Recovery file is not open")
 
 const DWORD SIGNATURE =									'ROEA';		//	'AEOR' backwards because of little-endianness
-const DWORD CURRENT_VERSION =							1;
+const DWORD CURRENT_VERSION =							4;
+const DWORD RANGE_DELETE_VERSION =						4;
+
+bool CRowInsertLog::Append (CBuffer &Output, CString *retsError)
+
+//	Append
+//
+//	Fills in the record header (if the version has one) and adds the record to
+//	the pending batch. Callers must Commit (see GetCommitPoint) or Flush to
+//	make the record durable.
+
+	{
+	if (m_dwVersion >= 3)
+		{
+		SRecordHeader *pHeader = (SRecordHeader *)Output.GetPointer();
+		pHeader->dwSize = Output.GetLength() - sizeof(SRecordHeader);
+		pHeader->dwCRC = CalcRecordCRC(pHeader->dwSize, &pHeader[1]);
+		}
+
+	try
+		{
+		m_pLog->Append(Output);
+		}
+	catch (...)
+		{
+		if (retsError)
+			*retsError = ERR_CRASH;
+		return false;
+		}
+
+	return true;
+	}
+
+DWORD CRowInsertLog::CalcRecordCRC (DWORD dwSize, void *pData)
+
+//	CalcRecordCRC
+//
+//	Computes the CRC for a record. We include the size so that a corrupt size
+//	is also detected.
+
+	{
+	DWORD dwCRC = utlCRC32C(&dwSize, sizeof(DWORD));
+	return utlCRC32C(pData, dwSize, dwCRC);
+	}
+
+bool CRowInsertLog::CanInsertRangeDelete (void) const
+
+//	CanInsertRangeDelete
+//
+//	Returns TRUE if the file is recent enough to hold range deletes. Reset
+//	upgrades it.
+
+	{
+	return (m_dwVersion >= RANGE_DELETE_VERSION);
+	}
+
+void CRowInsertLog::Close (void)
+
+//	Close
+//
+//	Writes out any pending records and closes the file.
+
+	{
+	if (m_pLog)
+		{
+		m_pLog->Close();
+		m_pLog->Release();
+		m_pLog = NULL;
+		}
+	}
 
 bool CRowInsertLog::Create (const CString &sFilename)
 
@@ -22,8 +101,18 @@ bool CRowInsertLog::Create (const CString &sFilename)
 //	Create a new log file
 
 	{
-	if (!m_File.Create(sFilename, CFile::FLAG_CREATE_ALWAYS | CFile::FLAG_WRITE_THROUGH))
+	Close();
+
+	//	We don't use write-through; CRowLogFile flushes according to the sync
+	//	policy.
+
+	m_pLog = new CRowLogFile;
+	if (!m_pLog->GetFile().Create(sFilename, CFile::FLAG_CREATE_ALWAYS))
+		{
+		m_pLog->Release();
+		m_pLog = NULL;
 		return false;
+		}
 
 	m_sFilename = sFilename;
 	m_dwVersion = CURRENT_VERSION;
@@ -34,11 +123,48 @@ bool CRowInsertLog::Create (const CString &sFilename)
 	Header.dwSignature = SIGNATURE;
 	Header.dwVersion = CURRENT_VERSION;
 
-	m_File.Write(&Header, sizeof(Header));
+	m_pLog->GetFile().Write(&Header, sizeof(Header));
+
+	//	Let the flusher bound how long a written batch can sit unflushed.
+	//	Close unregisters.
+
+	CRowLogFile::GetFlusher().Register(m_pLog);
 
 	return true;
 	}
 
+bool CRowInsertLog::Flush (CString *retsError)
+
+//	Flush
+//
+//	Commits all records inserted so far.
+
+	{
+	if (m_pLog == NULL)
+		return true;
+
+	return m_pLog->Commit(m_pLog->GetLastSeq(), retsError);
+	}
+
+void CRowInsertLog::GetCommitPoint (SCommitPoint *retCommit)
+
+//	GetCommitPoint
+//
+//	Returns the log and sequence number that callers must commit to make all
+//	records inserted so far durable. The caller may then commit without
+//	holding any lock, but must release the log when done.
+
+	{
+	retCommit->pLog = m_pLog;
+	retCommit->dwSeq = 0;
+
+	if (m_pLog)
+		{
+		m_pLog->AddRef();
+		retCommit->dwSeq = m_pLog->GetLastSeq();
+		}
+	}
+
 bool CRowInsertLog::Insert (const CRowKey &Key, CDatum dData, SEQUENCENUMBER RowID, CString *retsError)
 
 //	Insert
@@ -46,51 +172,82 @@ bool CRowInsertLog::Insert (const CRowKey &Key, CDatum dData, SEQUENCENUMBER Row
 //	Insert a row
 
 	{
-	ASSERT(m_File.IsOpen());
+	if (m_pLog == NULL)
+		{
+		if (retsError)
+			*retsError = ERR_NOT_OPEN;
+		return false;
+		}
 
 	//	Write out to a memory buffer first
 
 	CBuffer Output;
 
+	//	Leave room for the record header
+
+	if (m_dwVersion >= 3)
+		{
+		SRecordHeader Header;
+		Output.Write(&Header, sizeof(Header));
+		}
+
 	//	Save the key
 
 	Key.AsEncodedString().Serialize(Output);
 
-	//	Save the data
+	//	Save the data. We need to stay compatible with whatever version the
+	//	file was created with (Reset will upgrade it).
 
-	dData.Serialize(CDatum::formatAEONScript, Output);
+	if (m_dwVersion >= 2)
+		dData.Serialize(CDatum::formatAEONBinary, Output);
+	else
+		{
+		dData.Serialize(CDatum::formatAEONScript, Output);
 
-	//	We need a terminator for the datum serialization
+		//	We need a terminator for the datum serialization
 
-	if (m_dwVersion > 0)
-		Output.Write(" ", 1);
+		if (m_dwVersion > 0)
+			Output.Write(" ", 1);
+		}
 
 	//	Save the rowID
 
 	Output.Write(&RowID, sizeof(RowID));
 
-	//	Write to the file
+	//	Add to the pending batch
 
-	try
-		{
-		m_File.Write(Output.GetPointer(), Output.GetLength());
-		}
-	catch (CException e)
-		{
-		if (retsError)
-			*retsError = e.GetErrorString();
-		return false;
-		}
-	catch (...)
+	return Append(Output, retsError);
+	}
+
+bool CRowInsertLog::InsertRangeDelete (const CRowKey &From, const CRowKey &To, SEQUENCENUMBER Seq, CString *retsError)
+
+//	InsertRangeDelete
+//
+//	Logs a range delete (see CAeonRowArray::DeleteRange). The file must be at
+//	least version 4 (see CanInsertRangeDelete).
+
+	{
+	if (m_pLog == NULL || !CanInsertRangeDelete())
 		{
 		if (retsError)
-			*retsError = ERR_CRASH;
+			*retsError = ERR_NOT_OPEN;
 		return false;
 		}
 
-	//	Success
+	CBuffer Output;
 
-	return true;
+	SRecordHeader Header;
+	Output.Write(&Header, sizeof(Header));
+
+	//	An empty key marks the record as a range delete (rows always have a
+	//	key).
+
+	NULL_STR.Serialize(Output);
+	From.AsEncodedString().Serialize(Output);
+	(To.GetCount() > 0 ? To.AsEncodedString() : NULL_STR).Serialize(Output);
+	Output.Write(&Seq, sizeof(Seq));
+
+	return Append(Output, retsError);
 	}
 
 bool CRowInsertLog::Open (const CString &sFilename, CAeonRowArray *pRows, int *retiRowCount, CString *retsError)
@@ -100,29 +257,36 @@ bool CRowInsertLog::Open (const CString &sFilename, CAeonRowArray *pRows, int *r
 //	Open a log file.
 
 	{
-	if (!m_File.IsOpen())
+	if (m_pLog == NULL)
 		{
 		ASSERT(!sFilename.IsEmpty());
 
-		if (!m_File.Create(sFilename, CFile::FLAG_OPEN_ALWAYS))
+		m_pLog = new CRowLogFile;
+		if (!m_pLog->GetFile().Create(sFilename, CFile::FLAG_OPEN_ALWAYS))
 			{
+			m_pLog->Release();
+			m_pLog = NULL;
+
 			*retsError = strPattern(ERR_CANT_OPEN_RECOVERY, sFilename);
 			return false;
 			}
 
+		CFile &File = m_pLog->GetFile();
+
 		//	Open successful
 
 		m_sFilename = sFilename;
+		CRowLogFile::GetFlusher().Register(m_pLog);
 
 		//	See what version we're at. Version 0 did not have a header, so we
 		//	need to account for that.
 
-		DWORD dwFileSize = m_File.GetStreamLength();
+		DWORD dwFileSize = File.GetStreamLength();
 		if (dwFileSize >= sizeof(SHeader))
 			{
 			SHeader Header;
 
-			m_File.Read(&Header, sizeof(SHeader));
+			File.Read(&Header, sizeof(SHeader));
 			if (Header.dwSignature == SIGNATURE)
 				m_dwVersion = Header.dwVersion;
 
@@ -140,7 +304,7 @@ bool CRowInsertLog::Open (const CString &sFilename, CAeonRowArray *pRows, int *r
 			Header.dwSignature = SIGNATURE;
 			Header.dwVersion = CURRENT_VERSION;
 
-			m_File.Write(&Header, sizeof(SHeader));
+			File.Write(&Header, sizeof(SHeader));
 
 			m_dwVersion = CURRENT_VERSION;
 			}
@@ -172,8 +336,9 @@ bool CRowInsertLog::Recover (CAeonRowArray *pRows, int *retiRowCount, CString *r
 //	Recover a row array from a log file
 
 	{
+	CFile &File = m_pLog->GetFile();
 	int iRowCount = 0;
-	int iTotalSize = m_File.GetStreamLength();
+	int iTotalSize = File.GetStreamLength();
 	if (iTotalSize == 0)
 		{
 		if (retiRowCount)
@@ -181,26 +346,31 @@ bool CRowInsertLog::Recover (CAeonRowArray *pRows, int *retiRowCount, CString *r
 		return true;
 		}
 
+	//	Version 3 files have checksummed records
+
+	if (m_dwVersion >= 3)
+		return RecoverRecords(pRows, retiRowCount, retsError);
+
 	//	Start at the beginning
 
-	m_File.Seek(m_dwVersion == 0 ? 0 : sizeof(SHeader));
+	File.Seek(m_dwVersion == 0 ? 0 : sizeof(SHeader));
 
 	//	Read it
 
-	while (m_File.GetPos() < iTotalSize)
+	while (File.GetPos() < iTotalSize)
 		{
 		try
 			{
 			//	Key
 
-			CString sKey = CString::Deserialize(m_File);
+			CString sKey = CString::Deserialize(File);
 			CRowKey Key;
 			CRowKey::CreateFromEncodedKey(pRows->GetDimensions(), sKey, &Key);
 
 			//	Data
 
 			CDatum dData;
-			if (!CDatum::Deserialize(CDatum::formatAEONScript, m_File, &dData))
+			if (!CDatum::Deserialize((m_dwVersion >= 2 ? CDatum::formatAEONBinary : CDatum::formatAEONScript), File, &dData))
 				{
 				*retsError = ERR_CANT_PARSE;
 				return false;
@@ -208,10 +378,10 @@ bool CRowInsertLog::Recover (CAeonRowArray *pRows, int *retiRowCount, CString *r
 
 			//	Skip terminator, if necessary
 
-			if (m_dwVersion > 0)
+			if (m_dwVersion == 1)
 				{
 				char chTerm;
-				m_File.Read(&chTerm, 1);
+				File.Read(&chTerm, 1);
 				if (chTerm != ' ')
 					{
 					*retsError = ERR_NO_TERMINATOR;
@@ -222,7 +392,7 @@ bool CRowInsertLog::Recover (CAeonRowArray *pRows, int *retiRowCount, CString *r
 			//	RowID
 
 			SEQUENCENUMBER RowID;
-			m_File.Read(&RowID, sizeof(RowID));
+			File.Read(&RowID, sizeof(RowID));
 
 			//	Add to row
 
@@ -249,6 +419,130 @@ bool CRowInsertLog::Recover (CAeonRowArray *pRows, int *retiRowCount, CString *r
 	return true;
 	}
 
+bool CRowInsertLog::RecoverRecords (CAeonRowArray *pRows, int *retiRowCount, CString *retsError)
+
+//	RecoverRecords
+//
+//	Recovers rows from a version 3 (or later) file. If the last record is
+//	incomplete or fails its checksum, we assume that we crashed in the middle
+//	of a write: we stop there and truncate the file so that new records are
+//	appended after the last good one.
+
+	{
+	CFile &File = m_pLog->GetFile();
+	int iRowCount = 0;
+	int iTotalSize = File.GetStreamLength();
+	int iPos = sizeof(SHeader);
+
+	File.Seek(iPos);
+
+	while (iPos < iTotalSize)
+		{
+		try
+			{
+			//	Read the header and make sure the whole record is there.
+
+			SRecordHeader Header;
+			if (iTotalSize - iPos < (int)sizeof(SRecordHeader))
+				break;
+
+			File.Read(&Header, sizeof(Header));
+			if (Header.dwSize == 0 || Header.dwSize > (DWORD)(iTotalSize - iPos - sizeof(SRecordHeader)))
+				break;
+
+			CBuffer Record(Header.dwSize);
+			Record.SetLength(Header.dwSize);
+			File.Read(Record.GetPointer(), Header.dwSize);
+			if (CalcRecordCRC(Header.dwSize, Record.GetPointer()) != Header.dwCRC)
+				break;
+
+			//	Key
+
+			CString sKey = CString::Deserialize(Record);
+
+			//	An empty key is a range delete. We add it to the rows so that
+			//	it covers the rows before it (but not the ones after).
+
+			if (sKey.IsEmpty())
+				{
+				CString sFrom = CString::Deserialize(Record);
+				CString sTo = CString::Deserialize(Record);
+
+				SEQUENCENUMBER Seq;
+				Record.Read(&Seq, sizeof(Seq));
+
+				if (sFrom.IsEmpty())
+					{
+					*retsError = ERR_CANT_PARSE;
+					return false;
+					}
+
+				CRowKey To;
+				if (!sTo.IsEmpty())
+					To = CRowKey(pRows->GetDimensions(), sTo);
+
+				pRows->DeleteRange(CRowKey(pRows->GetDimensions(), sFrom), To, Seq);
+
+				iPos += sizeof(SRecordHeader) + Header.dwSize;
+				continue;
+				}
+
+			CRowKey Key;
+			CRowKey::CreateFromEncodedKey(pRows->GetDimensions(), sKey, &Key);
+
+			//	Data
+
+			CDatum dData;
+			if (!CDatum::Deserialize(CDatum::formatAEONBinary, Record, &dData))
+				{
+				*retsError = ERR_CANT_PARSE;
+				return false;
+				}
+
+			//	RowID
+
+			SEQUENCENUMBER RowID;
+			Record.Read(&RowID, sizeof(RowID));
+
+			//	Add to row
+
+			if (!pRows->Insert(Key, dData, RowID))
+				{
+				*retsError = ERR_CANT_INSERT;
+				return false;
+				}
+
+			iRowCount++;
+			iPos += sizeof(SRecordHeader) + Header.dwSize;
+			}
+		catch (...)
+			{
+			*retsError = ERR_CRASH_LOADING;
+			return false;
+			}
+		}
+
+	//	If we stopped before the end, discard the torn tail.
+
+	if (iPos < iTotalSize)
+		{
+		if (!File.SetLength(iPos))
+			{
+			*retsError = ERR_CRASH_LOADING;
+			return false;
+			}
+
+		File.Seek(iPos);
+		}
+
+	//	Done
+
+	if (retiRowCount)
+		*retiRowCount = iRowCount;
+
+	return true;
+	}
+
 bool CRowInsertLog::Reset (void)
 
 //	Reset
@@ -256,21 +550,45 @@ bool CRowInsertLog::Reset (void)
 //	Delete the file
 
 	{
-	ASSERT(m_File.IsOpen());
+	ASSERT(m_pLog);
 
 	//	Re-write to latest version
 
-	if (m_dwVersion != CURRENT_VERSION)
-		{
-		SHeader Header;
-		Header.dwSignature = SIGNATURE;
-		Header.dwVersion = CURRENT_VERSION;
+	SHeader Header;
+	Header.dwSignature = SIGNATURE;
+	Header.dwVersion = CURRENT_VERSION;
+
+	m_dwVersion = CURRENT_VERSION;
 
-		m_File.Seek(0);
-		m_File.Write(&Header, sizeof(SHeader));
+	return m_pLog->Reset(&Header, sizeof(SHeader));
+	}
+
+bool CRowInsertLog::WriteTornRecordTest (CString *retsError)
+
+//	WriteTornRecordTest
+//
+//	Appends the start of a record (but not the rest of it), as if we had
+//	crashed in the middle of a write. This is only used to test recovery.
 
-		m_dwVersion = CURRENT_VERSION;
+	{
+	if (m_pLog == NULL || m_dwVersion < 3)
+		{
+		if (retsError)
+			*retsError = ERR_NOT_OPEN;
+		return false;
 		}
 
-	return m_File.SetLength(sizeof(SHeader));
+	//	The header claims more data than we write.
+
+	SRecordHeader Header;
+	Header.dwSize = 1024;
+	Header.dwCRC = 0;
+
+	CBuffer Output;
+	Output.Write(&Header, sizeof(Header));
+	Output.Write("torn", 4);
+
+	DWORDLONG dwSeq;
+	m_pLog->Append(Output, &dwSeq);
+	return m_pLog->Commit(dwSeq, retsError);
 	}
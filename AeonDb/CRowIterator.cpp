@@ -22,11 +22,14 @@ void CRowIterator::AddSegment (IOrderedRowSet *pSegment)
 	{
 	ASSERT(pSegment != NULL);
 
+	//	Mutable row sets (e.g., the in-memory rows) give us a stable snapshot
+	//	so that we can iterate without holding a lock.
+
 	SEntry *pEntry = m_Data.Insert();
-	pEntry->pSegment = pSegment;
-	pEntry->pSegment->AddRef();
+	pEntry->pSegment = pSegment->OpenSnapshot();
 	pEntry->iPosCursor = -1;
-	pEntry->iCount = pSegment->GetCount();
+	pEntry->iCount = pEntry->pSegment->GetCount();
+	pEntry->Seq = pSegment->GetSequence();
 
 	ASSERT(pEntry->iCount > 0);
 	}
@@ -35,7 +38,8 @@ void CRowIterator::Advance (void)
 
 //	Advance
 //
-//	Advance to the next row
+//	Advance to the next row. We keep the entries in a min-heap ordered by their
+//	current key so that this is O(log n) in the number of segments.
 
 	{
 	int i;
@@ -51,51 +55,62 @@ void CRowIterator::Advance (void)
 			pEntry->iPosCursor = 0;
 			pEntry->sKey = pEntry->pSegment->GetKey(pEntry->iPosCursor);
 			}
+
+		HeapBuild();
 		}
 
-	//	Otherwise, advance the current entry to the next row
+	//	Otherwise, advance the current entry to the next row, along with any
+	//	other entries that have the same key (older versions of the row).
 
 	else
 		{
 		CString sKey = m_Data[m_iEntryCursor].sKey;
+		CRowKey Key(m_Dims, sKey);
 
-		//	Increment all entries that have this key
+		//	Pull all entries with an equivalent key off the heap (the current
+		//	entry is at the top).
 
-		for (i = 0; i < m_Data.GetCount(); i++)
+		TArray<int> Same;
+		while (m_Heap.GetCount() > 0
+				&& (HeapTop() == m_iEntryCursor 
+					|| CRowKey::Compare(m_Dims, CRowKey(m_Dims, m_Data[HeapTop()].sKey), Key) == 0))
+			Same.Insert(HeapPop());
+
+		//	Advance the ones with the same key and put them all back
+
+		for (i = 0; i < Same.GetCount(); i++)
 			{
-			SEntry *pEntry = &m_Data[i];
+			SEntry *pEntry = &m_Data[Same[i]];
 
-			if (i == m_iEntryCursor
+			if (Same[i] == m_iEntryCursor
 					|| strEquals(sKey, pEntry->sKey))
-				{
-				pEntry->iPosCursor++;
-				if (pEntry->iPosCursor < pEntry->iCount)
-					pEntry->sKey = pEntry->pSegment->GetKey(pEntry->iPosCursor);
-				else
-					pEntry->sKey = NULL_STR;
-				}
+				AdvanceEntry(Same[i]);
+
+			if (!pEntry->sKey.IsEmpty())
+				HeapPush(Same[i]);
 			}
 		}
 
-	//	Look for the smallest key
+	//	The smallest key is at the top of the heap
 
-	int iBestEntry = -1;
-	CString *pBestKey = NULL;
+	m_iEntryCursor = HeapTop();
+	}
 
-	for (i = 0; i < m_Data.GetCount(); i++)
-		{
-		SEntry *pEntry = &m_Data[i];
-		if (!pEntry->sKey.IsEmpty()
-				&& (pBestKey == NULL || CRowKey::Compare(m_Dims, CRowKey(m_Dims, pEntry->sKey), CRowKey(m_Dims, *pBestKey)) == 1))
-			{
-			pBestKey = &pEntry->sKey;
-			iBestEntry = i;
-			}
-		}
+void CRowIterator::AdvanceEntry (int iEntry)
 
-	//	Done
+//	AdvanceEntry
+//
+//	Advances the given entry to its next row and caches the key. If there are
+//	no more rows, the key is empty.
 
-	m_iEntryCursor = iBestEntry;
+	{
+	SEntry *pEntry = &m_Data[iEntry];
+
+	pEntry->iPosCursor++;
+	if (pEntry->iPosCursor < pEntry->iCount)
+		pEntry->sKey = pEntry->pSegment->GetKey(pEntry->iPosCursor);
+	else
+		pEntry->sKey = NULL_STR;
 	}
 
 void CRowIterator::AdvanceUntilDifferent (const CRowKey &PartialKey)
@@ -126,7 +141,7 @@ void CRowIterator::AdvanceUntilNonNil (void)
 		{
 		Advance();
 		}
-	while (HasMore() && m_Data[m_iEntryCursor].pSegment->GetData(m_Data[m_iEntryCursor].iPosCursor).IsNil());
+	while (HasMore() && IsNilRow());
 	}
 
 void CRowIterator::AdvanceWithLimits (void)
@@ -197,6 +212,7 @@ void CRowIterator::CleanUp (void)
 		m_Data[i].pSegment->Release();
 
 	m_Data.DeleteAll();
+	m_Heap.DeleteAll();
 	}
 
 bool CRowIterator::CompareToLimit (int *retiDiffKey)
@@ -244,13 +260,20 @@ void CRowIterator::Copy (const CRowIterator &Src)
 
 	m_Dims = Src.m_Dims;
 	m_Data = Src.m_Data;
+	m_Heap = Src.m_Heap;
 	m_iEntryCursor = Src.m_iEntryCursor;
 
+	//	Each copy needs its own snapshot of the in-memory rows because the
+	//	snapshot keeps our position (segments just return themselves).
+
 	for (i = 0; i < m_Data.GetCount(); i++)
-		m_Data[i].pSegment->AddRef();
+		m_Data[i].pSegment = m_Data[i].pSegment->OpenSnapshot();
 
 	m_bIncludeNil = Src.m_bIncludeNil;
 	m_Limits = Src.m_Limits;
+	m_Expiration = Src.m_Expiration;
+	m_ExpirationCutoff = Src.m_ExpirationCutoff;
+	m_RangeDeletes = Src.m_RangeDeletes;
 	}
 
 bool CRowIterator::DecrementLimit (int iDimIndex, int *retiDimLeft)
@@ -285,6 +308,112 @@ bool CRowIterator::DecrementLimit (int iDimIndex, int *retiDimLeft)
 		}
 	}
 
+void CRowIterator::HeapBuild (void)
+
+//	HeapBuild
+//
+//	Builds the heap from all entries that have rows left.
+
+	{
+	int i;
+
+	m_Heap.DeleteAll();
+	for (i = 0; i < m_Data.GetCount(); i++)
+		if (!m_Data[i].sKey.IsEmpty())
+			m_Heap.Insert(i);
+
+	for (i = m_Heap.GetCount() / 2 - 1; i >= 0; i--)
+		HeapSiftDown(i);
+	}
+
+int CRowIterator::HeapPop (void)
+
+//	HeapPop
+//
+//	Removes the top entry from the heap and returns it.
+
+	{
+	ASSERT(m_Heap.GetCount() > 0);
+
+	int iTop = m_Heap[0];
+	int iLast = m_Heap.GetCount() - 1;
+
+	m_Heap[0] = m_Heap[iLast];
+	m_Heap.Delete(iLast);
+
+	if (m_Heap.GetCount() > 1)
+		HeapSiftDown(0);
+
+	return iTop;
+	}
+
+bool CRowIterator::HeapPrecedes (int iEntry1, int iEntry2)
+
+//	HeapPrecedes
+//
+//	Returns TRUE if iEntry1 should come before iEntry2. If the keys are equal
+//	we prefer the entry added first (because it has the most recent rows).
+
+	{
+	int iCompare = CRowKey::Compare(m_Dims, CRowKey(m_Dims, m_Data[iEntry1].sKey), CRowKey(m_Dims, m_Data[iEntry2].sKey));
+	if (iCompare == 1)
+		return true;
+	else if (iCompare == -1)
+		return false;
+	else
+		return (iEntry1 < iEntry2);
+	}
+
+void CRowIterator::HeapPush (int iEntry)
+
+//	HeapPush
+//
+//	Adds an entry to the heap.
+
+	{
+	int iPos = m_Heap.GetCount();
+	m_Heap.Insert(iEntry);
+
+	while (iPos > 0)
+		{
+		int iParent = (iPos - 1) / 2;
+		if (!HeapPrecedes(m_Heap[iPos], m_Heap[iParent]))
+			break;
+
+		Swap(m_Heap[iPos], m_Heap[iParent]);
+		iPos = iParent;
+		}
+	}
+
+void CRowIterator::HeapSiftDown (int iPos)
+
+//	HeapSiftDown
+//
+//	Moves the entry at the given position down until the heap is valid.
+
+	{
+	int iCount = m_Heap.GetCount();
+
+	while (true)
+		{
+		int iBest = iPos;
+		int iLeft = 2 * iPos + 1;
+		int iRight = iLeft + 1;
+
+		if (iLeft < iCount && HeapPrecedes(m_Heap[iLeft], m_Heap[iBest]))
+			iBest = iLeft;
+
+		if (iRight < iCount && HeapPrecedes(m_Heap[iRight], m_Heap[iBest]))
+			iBest = iRight;
+
+		if (iBest == iPos)
+			return;
+
+		Swap(m_Heap[iPos], m_Heap[iBest]);
+		iPos = iBest;
+		}
+	}
+
 bool CRowIterator::Init (const CTableDimensions &Dims)
 
 //	Init
@@ -342,7 +471,13 @@ CString CRowIterator::GetNextRow (CDatum *retdData)
 	{
 	CString sKey = m_Data[m_iEntryCursor].sKey;
 	if (retdData)
+		{
 		*retdData = m_Data[m_iEntryCursor].pSegment->GetData(m_Data[m_iEntryCursor].iPosCursor);
+		if (IsHidden(*retdData))
+			*retdData = CDatum();
+		else
+			*retdData = m_Expiration.StripField(*retdData);
+		}
 	
 	AdvanceWithLimits();
 	return sKey;
@@ -356,7 +491,7 @@ void CRowIterator::GetNextRow (CRowKey *retKey, CDatum *retdData, SEQUENCENUMBER
 //	and advances the pointer
 
 	{
-	m_Data[m_iEntryCursor].pSegment->GetRow(m_Data[m_iEntryCursor].iPosCursor, retKey, retdData, retRowID);
+	GetRow(retKey, retdData, retRowID);
 	AdvanceWithLimits();
 	}
 
@@ -367,9 +502,7 @@ DWORD CRowIterator::GetNextRowSize (void)
 //	Returns the serialized size of the row and advances the pointer.
 
 	{
-	DWORD dwSize = CAeonRowValue::GetSerializedKeySize(m_Data[m_iEntryCursor].sKey)
-			+ m_Data[m_iEntryCursor].pSegment->GetRowSize(m_Data[m_iEntryCursor].iPosCursor);
-	
+	DWORD dwSize = GetRowSize();
 	AdvanceWithLimits();
 	return dwSize;
 	}
@@ -382,6 +515,35 @@ void CRowIterator::GetRow (CRowKey *retKey, CDatum *retdData, SEQUENCENUMBER *re
 
 	{
 	m_Data[m_iEntryCursor].pSegment->GetRow(m_Data[m_iEntryCursor].iPosCursor, retKey, retdData, retRowID);
+
+	if (retdData)
+		{
+		if (IsHidden(*retdData))
+			*retdData = CDatum();
+		else
+			*retdData = m_Expiration.StripField(*retdData);
+		}
+	}
+
+DWORD CRowIterator::GetRowSize (void)
+
+//	GetRowSize
+//
+//	Returns the serialized size of the current row (without advancing). A
+//	hidden row is the size of a nil row (which is what we would write).
+
+	{
+	DWORD dwDataSize;
+	if (IsHidden())
+		{
+		CAeonRowValue NilValue;
+		NilValue.SetValue(CDatum());
+		dwDataSize = NilValue.GetSerializedSize();
+		}
+	else
+		dwDataSize = m_Data[m_iEntryCursor].pSegment->GetRowSize(m_Data[m_iEntryCursor].iPosCursor);
+
+	return CAeonRowValue::GetSerializedKeySize(m_Data[m_iEntryCursor].sKey) + dwDataSize;
 	}
 
 bool CRowIterator::HasMore (void)
@@ -394,6 +556,53 @@ bool CRowIterator::HasMore (void)
 	return (m_iEntryCursor != -1);
 	}
 
+bool CRowIterator::IsHidden (void)
+
+//	IsHidden
+//
+//	Returns TRUE if the current row has expired or is covered by a range
+//	delete.
+
+	{
+	const SEntry &Entry = m_Data[m_iEntryCursor];
+
+	//	Check range deletes first because we don't need the data
+
+	if (!m_RangeDeletes.IsEmpty() && m_RangeDeletes.IsDeleted(m_Dims, Entry.sKey, Entry.Seq))
+		return true;
+
+	if (!m_Expiration.IsEnabled())
+		return false;
+
+	return m_Expiration.IsExpired(Entry.pSegment->GetData(Entry.iPosCursor), m_ExpirationCutoff);
+	}
+
+bool CRowIterator::IsHidden (CDatum dData)
+
+//	IsHidden
+//
+//	Returns TRUE if the current row (whose data is dData) has expired or is
+//	covered by a range delete.
+
+	{
+	const SEntry &Entry = m_Data[m_iEntryCursor];
+
+	return (m_Expiration.IsExpired(dData, m_ExpirationCutoff)
+			|| (!m_RangeDeletes.IsEmpty() && m_RangeDeletes.IsDeleted(m_Dims, Entry.sKey, Entry.Seq)));
+	}
+
+bool CRowIterator::IsNilRow (void)
+
+//	IsNilRow
+//
+//	Returns TRUE if the current row is nil (deleted, expired, or covered by a
+//	range delete).
+
+	{
+	CDatum dData = m_Data[m_iEntryCursor].pSegment->GetData(m_Data[m_iEntryCursor].iPosCursor);
+	return (dData.IsNil() || IsHidden(dData));
+	}
+
 void CRowIterator::Reset (void)
 
 //	Reset
@@ -435,44 +644,35 @@ bool CRowIterator::SelectKey (const CRowKey &Key)
 			pEntry->sKey = NULL_STR;
 		}
 
-	//	If we found it, then the key is in the right place
+	//	Rebuild the heap. If we found the key, then it will be at the top
+	//	(because all other entries are positioned at or after it and ties go to
+	//	the earliest entry).
+
+	HeapBuild();
+	m_iEntryCursor = HeapTop();
 
 	if (iFound != -1)
-		{
-		m_iEntryCursor = iFound;
 		return true;
-		}
 
-	//	Otherwise, pick the lowest key
+	//	If this is a partial key then see if we at least match all parts of
+	//	the partial key. If so, then we consider it a match.
 
+	else if (m_iEntryCursor != -1 && Key.GetCount() < m_Dims.GetCount())
+		return CRowKey::ComparePartial(m_Dims, Key, CRowKey(m_Dims, m_Data[m_iEntryCursor].sKey));
 	else
-		{
-		int iBestEntry = -1;
-		CString *pBestKey = NULL;
-
-		for (i = 0; i < m_Data.GetCount(); i++)
-			{
-			SEntry *pEntry = &m_Data[i];
-			if (!pEntry->sKey.IsEmpty()
-					&& (pBestKey == NULL || CRowKey::Compare(m_Dims, CRowKey(m_Dims, pEntry->sKey), CRowKey(m_Dims, *pBestKey)) == 1))
-				{
-				pBestKey = &pEntry->sKey;
-				iBestEntry = i;
-				}
-			}
-
-		//	Done
+		return false;
+	}
 
-		m_iEntryCursor = iBestEntry;
+void CRowIterator::SetExpiration (const CAeonRowExpiration &Expiration)
 
-		//	If this is a partial key then see if we at least match all 
-		//	parts of the partial key. If so, then we consider it a match.
+//	SetExpiration
+//
+//	Treat rows that have expired (as of now) as nil. Call before Reset.
 
-		if (pBestKey && Key.GetCount() < m_Dims.GetCount())
-			return CRowKey::ComparePartial(m_Dims, Key, CRowKey(m_Dims, *pBestKey));
-		else
-			return false;
-		}
+	{
+	m_Expiration = Expiration;
+	if (m_Expiration.IsEnabled())
+		m_ExpirationCutoff = m_Expiration.GetCutoff(CDateTime(CDateTime::Now));
 	}
 
 void CRowIterator::SetLimits (const TArray<int> &Limits)
@@ -516,10 +716,53 @@ void CRowIterator::WriteNextRow (IByteStream &Stream, DWORD *retdwKeySize, DWORD
 
 	{
 	CAeonRowValue::SerializeKey(Stream, m_Data[m_iEntryCursor].sKey, retdwKeySize);
-	m_Data[m_iEntryCursor].pSegment->WriteData(Stream, m_Data[m_iEntryCursor].iPosCursor, retdwDataSize, retRowID);
+	if (!WriteIfHidden(Stream, retdwDataSize, retRowID))
+		m_Data[m_iEntryCursor].pSegment->WriteData(Stream, m_Data[m_iEntryCursor].iPosCursor, retdwDataSize, retRowID);
+
+	if (m_bIncludeNil)
+		Advance();
+	else
+		AdvanceUntilNonNil();
+	}
+
+void CRowIterator::WriteNextValue (IByteStream &Stream, DWORD *retdwDataSize, SEQUENCENUMBER *retRowID)
+
+//	WriteNextValue
+//
+//	Serializes the current row's data (but not its key) and advances to the
+//	next row. Callers that encode keys themselves use GetKey first.
+
+	{
+	if (!WriteIfHidden(Stream, retdwDataSize, retRowID))
+		m_Data[m_iEntryCursor].pSegment->WriteData(Stream, m_Data[m_iEntryCursor].iPosCursor, retdwDataSize, retRowID);
 
 	if (m_bIncludeNil)
 		Advance();
 	else
 		AdvanceUntilNonNil();
 	}
+
+bool CRowIterator::WriteIfHidden (IByteStream &Stream, DWORD *retdwDataSize, SEQUENCENUMBER *retRowID)
+
+//	WriteIfHidden
+//
+//	If the current row has expired (or is covered by a range delete), we write
+//	a nil value in its place (keeping the RowID) and return TRUE. This is how
+//	compaction drops hidden data.
+
+	{
+	if (!IsHidden())
+		return false;
+
+	CAeonRowValue NilValue;
+	NilValue.SetValue(CDatum());
+	NilValue.Serialize(Stream);
+
+	if (retdwDataSize)
+		*retdwDataSize = NilValue.GetSerializedSize();
+
+	if (retRowID)
+		m_Data[m_iEntryCursor].pSegment->GetRow(m_Data[m_iEntryCursor].iPosCursor, NULL, NULL, retRowID);
+
+	return true;
+	}
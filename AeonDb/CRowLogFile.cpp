@@ -0,0 +1,304 @@
+//	CRowLogFile.cpp
+//
+//	CRowLogFile class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	Inserts append records to m_Pending (under m_cs) and get back a sequence
+//	number. To make a record durable, the caller calls Commit with that
+//	sequence number (without holding any table lock). The first thread to
+//	get m_csWrite writes everything pending as a single batch; threads that
+//	were waiting on m_csWrite usually find that their records went out in
+//	that same batch and return immediately.
+//
+//	Under syncInterval, a batch that is written but not flushed is flushed by
+//	the next commit after the interval or, if no commit comes, by
+//	CRowLogFlusher (which calls SyncIfStale).
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(ERR_LOG_FAILED,					"Unable to write to recovery file: %s.")
+DECLARE_CONST_STRING(ERR_CANT_FLUSH,					"Unable to flush recovery file: %s.")
+
+CRowLogFile::ESyncPolicies CRowLogFile::m_iSyncPolicy = CRowLogFile::syncBatch;
+DWORD CRowLogFile::m_dwSyncInterval = 0;
+CRowLogFlusher CRowLogFile::m_Flusher;
+
+CRowLogFile::CRowLogFile (void) :
+		m_iRefCount(1),
+		m_dwAppendSeq(0),
+		m_dwDurableSeq(0),
+		m_dwLastSync(0),
+		m_bUnsynced(false),
+		m_bFailed(false)
+
+//	CRowLogFile constructor
+
+	{
+	}
+
+void CRowLogFile::AddRef (void)
+
+//	AddRef
+//
+//	Add a reference. We can't use IRefCounted because commits release their
+//	reference outside of the table lock.
+
+	{
+	CSmartLock Lock(m_cs);
+	m_iRefCount++;
+	}
+
+void CRowLogFile::Append (IMemoryBlock &Record, DWORDLONG *retdwSeq)
+
+//	Append
+//
+//	Appends a record to the pending buffer. The record is not written until
+//	someone calls Commit.
+
+	{
+	CSmartLock Lock(m_cs);
+
+	m_Pending.Write(Record.GetPointer(), Record.GetLength());
+	m_dwAppendSeq++;
+
+	if (retdwSeq)
+		*retdwSeq = m_dwAppendSeq;
+	}
+
+void CRowLogFile::Close (void)
+
+//	Close
+//
+//	Writes out anything pending and closes the file.
+
+	{
+	m_Flusher.Unregister(this);
+
+	Commit(GetLastSeq());
+
+	CSmartLock WriteLock(m_csWrite);
+	if (m_bUnsynced && m_File.IsOpen())
+		m_File.Flush();
+
+	m_bUnsynced = false;
+	m_File.Close();
+	}
+
+bool CRowLogFile::Commit (DWORDLONG dwSeq, CString *retsError)
+
+//	Commit
+//
+//	Waits until all records up to (and including) dwSeq have been written out
+//	(and flushed to disk, depending on the sync policy).
+
+	{
+	CSmartLock WriteLock(m_csWrite);
+
+	//	Take whatever is pending. If our record already went out in someone
+	//	else's batch, then we're done.
+
+	CBuffer Batch;
+	DWORDLONG dwBatchSeq;
+		{
+		CSmartLock Lock(m_cs);
+		if (m_dwDurableSeq >= dwSeq)
+			return true;
+
+		if (m_bFailed || !m_File.IsOpen())
+			{
+			if (retsError)
+				*retsError = strPattern(ERR_LOG_FAILED, m_File.GetFilespec());
+			return false;
+			}
+
+		Batch.TakeHandoff(m_Pending);
+		dwBatchSeq = m_dwAppendSeq;
+		}
+
+	//	Write the batch. Other threads can keep appending while we wait on the
+	//	disk.
+
+	try
+		{
+		m_File.Write(Batch.GetPointer(), Batch.GetLength());
+
+		if (ShouldSync())
+			{
+			if (!m_File.Flush())
+				throw CException(errFail, strPattern(ERR_CANT_FLUSH, m_File.GetFilespec()));
+
+			m_dwLastSync = sysGetTickCount();
+			m_bUnsynced = false;
+			}
+		else
+			m_bUnsynced = true;
+		}
+	catch (CException e)
+		{
+		CSmartLock Lock(m_cs);
+		m_bFailed = true;
+
+		if (retsError)
+			*retsError = e.GetErrorString();
+		return false;
+		}
+	catch (...)
+		{
+		CSmartLock Lock(m_cs);
+		m_bFailed = true;
+
+		if (retsError)
+			*retsError = strPattern(ERR_LOG_FAILED, m_File.GetFilespec());
+		return false;
+		}
+
+	//	Done
+
+	CSmartLock Lock(m_cs);
+	m_dwDurableSeq = dwBatchSeq;
+	return true;
+	}
+
+DWORDLONG CRowLogFile::GetLastSeq (void)
+
+//	GetLastSeq
+//
+//	Returns the sequence number of the last record appended.
+
+	{
+	CSmartLock Lock(m_cs);
+	return m_dwAppendSeq;
+	}
+
+CRowLogFile::ESyncPolicies CRowLogFile::GetSyncPolicy (DWORD *retdwIntervalMS)
+
+//	GetSyncPolicy
+//
+//	Returns the current sync policy.
+
+	{
+	if (retdwIntervalMS)
+		*retdwIntervalMS = m_dwSyncInterval;
+
+	return m_iSyncPolicy;
+	}
+
+bool CRowLogFile::IsDurable (DWORDLONG dwSeq)
+
+//	IsDurable
+//
+//	Returns TRUE if all records up to dwSeq have been committed.
+
+	{
+	CSmartLock Lock(m_cs);
+	return (m_dwDurableSeq >= dwSeq);
+	}
+
+void CRowLogFile::Release (void)
+
+//	Release
+//
+//	Release a reference.
+
+	{
+	m_cs.Lock();
+	bool bDelete = (--m_iRefCount == 0);
+	m_cs.Unlock();
+
+	if (bDelete)
+		delete this;
+	}
+
+bool CRowLogFile::Reset (void *pHeader, DWORD dwHeaderSize)
+
+//	Reset
+//
+//	Truncates the file to just the given header. Callers use this after the
+//	rows have been saved elsewhere, so we discard anything pending and treat
+//	all records so far as committed.
+
+	{
+	CSmartLock WriteLock(m_csWrite);
+
+		{
+		CSmartLock Lock(m_cs);
+		m_Pending.SetLength(0);
+		m_Pending.Seek(0);
+		m_dwDurableSeq = m_dwAppendSeq;
+		m_bFailed = false;
+		}
+
+	m_bUnsynced = false;
+
+	try
+		{
+		m_File.Seek(0);
+		m_File.Write(pHeader, dwHeaderSize);
+		}
+	catch (...)
+		{
+		return false;
+		}
+
+	return m_File.SetLength(dwHeaderSize);
+	}
+
+void CRowLogFile::SetSyncPolicy (ESyncPolicies iPolicy, DWORD dwIntervalMS)
+
+//	SetSyncPolicy
+//
+//	Sets the policy for flushing recovery files to disk (for all files).
+
+	{
+	m_iSyncPolicy = iPolicy;
+	m_dwSyncInterval = dwIntervalMS;
+	}
+
+bool CRowLogFile::ShouldSync (void)
+
+//	ShouldSync
+//
+//	Returns TRUE if we should flush the current batch to disk. Must be called
+//	inside m_csWrite.
+
+	{
+	switch (m_iSyncPolicy)
+		{
+		case syncBatch:
+			return true;
+
+		case syncInterval:
+			return (m_dwLastSync == 0 || sysGetTicksElapsed(m_dwLastSync) >= m_dwSyncInterval);
+
+		default:
+			return false;
+		}
+	}
+
+void CRowLogFile::SyncIfStale (void)
+
+//	SyncIfStale
+//
+//	Under the syncInterval policy, flushes the file if a batch has been
+//	written but not flushed for at least the interval.
+
+	{
+	if (m_iSyncPolicy != syncInterval)
+		return;
+
+	CSmartLock WriteLock(m_csWrite);
+	if (!m_bUnsynced
+			|| !m_File.IsOpen()
+			|| (m_dwLastSync != 0 && sysGetTicksElapsed(m_dwLastSync) < m_dwSyncInterval))
+		return;
+
+	if (!m_File.Flush())
+		{
+		CSmartLock Lock(m_cs);
+		m_bFailed = true;
+		return;
+		}
+
+	m_dwLastSync = sysGetTickCount();
+	m_bUnsynced = false;
+	}
@@ -0,0 +1,122 @@
+//	CRowLogFlusher.cpp
+//
+//	CRowLogFlusher class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	Logs register when they are opened and unregister when they are closed.
+//	Owners always close a log before releasing their reference, so every log
+//	in our list is alive and we can add a reference of our own (under our
+//	lock) before flushing it.
+
+#include "stdafx.h"
+
+const DWORD IDLE_INTERVAL =					1000;
+
+void CRowLogFlusher::Register (CRowLogFile *pLog)
+
+//	Register
+//
+//	Adds a log to flush.
+
+	{
+	CSmartLock Lock(m_cs);
+	m_Logs.Insert(pLog);
+	}
+
+void CRowLogFlusher::Run (void)
+
+//	Run
+//
+//	Flusher thread
+
+	{
+	int i;
+
+	while (true)
+		{
+		//	Wake up often enough to meet the sync interval. If we're not using
+		//	syncInterval, we just check once in a while in case it changes.
+
+		DWORD dwInterval;
+		if (CRowLogFile::GetSyncPolicy(&dwInterval) != CRowLogFile::syncInterval || dwInterval == 0)
+			dwInterval = IDLE_INTERVAL;
+
+		if (m_Quit.Wait(dwInterval))
+			return;
+
+		//	Get the list of logs
+
+		TArray<CRowLogFile *> Logs;
+			{
+			CSmartLock Lock(m_cs);
+			Logs = m_Logs;
+			for (i = 0; i < Logs.GetCount(); i++)
+				Logs[i]->AddRef();
+			}
+
+		//	Flush any that are stale
+
+		for (i = 0; i < Logs.GetCount(); i++)
+			{
+			Logs[i]->SyncIfStale();
+			Logs[i]->Release();
+			}
+		}
+	}
+
+void CRowLogFlusher::StartFlusher (void)
+
+//	StartFlusher
+//
+//	Starts the thread.
+
+	{
+	CSmartLock Lock(m_cs);
+	if (m_bRunning)
+		return;
+
+	m_Quit.Create();
+	m_bRunning = true;
+
+	Start();
+	}
+
+void CRowLogFlusher::StopFlusher (void)
+
+//	StopFlusher
+//
+//	Stops the thread.
+
+	{
+		{
+		CSmartLock Lock(m_cs);
+		if (!m_bRunning)
+			return;
+
+		m_Quit.Set();
+		}
+
+	Wait();
+
+	CSmartLock Lock(m_cs);
+	m_bRunning = false;
+	}
+
+void CRowLogFlusher::Unregister (CRowLogFile *pLog)
+
+//	Unregister
+//
+//	Removes a log. On return we won't touch it again (except to release a
+//	reference we already hold).
+
+	{
+	int i;
+
+	CSmartLock Lock(m_cs);
+	for (i = 0; i < m_Logs.GetCount(); i++)
+		if (m_Logs[i] == pLog)
+			{
+			m_Logs.Delete(i);
+			break;
+			}
+	}
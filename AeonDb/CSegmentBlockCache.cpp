@@ -5,6 +5,20 @@
 
 #include "stdafx.h"
 
+const DWORD TOUCH_PAGE_SIZE =				4096;
+
+DECLARE_CONST_STRING(ERR_BAD_BLOCK_CHECKSUM,	"Checksum mismatch in segment block at offset %d: %s.")
+
+CAeonBlockCache CSegmentBlockCache::m_SharedCache;
+CAeonReadAhead CSegmentBlockCache::m_ReadAhead;
+
+//	32-bit processes don't have the address space to map every segment. We
+//	count segments on each path so that Arc.getStatus shows which one we use.
+
+bool CSegmentBlockCache::m_bMapSegments = (sizeof(void *) >= 8);
+volatile LONG CSegmentBlockCache::m_iMappedCount = 0;
+volatile LONG CSegmentBlockCache::m_iUnmappedCount = 0;
+
 CSegmentBlockCache::~CSegmentBlockCache (void)
 
 //	CSegmentBlockCache destructor
@@ -13,116 +27,159 @@ CSegmentBlockCache::~CSegmentBlockCache (void)
 	Term();
 	}
 
-void CSegmentBlockCache::FreeUnloadedBlocks (void)
+char *CSegmentBlockCache::DecompressBlock (const char *pData, DWORD dwDataSize, DWORD *retdwSize)
 
-//	FreeUnloadedBlocks
+//	DecompressBlock
 //
-//	Frees as many blocks as possible to get 1 below the cache size
+//	Decompresses a block as stored on disk and returns a newly allocated
+//	buffer (which the caller must free with delete []). We throw on error.
 
 	{
-	int i;
+	if (dwDataSize < sizeof(SCompressedBlockHeader))
+		throw CException(errFail);
 
-	while (m_Cache.GetCount() > m_iCacheSize - 1)
-		{
-		//	Find the least recently accessed unloaded block
+	const SCompressedBlockHeader *pHeader = (const SCompressedBlockHeader *)pData;
+	CBuffer Compressed((LPVOID)(pData + sizeof(SCompressedBlockHeader)), (int)(dwDataSize - sizeof(SCompressedBlockHeader)), false);
 
-		int iBestBlock = -1;
-		DWORD dwBestAccess;
-		for (i = 0; i < m_Cache.GetCount(); i++)
-			{
-			if (m_Cache[i].dwRefCount == 0)
-				{
-				if (iBestBlock == -1 || m_Cache[i].dwLastAccess < dwBestAccess)
-					{
-					dwBestAccess = m_Cache[i].dwLastAccess;
-					iBestBlock = i;
-					}
-				}
-			}
-
-		//	If we could not find an approprate block, then we're done
-
-		if (iBestBlock == -1)
-			return;
+	CBuffer Block;
+	compDecompress(Compressed, (ECompressionTypes)pHeader->dwCodec, &Block);
+	if ((DWORD)Block.GetLength() != pHeader->dwSize || Block.GetLength() == 0)
+		throw CException(errFail);
 
-		//	Otherwise, free the block
-
-		delete m_Cache[iBestBlock].pBlock;
-		m_Cache.Delete(iBestBlock);
-		}
+	*retdwSize = Block.GetLength();
+	return (char *)Block.GetHandoff();
 	}
 
-bool CSegmentBlockCache::Init (const CString &sFilespec, int iCacheSize)
+bool CSegmentBlockCache::Init (const CString &sFilespec, bool bCompressed)
 
 //	Init
 //
 //	Initialize the block cache
 
 	{
+	m_bCompressed = bCompressed;
+
 	//	Open the segment
 
 	if (!m_File.Create(sFilespec, CFile::FLAG_OPEN_READ_ONLY))
 		return false;
 
-	//	Set some variables
+	//	Map the file, if we can. Segments never change once written, so the
+	//	mapping stays valid until we close. If this fails, we just read blocks
+	//	from m_File.
+
+	if (m_bMapSegments)
+		m_Map.OpenReadOnly(sFilespec);
 
-	m_iCacheSize = iCacheSize;
+	if (m_Map.IsOpen())
+		::InterlockedIncrement(&m_iMappedCount);
+	else
+		::InterlockedIncrement(&m_iUnmappedCount);
+
+	//	Get an ID so the shared cache can tell our blocks apart
+
+	m_dwSegmentID = m_SharedCache.CreateSegmentID();
 
 	//	Done
 
 	return true;
 	}
 
-void CSegmentBlockCache::LoadBlock (DWORD dwOffset, DWORD dwBlockSize, void **retpBlock)
+void CSegmentBlockCache::LoadBlock (int iBlock, DWORD dwOffset, DWORD dwBlockSize, void **retpBlock)
 
 //	LoadBlock
 //
-//	Loads a block. Caller must call UnloadBlock when done.
+//	Loads a block. Caller must call UnloadBlock when done. If we have
+//	checksums, we verify the block the first time we read it from disk (we
+//	throw CFileException on mismatch).
 
 	{
-	ASSERT(m_iCacheSize != -1);
+	ASSERT(m_dwSegmentID != 0);
 	ASSERT(dwBlockSize > 0);
 
-	//	Look for the block in the cache. If it is not there, then we
-	//	need to load it from disk.
-
-	SEntry *pEntry = m_Cache.GetAt(dwOffset);
-	if (pEntry == NULL)
+	void *pBlock;
+	if (m_Map.IsOpen())
 		{
-		//	Free a block from the cache, if necessary
+		if ((DWORDLONG)dwOffset + dwBlockSize > m_Map.GetLength())
+			throw CException(errFail);
 
-		FreeUnloadedBlocks();
+		//	Uncompressed blocks are used in place. The shared cache never sees
+		//	them, so we remember which ones we've verified.
 
-		//	Allocate a block of sufficient size
+		if (!m_bCompressed)
+			{
+			pBlock = m_Map.GetPointer() + dwOffset;
 
-		void *pBlock = new char [dwBlockSize];
+			const DWORD *pChecksum = GetChecksum(iBlock);
+			if (pChecksum && !m_Verified[iBlock])
+				{
+				VerifyBlock(m_File, dwOffset, pBlock, dwBlockSize, *pChecksum);
+				m_Verified[iBlock] = 1;
+				}
+			}
+		else
+			pBlock = m_SharedCache.LoadBlock(m_dwSegmentID, m_File, dwOffset, dwBlockSize, true, m_Map.GetPointer(), GetChecksum(iBlock));
+		}
+	else
+		pBlock = m_SharedCache.LoadBlock(m_dwSegmentID, m_File, dwOffset, dwBlockSize, m_bCompressed, NULL, GetChecksum(iBlock));
 
-		//	Load from disk
+	if (retpBlock)
+		*retpBlock = pBlock;
+	}
 
-		try
-			{
-			m_File.Seek(dwOffset);
-			DWORD dwBytesRead = m_File.Read(pBlock, dwBlockSize);
-			}
-		catch (...)
-			{
-			delete pBlock;
-			throw;
-			}
+void CSegmentBlockCache::Prefetch (int iBlock, DWORD dwOffset, DWORD dwBlockSize)
 
-		//	Insert the entry
+//	Prefetch
+//
+//	Makes sure the given block is in memory so that a later LoadBlock doesn't
+//	wait on the disk. We only do this for mapped files: compressed blocks get
+//	decompressed into the shared cache; uncompressed blocks get paged in by
+//	touching them (or by verifying them, which touches every byte).
 
-		pEntry = m_Cache.Insert(dwOffset);
-		pEntry->dwRefCount = 0;
-		pEntry->pBlock = pBlock;
+	{
+	DWORD i;
+
+	if (!m_Map.IsOpen() || dwBlockSize == 0 || (DWORDLONG)dwOffset + dwBlockSize > m_Map.GetLength())
+		return;
+
+	if (m_bCompressed)
+		{
+		m_SharedCache.LoadBlock(m_dwSegmentID, m_File, dwOffset, dwBlockSize, true, m_Map.GetPointer(), GetChecksum(iBlock));
+		m_SharedCache.UnloadBlock(m_dwSegmentID, dwOffset);
+		}
+	else if (GetChecksum(iBlock) && !m_Verified[iBlock])
+		{
+		VerifyBlock(m_File, dwOffset, m_Map.GetPointer() + dwOffset, dwBlockSize, *GetChecksum(iBlock));
+		m_Verified[iBlock] = 1;
 		}
+	else
+		{
+		//	NOTE: volatile so that the reads aren't optimized away.
 
-	//	Return the entry
+		volatile const char *pBlock = m_Map.GetPointer() + dwOffset;
+		for (i = 0; i < dwBlockSize; i += TOUCH_PAGE_SIZE)
+			pBlock[i];
 
-	pEntry->dwRefCount++;
-	pEntry->dwLastAccess = sysGetTickCount();
-	if (retpBlock)
-		*retpBlock = pEntry->pBlock;
+		pBlock[dwBlockSize - 1];
+		}
+	}
+
+void CSegmentBlockCache::SetChecksums (const TArray<DWORD> &Checksums)
+
+//	SetChecksums
+//
+//	Sets the CRC32C of each block on disk (by block index). We verify blocks
+//	against these as we load them.
+
+	{
+	int i;
+
+	m_Checksums = Checksums;
+
+	m_Verified.DeleteAll();
+	m_Verified.InsertEmpty(m_Checksums.GetCount());
+	for (i = 0; i < m_Verified.GetCount(); i++)
+		m_Verified[i] = 0;
 	}
 
 void CSegmentBlockCache::Term (void)
@@ -132,21 +189,25 @@ void CSegmentBlockCache::Term (void)
 //	Free the cache and closes the file
 
 	{
-	int i;
-
 	//	Close the file
 
+	if (m_Map.IsOpen())
+		{
+		::InterlockedDecrement(&m_iMappedCount);
+		m_Map.Close();
+		}
+	else if (m_File.IsOpen())
+		::InterlockedDecrement(&m_iUnmappedCount);
+
 	m_File.Close();
 
-	//	Delete cache
+	//	Free our blocks from the shared cache
 
-	for (i = 0; i < m_Cache.GetCount(); i++)
+	if (m_dwSegmentID)
 		{
-		ASSERT(m_Cache[i].dwRefCount == 0);
-		delete m_Cache[i].pBlock;
+		m_SharedCache.DeleteSegment(m_dwSegmentID);
+		m_dwSegmentID = 0;
 		}
-
-	m_Cache.DeleteAll();
 	}
 
 void CSegmentBlockCache::UnloadBlock (DWORD dwOffset)
@@ -156,13 +217,23 @@ void CSegmentBlockCache::UnloadBlock (DWORD dwOffset)
 //	Unloads the block
 
 	{
-	//	Get the block from the cache
+	//	Blocks used in place from the mapping aren't in the shared cache.
 
-	SEntry *pEntry = m_Cache.GetAt(dwOffset);
-	if (pEntry)
-		{
-		ASSERT(pEntry->dwRefCount > 0);
-		if (pEntry->dwRefCount > 0)
-			pEntry->dwRefCount--;
-		}
+	if (m_Map.IsOpen() && !m_bCompressed)
+		return;
+
+	m_SharedCache.UnloadBlock(m_dwSegmentID, dwOffset);
+	}
+
+void CSegmentBlockCache::VerifyBlock (const CFile &File, DWORD dwOffset, const void *pData, DWORD dwDataSize, DWORD dwChecksum)
+
+//	VerifyBlock
+//
+//	Makes sure the block (as stored on disk) matches its checksum. If not, we
+//	throw CFileException so that callers treat it like any other disk error
+//	(and switch to the backup).
+
+	{
+	if (utlCRC32C(pData, dwDataSize) != dwChecksum)
+		throw CFileException(errDisk, File.GetFilespec(), 0, strPattern(ERR_BAD_BLOCK_CHECKSUM, dwOffset, File.GetFilespec()));
 	}
@@ -0,0 +1,147 @@
+//	CSegmentBloomFilter.cpp
+//
+//	CSegmentBloomFilter class
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	The filter is stored in the segment file as follows:
+//
+//	DWORD		No. of bits in filter
+//	DWORD		No. of probes per key
+//	BYTEs		bits (padded to DWORD-align)
+//
+//	We derive all probes from a single hash of the encoded key by double
+//	hashing (adding a rotated copy of the hash for each probe).
+
+#include "stdafx.h"
+
+const int MIN_BIT_COUNT =					64;
+
+void CSegmentBloomFilter::Create (const TArray<DWORD> &KeyHashes, int iBitsPerKey)
+
+//	Create
+//
+//	Creates a filter from the given key hashes (from HashKey).
+
+	{
+	int i, j;
+
+	//	The optimal number of probes is ln(2) * bits-per-key. We round down to
+	//	save a little time on lookups.
+
+	m_dwHashCount = (DWORD)Max(1, Min(30, (iBitsPerKey * 69) / 100));
+
+	//	Round up to a whole number of DWORDs
+
+	int iBitCount = Max(MIN_BIT_COUNT, KeyHashes.GetCount() * iBitsPerKey);
+	int iByteCount = AlignUp(iBitCount, 32) / 8;
+	m_dwBitCount = iByteCount * 8;
+
+	m_Bits.DeleteAll();
+	m_Bits.InsertEmpty(iByteCount);
+	utlMemSet(&m_Bits[0], iByteCount, 0);
+
+	//	Set bits
+
+	for (i = 0; i < KeyHashes.GetCount(); i++)
+		{
+		DWORD dwHash = KeyHashes[i];
+		DWORD dwDelta = (dwHash >> 17) | (dwHash << 15);
+
+		for (j = 0; j < (int)m_dwHashCount; j++)
+			{
+			DWORD dwBit = dwHash % m_dwBitCount;
+			m_Bits[dwBit / 8] |= (1 << (dwBit % 8));
+			dwHash += dwDelta;
+			}
+		}
+	}
+
+DWORD CSegmentBloomFilter::HashKey (const CString &sKey)
+
+//	HashKey
+//
+//	Hashes an encoded key
+
+	{
+	return THash<CString>()(sKey);
+	}
+
+bool CSegmentBloomFilter::MayContain (const CString &sKey) const
+
+//	MayContain
+//
+//	Returns FALSE if the key is definitely not in the segment. If we don't
+//	have a filter (older segments) we always return TRUE.
+
+	{
+	int i;
+
+	if (IsEmpty())
+		return true;
+
+	DWORD dwHash = HashKey(sKey);
+	DWORD dwDelta = (dwHash >> 17) | (dwHash << 15);
+
+	for (i = 0; i < (int)m_dwHashCount; i++)
+		{
+		DWORD dwBit = dwHash % m_dwBitCount;
+		if (!(m_Bits[dwBit / 8] & (1 << (dwBit % 8))))
+			return false;
+
+		dwHash += dwDelta;
+		}
+
+	return true;
+	}
+
+bool CSegmentBloomFilter::Read (IByteStream &Stream, DWORD dwSize)
+
+//	Read
+//
+//	Reads the filter from the stream. We throw on I/O error and return FALSE
+//	if the filter is invalid.
+
+	{
+	m_dwBitCount = 0;
+	m_dwHashCount = 0;
+	m_Bits.DeleteAll();
+
+	if (dwSize < 2 * sizeof(DWORD))
+		return false;
+
+	DWORD dwBitCount;
+	DWORD dwHashCount;
+	Stream.ReadChecked(&dwBitCount, sizeof(DWORD));
+	Stream.ReadChecked(&dwHashCount, sizeof(DWORD));
+
+	DWORD dwByteCount = dwBitCount / 8;
+	if (dwBitCount == 0
+			|| (dwBitCount % 32) != 0
+			|| dwHashCount == 0
+			|| dwByteCount != dwSize - 2 * sizeof(DWORD))
+		return false;
+
+	m_Bits.InsertEmpty(dwByteCount);
+	Stream.ReadChecked(&m_Bits[0], dwByteCount);
+
+	m_dwBitCount = dwBitCount;
+	m_dwHashCount = dwHashCount;
+
+	return true;
+	}
+
+void CSegmentBloomFilter::Write (IByteStream &Stream, DWORD *retdwSize) const
+
+//	Write
+//
+//	Writes the filter to the stream.
+
+	{
+	Stream.Write(&m_dwBitCount, sizeof(DWORD));
+	Stream.Write(&m_dwHashCount, sizeof(DWORD));
+	if (m_Bits.GetCount() > 0)
+		Stream.Write(&m_Bits[0], m_Bits.GetCount());
+
+	if (retdwSize)
+		*retdwSize = 2 * sizeof(DWORD) + m_Bits.GetCount();
+	}
@@ -0,0 +1,247 @@
+//	CompactionPolicies.cpp
+//
+//	ICompactionPolicy classes
+//	Copyright (c) 2018 Kronosaur Productions, LLC. All Rights Reserved.
+//
+//	Each segment covers the whole key range of its view, so we can't partition
+//	segments by key the way some LSM stores do. Instead, both policies operate
+//	on contiguous runs of segments (ordered newest to oldest) and differ only in
+//	how they decide which run to merge.
+
+#include "stdafx.h"
+
+DECLARE_CONST_STRING(COMPACTION_LEVELED,				"leveled")
+DECLARE_CONST_STRING(COMPACTION_SIZE_TIERED,			"sizeTiered")
+
+const DWORDLONG SMALL_SEGMENT_SIZE =		10000000;
+const DWORDLONG LEVEL_BASE_SIZE =			10000000;
+const DWORDLONG LEVEL_FANOUT =				10;
+
+const int MIN_TIER_COUNT =					4;
+const int MAX_TIER_COUNT =					16;
+const int MAX_SEGMENT_COUNT =				10;
+const int FALLBACK_MERGE_COUNT =			3;
+
+static CLeveledCompaction g_LeveledPolicy;
+static CSizeTieredCompaction g_SizeTieredPolicy;
+
+//	ICompactionPolicy ----------------------------------------------------------
+
+const ICompactionPolicy &ICompactionPolicy::Get (ETypes iType)
+
+//	Get
+//
+//	Returns the policy of the given type.
+
+	{
+	switch (iType)
+		{
+		case typeLeveled:
+			return g_LeveledPolicy;
+
+		default:
+			return g_SizeTieredPolicy;
+		}
+	}
+
+const CString &ICompactionPolicy::GetTypeID (ETypes iType)
+
+//	GetTypeID
+//
+//	Returns the ID of the given type.
+
+	{
+	switch (iType)
+		{
+		case typeLeveled:
+			return COMPACTION_LEVELED;
+
+		default:
+			return COMPACTION_SIZE_TIERED;
+		}
+	}
+
+bool ICompactionPolicy::ParseTypeID (const CString &sType, ETypes *retiType)
+
+//	ParseTypeID
+//
+//	Parses a policy ID. Returns FALSE if the ID is unknown.
+
+	{
+	if (strEquals(sType, COMPACTION_LEVELED))
+		*retiType = typeLeveled;
+	else if (strEquals(sType, COMPACTION_SIZE_TIERED))
+		*retiType = typeSizeTiered;
+	else
+		return false;
+
+	return true;
+	}
+
+//	CLeveledCompaction ---------------------------------------------------------
+
+int CLeveledCompaction::GetLevel (DWORDLONG dwSize)
+
+//	GetLevel
+//
+//	Returns the level that a segment of the given size belongs to. Level 0 holds
+//	segments up to LEVEL_BASE_SIZE; each level after that is LEVEL_FANOUT times
+//	larger.
+
+	{
+	int iLevel = 0;
+	DWORDLONG dwLevelSize = LEVEL_BASE_SIZE;
+	while (dwSize > dwLevelSize)
+		{
+		iLevel++;
+		dwLevelSize *= LEVEL_FANOUT;
+		}
+
+	return iLevel;
+	}
+
+bool CLeveledCompaction::SelectSegments (const TArray<DWORDLONG> &SegSizes, DWORDLONG dwMaxSize, int *retiStart, int *retiCount) const
+
+//	SelectSegments
+//
+//	Starting with the newest segment, we keep adding older segments as long as
+//	the accumulated run has reached the level of the next segment. Thus newer
+//	data gets pushed down into the next level once there is enough of it, and
+//	each row gets rewritten roughly once per level.
+
+	{
+	int i;
+
+	int iStart = 0;
+	while (iStart < SegSizes.GetCount() - 1)
+		{
+		DWORDLONG dwTotal = SegSizes[iStart];
+		int iEnd = iStart + 1;
+
+		while (iEnd < SegSizes.GetCount()
+				&& GetLevel(dwTotal) >= GetLevel(SegSizes[iEnd])
+				&& dwTotal + SegSizes[iEnd] <= dwMaxSize)
+			{
+			dwTotal += SegSizes[iEnd];
+			iEnd++;
+			}
+
+		if (iEnd - iStart >= 2)
+			{
+			*retiStart = iStart;
+			*retiCount = iEnd - iStart;
+			return true;
+			}
+
+		iStart = iEnd;
+		}
+
+	//	If we've got too many segments, merge the newest few so that reads
+	//	don't have to probe all of them.
+
+	if (SegSizes.GetCount() >= MAX_SEGMENT_COUNT)
+		{
+		DWORDLONG dwTotal = 0;
+		for (i = 0; i < FALLBACK_MERGE_COUNT; i++)
+			dwTotal += SegSizes[i];
+
+		if (dwTotal <= dwMaxSize)
+			{
+			*retiStart = 0;
+			*retiCount = FALLBACK_MERGE_COUNT;
+			return true;
+			}
+		}
+
+	return false;
+	}
+
+//	CSizeTieredCompaction ------------------------------------------------------
+
+bool CSizeTieredCompaction::SelectSegments (const TArray<DWORDLONG> &SegSizes, DWORDLONG dwMaxSize, int *retiStart, int *retiCount) const
+
+//	SelectSegments
+//
+//	We merge runs of segments of similar size. Small segments (which are
+//	cheap to merge) get merged as soon as we have two of them in a row.
+
+	{
+	int i;
+
+	//	First look for adjacent small segments.
+
+	for (i = 0; i < SegSizes.GetCount() - 1; i++)
+		{
+		DWORDLONG dwTotal = SegSizes[i];
+		int iEnd = i;
+		while (iEnd + 1 < SegSizes.GetCount()
+				&& iEnd + 1 - i < MAX_TIER_COUNT
+				&& dwTotal + SegSizes[iEnd + 1] <= SMALL_SEGMENT_SIZE)
+			{
+			iEnd++;
+			dwTotal += SegSizes[iEnd];
+			}
+
+		if (iEnd > i)
+			{
+			*retiStart = i;
+			*retiCount = iEnd - i + 1;
+			return true;
+			}
+		}
+
+	//	Now look for a tier: a run of segments whose sizes are all within a
+	//	factor of two of the run's average.
+
+	for (i = 0; i <= SegSizes.GetCount() - MIN_TIER_COUNT; i++)
+		{
+		DWORDLONG dwTotal = SegSizes[i];
+		int iCount = 1;
+		while (i + iCount < SegSizes.GetCount() && iCount < MAX_TIER_COUNT)
+			{
+			DWORDLONG dwNext = SegSizes[i + iCount];
+			DWORDLONG dwNewTotal = dwTotal + dwNext;
+			DWORDLONG dwAverage = dwNewTotal / (iCount + 1);
+			if (dwNext * 2 < dwAverage || dwNext > dwAverage * 2 || dwNewTotal > dwMaxSize)
+				break;
+
+			//	Make sure all previous segments are still in the tier.
+
+			int j;
+			for (j = i; j < i + iCount; j++)
+				if (SegSizes[j] * 2 < dwAverage || SegSizes[j] > dwAverage * 2)
+					break;
+
+			if (j < i + iCount)
+				break;
+
+			dwTotal = dwNewTotal;
+			iCount++;
+			}
+
+		if (iCount >= MIN_TIER_COUNT)
+			{
+			*retiStart = i;
+			*retiCount = iCount;
+			return true;
+			}
+		}
+
+	//	If we've got too many segments, merge the newest few.
+
+	if (SegSizes.GetCount() >= MAX_SEGMENT_COUNT)
+		{
+		DWORDLONG dwTotal = 0;
+		for (i = 0; i < FALLBACK_MERGE_COUNT; i++)
+			dwTotal += SegSizes[i];
+
+		if (dwTotal <= dwMaxSize)
+			{
+			*retiStart = 0;
+			*retiCount = FALLBACK_MERGE_COUNT;
+			return true;
+			}
+		}
+
+	return false;
+	}
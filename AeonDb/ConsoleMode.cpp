@@ -106,12 +106,13 @@ CString CAeonEngine::ConsoleCommand (const CString &sCmd, const TArray<CDatum> &
 		//	Set up flags and options
 
 		DWORD dwFlags = CAeonTable::FLAG_NO_KEY;
+		TArray<CString> Fields;
 
 		//	Ask the table
 
 		CDatum dResult;
 		CString sError;
-		if (!pTable->GetRows(0, Args[1], iRowCount, Limits, dwFlags, &dResult, &sError))
+		if (!pTable->GetRows(0, Args[1], iRowCount, Limits, dwFlags, CDatum(), Fields, &dResult, &sError))
 			return sError;
 
 		return dResult.AsString();
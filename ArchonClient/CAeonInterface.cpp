@@ -12,12 +12,86 @@ DECLARE_CONST_STRING(FIELD_IF_MODIFIED_AFTER,			"ifModifiedAfter")
 DECLARE_CONST_STRING(FIELD_PARTIAL_MAX_SIZE,			"partialMaxSize")
 DECLARE_CONST_STRING(FIELD_PARTIAL_POS,					"partialPos")
 
+DECLARE_CONST_STRING(OPTION_INSERT_NEW,					"insertNew")
+
 DECLARE_CONST_STRING(MSG_AEON_FILE_DOWNLOAD,			"Aeon.fileDownload")
 DECLARE_CONST_STRING(MSG_HYPERION_SERVICE_MSG,			"Hyperion.serviceMsg")
 DECLARE_CONST_STRING(MSG_TRANSPACE_DOWNLOAD,			"Transpace.download")
 
 DECLARE_CONST_STRING(SEPARATOR_SLASH,					"/")
 
+CDatum CAeonInterface::CreateInsertManyPayload (const CString &sTable, const TArray<CDatum> &KeyPaths, const TArray<CDatum> &Data, bool bInsertNew)
+
+//	CreateInsertManyPayload
+//
+//	Creates a payload for Aeon.insertMany:
+//
+//	{tableName} (({rowPath} {data}) ...) [{options}]
+//
+//	If bInsertNew is TRUE we add the insertNew option, which fails the batch
+//	if any of the rows already exist.
+
+	{
+	int i;
+
+	ASSERT(KeyPaths.GetCount() == Data.GetCount());
+
+	CComplexArray *pRows = new CComplexArray;
+	for (i = 0; i < KeyPaths.GetCount(); i++)
+		{
+		CComplexArray *pRow = new CComplexArray;
+		pRow->Insert(KeyPaths[i]);
+		pRow->Insert(Data[i]);
+
+		pRows->Insert(CDatum(pRow));
+		}
+
+	CComplexArray *pPayload = new CComplexArray;
+	pPayload->Insert(sTable);
+	pPayload->Insert(CDatum(pRows));
+
+	if (bInsertNew)
+		{
+		CComplexArray *pOptions = new CComplexArray;
+		pOptions->Insert(OPTION_INSERT_NEW);
+
+		pPayload->Insert(CDatum(pOptions));
+		}
+
+	return CDatum(pPayload);
+	}
+
+CDatum CAeonInterface::CreateMutateManyPayload (const CString &sTable, const TArray<CDatum> &KeyPaths, const TArray<CDatum> &Data, const TArray<CDatum> &MutateDescs)
+
+//	CreateMutateManyPayload
+//
+//	Creates a payload for Aeon.mutateMany:
+//
+//	{tableName} (({rowPath} {data} {mutationDesc}) ...)
+
+	{
+	int i;
+
+	ASSERT(KeyPaths.GetCount() == Data.GetCount() && KeyPaths.GetCount() == MutateDescs.GetCount());
+
+	CComplexArray *pRows = new CComplexArray;
+	for (i = 0; i < KeyPaths.GetCount(); i++)
+		{
+		CComplexArray *pRow = new CComplexArray;
+		pRow->Insert(KeyPaths[i]);
+		pRow->Insert(Data[i]);
+		pRow->Insert(MutateDescs[i]);
+
+		pRows->Insert(CDatum(pRow));
+		}
+
+	CComplexArray *pPayload = new CComplexArray;
+	pPayload->Insert(sTable);
+	pPayload->Insert(CDatum(pRows));
+
+	return CDatum(pPayload);
+	}
+
 CString CAeonInterface::EncodeFilePathComponent (const CString &sValue)
 
 //	EncodeFilePathComponent
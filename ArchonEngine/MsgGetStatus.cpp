@@ -6,6 +6,7 @@
 #include "stdafx.h"
 
 DECLARE_CONST_STRING(ADDRESS_EXARCH_COMMAND,			"Exarch.command@~/CentralModule")
+DECLARE_CONST_STRING(VIRTUAL_PORT_AEON_COMMAND,			"Aeon.command")
 DECLARE_CONST_STRING(VIRTUAL_PORT_ESPER_COMMAND,		"Esper.command")
 DECLARE_CONST_STRING(VIRTUAL_PORT_HYPERION_COMMAND,		"Hyperion.command")
 
@@ -68,6 +69,9 @@ CStatusSession::CStatusSession (CExarchEngine *pEngine)
 
 	Msg.sAddr = VIRTUAL_PORT_ESPER_COMMAND;
 	AddMessage(Msg);
+
+	Msg.sAddr = VIRTUAL_PORT_AEON_COMMAND;
+	AddMessage(Msg);
 	}
 
 CStatusSession::~CStatusSession (void)
@@ -13,6 +13,9 @@ DECLARE_CONST_STRING(STR_FAIL_PATTERN,					"FAIL: %s")
 DECLARE_CONST_STRING(STR_PASS,							"pass")
 DECLARE_CONST_STRING(STR_DEBUG,							"debug")
 
+DECLARE_CONST_STRING(FIELD_DATA,							"data")
+DECLARE_CONST_STRING(FIELD_SCORE,						"score")
+
 DECLARE_CONST_STRING(MSG_ERROR_NO_RIGHT,				"Error.notAllowed")
 DECLARE_CONST_STRING(MSG_ERROR_TIMEOUT,					"Error.timeout")
 DECLARE_CONST_STRING(MSG_ERROR_UNABLE_TO_COMPLY,		"Error.unableToComply")
@@ -27,8 +30,14 @@ DECLARE_CONST_STRING(ERR_NEED_ADMIN,					"Arc.admin rights required.")
 DECLARE_CONST_STRING(ERR_INVALID_PAYLOAD,				"Unable to parse payload: %s.")
 
 const DWORD FLAG_ABORT_ON_FAIL =						0x00000001;
+const DWORD FLAG_SAVE_REPLY =							0x00000002;	//	Remember the reply (e.g., a cursor ID)
+const DWORD FLAG_USE_SAVED_REPLY =						0x00000004;	//	Substitute the saved reply for %s in the payload
+const DWORD FLAG_COMPARE_DATA =							0x00000008;	//	Compare only the data field (e.g., of a download)
+const DWORD FLAG_WAIT_BEFORE =							0x00000010;	//	Wait a couple of seconds before sending (e.g., for a lease to expire)
+const DWORD FLAG_IGNORE_SCORES =						0x00000020;	//	Remove the score field from each row (e.g., of a text search)
 
 const DWORD MESSAGE_TIMEOUT =							30 * 1000;
+const DWORD WAIT_BEFORE_TIME =							2 * 1000;
 
 class CUnitTestSession : public ISessionHandler
 	{
@@ -56,12 +65,14 @@ class CUnitTestSession : public ISessionHandler
 			DWORD dwFlags;
 			};
 
+		static CString RemoveScores (CDatum dRows);
 		void SendMessageCommand (int iPos, DWORD dwTicket);
 
 		TArray<int> m_Messages;					//	List of messages to test
 		int m_iPos;								//	Current message being tested
 		int m_iPass;							//	Number of messages that passed
 		int m_iTimeout;							//	Timeout to wait for reply
+		CString m_sSavedReply;					//	Reply saved by FLAG_SAVE_REPLY
 
 		static STestMessageEntry m_TestMessageList[];
 		static int m_iTestMessageListCount;
@@ -81,8 +92,12 @@ DECLARE_CONST_STRING(ADDR_EXARCH,						"Exarch.command@~/CentralModule")
 DECLARE_CONST_STRING(ADDR_HEXE,							"Hexe.command")
 
 DECLARE_CONST_STRING(MSG_AEON_BAD_COMMAND1,				"Aeon.badCommand")
+DECLARE_CONST_STRING(MSG_AEON_CLOSE_CURSOR,				"Aeon.closeCursor")
+DECLARE_CONST_STRING(MSG_AEON_COMPACT_TABLE_TEST,		"Aeon.compactTableTest")
 DECLARE_CONST_STRING(MSG_AEON_CREATE_TABLE,				"Aeon.createTable")
+DECLARE_CONST_STRING(MSG_AEON_DELETE_RANGE,				"Aeon.deleteRange")
 DECLARE_CONST_STRING(MSG_AEON_DELETE_TABLE,				"Aeon.deleteTable")
+DECLARE_CONST_STRING(MSG_AEON_FETCH_CURSOR,				"Aeon.fetchCursor")
 DECLARE_CONST_STRING(MSG_AEON_FILE_DIRECTORY,			"Aeon.fileDirectory")
 DECLARE_CONST_STRING(MSG_AEON_FILE_DOWNLOAD,			"Aeon.fileDownload")
 DECLARE_CONST_STRING(MSG_AEON_FILE_GET_DESC,			"Aeon.fileGetDesc")
@@ -92,17 +107,50 @@ DECLARE_CONST_STRING(MSG_AEON_GET_KEY_RANGE,			"Aeon.getKeyRange")
 DECLARE_CONST_STRING(MSG_AEON_GET_ROWS,					"Aeon.getRows")
 DECLARE_CONST_STRING(MSG_AEON_GET_TABLES,				"Aeon.getTables")
 DECLARE_CONST_STRING(MSG_AEON_GET_VALUE,				"Aeon.getValue")
+DECLARE_CONST_STRING(MSG_AEON_HOUSEKEEP_TABLE_TEST,		"Aeon.housekeepTableTest")
 DECLARE_CONST_STRING(MSG_AEON_INSERT,					"Aeon.insert")
+DECLARE_CONST_STRING(MSG_AEON_INSERT_MANY,				"Aeon.insertMany")
+DECLARE_CONST_STRING(MSG_AEON_INSERT_NEW,				"Aeon.insertNew")
 DECLARE_CONST_STRING(MSG_AEON_MUTATE,					"Aeon.mutate")
+DECLARE_CONST_STRING(MSG_AEON_MUTATE_MANY,				"Aeon.mutateMany")
+DECLARE_CONST_STRING(MSG_AEON_OPEN_CURSOR,				"Aeon.openCursor")
 DECLARE_CONST_STRING(MSG_AEON_RECOVER_TABLE_TEST,		"Aeon.recoverTableTest")
+DECLARE_CONST_STRING(MSG_AEON_SCRUB_TABLE_TEST,			"Aeon.scrubTableTest")
+DECLARE_CONST_STRING(MSG_AEON_SEARCH_TEXT,				"Aeon.searchText")
+DECLARE_CONST_STRING(MSG_AEON_SET_LEGACY_ROW_FORMAT,	"Aeon.setLegacyRowFormat")
+DECLARE_CONST_STRING(MSG_AEON_SET_LOG_SYNC,				"Aeon.setLogSync")
+DECLARE_CONST_STRING(MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	"Aeon.setSegmentBlockSize")
+DECLARE_CONST_STRING(MSG_AEON_SET_SEGMENT_COMPRESSION,	"Aeon.setSegmentCompression")
+DECLARE_CONST_STRING(MSG_AEON_SET_SEGMENT_MAPPING,		"Aeon.setSegmentMapping")
+DECLARE_CONST_STRING(MSG_AEON_SET_VIEW_UPDATE_THREADS,	"Aeon.setViewUpdateThreads")
 DECLARE_CONST_STRING(MSG_AEON_WAIT_FOR_VIEW,			"Aeon.waitForView")
 DECLARE_CONST_STRING(MSG_AEON_WAIT_FOR_VOLUME,			"Aeon.waitForVolume")
+DECLARE_CONST_STRING(MSG_ARC_GET_STATUS,					"Arc.getStatus")
 DECLARE_CONST_STRING(MSG_EXARCH_CREATE_TEST_VOLUME,		"Exarch.createTestVolume")
 DECLARE_CONST_STRING(MSG_EXARCH_DELETE_TEST_DRIVE,		"Exarch.deleteTestDrive")
 DECLARE_CONST_STRING(MSG_EXARCH_REMOVE_VOLUME,			"Exarch.removeVolume")
 DECLARE_CONST_STRING(MSG_HEXE_RUN,						"Hexe.run")
 DECLARE_CONST_STRING(MSG_OK,							"OK")
 
+#ifdef DEBUG
+//	Rows for the segment format tests. We run them once for each block codec
+//	and segment read path, after selecting them with Aeon.setSegmentCompression
+//	and Aeon.setSegmentMapping.
+
+#define SEGMENT_FORMAT_TEST_ROWS	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((order_000 value_00) (order_001 value_01) (order_002 value_02) (order_003 value_03) (order_004 value_04) (order_005 value_05) (order_006 value_06) (order_007 value_07) (order_008 value_08) (order_009 value_09) (order_010 value_10) (order_011 value_11) (order_012 value_12) (order_013 value_13) (order_014 value_14) (order_015 value_15) (order_016 value_16) (order_017 value_17) (order_018 value_18) (order_019 value_19)))"),	DEF_STRING(""),	0 },	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 order_000)"),	DEF_STRING("value_00"),	0 },	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 order_005)"),	DEF_STRING("value_05"),	0 },	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 order_016)"),	DEF_STRING("value_16"),	0 },	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 order_019)"),	DEF_STRING("value_19"),	0 },	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 order_0165)"),	DEF_STRING("nil"),	0 },	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 100)"),	DEF_STRING("(order_000 value_00 order_001 value_01 order_002 value_02 order_003 value_03 order_004 value_04 order_005 value_05 order_006 value_06 order_007 value_07 order_008 value_08 order_009 value_09 order_010 value_10 order_011 value_11 order_012 value_12 order_013 value_13 order_014 value_14 order_015 value_15 order_016 value_16 order_017 value_17 order_018 value_18 order_019 value_19)"),	0 },	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 order_014 3)"),	DEF_STRING("(order_014 value_14 order_015 value_15 order_016 value_16)"),	0 },	\
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+#endif
+
 CUnitTestSession::STestMessageEntry CUnitTestSession::m_TestMessageList[] =	{
 
 	//	Aeon -----------------------------------------------------------------------------------------------------------
@@ -159,6 +207,84 @@ CUnitTestSession::STestMessageEntry CUnitTestSession::m_TestMessageList[] =	{
 	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_KEY_RANGE,		DEF_STRING("(drhouse_t1 10)"),		DEF_STRING("(row1 row2 row3)"),	0 },
 	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
 
+	//	Test batch inserts
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row2 row2_value) (row1 row1_value) (row3 row3_value)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row4 row4_value) (\"\" dont_support_null_keys)))"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_KEY_RANGE,		DEF_STRING("(drhouse_t1 10)"),		DEF_STRING("(row1 row2 row3)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row4 row4_value) (row1 other_value)) (insertNew))"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row4 row4_value) (row4 other_value)) (insertNew))"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row4 row4_value)) (noSuchOption))"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_KEY_RANGE,		DEF_STRING("(drhouse_t1 10)"),		DEF_STRING("(row1 row2 row3)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row4 row4_value)) (insertNew))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_KEY_RANGE,		DEF_STRING("(drhouse_t1 10)"),		DEF_STRING("(row1 row2 row3 row4)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_MUTATE_MANY,		DEF_STRING("(drhouse_t1 ((row5 { counter:1 } {}) (row5 { counter:2 } { counter:increment })))"),	DEF_STRING("({counter:1} {counter:3})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test row filters and projection
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row1 { name:Gregory status:open }) (row2 { name:Lisa status:closed }) (row3 { name:James status:open })))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:Gregory} {name:Lisa} {name:James})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) \"(lambda (row) (= (@ row 'status) 'open))\" (name))"),	DEF_STRING("({name:Gregory} {name:James})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) \"(lambda (row\" (name))"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"1-noSuchCursor\")"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("(drhouse_t1 \"gregory\")"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test full-text views: indexing, ranking (row1 mentions "house" most; the
+	//	rarer "wilson" outranks a single "house"), and updates and deletes
+	//	removing postings. We flush first because idf counts the rows in
+	//	segments.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} secondaryViews:({ name:text1 type:fullText fields:(title body) }) })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row1 { title:House body:\"House, house.\" }) (row2 { title:Cuddy body:\"Dean of medicine; hired House\" }) (row3 { title:Wilson body:Oncology })))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"house\")"),	DEF_STRING("({primaryKey:row1} {primaryKey:row2})"),	FLAG_IGNORE_SCORES },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"house OR wilson\")"),	DEF_STRING("({primaryKey:row1} {primaryKey:row3} {primaryKey:row2})"),	FLAG_IGNORE_SCORES },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"house OR wilson\" 1)"),	DEF_STRING("({primaryKey:row1})"),	FLAG_IGNORE_SCORES },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"HOUSE medicine\")"),	DEF_STRING("({primaryKey:row2})"),	FLAG_IGNORE_SCORES },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"onco*\")"),	DEF_STRING("({primaryKey:row3})"),	FLAG_IGNORE_SCORES },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"foreman\")"),	DEF_STRING("()"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \" , \")"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row2 { title:Cuddy body:Administrator })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"house\")"),	DEF_STRING("({primaryKey:row1})"),	FLAG_IGNORE_SCORES },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"medicine\")"),	DEF_STRING("()"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"administrator\")"),	DEF_STRING("({primaryKey:row2})"),	FLAG_IGNORE_SCORES },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row1 nil)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"house\")"),	DEF_STRING("()"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test row expiration
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} ttl:{ field:expiresOn } })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row1 { name:Gregory expiresOn:#2013-09-10T0:0:0.0 }) (row2 { name:Lisa expiresOn:#2999-09-10T0:0:0.0 }) (row3 { name:James })))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:Lisa} {name:James})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:Lisa} {name:James})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} ttl:{ seconds:60 } })"),		DEF_STRING("X"),	0 },
+
+	//	Test range deletes
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} y:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 (((a y1) { name:A1 }) ((a y2) { name:A2 }) ((b y1) { name:B1 }) ((c y1) { name:C1 })))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 (a y3) { name:A3 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_RANGE,		DEF_STRING("(drhouse_t1 (a))"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:B1} {name:C1})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_RANGE,		DEF_STRING("(drhouse_t1 (b y1) (c y1))"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 (a y1) { name:A1b })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:A1b} {name:C1})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_RANGE,		DEF_STRING("(drhouse_t1 (c y1) (b y1))"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} secondaryViews:({ name:view1 x:{ key:name keyType:utf8 }}) })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row1 { name:Gregory })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_RANGE,		DEF_STRING("(drhouse_t1 (row1))"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row1)"),	DEF_STRING("{name:Gregory}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
 	//	Test mutators
 
 	{	UT_AEON_MUTATE,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
@@ -478,6 +604,435 @@ CUnitTestSession::STestMessageEntry CUnitTestSession::m_TestMessageList[] =	{
 	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view1) c (10 1 10) noKey)"),	DEF_STRING("()"),	0 },
 	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
 
+	//	Aggregate views
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} secondaryViews:({ name:view1 type:aggregate x:{ key:lastName keyType:utf8 } aggregates:{ total:(sum score) } }) })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row1 { firstName:Albert lastName:Zerg score:100 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row2 { firstName:Betty lastName:Yanis score:150 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row4 { firstName:Dana lastName:Zerg score:250 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view1) nil 10 noKey)"),	DEF_STRING("({count:1 total:150} {count:2 total:350})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row4 nil)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view1) nil 10 noKey)"),	DEF_STRING("({count:1 total:150} {count:1 total:100})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} secondaryViews:({ name:view1 type:aggregate x:{ key:lastName keyType:utf8 } aggregates:{ hi:(max score) lo:(min score) } }) })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row1 { firstName:Albert lastName:Zerg score:100 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row2 { firstName:Betty lastName:Zerg score:150 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row4 { firstName:Dana lastName:Zerg score:250 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view1) nil 10 noKey)"),	DEF_STRING("({count:3 hi:250 lo:100})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row4 nil)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view1) nil 10 noKey)"),	DEF_STRING("({count:2 hi:150 lo:100})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row1 { firstName:Albert lastName:Zerg score:200 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view1) nil 10 noKey)"),	DEF_STRING("({count:2 hi:200 lo:150})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test point lookups across segments. Each segment has a Bloom filter, so
+	//	lookups skip segments that can't have the key; make sure we still find
+	//	keys in older segments and the newest version of each row.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((apple apple_value) (banana banana_value) (cherry cherry_value) (date date_value) (elder elder_value)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((fig fig_value) (grape grape_value)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 banana banana_modified)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 apple)"),	DEF_STRING("apple_value"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 banana)"),	DEF_STRING("banana_modified"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 elder)"),	DEF_STRING("elder_value"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 grape)"),	DEF_STRING("grape_value"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 blueberry)"),	DEF_STRING("nil"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 zucchini)"),	DEF_STRING("nil"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_NEW,		DEF_STRING("(drhouse_t1 cherry cherry_modified)"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_NEW,		DEF_STRING("(drhouse_t1 kiwi kiwi_value)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 cherry)"),	DEF_STRING("cherry_value"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_KEY_RANGE,		DEF_STRING("(drhouse_t1 10)"),		DEF_STRING("(apple banana cherry date elder fig grape kiwi)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test merging rows from several segments and the in-memory rows. The
+	//	newest version of each row wins and deleted rows are skipped, even when
+	//	the delete is in a newer segment than the row.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((a a1) (b b1) (c c1) (d d1)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((b b2) (c nil) (e e2)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((a a3) (f f3)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((d nil) (e e4) (g g4)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("(a a3 b b2 e e4 f f3 g g4)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 b 3)"),	DEF_STRING("(b b2 e e4 f f3)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_KEY_RANGE,		DEF_STRING("(drhouse_t1 3)"),		DEF_STRING("(a b e)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test in-memory rows inserted out of order, overwritten, and deleted.
+	//	They must come back sorted, with the latest version of each row, both
+	//	from memory and after they are saved to a segment.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} y:{keyType:int32} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 (((m 2) m2) ((c 1) c1) ((x 5) x5) ((c 3) c3) ((m 1) m1) ((a 9) a9)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 (c 1) c1_modified)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 (x 5) nil)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 (c 1))"),	DEF_STRING("c1_modified"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 (x 5))"),	DEF_STRING("nil"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("((a 9) a9 (c 1) c1_modified (c 3) c3 (m 1) m1 (m 2) m2)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 (m 1) 10)"),	DEF_STRING("((m 1) m1 (m 2) m2)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("((a 9) a9 (c 1) c1_modified (c 3) c3 (m 1) m1 (m 2) m2)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 (c 2) c2)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 c (10 1 10))"),	DEF_STRING("((c 1) c1_modified (c 2) c2 (c 3) c3)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test that every type round-trips through the binary row format: in
+	//	memory, in a segment, and when replayed from the recovery log.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row1 { a:(1 two 3.25 (nested list)) d:3.25 i0:0 i1:-1 i2:300000000 i3:-300000000 s:\"hello world\" sub:{ x:1 y:(true) } t:true when:#2013-09-20T10:30:05.0 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row1)"),	DEF_STRING("{a:(1 two 3.25 (nested list)) d:3.25 i0:0 i1:-1 i2:300000000 i3:-300000000 s:\"hello world\" sub:{x:1 y:(true)} t:true when:#2013-09-20T10:30:05.0000}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row1)"),	DEF_STRING("{a:(1 two 3.25 (nested list)) d:3.25 i0:0 i1:-1 i2:300000000 i3:-300000000 s:\"hello world\" sub:{x:1 y:(true)} t:true when:#2013-09-20T10:30:05.0000}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row2 { a:(1 two 3.25 (nested list)) d:3.25 i0:0 i1:-1 i2:300000000 i3:-300000000 s:\"hello world\" sub:{ x:1 y:(true) } t:true when:#2013-09-20T10:30:05.0 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_RECOVER_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row2)"),	DEF_STRING("{a:(1 two 3.25 (nested list)) d:3.25 i0:0 i1:-1 i2:300000000 i3:-300000000 s:\"hello world\" sub:{x:1 y:(true)} t:true when:#2013-09-20T10:30:05.0000}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+#ifdef DEBUG
+	//	Test the recovery log under each sync policy. Aeon.recoverTableTest
+	//	reloads the in-memory rows from the log; with tornTail it first leaves a
+	//	partial record at the end, which recovery must drop (and later records
+	//	must still be readable).
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LOG_SYNC,		DEF_STRING("(interval 50)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row1 row1_value) (row2 row2_value) (row3 row3_value)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row2 row2_modified)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_RECOVER_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("(row1 row1_value row2 row2_modified row3 row3_value)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LOG_SYNC,		DEF_STRING("(os)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row4 row4_value)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_RECOVER_TABLE_TEST,	DEF_STRING("(drhouse_t1 tornTail)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("(row1 row1_value row2 row2_modified row3 row3_value row4 row4_value)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LOG_SYNC,		DEF_STRING("(batch)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row5 row5_value)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_RECOVER_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("(row1 row1_value row2 row2_modified row3 row3_value row4 row4_value row5 row5_value)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LOG_SYNC,		DEF_STRING("(sometimes)"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LOG_SYNC,		DEF_STRING("(interval)"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LOG_SYNC,		DEF_STRING("(interval 0)"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LOG_SYNC,		DEF_STRING("(interval -50)"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LOG_SYNC,		DEF_STRING("(interval 2.5)"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LOG_SYNC,		DEF_STRING("(interval \"50\")"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LOG_SYNC,		DEF_STRING("(batch 2.5)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test compaction: a cursor opened before a merge still reads the rows
+	//	from the old segments; reads after the merge see the same rows.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} compaction:sizeTiered })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((a a1) (c c1) (e e1)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((b b2) (c c2) (f f2)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((d d3) (e e3)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 f nil)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_OPEN_CURSOR,		DEF_STRING("(drhouse_t1)"),		DEF_STRING("-"),	FLAG_ABORT_ON_FAIL | FLAG_SAVE_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_COMPACT_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING("(a a1 b b2 c c2 d d3 e e3)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING("nil"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("(a a1 b b2 c c2 d d3 e e3)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 f)"),	DEF_STRING("nil"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_COMPACT_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_COMPACT_TABLE_TEST,	DEF_STRING("(noSuchTable)"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} compaction:leveled })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((a a1) (b b1)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((b b2) (c c2)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_COMPACT_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("(a a1 b b2 c c2)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test that compaction drops expired rows (from views too). We remove the
+	//	ttl afterwards: dropped rows stay gone. View rows only show the ttl field
+	//	if the view lists it as a column.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} compaction:leveled ttl:{ field:expiresOn } secondaryViews:({ name:view1 x:{ key:name keyType:utf8 }} { name:view2 x:{ key:name keyType:utf8 } columns:(primaryKey expiresOn) }) })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row1 { name:Gregory expiresOn:#2013-09-10T0:0:0.0 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row2 { name:Lisa expiresOn:#2999-09-10T0:0:0.0 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row3 { name:James })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view1) nil 10)"),	DEF_STRING("((James 3) {primaryKey:row3} (Lisa 2) {primaryKey:row2})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view2) nil 10)"),	DEF_STRING("((James 3) {primaryKey:row3} (Lisa 2) {expiresOn:#2999-09-10T00:00:00.0000 primaryKey:row2})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_COMPACT_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view1) nil 10)"),	DEF_STRING("((James 3) {primaryKey:row3} (Lisa 2) {primaryKey:row2})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} compaction:leveled secondaryViews:({ name:view1 x:{ key:name keyType:utf8 }} { name:view2 x:{ key:name keyType:utf8 } columns:(primaryKey expiresOn) }) })"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:Lisa} {name:James})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view2) nil 10)"),	DEF_STRING("((James 3) {primaryKey:row3} (Lisa 2) {expiresOn:#2999-09-10T00:00:00.0000 primaryKey:row2})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test that range deletes survive recovery, saving, and compaction (which
+	//	drops them along with the rows they cover).
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} y:{keyType:utf8} compaction:leveled })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 (((a y1) { name:A1 }) ((a y2) { name:A2 }) ((b y1) { name:B1 })))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 (a y3) { name:A3 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_RANGE,		DEF_STRING("(drhouse_t1 (a))"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 (a y4) { name:A4 })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_RECOVER_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:A4} {name:B1})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:A4} {name:B1})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_COMPACT_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:A4} {name:B1})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 (a y1) { name:A1b })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:A1b} {name:A4} {name:B1})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test segments whose rows were saved as AEONScript (before the binary
+	//	format). We must read them next to binary rows, and a merge must
+	//	convert them.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LEGACY_ROW_FORMAT,	DEF_STRING("(true)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} compaction:leveled })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row1 { name:Ann score:100 }) (row2 (1 2 3)) (row3 \"text value\")))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_LEGACY_ROW_FORMAT,	DEF_STRING("(nil)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row4 { name:Dana })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row1)"),	DEF_STRING("{name:Ann score:100}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row3)"),	DEF_STRING("text value"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("(row1 {name:Ann score:100} row2 (1 2 3) row3 \"text value\" row4 {name:Dana})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_COMPACT_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("(row1 {name:Ann score:100} row2 (1 2 3) row3 \"text value\" row4 {name:Dana})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+#endif
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} compaction:bogus })"),		DEF_STRING("X"),	0 },
+
+#ifdef DEBUG
+	//	Test block compression and key prefix compression. A small block size
+	//	gives several blocks, and more than 16 keys sharing a prefix cross a
+	//	key restart point. Each codec must round-trip the same rows; at the end
+	//	we restore the default codec and block size.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	DEF_STRING("(256)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(none)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	SEGMENT_FORMAT_TEST_ROWS
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(lz)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	SEGMENT_FORMAT_TEST_ROWS
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(zlib)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	SEGMENT_FORMAT_TEST_ROWS
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(bzip)"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	DEF_STRING("(-1)"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(lz)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	DEF_STRING("(0)"),		DEF_STRING(""),	0 },
+
+	//	Test both segment read paths. Mapped segments (the default, used above)
+	//	read uncompressed blocks in place and decompress the rest from the
+	//	mapping; unmapped segments read every block into the block cache. We run
+	//	the same rows for each codec without mapping, then restore the defaults.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	DEF_STRING("(256)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_MAPPING,	DEF_STRING("(nil)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(none)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	SEGMENT_FORMAT_TEST_ROWS
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(lz)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	SEGMENT_FORMAT_TEST_ROWS
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(zlib)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	SEGMENT_FORMAT_TEST_ROWS
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(lz)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_MAPPING,	DEF_STRING("(true)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	DEF_STRING("(0)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_ARC_GET_STATUS,			DEF_STRING(""),		DEF_STRING("-"),	0 },
+
+	//	Test sequential scans over many small blocks, which start read-ahead
+	//	after a couple of blocks. A cursor fetched a row at a time must see the
+	//	same rows in the same order as a single scan.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	DEF_STRING("(64)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row_000 value_00) (row_001 value_01) (row_002 value_02) (row_003 value_03) (row_004 value_04) (row_005 value_05) (row_006 value_06) (row_007 value_07) (row_008 value_08) (row_009 value_09) (row_010 value_10) (row_011 value_11) (row_012 value_12) (row_013 value_13) (row_014 value_14) (row_015 value_15) (row_016 value_16) (row_017 value_17) (row_018 value_18) (row_019 value_19) (row_020 value_20) (row_021 value_21) (row_022 value_22) (row_023 value_23)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	DEF_STRING("(0)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 100)"),	DEF_STRING("(row_000 value_00 row_001 value_01 row_002 value_02 row_003 value_03 row_004 value_04 row_005 value_05 row_006 value_06 row_007 value_07 row_008 value_08 row_009 value_09 row_010 value_10 row_011 value_11 row_012 value_12 row_013 value_13 row_014 value_14 row_015 value_15 row_016 value_16 row_017 value_17 row_018 value_18 row_019 value_19 row_020 value_20 row_021 value_21 row_022 value_22 row_023 value_23)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 row_010 100)"),	DEF_STRING("(row_010 value_10 row_011 value_11 row_012 value_12 row_013 value_13 row_014 value_14 row_015 value_15 row_016 value_16 row_017 value_17 row_018 value_18 row_019 value_19 row_020 value_20 row_021 value_21 row_022 value_22 row_023 value_23)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_OPEN_CURSOR,		DEF_STRING("(drhouse_t1)"),		DEF_STRING("-"),	FLAG_ABORT_ON_FAIL | FLAG_SAVE_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\" 1)"),	DEF_STRING("(row_000 value_00)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\" 1)"),	DEF_STRING("(row_001 value_01)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\" 1)"),	DEF_STRING("(row_002 value_02)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\" 1)"),	DEF_STRING("(row_003 value_03)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING("(row_004 value_04 row_005 value_05 row_006 value_06 row_007 value_07 row_008 value_08 row_009 value_09 row_010 value_10 row_011 value_11 row_012 value_12 row_013 value_13 row_014 value_14 row_015 value_15 row_016 value_16 row_017 value_17 row_018 value_18 row_019 value_19 row_020 value_20 row_021 value_21 row_022 value_22 row_023 value_23)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING("nil"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+#endif
+
+	//	Test the row cache. Reads must see every insert, mutation, and delete
+	//	even when the row (or its absence) is already cached.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} rowCacheSize:65536 })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row0)"),	DEF_STRING("nil"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row0 { name:Ann })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row0)"),	DEF_STRING("{name:Ann}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row1 { name:Gregory }) (row2 { name:Lisa }) (row3 { name:James })))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row1)"),	DEF_STRING("{name:Gregory}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row1)"),	DEF_STRING("{name:Gregory}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row1 { name:Greg })"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row1)"),	DEF_STRING("{name:Greg}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_MUTATE,			DEF_STRING("(drhouse_t1 row1 { visits:1 } { visits:increment } )"),	DEF_STRING("{name:Greg visits:1}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row1)"),	DEF_STRING("{name:Greg visits:1}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row2)"),	DEF_STRING("{name:Lisa}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_RANGE,		DEF_STRING("(drhouse_t1 row2 row3)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row2)"),	DEF_STRING("nil"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row3)"),	DEF_STRING("{name:James}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row3 nil)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row3)"),	DEF_STRING("nil"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} rowCacheSize:1024 })"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row1)"),	DEF_STRING("{name:Greg visits:1}"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10 (noKey) nil (name))"),	DEF_STRING("({name:Ann} {name:Greg})"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} rowCacheSize:-1 })"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test snapshot reads. A cursor sees the rows as they were when it was
+	//	opened, even if rows change (and memory is saved to a new segment)
+	//	before we fetch.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((a a1) (b b1) (c c1)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((d d1) (e e1)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_OPEN_CURSOR,		DEF_STRING("(drhouse_t1)"),		DEF_STRING("-"),	FLAG_ABORT_ON_FAIL | FLAG_SAVE_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((a a2) (b nil) (bb bb2) (e nil) (f f2)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 c c3)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\" 1)"),	DEF_STRING("(a a1)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING("(b b1 c c1 d d1 e e1)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING("nil"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("(a a2 bb bb2 c c3 d d1 f f2)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test cursors: fetching in batches, starting at a key, closing, and
+	//	lease expiry (the last cursor has a one second lease).
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((a a1) (b b1) (c c1) (d d1) (e e1)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_OPEN_CURSOR,		DEF_STRING("(drhouse_t1)"),		DEF_STRING("-"),	FLAG_ABORT_ON_FAIL | FLAG_SAVE_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\" 1)"),	DEF_STRING("(a a1)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\" 1)"),	DEF_STRING("(b b1)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CLOSE_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING(""),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING("X"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CLOSE_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING(""),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_OPEN_CURSOR,		DEF_STRING("(drhouse_t1 c)"),		DEF_STRING("-"),	FLAG_ABORT_ON_FAIL | FLAG_SAVE_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING("(c c1 d d1 e e1)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING("nil"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\")"),		DEF_STRING("X"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_OPEN_CURSOR,		DEF_STRING("(drhouse_t1 nil nil nil nil 1)"),		DEF_STRING("-"),	FLAG_ABORT_ON_FAIL | FLAG_SAVE_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\" 1)"),	DEF_STRING("(a a1)"),	FLAG_USE_SAVED_REPLY },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FETCH_CURSOR,		DEF_STRING("(\"%s\" 1)"),	DEF_STRING("X"),	FLAG_USE_SAVED_REPLY | FLAG_WAIT_BEFORE },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+#ifdef DEBUG
+	//	Test segment checksums. Uncompressed and compressed blocks are verified
+	//	as we read them, and a scrub of every segment (including a merged one)
+	//	must find no bad files.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	DEF_STRING("(128)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(none)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row_000 value_00) (row_001 value_01) (row_002 value_02) (row_003 value_03) (row_004 value_04) (row_005 value_05) (row_006 value_06) (row_007 value_07) (row_008 value_08) (row_009 value_09)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row_010 value_10) (row_011 value_11) (row_012 value_12) (row_013 value_13) (row_014 value_14) (row_015 value_15)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row_009)"),	DEF_STRING("value_09"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 100)"),	DEF_STRING("(row_000 value_00 row_001 value_01 row_002 value_02 row_003 value_03 row_004 value_04 row_005 value_05 row_006 value_06 row_007 value_07 row_008 value_08 row_009 value_09 row_010 value_10 row_011 value_11 row_012 value_12 row_013 value_13 row_014 value_14 row_015 value_15)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SCRUB_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING("0"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_COMPACT_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SCRUB_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING("0"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row_100 value_100)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_RECOVER_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 row_014 10)"),	DEF_STRING("(row_014 value_14 row_015 value_15 row_100 value_100)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(zlib)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row_000 value_00) (row_001 value_01) (row_002 value_02) (row_003 value_03) (row_004 value_04) (row_005 value_05) (row_006 value_06) (row_007 value_07) (row_008 value_08) (row_009 value_09)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row_010 value_10) (row_011 value_11) (row_012 value_12) (row_013 value_13) (row_014 value_14) (row_015 value_15)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row_009)"),	DEF_STRING("value_09"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 100)"),	DEF_STRING("(row_000 value_00 row_001 value_01 row_002 value_02 row_003 value_03 row_004 value_04 row_005 value_05 row_006 value_06 row_007 value_07 row_008 value_08 row_009 value_09 row_010 value_10 row_011 value_11 row_012 value_12 row_013 value_13 row_014 value_14 row_015 value_15)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SCRUB_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING("0"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_COMPACT_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SCRUB_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING("0"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row_100 value_100)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_RECOVER_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 row_014 10)"),	DEF_STRING("(row_014 value_14 row_015 value_15 row_100 value_100)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SCRUB_TABLE_TEST,	DEF_STRING("(noSuchTable)"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_COMPRESSION,	DEF_STRING("(lz)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_SET_SEGMENT_BLOCK_SIZE,	DEF_STRING("(0)"),		DEF_STRING(""),	0 },
+
+	//	Test checkpoints. Housekeeping saves in-memory rows after enough updates
+	//	or when they use more than the table's share of memory; either way no
+	//	row is lost or repeated when we later replay the recovery log.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row_000 value_000) (row_001 value_001) (row_002 value_002) (row_003 value_003) (row_004 value_004) (row_005 value_005) (row_006 value_006) (row_007 value_007) (row_008 value_008) (row_009 value_009) (row_010 value_010) (row_011 value_011) (row_012 value_012) (row_013 value_013) (row_014 value_014) (row_015 value_015) (row_016 value_016) (row_017 value_017) (row_018 value_018) (row_019 value_019) (row_020 value_020) (row_021 value_021) (row_022 value_022) (row_023 value_023) (row_024 value_024) (row_025 value_025) (row_026 value_026) (row_027 value_027) (row_028 value_028) (row_029 value_029) (row_030 value_030) (row_031 value_031) (row_032 value_032) (row_033 value_033) (row_034 value_034) (row_035 value_035) (row_036 value_036) (row_037 value_037) (row_038 value_038) (row_039 value_039) (row_040 value_040) (row_041 value_041) (row_042 value_042) (row_043 value_043) (row_044 value_044) (row_045 value_045) (row_046 value_046) (row_047 value_047) (row_048 value_048) (row_049 value_049) (row_050 value_050) (row_051 value_051) (row_052 value_052) (row_053 value_053) (row_054 value_054) (row_055 value_055) (row_056 value_056) (row_057 value_057) (row_058 value_058) (row_059 value_059) (row_060 value_060) (row_061 value_061) (row_062 value_062) (row_063 value_063) (row_064 value_064) (row_065 value_065) (row_066 value_066) (row_067 value_067) (row_068 value_068) (row_069 value_069) (row_070 value_070) (row_071 value_071) (row_072 value_072) (row_073 value_073) (row_074 value_074) (row_075 value_075) (row_076 value_076) (row_077 value_077) (row_078 value_078) (row_079 value_079) (row_080 value_080) (row_081 value_081) (row_082 value_082) (row_083 value_083) (row_084 value_084) (row_085 value_085) (row_086 value_086) (row_087 value_087) (row_088 value_088) (row_089 value_089) (row_090 value_090) (row_091 value_091) (row_092 value_092) (row_093 value_093) (row_094 value_094) (row_095 value_095) (row_096 value_096) (row_097 value_097) (row_098 value_098) (row_099 value_099) (row_100 value_100) (row_101 value_101) (row_102 value_102) (row_103 value_103) (row_104 value_104)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_HOUSEKEEP_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row_000 value_new) (row_200 value_200)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_HOUSEKEEP_TABLE_TEST,	DEF_STRING("(drhouse_t1 1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row_050 nil) (row_201 value_201)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_HOUSEKEEP_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_RECOVER_TABLE_TEST,	DEF_STRING("(drhouse_t1 tornTail)"),	DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row_000)"),	DEF_STRING("value_new"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row_050)"),	DEF_STRING("nil"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 row_048 4)"),	DEF_STRING("(row_048 value_048 row_049 value_049 row_051 value_051 row_052 value_052)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 row_103 10)"),	DEF_STRING("(row_103 value_103 row_104 value_104 row_200 value_200 row_201 value_201)"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_HOUSEKEEP_TABLE_TEST,	DEF_STRING("(noSuchTable)"),	DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+#endif
+
+	//	Test file contents stored as shared chunks. Files with the same content
+	//	share a chunk, so replacing one of them must not change the other.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 type:file })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile1\" { version:0 fileDesc:{} } \"Shared chunk contents\")"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile2\" { version:0 fileDesc:{} } \"Shared chunk contents\")"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile1\")"),		DEF_STRING("Shared chunk contents"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile2\")"),		DEF_STRING("Shared chunk contents"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile1\" { } \"New contents\")"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile1\")"),		DEF_STRING("New contents"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile2\")"),		DEF_STRING("Shared chunk contents"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile2\" { partialPos:7 partialMaxSize:5 })"),		DEF_STRING("chunk"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile3\" { version:0 fileDesc:{} } \"New contents\")"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile3\")"),		DEF_STRING("New contents"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/chunkFile2\")"),		DEF_STRING("Shared chunk contents"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+	//	Test uploads in several parts. Each part is written in place in a file
+	//	of the final size, so parts can arrive in any order. We also append to
+	//	and overwrite part of an existing file.
+
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 type:file })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/partFile1\" { version:0 fileDesc:{} uploadSize:20 partialPos:0 } \"0123456789\")"),		DEF_STRING("-"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/partFile1\" { version:0 fileDesc:{} uploadSize:20 partialPos:10 } \"abcdefghij\")"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/partFile1\")"),		DEF_STRING("0123456789abcdefghij"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/partFile2\" { version:0 fileDesc:{} uploadSize:15 partialPos:10 } \"ABCDE\")"),		DEF_STRING("-"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/partFile2\" { version:0 fileDesc:{} uploadSize:15 partialPos:5 } \"56789\")"),		DEF_STRING("-"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/partFile2\" { version:0 fileDesc:{} uploadSize:15 partialPos:0 } \"01234\")"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/partFile2\")"),		DEF_STRING("0123456789ABCDE"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/partFile1\" { uploadPos:-1 } \"KLMNO\")"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/partFile1\")"),		DEF_STRING("0123456789abcdefghijKLMNO"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/partFile1\" { uploadPos:5 } \"XY\")"),		DEF_STRING(""),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_DOWNLOAD,		DEF_STRING("(\"/drhouse_t1/partFile1\")"),		DEF_STRING("01234XY789abcdefghijKLMNO"),	FLAG_COMPARE_DATA },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_FILE_UPLOAD,		DEF_STRING("(\"/drhouse_t1/noSuchFile\" { uploadPos:-1 } \"KLMNO\")"),		DEF_STRING("X"),	0 },
+	{	UT_AEON,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
 	//	Test adding a secondary view after first creation
 
 	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
@@ -490,6 +1045,42 @@ CUnitTestSession::STestMessageEntry CUnitTestSession::m_TestMessageList[] =	{
 	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view1) nil 10)"),	DEF_STRING(""),	0 },
 	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
 
+	//	Test building a full-text view over existing rows
+
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row1 { title:House body:\"House, house.\" }) (row2 { title:Cuddy body:\"Dean of medicine; hired House\" }) (row3 { title:Wilson body:Oncology })))"),	DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} secondaryViews:({ name:text1 type:fullText fields:(title body) }) })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_WAIT_FOR_VIEW,		DEF_STRING("((drhouse_t1 text1))"),		DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_SEARCH_TEXT,		DEF_STRING("((drhouse_t1 text1) \"house OR wilson\")"),	DEF_STRING("({primaryKey:row1} {primaryKey:row3} {primaryKey:row2})"),	FLAG_IGNORE_SCORES },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+
+#ifdef DEBUG
+	//	Test that rebuilding a view on several threads produces the same rows as
+	//	rebuilding it on one. (Rows must be in segments to be split.)
+
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row1 { lastName:Zerg })"),	DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row2 { lastName:Yanis })"),	DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row3 { lastName:Xerxes })"),	DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row4 { lastName:Zerg })"),	DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row5 { lastName:Abbot })"),	DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row6 { lastName:Moss })"),	DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row7 { lastName:Yanis })"),	DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row8 { lastName:Chen })"),	DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_SET_VIEW_UPDATE_THREADS,	DEF_STRING("(1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} secondaryViews:({ name:view1 x:{ key:lastName keyType:utf8 }}) })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_WAIT_FOR_VIEW,		DEF_STRING("((drhouse_t1 view1))"),		DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view1) nil 20 noKey)"),	DEF_STRING("({primaryKey:row5} {primaryKey:row8} {primaryKey:row6} {primaryKey:row3} {primaryKey:row2} {primaryKey:row7} {primaryKey:row1} {primaryKey:row4})"),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_SET_VIEW_UPDATE_THREADS,	DEF_STRING("(4 1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 x:{keyType:utf8} secondaryViews:({ name:view1 x:{ key:lastName keyType:utf8 }} { name:view2 x:{ key:lastName keyType:utf8 }}) })"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_WAIT_FOR_VIEW,		DEF_STRING("((drhouse_t1 view2))"),		DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("((drhouse_t1 view2) nil 20 noKey)"),	DEF_STRING("({primaryKey:row5} {primaryKey:row8} {primaryKey:row6} {primaryKey:row3} {primaryKey:row2} {primaryKey:row7} {primaryKey:row1} {primaryKey:row4})"),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_SET_VIEW_UPDATE_THREADS,	DEF_STRING("(0)"),		DEF_STRING(""),	0 },
+	{	UT_AEON_VIEW_UPDATE,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+#endif
+
 	//	Test drive failure
 	//
 	//	Aeon.createTable should fail if the primary drive failed.
@@ -523,6 +1114,32 @@ CUnitTestSession::STestMessageEntry CUnitTestSession::m_TestMessageList[] =	{
 	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
 	{	UT_AEON_BACKUP,	ADDR_EXARCH,	MSG_EXARCH_REMOVE_VOLUME,	DEF_STRING("(drhouse_vol03)"),		DEF_STRING(""),	0 },
 
+#ifdef DEBUG
+	//	Test incremental backups. Each save copies only the new segment to the
+	//	backup volume, and a merge replaces the merged segments there. When the
+	//	primary volume is lost we read every row from the backup.
+
+	{	UT_AEON_BACKUP,	ADDR_EXARCH,	MSG_EXARCH_CREATE_TEST_VOLUME,	DEF_STRING("(drhouse_vol04)"),		DEF_STRING(""),	FLAG_ABORT_ON_FAIL },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_WAIT_FOR_VOLUME,		DEF_STRING("(drhouse_vol04)"),		DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_CREATE_TABLE,		DEF_STRING("({ name:drhouse_t1 primaryVolume:drhouse_vol04 x:{keyType:utf8}})"),		DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row1 row1_value) (row2 row2_value)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row2 row2_new) (row3 row3_value)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_INSERT_MANY,		DEF_STRING("(drhouse_t1 ((row1 nil) (row4 row4_value)))"),	DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_COMPACT_TABLE_TEST,	DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_INSERT,			DEF_STRING("(drhouse_t1 row5 row5_value)"),	DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_FLUSH_DB,			DEF_STRING(""),		DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_EXARCH,	MSG_EXARCH_DELETE_TEST_DRIVE,	DEF_STRING("(drhouse_vol04)"),		DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row1)"),		DEF_STRING("nil"),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row2)"),		DEF_STRING("row2_new"),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_GET_VALUE,			DEF_STRING("(drhouse_t1 row5)"),		DEF_STRING("row5_value"),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_GET_ROWS,			DEF_STRING("(drhouse_t1 nil 10)"),	DEF_STRING("(row2 row2_new row3 row3_value row4 row4_value row5 row5_value)"),	0 },
+	{	UT_AEON_BACKUP,	ADDR_AEON,		MSG_AEON_DELETE_TABLE,		DEF_STRING("(drhouse_t1)"),		DEF_STRING(""),	0 },
+	{	UT_AEON_BACKUP,	ADDR_EXARCH,	MSG_EXARCH_REMOVE_VOLUME,	DEF_STRING("(drhouse_vol04)"),		DEF_STRING(""),	0 },
+#endif
+
 	//	Hexe -----------------------------------------------------------------------------------------------------------
 
 	{	UT_HEXE,	ADDR_HEXE,		MSG_HEXE_RUN,				DEF_STRING("(\"\\\"Hello, World!\\\"\")"),		DEF_STRING("Hello, World!"),	0 },
@@ -812,6 +1429,17 @@ bool CUnitTestSession::OnProcessMessage (const SArchonMessage &Msg)
 		sResponse = CString(Buffer.GetPointer(), Buffer.GetLength());
 		}
 
+	//	Some replies have fields that change on every run (e.g., modifiedOn),
+	//	so we only compare the data.
+
+	if ((m_TestMessageList[iTest].dwFlags & FLAG_COMPARE_DATA) && !IsError(Msg))
+		sResponse = Msg.dPayload.GetElement(FIELD_DATA).AsString();
+
+	//	Scores are floating point, so we only compare the order of the rows.
+
+	if ((m_TestMessageList[iTest].dwFlags & FLAG_IGNORE_SCORES) && !IsError(Msg))
+		sResponse = RemoveScores(Msg.dPayload);
+
 	//	Compare the response
 
 	bool bSuccess;
@@ -877,6 +1505,11 @@ bool CUnitTestSession::OnProcessMessage (const SArchonMessage &Msg)
 	if (bSuccess)
 		m_iPass++;
 
+	//	Remember the reply if a later message needs it
+
+	if (bSuccess && !IsError(Msg) && (m_TestMessageList[iTest].dwFlags & FLAG_SAVE_REPLY))
+		m_sSavedReply = sResponse;
+
 	//	See if we need to abort
 
 	bool bAbort = (!bSuccess && (m_TestMessageList[iTest].dwFlags & FLAG_ABORT_ON_FAIL));
@@ -965,6 +1598,34 @@ bool CUnitTestSession::OnStartSession (const SArchonMessage &Msg, DWORD dwTicket
 	return true;
 	}
 
+CString CUnitTestSession::RemoveScores (CDatum dRows)
+
+//	RemoveScores
+//
+//	Returns the rows (serialized) without their score field.
+
+	{
+	int i, j;
+
+	CComplexArray *pRows = new CComplexArray;
+	for (i = 0; i < dRows.GetCount(); i++)
+		{
+		CDatum dRow = dRows.GetElement(i);
+
+		CComplexStruct *pRow = new CComplexStruct;
+		for (j = 0; j < dRow.GetCount(); j++)
+			if (!strEquals(dRow.GetKey(j), FIELD_SCORE))
+				pRow->SetElement(dRow.GetKey(j), dRow.GetElement(j));
+
+		pRows->Insert(CDatum(pRow));
+		}
+
+	CBuffer Buffer(4096);
+	CDatum(pRows).Serialize(CDatum::formatAEONScript, Buffer);
+
+	return CString(Buffer.GetPointer(), Buffer.GetLength());
+	}
+
 void CUnitTestSession::SendMessageCommand (int iPos, DWORD dwTicket)
 
 //	SendMessageCommand
@@ -974,18 +1635,29 @@ void CUnitTestSession::SendMessageCommand (int iPos, DWORD dwTicket)
 	{
 	int iTest = m_Messages[iPos];
 
+	//	Some messages need a value from an earlier reply (e.g., a cursor ID).
+
+	CString sPayload(m_TestMessageList[iTest].pPayload, m_TestMessageList[iTest].iPayloadLen);
+	if (m_TestMessageList[iTest].dwFlags & FLAG_USE_SAVED_REPLY)
+		sPayload = strPattern(sPayload, m_sSavedReply);
+
 	//	Parse the payload
 	//	NOTE: We use CHexeDocument so that we can parse lambda expression into
 	//	code blocks.
 
-	CMemoryBuffer Buffer(m_TestMessageList[iTest].pPayload, m_TestMessageList[iTest].iPayloadLen);
+	CMemoryBuffer Buffer((LPSTR)sPayload, sPayload.GetLength());
 	CDatum dPayload;
 	if (Buffer.GetLength() > 0 && !CHexeDocument::ParseData(Buffer, &dPayload))
 		{
-		GetProcessCtx()->Log(MSG_LOG_ERROR, strPattern(ERR_INVALID_PAYLOAD, CString(m_TestMessageList[iTest].pPayload, m_TestMessageList[iTest].iPayloadLen)));
+		GetProcessCtx()->Log(MSG_LOG_ERROR, strPattern(ERR_INVALID_PAYLOAD, sPayload));
 		return;
 		}
 
+	//	Some tests need time to pass first
+
+	if (m_TestMessageList[iTest].dwFlags & FLAG_WAIT_BEFORE)
+		::Sleep(WAIT_BEFORE_TIME);
+
 	//	Send it
 
 	ISessionHandler::SendMessageCommand(m_TestMessageList[iTest].sAddr,
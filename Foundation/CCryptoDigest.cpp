@@ -14,11 +14,18 @@ void CCryptoDigest::AddData (void *pData, int iLength)
 	{
 	if (!m_bInitialized)
 		{
-		SHAInit(&m_Ctx);
+		if (m_iAlgorithm == algSHA256)
+			SHA256Init(&m_Ctx256);
+		else
+			SHAInit(&m_Ctx);
+
 		m_bInitialized = true;
 		}
 
-	SHAUpdate(&m_Ctx, (BYTE *)pData, iLength);
+	if (m_iAlgorithm == algSHA256)
+		SHA256Update(&m_Ctx256, (BYTE *)pData, iLength);
+	else
+		SHAUpdate(&m_Ctx, (BYTE *)pData, iLength);
 	}
 
 void CCryptoDigest::AddData (IMemoryBlock &Data)
@@ -44,20 +51,20 @@ void CCryptoDigest::CalcDigest (CIPInteger *retDigest)
 		return;
 		}
 
-	DIGEST Buffer;
-	SHAFinal((BYTE *)Buffer, &m_Ctx);
+	DIGEST256 Buffer;
+	CalcDigest((BYTE *)Buffer);
 
 	//	NOTE: InitFromBytes expects big-endian order, which is what SHAFinal
-	//	outputs.
+	//	(and SHA256Final) outputs.
 
-	retDigest->InitFromBytes(CBuffer(Buffer, sizeof(Buffer), false));
+	retDigest->InitFromBytes(CBuffer(Buffer, GetDigestSize(), false));
 	}
 
 void CCryptoDigest::CalcDigest (BYTE *retDigest)
 
 //	CalcDigest
 //
-//	Returns the digest
+//	Returns the digest. retDigest must have room for GetDigestSize() bytes.
 
 	{
 	if (!m_bInitialized)
@@ -66,5 +73,8 @@ void CCryptoDigest::CalcDigest (BYTE *retDigest)
 		return;
 		}
 
-	SHAFinal(retDigest, &m_Ctx);
+	if (m_iAlgorithm == algSHA256)
+		SHA256Final(retDigest, &m_Ctx256);
+	else
+		SHAFinal(retDigest, &m_Ctx);
 	}
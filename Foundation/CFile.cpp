@@ -228,6 +228,36 @@ int CFile::Read (void *pData, int iLength)
 	return dwBytesRead;
 	}
 
+int CFile::ReadAt (DWORDLONG dwPos, void *pData, int iLength)
+
+//	ReadAt
+//
+//	Reads data at the given position. Unlike Seek + Read, the position is part
+//	of the read, so threads sharing this file can read different blocks at the
+//	same time.
+//
+//	NOTE: The file pointer is left at the end of the read (Windows moves it
+//	even for positioned reads on a synchronous handle), so callers mixing this
+//	with Read must Seek first.
+
+	{
+	ASSERT(m_hFile != INVALID_HANDLE_VALUE);
+
+	if (iLength == 0)
+		return 0;
+
+	OVERLAPPED Pos;
+	utlMemSet(&Pos, sizeof(Pos), 0);
+	Pos.Offset = (DWORD)(dwPos & 0xffffffff);
+	Pos.OffsetHigh = (DWORD)(dwPos >> 32);
+
+	DWORD dwBytesRead;
+	if (!::ReadFile(m_hFile, pData, iLength, &dwBytesRead, &Pos) || (dwBytesRead != (DWORD)iLength))
+		throw CFileException(errDisk, m_sFilespec, ::GetLastError(), strPattern(ERR_READ, m_sFilespec, ::GetLastError()));
+
+	return dwBytesRead;
+	}
+
 void CFile::Seek (int iPos, bool bFromEnd)
 
 //	Seek
@@ -302,3 +332,33 @@ int CFile::Write (void *pData, int iLength)
 		return iLength;
 		}
 	}
+
+int CFile::WriteAt (DWORDLONG dwPos, const void *pData, int iLength)
+
+//	WriteAt
+//
+//	Writes data at the given position without seeking first. Since we don't
+//	depend on the file pointer, other threads may write other parts of the
+//	file with their own handles at the same time.
+//
+//	NOTE: The file pointer is left at the end of the write (Windows moves it
+//	even for positioned writes on a synchronous handle), so callers mixing
+//	this with Write must Seek first.
+
+	{
+	ASSERT(m_hFile != INVALID_HANDLE_VALUE);
+
+	if (iLength == 0)
+		return 0;
+
+	OVERLAPPED Pos;
+	utlMemSet(&Pos, sizeof(Pos), 0);
+	Pos.Offset = (DWORD)(dwPos & 0xffffffff);
+	Pos.OffsetHigh = (DWORD)(dwPos >> 32);
+
+	DWORD dwBytesWritten;
+	if (!::WriteFile(m_hFile, pData, iLength, &dwBytesWritten, &Pos) || (dwBytesWritten != (DWORD)iLength))
+		throw CFileException(errDisk, m_sFilespec, ::GetLastError(), strPattern(ERR_WRITE, m_sFilespec, ::GetLastError()));
+
+	return dwBytesWritten;
+	}
@@ -97,7 +97,7 @@ bool CFileBuffer64::Open (const CString &sFilespec, DWORDLONG dwStart, DWORDLONG
 				0,
 				0,
 				NULL);
-		if (m_hFileMap == INVALID_HANDLE_VALUE)
+		if (m_hFileMap == NULL)
 			{
 			::CloseHandle(m_hFile);
 			m_hFile = INVALID_HANDLE_VALUE;
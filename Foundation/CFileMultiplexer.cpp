@@ -8,6 +8,42 @@
 DECLARE_CONST_STRING(ERR_MIRROR_SAME_AS_PRIMARY,		"Mirror file cannot be same as primary: %s.")
 DECLARE_CONST_STRING(ERR_CANT_CREATE_MIRROR,			"Unable to create mirror file: %s.")
 
+const int MIN_PARALLEL_WRITE =							64 * 1024;
+
+//	CMirrorWriteThread
+//
+//	A single worker thread (started on first use) that writes large blocks to
+//	mirrors while the caller writes the primary. Callers post a request and
+//	wait for it to complete.
+
+class CMirrorWriteThread : public TThread<CMirrorWriteThread>
+	{
+	public:
+		struct SRequest
+			{
+			TArray<CFile> *pMirrors;
+			DWORDLONG dwPos;
+			const void *pData;
+			int iLength;
+
+			bool bFailed;					//	Set if any mirror failed
+			CManualEvent Done;				//	Set when the request is complete
+			};
+
+		CMirrorWriteThread (void) : m_bRunning(false) { }
+
+		void Post (SRequest *pRequest);
+		void Run (void);
+
+	private:
+		CCriticalSection m_cs;
+		TArray<SRequest *> m_Queue;
+		CManualEvent m_WorkAvail;
+		bool m_bRunning;
+	};
+
+static CMirrorWriteThread g_MirrorWriter;
+
 void CFileMultiplexer::Close (void)
 
 //	Close
@@ -35,6 +71,7 @@ bool CFileMultiplexer::Create (const CString &sFilespec, DWORD dwFlags, CString
 	//	Clear out all mirrors
 
 	m_Mirrors.DeleteAll();
+	m_bMirrorFailed = false;
 
 	//	Create the primary file
 
@@ -190,7 +227,8 @@ bool CFileMultiplexer::Flush (void)
 	//	Flush all mirrors
 
 	for (i = 0; i < m_Mirrors.GetCount(); i++)
-		m_Mirrors[i].Flush();
+		if (!m_Mirrors[i].Flush())
+			m_bMirrorFailed = true;
 
 	//	Done
 
@@ -220,7 +258,7 @@ int CFileMultiplexer::Read (void *pData, int iLength)
 			}
 		catch (...)
 			{
-			//	LATER: Figure out what to do with the error.
+			m_bMirrorFailed = true;
 			}
 		}
 
@@ -252,11 +290,31 @@ void CFileMultiplexer::Seek (int iPos, bool bFromEnd)
 			}
 		catch (...)
 			{
-			//	LATER: Figure out what to do with the error.
+			m_bMirrorFailed = true;
 			}
 		}
 	}
 
+bool CFileMultiplexer::SetLength (int iLength)
+
+//	SetLength
+//
+//	Sets the length of all files. We use this to allocate space for a file
+//	before we write it. Returns FALSE if we could not set the length of the
+//	primary file.
+
+	{
+	int i;
+
+	for (i = 0; i < m_Mirrors.GetCount(); i++)
+		{
+		if (!m_Mirrors[i].SetLength(iLength))
+			m_bMirrorFailed = true;
+		}
+
+	return m_Primary.SetLength(iLength);
+	}
+
 int CFileMultiplexer::Write (void *pData, int iLength)
 
 //	Write
@@ -280,7 +338,7 @@ int CFileMultiplexer::Write (void *pData, int iLength)
 			}
 		catch (...)
 			{
-			//	LATER: Figure out what to do with the error.
+			m_bMirrorFailed = true;
 			}
 		}
 
@@ -288,3 +346,136 @@ int CFileMultiplexer::Write (void *pData, int iLength)
 
 	return iResult;
 	}
+
+void CFileMultiplexer::WriteAt (DWORDLONG dwPos, const void *pData, int iLength)
+
+//	WriteAt
+//
+//	Writes data at the given position in all files. For large writes the
+//	mirror thread writes the mirrors while we write the primary. Throws if we
+//	fail to write the primary; if we fail to write a mirror we set
+//	m_bMirrorFailed (see MirrorFailed).
+//
+//	NOTE: As with CFile::WriteAt, each file's pointer is left at the end of
+//	the write.
+
+	{
+	int i;
+
+	if (m_Mirrors.GetCount() == 0 || iLength < MIN_PARALLEL_WRITE)
+		{
+		m_Primary.WriteAt(dwPos, pData, iLength);
+
+		for (i = 0; i < m_Mirrors.GetCount(); i++)
+			{
+			try
+				{
+				m_Mirrors[i].WriteAt(dwPos, pData, iLength);
+				}
+			catch (...)
+				{
+				m_bMirrorFailed = true;
+				}
+			}
+
+		return;
+		}
+
+	//	The mirror thread uses pData, so we must wait for it even if the
+	//	primary fails.
+
+	CMirrorWriteThread::SRequest Request;
+	Request.pMirrors = &m_Mirrors;
+	Request.dwPos = dwPos;
+	Request.pData = pData;
+	Request.iLength = iLength;
+	Request.bFailed = false;
+	Request.Done.Create();
+
+	g_MirrorWriter.Post(&Request);
+
+	try
+		{
+		m_Primary.WriteAt(dwPos, pData, iLength);
+		}
+	catch (...)
+		{
+		Request.Done.Wait();
+		throw;
+		}
+
+	Request.Done.Wait();
+	if (Request.bFailed)
+		m_bMirrorFailed = true;
+	}
+
+//	CMirrorWriteThread ---------------------------------------------------------
+
+void CMirrorWriteThread::Post (SRequest *pRequest)
+
+//	Post
+//
+//	Queues a request (starting the thread, if necessary).
+
+	{
+	CSmartLock Lock(m_cs);
+
+	if (!m_bRunning)
+		{
+		m_WorkAvail.Create();
+		Start();
+		m_bRunning = true;
+		}
+
+	m_Queue.Insert(pRequest);
+	m_WorkAvail.Set();
+	}
+
+void CMirrorWriteThread::Run (void)
+
+//	Run
+//
+//	Writes queued requests to their mirrors. We run until the process exits.
+
+	{
+	int i;
+
+	while (true)
+		{
+		m_WorkAvail.Wait();
+
+		//	Take the next request
+
+		SRequest *pRequest;
+			{
+			CSmartLock Lock(m_cs);
+			if (m_Queue.GetCount() == 0)
+				{
+				m_WorkAvail.Reset();
+				continue;
+				}
+
+			pRequest = m_Queue[0];
+			m_Queue.Delete(0);
+			}
+
+		//	Write
+
+		TArray<CFile> &Mirrors = *pRequest->pMirrors;
+		for (i = 0; i < Mirrors.GetCount(); i++)
+			{
+			try
+				{
+				Mirrors[i].WriteAt(pRequest->dwPos, pRequest->pData, pRequest->iLength);
+				}
+			catch (...)
+				{
+				pRequest->bFailed = true;
+				}
+			}
+
+		//	NOTE: The caller may free the request as soon as we set the event.
+
+		pRequest->Done.Set();
+		}
+	}
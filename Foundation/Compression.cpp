@@ -10,7 +10,15 @@
 
 const DWORD BUFFER_SIZE =					1024 * 1024;
 
+const int LZ_HASH_BITS =					12;
+const int LZ_HASH_SIZE =					(1 << LZ_HASH_BITS);
+const int LZ_MIN_MATCH =					4;
+const int LZ_MAX_OFFSET =					0xffff;
+
 void Deflate (IMemoryBlock &Data, ECompressionTypes iType, IMemoryBlock *retBuffer);
+void Inflate (IMemoryBlock &Data, ECompressionTypes iType, IMemoryBlock *retBuffer);
+void LZCompress (IMemoryBlock &Data, IMemoryBlock *retBuffer);
+void LZDecompress (IMemoryBlock &Data, IMemoryBlock *retBuffer);
 void NullCopy (IMemoryBlock &Data, IMemoryBlock *retBuffer);
 void NullCopy (IMemoryBlock &Data, IByteStream &Result);
 void NullCopy (IByteStream &Data, IByteStream &Result);
@@ -33,6 +41,37 @@ void compCompress (IMemoryBlock &Data, ECompressionTypes iType, IMemoryBlock *re
 			Deflate(Data, iType, retBuffer);
 			break;
 
+		case compressionLZ:
+			LZCompress(Data, retBuffer);
+			break;
+
+		default:
+			throw CException(errFail);
+		}
+	}
+
+void compDecompress (IMemoryBlock &Data, ECompressionTypes iType, IMemoryBlock *retBuffer)
+
+//	compDecompress
+//
+//	Decompresses Data into Result. We throw if the data is corrupt.
+
+	{
+	switch (iType)
+		{
+		case compressionNone:
+			NullCopy(Data, retBuffer);
+			break;
+
+		case compressionGzip:
+		case compressionZlib:
+			Inflate(Data, iType, retBuffer);
+			break;
+
+		case compressionLZ:
+			LZDecompress(Data, retBuffer);
+			break;
+
 		default:
 			throw CException(errFail);
 		}
@@ -115,6 +154,275 @@ void Deflate (IMemoryBlock &Data, ECompressionTypes iType, IMemoryBlock *retBuff
 	deflateEnd(&zcpr);
 	}
 
+void Inflate (IMemoryBlock &Data, ECompressionTypes iType, IMemoryBlock *retBuffer)
+	{
+	//	Initialize library
+
+	z_stream zcpr;
+	utlMemSet(&zcpr, sizeof(zcpr));
+
+	if (iType == compressionZlib)
+		inflateInit(&zcpr);
+	else if (iType == compressionGzip)
+		inflateInit2(&zcpr, 0x1f);	//	Bit 0x10 means gzip header
+	else
+		{
+		ASSERT(false);
+		return;
+		}
+
+	//	The entire source is available
+
+	zcpr.next_in = (BYTE *)Data.GetPointer();
+	zcpr.avail_in = Data.GetLength();
+
+	DWORD dwDestBufferSize = Min((DWORD)Data.GetLength() * 4 + 1024, BUFFER_SIZE);
+	retBuffer->SetLength(dwDestBufferSize);
+
+	zcpr.next_out = (BYTE *)retBuffer->GetPointer();
+	zcpr.avail_out = dwDestBufferSize;
+
+	while (true)
+		{
+		int ret = inflate(&zcpr, Z_NO_FLUSH);
+
+		//	If we finished, then we're done
+
+		if (ret == Z_STREAM_END)
+			{
+			retBuffer->SetLength(zcpr.total_out);
+			break;
+			}
+
+		//	If we need more output buffer, allocate more. NOTE: The buffer
+		//	may move, so we recompute the output pointer.
+
+		else if (ret == Z_OK && zcpr.avail_out == 0)
+			{
+			DWORD dwCurrent = retBuffer->GetLength();
+			retBuffer->SetLength(dwCurrent + BUFFER_SIZE);
+
+			zcpr.next_out = (BYTE *)(retBuffer->GetPointer() + zcpr.total_out);
+			zcpr.avail_out = BUFFER_SIZE;
+			}
+
+		//	Otherwise the stream is truncated or corrupt
+
+		else
+			{
+			inflateEnd(&zcpr);
+			throw CException(errFail);
+			}
+		}
+
+	//	Done
+
+	inflateEnd(&zcpr);
+	}
+
+inline DWORD LZRead32 (const BYTE *pPos)
+	{
+	return ((DWORD)pPos[0]) | ((DWORD)pPos[1] << 8) | ((DWORD)pPos[2] << 16) | ((DWORD)pPos[3] << 24);
+	}
+
+int LZReadLength (const BYTE *&pPos, const BYTE *pEnd)
+	{
+	int iLen = 0;
+	while (true)
+		{
+		if (pPos >= pEnd)
+			throw CException(errFail);
+
+		BYTE byValue = *pPos++;
+		iLen += byValue;
+		if (byValue != 255)
+			return iLen;
+		}
+	}
+
+BYTE *LZWriteLength (BYTE *pPos, int iLen)
+	{
+	while (iLen >= 255)
+		{
+		*pPos++ = 255;
+		iLen -= 255;
+		}
+
+	*pPos++ = (BYTE)iLen;
+	return pPos;
+	}
+
+BYTE *LZWriteSequence (BYTE *pPos, const BYTE *pLiterals, int iLiteralLen, int iOffset, int iMatchLen)
+
+//	LZWriteSequence
+//
+//	Writes a run of literals followed by a match. If iMatchLen is 0 then this
+//	is the final sequence and we only write the literals.
+
+	{
+	int iMatchCode = (iMatchLen ? iMatchLen - LZ_MIN_MATCH : 0);
+
+	*pPos++ = (BYTE)((Min(iLiteralLen, 15) << 4) | Min(iMatchCode, 15));
+	if (iLiteralLen >= 15)
+		pPos = LZWriteLength(pPos, iLiteralLen - 15);
+
+	utlMemCopy(pLiterals, pPos, iLiteralLen);
+	pPos += iLiteralLen;
+
+	if (iMatchLen == 0)
+		return pPos;
+
+	*pPos++ = (BYTE)(iOffset & 0xff);
+	*pPos++ = (BYTE)(iOffset >> 8);
+
+	if (iMatchCode >= 15)
+		pPos = LZWriteLength(pPos, iMatchCode - 15);
+
+	return pPos;
+	}
+
+void LZCompress (IMemoryBlock &Data, IMemoryBlock *retBuffer)
+
+//	LZCompress
+//
+//	Compresses using a simple, fast LZ77 variant (similar to LZ4). The output
+//	is a series of sequences:
+//
+//	BYTE		token: literal count (high nibble), match length - 4 (low nibble)
+//	BYTEs		extra literal count (if 15; 255 means keep adding)
+//	BYTEs		literals
+//	WORD		match offset (back from current position)
+//	BYTEs		extra match length (if 15; 255 means keep adding)
+//
+//	The last sequence has only literals (and no offset).
+
+	{
+	const BYTE *pSource = (const BYTE *)Data.GetPointer();
+	int iSourceLen = Data.GetLength();
+
+	//	Worst case is all literals plus the extra length bytes.
+
+	retBuffer->SetLength(iSourceLen + (iSourceLen / 255) + 16);
+	BYTE *pDest = (BYTE *)retBuffer->GetPointer();
+	BYTE *pOut = pDest;
+
+	//	Hash of 4-byte sequences to the last position where we saw them
+
+	int *pTable = new int [LZ_HASH_SIZE];
+	for (int i = 0; i < LZ_HASH_SIZE; i++)
+		pTable[i] = -1;
+
+	int iAnchor = 0;
+	int iPos = 0;
+	while (iPos + LZ_MIN_MATCH <= iSourceLen)
+		{
+		DWORD dwSeq = LZRead32(pSource + iPos);
+		DWORD dwHash = (dwSeq * 2654435761U) >> (32 - LZ_HASH_BITS);
+		int iCandidate = pTable[dwHash];
+		pTable[dwHash] = iPos;
+
+		if (iCandidate < 0
+				|| iPos - iCandidate > LZ_MAX_OFFSET
+				|| LZRead32(pSource + iCandidate) != dwSeq)
+			{
+			iPos++;
+			continue;
+			}
+
+		//	Extend the match as far as we can
+
+		int iMatchLen = LZ_MIN_MATCH;
+		while (iPos + iMatchLen < iSourceLen && pSource[iCandidate + iMatchLen] == pSource[iPos + iMatchLen])
+			iMatchLen++;
+
+		pOut = LZWriteSequence(pOut, pSource + iAnchor, iPos - iAnchor, iPos - iCandidate, iMatchLen);
+
+		iPos += iMatchLen;
+		iAnchor = iPos;
+		}
+
+	//	Whatever is left goes out as literals
+
+	pOut = LZWriteSequence(pOut, pSource + iAnchor, iSourceLen - iAnchor, 0, 0);
+
+	delete [] pTable;
+	retBuffer->SetLength((int)(pOut - pDest));
+	}
+
+void LZDecompress (IMemoryBlock &Data, IMemoryBlock *retBuffer)
+
+//	LZDecompress
+//
+//	Decompresses data written by LZCompress. We throw if the data is corrupt.
+
+	{
+	const BYTE *pPos = (const BYTE *)Data.GetPointer();
+	const BYTE *pEnd = pPos + Data.GetLength();
+
+	int iOut = 0;
+	retBuffer->SetLength(Data.GetLength() * 2 + 1024);
+
+	while (true)
+		{
+		if (pPos >= pEnd)
+			throw CException(errFail);
+
+		BYTE byToken = *pPos++;
+
+		//	Literals
+
+		int iLiteralLen = (byToken >> 4);
+		if (iLiteralLen == 15)
+			iLiteralLen += LZReadLength(pPos, pEnd);
+
+		if (iLiteralLen > (int)(pEnd - pPos))
+			throw CException(errFail);
+
+		if (iOut + iLiteralLen > retBuffer->GetLength())
+			retBuffer->SetLength(Max(iOut + iLiteralLen, retBuffer->GetLength() * 2));
+
+		utlMemCopy(pPos, retBuffer->GetPointer() + iOut, iLiteralLen);
+		pPos += iLiteralLen;
+		iOut += iLiteralLen;
+
+		//	If we're out of input, this was the last sequence
+
+		if (pPos == pEnd)
+			break;
+
+		//	Match
+
+		if (pEnd - pPos < 2)
+			throw CException(errFail);
+
+		int iOffset = ((int)pPos[0]) | ((int)pPos[1] << 8);
+		pPos += 2;
+
+		int iMatchLen = (byToken & 0x0f);
+		if (iMatchLen == 15)
+			iMatchLen += LZReadLength(pPos, pEnd);
+		iMatchLen += LZ_MIN_MATCH;
+
+		if (iOffset == 0 || iOffset > iOut)
+			throw CException(errFail);
+
+		if (iOut + iMatchLen > retBuffer->GetLength())
+			retBuffer->SetLength(Max(iOut + iMatchLen, retBuffer->GetLength() * 2));
+
+		//	NOTE: The match may overlap the output, so we copy a byte at a
+		//	time.
+
+		BYTE *pDest = (BYTE *)retBuffer->GetPointer() + iOut;
+		const BYTE *pMatch = pDest - iOffset;
+		for (int i = 0; i < iMatchLen; i++)
+			pDest[i] = pMatch[i];
+
+		iOut += iMatchLen;
+		}
+
+	retBuffer->SetLength(iOut);
+	}
+
 void NullCopy (IMemoryBlock &Data, IMemoryBlock *retBuffer)
 	{
 	retBuffer->SetLength(Data.GetLength());
@@ -376,6 +376,182 @@ static void SHAtoByte(BYTE *output, UINT4 *input, unsigned int len)
 	}
 }
 
+//	SHA-256 -------------------------------------------------------------------
+//
+//	See: FIPS 180-4
+
+#define SHA256_DATASIZE		64
+#define SHA256_DIGESTSIZE	32
+
+#define ROTR256(n,X)		( ( ( X ) >> n ) | ( ( X ) << ( 32 - n ) ) )
+#define CH256(x,y,z)		( ( ( x ) & ( y ) ) ^ ( ~( x ) & ( z ) ) )
+#define MAJ256(x,y,z)		( ( ( x ) & ( y ) ) ^ ( ( x ) & ( z ) ) ^ ( ( y ) & ( z ) ) )
+#define BSIG0(x)			( ROTR256(2, x) ^ ROTR256(13, x) ^ ROTR256(22, x) )
+#define BSIG1(x)			( ROTR256(6, x) ^ ROTR256(11, x) ^ ROTR256(25, x) )
+#define SSIG0(x)			( ROTR256(7, x) ^ ROTR256(18, x) ^ ( ( x ) >> 3 ) )
+#define SSIG1(x)			( ROTR256(17, x) ^ ROTR256(19, x) ^ ( ( x ) >> 10 ) )
+
+static const DWORD SHA256_K[64] =
+	{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+	};
+
+static void SHA256Transform (DWORD *pState, const BYTE *pData)
+
+//	SHA256Transform
+//
+//	Processes one 64-byte block.
+
+	{
+	int i;
+	DWORD W[64];
+
+	//	The message is big-endian regardless of the platform
+
+	for (i = 0; i < 16; i++)
+		W[i] = ((DWORD)pData[i * 4] << 24)
+				| ((DWORD)pData[i * 4 + 1] << 16)
+				| ((DWORD)pData[i * 4 + 2] << 8)
+				| ((DWORD)pData[i * 4 + 3]);
+
+	for (i = 16; i < 64; i++)
+		W[i] = SSIG1(W[i - 2]) + W[i - 7] + SSIG0(W[i - 15]) + W[i - 16];
+
+	DWORD a = pState[0];
+	DWORD b = pState[1];
+	DWORD c = pState[2];
+	DWORD d = pState[3];
+	DWORD e = pState[4];
+	DWORD f = pState[5];
+	DWORD g = pState[6];
+	DWORD h = pState[7];
+
+	for (i = 0; i < 64; i++)
+		{
+		DWORD T1 = h + BSIG1(e) + CH256(e, f, g) + SHA256_K[i] + W[i];
+		DWORD T2 = BSIG0(a) + MAJ256(a, b, c);
+		h = g;
+		g = f;
+		f = e;
+		e = d + T1;
+		d = c;
+		c = b;
+		b = a;
+		a = T1 + T2;
+		}
+
+	pState[0] += a;
+	pState[1] += b;
+	pState[2] += c;
+	pState[3] += d;
+	pState[4] += e;
+	pState[5] += f;
+	pState[6] += g;
+	pState[7] += h;
+	}
+
+void CCryptoDigest::SHA256Init (SHA256_CTX *pCtx)
+
+//	SHA256Init
+//
+//	Initializes the context
+
+	{
+	pCtx->state[0] = 0x6a09e667;
+	pCtx->state[1] = 0xbb67ae85;
+	pCtx->state[2] = 0x3c6ef372;
+	pCtx->state[3] = 0xa54ff53a;
+	pCtx->state[4] = 0x510e527f;
+	pCtx->state[5] = 0x9b05688c;
+	pCtx->state[6] = 0x1f83d9ab;
+	pCtx->state[7] = 0x5be0cd19;
+	pCtx->count = 0;
+	}
+
+void CCryptoDigest::SHA256Update (SHA256_CTX *pCtx, BYTE *buffer, int count)
+
+//	SHA256Update
+//
+//	Adds data to the hash
+
+	{
+	int iUsed = (int)(pCtx->count % SHA256_DATASIZE);
+	pCtx->count += count;
+
+	//	Fill a partial block first
+
+	if (iUsed)
+		{
+		int iFree = SHA256_DATASIZE - iUsed;
+		if (count < iFree)
+			{
+			memcpy(pCtx->data + iUsed, buffer, count);
+			return;
+			}
+
+		memcpy(pCtx->data + iUsed, buffer, iFree);
+		SHA256Transform(pCtx->state, pCtx->data);
+		buffer += iFree;
+		count -= iFree;
+		}
+
+	//	Whole blocks straight from the caller's buffer
+
+	while (count >= SHA256_DATASIZE)
+		{
+		SHA256Transform(pCtx->state, buffer);
+		buffer += SHA256_DATASIZE;
+		count -= SHA256_DATASIZE;
+		}
+
+	memcpy(pCtx->data, buffer, count);
+	}
+
+void CCryptoDigest::SHA256Final (BYTE *output, SHA256_CTX *pCtx)
+
+//	SHA256Final
+//
+//	Pads the message (1 0* and the 64-bit bit count) and returns the digest
+//	in big-endian order.
+
+	{
+	int i;
+
+	DWORDLONG dwBits = pCtx->count * 8;
+	int iUsed = (int)(pCtx->count % SHA256_DATASIZE);
+
+	pCtx->data[iUsed++] = 0x80;
+	if (iUsed > SHA256_DATASIZE - 8)
+		{
+		memset(pCtx->data + iUsed, 0, SHA256_DATASIZE - iUsed);
+		SHA256Transform(pCtx->state, pCtx->data);
+		iUsed = 0;
+		}
+
+	memset(pCtx->data + iUsed, 0, SHA256_DATASIZE - 8 - iUsed);
+	for (i = 0; i < 8; i++)
+		pCtx->data[SHA256_DATASIZE - 1 - i] = (BYTE)(dwBits >> (i * 8));
+
+	SHA256Transform(pCtx->state, pCtx->data);
+
+	for (i = 0; i < 8; i++)
+		{
+		output[i * 4] = (BYTE)(pCtx->state[i] >> 24);
+		output[i * 4 + 1] = (BYTE)(pCtx->state[i] >> 16);
+		output[i * 4 + 2] = (BYTE)(pCtx->state[i] >> 8);
+		output[i * 4 + 3] = (BYTE)(pCtx->state[i]);
+		}
+
+	memset(pCtx, 0, sizeof(SHA256_CTX));
+	}
+
 //	Wrappers ------------------------------------------------------------------
 
 void cryptoCreateDigest (IMemoryBlock &Data, CIPInteger *retd)
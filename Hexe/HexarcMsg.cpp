@@ -28,8 +28,10 @@ DECLARE_CONST_STRING(MSG_AEON_GET_TABLES,				"Aeon.getTables")
 DECLARE_CONST_STRING(MSG_AEON_GET_DATA,					"Aeon.getValue")
 DECLARE_CONST_STRING(MSG_AEON_GET_VIEW_INFO,			"Aeon.getViewInfo")
 DECLARE_CONST_STRING(MSG_AEON_INSERT,					"Aeon.insert")
+DECLARE_CONST_STRING(MSG_AEON_INSERT_MANY,				"Aeon.insertMany")
 DECLARE_CONST_STRING(MSG_AEON_INSERT_NEW,				"Aeon.insertNew")
 DECLARE_CONST_STRING(MSG_AEON_MUTATE,					"Aeon.mutate")
+DECLARE_CONST_STRING(MSG_AEON_MUTATE_MANY,				"Aeon.mutateMany")
 DECLARE_CONST_STRING(MSG_ARC_SANDBOX_MSG,				"Arc.sandboxMsg")
 DECLARE_CONST_STRING(MSG_CRYPTOSAUR_ADD_RIGHTS,			"Cryptosaur.addRights")
 DECLARE_CONST_STRING(MSG_CRYPTOSAUR_CHANGE_PASSWORD,	"Cryptosaur.changePassword")
@@ -100,8 +102,10 @@ CHexeProcess::SHexarcMsgInfo CHexeProcess::m_HexarcMsgInfo[] =
 		{	MSG_AEON_GET_DATA,				ADDR_AEON_COMMAND,			0	},
 		{	MSG_AEON_GET_VIEW_INFO,			ADDR_AEON_COMMAND,			0	},
 		{	MSG_AEON_INSERT,				ADDR_AEON_COMMAND,			0	},
+		{	MSG_AEON_INSERT_MANY,			ADDR_AEON_COMMAND,			0	},
 		{	MSG_AEON_INSERT_NEW,			ADDR_AEON_COMMAND,			0	},
 		{	MSG_AEON_MUTATE,				ADDR_AEON_COMMAND,			0	},
+		{	MSG_AEON_MUTATE_MANY,			ADDR_AEON_COMMAND,			0	},
 		{	MSG_TRANSPACE_DOWNLOAD,			ADDR_AEON_COMMAND,			0	},
 
 		{	MSG_CRYPTOSAUR_ADD_RIGHTS,		ADDR_CRYPTOSAUR_COMMAND,	0	},
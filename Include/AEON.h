@@ -46,6 +46,12 @@ const DWORD_PTR AEON_NUMBER_MASK =			0xFFFFFFF0;
 const DWORD_PTR AEON_MIN_28BIT =			0xF8000000;
 const DWORD_PTR AEON_MAX_28BIT =			0x07FFFFFF;
 
+//	formatAEONBinary serializations always start with this byte (which also
+//	encodes the version). It is never the first byte of AEONScript because it
+//	is a UTF-8 continuation byte.
+
+const BYTE AEON_BINARY_SIGNATURE =			0xA1;
+
 typedef void (*MARKPROC)(void);
 
 //	CDatum
@@ -126,6 +132,7 @@ class CDatum
 			formatJSON =		1,
 			formatAEONLocal =	2,			//	Serialized to a local machine
 			formatTextUTF8 =	3,			//	Plain text (unstructured)
+			formatAEONBinary =	4,			//	Compact tagged binary (for storage)
 			};
 
 		enum Constants
@@ -225,6 +232,7 @@ class CDatum
 
 	private:
 		static int DefaultCompare (void *pCtx, const CDatum &dKey1, const CDatum &dKey2);
+		static bool DeserializeAEONBinary (IByteStream &Stream, CDatum *retDatum);
 		static bool DeserializeAEONScript (IByteStream &Stream, IAEONParseExtension *pExtension, CDatum *retDatum);
 		static inline bool DeserializeAEONScript (IByteStream &Stream, CDatum *retDatum) { return DeserializeAEONScript(Stream, NULL, retDatum); }
 		static bool DeserializeJSON (IByteStream &Stream, CDatum *retDatum);
@@ -236,6 +244,7 @@ class CDatum
 		double raw_GetDouble (void) const;
 		int raw_GetInt32 (void) const;
 		inline const CString &raw_GetString (void) const { ASSERT(AEON_TYPE_STRING == 0x00); return *(CString *)&m_dwData; }
+		void SerializeAEONBinary (IByteStream &Stream) const;
 		void SerializeAEONScript (ESerializationFormats iFormat, IByteStream &Stream) const;
 		void SerializeJSON (IByteStream &Stream) const;
 
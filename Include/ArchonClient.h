@@ -12,6 +12,8 @@
 class CAeonInterface
 	{
 	public:
+		static CDatum CreateInsertManyPayload (const CString &sTable, const TArray<CDatum> &KeyPaths, const TArray<CDatum> &Data, bool bInsertNew = false);
+		static CDatum CreateMutateManyPayload (const CString &sTable, const TArray<CDatum> &KeyPaths, const TArray<CDatum> &Data, const TArray<CDatum> &MutateDescs);
 		static CString EncodeFilePathComponent (const CString &sValue);
 		static CString FilespecToFilePath (const CString &sFilespec);
 		static bool ParseFilePath (const CString &sFilePath, const CString &sRoot, int iOffset, const CDateTime &IfModifiedAfter, CString *retsAddr, CString *retsMsg, CDatum *retdPayload);
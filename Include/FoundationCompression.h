@@ -14,6 +14,7 @@ enum ECompressionTypes
 	compressionNone =						0,
 	compressionZlib =						1,	//	Zlib format
 	compressionGzip =						2,	//	Gzip format
+	compressionLZ =							3,	//	Fast LZ77 (byte-aligned, no entropy coding)
 	};
 
 void compCompress (IMemoryBlock &Data, ECompressionTypes iType, IMemoryBlock *retBuffer);
@@ -17,19 +17,27 @@ enum EPasswordFlags
 	};
 
 typedef BYTE DIGEST [20];
+typedef BYTE DIGEST256 [32];
 
 //	Cryptographic Algorithms
 
 class CCryptoDigest
 	{
 	public:
-		CCryptoDigest (void) : m_bInitialized(false)
+		enum EAlgorithms
+			{
+			algSHA1,						//	20-byte digest (DIGEST)
+			algSHA256,						//	32-byte digest (DIGEST256)
+			};
+
+		CCryptoDigest (EAlgorithms iAlgorithm = algSHA1) : m_iAlgorithm(iAlgorithm), m_bInitialized(false)
 			{ }
 
 		void AddData (void *pData, int iLength);
 		void AddData (IMemoryBlock &Data);
 		void CalcDigest (CIPInteger *retDigest);
 		void CalcDigest (BYTE *retDigest);
+		inline int GetDigestSize (void) const { return (m_iAlgorithm == algSHA256 ? sizeof(DIGEST256) : sizeof(DIGEST)); }
 		inline void Reset (void) { m_bInitialized = false; }
 
 	private:
@@ -43,12 +51,25 @@ class CCryptoDigest
 			bool bBigEndian;
 			};
 
+		struct SHA256_CTX
+			{
+			DWORD state[8];
+			DWORDLONG count;			//	Bytes processed
+			BYTE data[64];
+			};
+
 		void SHAInit(SHA_CTX *);
 		void SHAUpdate(SHA_CTX *, BYTE *buffer, int count);
 		void SHAFinal(BYTE *output, SHA_CTX *);
 
+		void SHA256Init(SHA256_CTX *);
+		void SHA256Update(SHA256_CTX *, BYTE *buffer, int count);
+		void SHA256Final(BYTE *output, SHA256_CTX *);
+
+		EAlgorithms m_iAlgorithm;
 		bool m_bInitialized;
 		SHA_CTX m_Ctx;
+		SHA256_CTX m_Ctx256;
 	};
 
 void cryptoCreateDigest (IMemoryBlock &Data, CIPInteger *retd);
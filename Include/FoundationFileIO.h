@@ -40,8 +40,10 @@ class CFile : public IByteStream
 		DWORDLONG GetSize (void);
 		inline bool IsOpen (void) const { return m_hFile != INVALID_HANDLE_VALUE; }
 		bool Lock (int iPos, int iLength, int iTimeout = 0);
+		int ReadAt (DWORDLONG dwPos, void *pData, int iLength);
 		bool SetLength (int iLength);
 		void Unlock (int iPos, int iLength);
+		int WriteAt (DWORDLONG dwPos, const void *pData, int iLength);
 
 		//	IByteStream virtuals
 		virtual int GetPos (void);
@@ -137,7 +139,7 @@ class CFileBuffer64 : public CMemoryBlockImpl64
 class CFileMultiplexer : public IByteStream
 	{
 	public:
-		CFileMultiplexer (void) { }
+		CFileMultiplexer (void) : m_bMirrorFailed(false) { }
 		~CFileMultiplexer (void) { }
 
 		void Close (void);
@@ -145,7 +147,10 @@ class CFileMultiplexer : public IByteStream
 		bool CreateMirror (const CString &sFilespec, CString *retsError = NULL);
 		bool Delete (void);
 		bool Flush (void);
+		inline bool MirrorFailed (void) const { return m_bMirrorFailed; }
 		bool OpenMirror (const CString &sFilespec, CString *retsError = NULL);
+		bool SetLength (int iLength);
+		void WriteAt (DWORDLONG dwPos, const void *pData, int iLength);
 
 		//	IByteStream virtuals
 		virtual int GetPos (void) { return m_Primary.GetPos(); }
@@ -162,6 +167,7 @@ class CFileMultiplexer : public IByteStream
 	private:
 		CFile m_Primary;
 		TArray<CFile> m_Mirrors;
+		bool m_bMirrorFailed;				//	A write to a mirror failed (mirror is out of date)
 	};
 
 class CResource : public CMemoryBlockImpl
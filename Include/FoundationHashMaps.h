@@ -31,7 +31,8 @@ template <> struct THash<CString> : public HashBase
 template <class KEY, class VALUE, class HASH = THash<KEY>> class THashMap
 	{
 	public:
-		THashMap (int iTableSize = 256)
+		THashMap (int iTableSize = 256) :
+				m_iCount(0)
 			{
 			ASSERT(iTableSize > 0);
 			m_Map.InsertEmpty(iTableSize);
@@ -42,18 +43,19 @@ template <class KEY, class VALUE, class HASH = THash<KEY>> class THashMap
 			int iTableSize = m_Map.GetCount();
 			m_Map.DeleteAll();
 			m_Map.InsertEmpty(iTableSize);
+			m_iCount = 0;
 			}
 
 		void DeleteAt (const KEY &key)
 			{
 			SEntry &Entry = GetHashEntry(key);
-			Entry.DeleteAt(key);
+			if (Entry.RemoveEntry(key))
+				m_iCount--;
 			}
 
 		bool Find (const KEY &key, VALUE *retpValue = NULL) const
 			{
-			SEntry &Entry = GetHashEntry(key);
-			VALUE *pValue = Entry.GetAt(key);
+			VALUE *pValue = GetAt(key);
 			if (pValue == NULL)
 				return false;
 
@@ -68,6 +70,8 @@ template <class KEY, class VALUE, class HASH = THash<KEY>> class THashMap
 			return GetHashEntry(key).GetAt(key);
 			}
 
+		inline int GetCount (void) const { return m_iCount; }
+
 		void Insert (const KEY &key, const VALUE &value)
 			{
 			*SetAt(key) = value;
@@ -75,7 +79,21 @@ template <class KEY, class VALUE, class HASH = THash<KEY>> class THashMap
 
 		VALUE *SetAt (const KEY &key, bool *retbInserted = NULL)
 			{
-			return GetHashEntry(key).SetAt(key);
+			//	Grow the table when the chains get long, so that lookups stay
+			//	O(1) on average.
+
+			if (m_iCount >= 2 * m_Map.GetCount())
+				Rehash(2 * m_Map.GetCount());
+
+			bool bInserted;
+			VALUE *pValue = GetHashEntry(key).SetAt(key, &bInserted);
+			if (bInserted)
+				m_iCount++;
+
+			if (retbInserted)
+				*retbInserted = bInserted;
+
+			return pValue;
 			}
 
 	private:
@@ -91,7 +109,7 @@ template <class KEY, class VALUE, class HASH = THash<KEY>> class THashMap
 				{
 				Key = Src.Key;
 				Value = Src.Value;
-				if (Src.pExtra && pExtra != ONE_ENTRY)
+				if (Src.pExtra && Src.pExtra != ONE_ENTRY)
 					pExtra = new TSortMap<KEY, VALUE>(*Src.pExtra);
 				else
 					pExtra = Src.pExtra;
@@ -110,32 +128,17 @@ template <class KEY, class VALUE, class HASH = THash<KEY>> class THashMap
 
 				Key = Src.Key;
 				Value = Src.Value;
-				if (Src.pExtra && pExtra != ONE_ENTRY)
+				if (Src.pExtra && Src.pExtra != ONE_ENTRY)
 					pExtra = new TSortMap<KEY, VALUE>(*Src.pExtra);
 				else
 					pExtra = Src.pExtra;
+
+				return *this;
 				}
 
 			inline void AddEntry (const KEY &KeyArg, const VALUE &ValueArg)
 				{
-				if (pExtra == NULL)
-					{
-					Key = KeyArg;
-					Value = ValueArg;
-					pExtra = ONE_ENTRY;
-					}
-				else if (pExtra == ONE_ENTRY)
-					{
-					pExtra = new TSortMap<KEY, VALUE>;
-					pExtra->Insert(Key, Value);
-					pExtra->Insert(KeyArg, ValueArg);
-					Key = KEY();
-					Value = VALUE();
-					}
-				else
-					{
-					pExtra->Insert(KeyArg, ValueArg);
-					}
+				*SetAt(KeyArg) = ValueArg;
 				}
 
 			inline VALUE *GetAt (const KEY &KeyArg)
@@ -153,21 +156,29 @@ template <class KEY, class VALUE, class HASH = THash<KEY>> class THashMap
 					return pExtra->GetAt(KeyArg);
 				}
 
-			inline void RemoveEntry (const KEY &KeyArg)
+			inline bool RemoveEntry (const KEY &KeyArg)
 				{
 				if (pExtra == NULL)
-					;
+					return false;
 				else if (pExtra == ONE_ENTRY)
 					{
-					if (KeyCompare(Key, KeyArg) == 0)
-						{
-						Key = KEY();
-						Value = VALUE();
-						pExtra = NULL;
-						}
+					if (KeyCompare(Key, KeyArg) != 0)
+						return false;
+
+					Key = KEY();
+					Value = VALUE();
+					pExtra = NULL;
+					return true;
 					}
 				else
-					pExtra->DeleteAt(KeyArg);
+					{
+					int iPos;
+					if (!pExtra->FindPos(KeyArg, &iPos))
+						return false;
+
+					pExtra->Delete(iPos);
+					return true;
+					}
 				}
 
 			inline VALUE *SetAt (const KEY &KeyArg, bool *retbInserted = NULL)
@@ -211,13 +222,37 @@ template <class KEY, class VALUE, class HASH = THash<KEY>> class THashMap
 			TSortMap<KEY, VALUE> *pExtra;
 			};
 
-#undef ONE_ENTRY
-
 		SEntry &GetHashEntry (const KEY &key) const
 			{
 			return m_Map[(HASH{}(key) % m_Map.GetCount())];
 			}
 
-		TArray<SEntry> m_Map;
-	};
+		void Rehash (int iTableSize)
+			{
+			int i, j;
+
+			TArray<SEntry> NewMap;
+			NewMap.InsertEmpty(iTableSize);
 
+			for (i = 0; i < m_Map.GetCount(); i++)
+				{
+				SEntry &Entry = m_Map[i];
+				if (Entry.pExtra == NULL)
+					continue;
+				else if (Entry.pExtra == ONE_ENTRY)
+					NewMap[HASH{}(Entry.Key) % iTableSize].AddEntry(Entry.Key, Entry.Value);
+				else
+					{
+					for (j = 0; j < Entry.pExtra->GetCount(); j++)
+						NewMap[HASH{}(Entry.pExtra->GetKey(j)) % iTableSize].AddEntry(Entry.pExtra->GetKey(j), Entry.pExtra->GetValue(j));
+					}
+				}
+
+			m_Map.TakeHandoff(NewMap);
+			}
+
+#undef ONE_ENTRY
+
+		mutable TArray<SEntry> m_Map;
+		int m_iCount;
+	};
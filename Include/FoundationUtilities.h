@@ -178,6 +178,7 @@ template <class VALUE> VALUE Sign (VALUE iValue) { return (iValue < 0 ? -1 : (iV
 template <class VALUE> void Swap (VALUE &a, VALUE &b) { VALUE temp = a;	a = b;	b = temp; }
 
 DWORD utlAdler32 (IMemoryBlock &Data);
+DWORD utlCRC32C (const void *pData, DWORD dwLen, DWORD dwCRC = 0);
 int utlBitsSet (DWORD dwValue);
 
 //	Win32 utilities